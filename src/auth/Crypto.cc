@@ -148,7 +148,7 @@ public:
       *enc_key, (const byte*)CEPH_AES_IV);
     CryptoPP::StreamTransformationFilter stfEncryptor(cbc, sink);
 
-    for (std::list<bufferptr>::const_iterator it = in.buffers().begin();
+    for (bufferlist::buffers_t::const_iterator it = in.buffers().begin();
 	 it != in.buffers().end(); ++it) {
       const unsigned char *in_buf = (const unsigned char *)it->c_str();
       stfEncryptor.Put(in_buf, it->length());
@@ -174,7 +174,7 @@ public:
     CryptoPP::CBC_Mode_ExternalCipher::Decryption cbc(
       *dec_key, (const byte*)CEPH_AES_IV );
     CryptoPP::StreamTransformationFilter stfDecryptor(cbc, sink);
-    for (std::list<bufferptr>::const_iterator it = in.buffers().begin();
+    for (bufferlist::buffers_t::const_iterator it = in.buffers().begin();
 	 it != in.buffers().end(); ++it) {
       const unsigned char *in_buf = (const unsigned char *)it->c_str();
       stfDecryptor.Put(in_buf, it->length());
@@ -1300,26 +1300,41 @@ namespace librbd {
       return 0;
     }
 
-    int metadata_get(librados::IoCtx *ioctx, const std::string &oid,
-                     const std::string &key, string *s)
+    void metadata_get_start(librados::ObjectReadOperation *op,
+                            const std::string &key)
     {
-      assert(s);
-      bufferlist in, out;
-      ::encode(key, in);
-      int r = ioctx->exec(oid, "rbd", "metadata_get", in, out);
-      if (r < 0)
-        return r;
+      bufferlist bl;
+      ::encode(key, bl);
+      op->exec("rbd", "metadata_get", bl);
+    }
 
-      bufferlist::iterator iter = out.begin();
+    int metadata_get_finish(bufferlist::iterator *it, std::string *value)
+    {
       try {
-        ::decode(*s, iter);
+        ::decode(*value, *it);
       } catch (const buffer::error &err) {
         return -EBADMSG;
       }
-
       return 0;
     }
 
+    int metadata_get(librados::IoCtx *ioctx, const std::string &oid,
+                     const std::string &key, string *s)
+    {
+      assert(s);
+      librados::ObjectReadOperation op;
+      metadata_get_start(&op, key);
+
+      bufferlist out_bl;
+      int r = ioctx->operate(oid, &op, &out_bl);
+      if (r < 0) {
+        return r;
+      }
+
+      bufferlist::iterator it = out_bl.begin();
+      return metadata_get_finish(&it, s);
+    }
+
     void mirror_uuid_get_start(librados::ObjectReadOperation *op) {
       bufferlist bl;
       op->exec("rbd", "mirror_uuid_get", bl);
@@ -8,6 +8,9 @@
 
 class Checksummer {
 public:
+  /// blocks calculated or verified per call into the algorithm
+  enum { csum_batch = 16 };
+
   enum CSumType {
     CSUM_NONE = 1,	//intentionally set to 1 to be aligned with OSDMnitor's pool_opts_t handling - it treats 0 as unset while we need to distinguish none and unset cases
     CSUM_XXHASH32 = 2,
@@ -67,6 +70,28 @@ public:
     }
   }
 
+  // crcs of consecutive blocks, a batch at a time so that blocks
+  // sharing a buffer are checksummed in one interleaved pass
+  template<typename value_t>
+  static void crc32c_blocks(
+    uint32_t init_value,
+    size_t len,
+    size_t blocks,
+    bufferlist::const_iterator& p,
+    value_t *pv,
+    uint32_t mask
+    ) {
+    uint32_t crcs[csum_batch];
+    while (blocks > 0) {
+      size_t n = blocks < csum_batch ? blocks : (size_t)csum_batch;
+      p.crc32c_blocks(len, n, init_value, crcs);
+      for (size_t i = 0; i < n; ++i) {
+	*pv++ = crcs[i] & mask;
+      }
+      blocks -= n;
+    }
+  }
+
   struct crc32c {
     typedef uint32_t init_value_t;
     typedef __le32 value_t;
@@ -86,6 +111,16 @@ public:
       ) {
       return p.crc32c(len, init_value);
     }
+    static void calc(
+      state_t state,
+      init_value_t init_value,
+      size_t len,
+      size_t blocks,
+      bufferlist::const_iterator& p,
+      value_t *pv
+      ) {
+      crc32c_blocks(init_value, len, blocks, p, pv, 0xffffffff);
+    }
   };
 
   struct crc32c_16 {
@@ -107,6 +142,16 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xffff;
     }
+    static void calc(
+      state_t state,
+      init_value_t init_value,
+      size_t len,
+      size_t blocks,
+      bufferlist::const_iterator& p,
+      value_t *pv
+      ) {
+      crc32c_blocks(init_value, len, blocks, p, pv, 0xffff);
+    }
   };
 
   struct crc32c_8 {
@@ -128,6 +173,16 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xff;
     }
+    static void calc(
+      state_t state,
+      init_value_t init_value,
+      size_t len,
+      size_t blocks,
+      bufferlist::const_iterator& p,
+      value_t *pv
+      ) {
+      crc32c_blocks(init_value, len, blocks, p, pv, 0xff);
+    }
   };
 
   struct xxhash32 {
@@ -157,6 +212,18 @@ public:
       }
       return XXH32_digest(state);
     }
+    static void calc(
+      state_t state,
+      init_value_t init_value,
+      size_t len,
+      size_t blocks,
+      bufferlist::const_iterator& p,
+      value_t *pv
+      ) {
+      while (blocks--) {
+	*pv++ = calc(state, init_value, len, p);
+      }
+    }
   };
 
   struct xxhash64 {
@@ -186,6 +253,18 @@ public:
       }
       return XXH64_digest(state);
     }
+    static void calc(
+      state_t state,
+      init_value_t init_value,
+      size_t len,
+      size_t blocks,
+      bufferlist::const_iterator& p,
+      value_t *pv
+      ) {
+      while (blocks--) {
+	*pv++ = calc(state, init_value, len, p);
+      }
+    }
   };
 
   template<class Alg>
@@ -221,10 +300,7 @@ public:
     typename Alg::value_t *pv =
       reinterpret_cast<typename Alg::value_t*>(csum_data->c_str());
     pv += offset / csum_block_size;
-    while (blocks--) {
-      *pv = Alg::calc(state, init_value, csum_block_size, p);
-      ++pv;
-    }
+    Alg::calc(state, init_value, csum_block_size, blocks, p, pv);
     Alg::fini(&state);
     return 0;
   }
@@ -249,18 +325,25 @@ public:
       reinterpret_cast<const typename Alg::value_t*>(csum_data.c_str());
     pv += offset / csum_block_size;
     size_t pos = offset;
+    typename Alg::value_t v[csum_batch];
     while (length > 0) {
-      typename Alg::value_t v = Alg::calc(state, -1, csum_block_size, p);
-      if (*pv != v) {
-	if (bad_csum) {
-	  *bad_csum = v;
+      size_t n = length / csum_block_size;
+      if (n > csum_batch) {
+	n = csum_batch;
+      }
+      Alg::calc(state, -1, csum_block_size, n, p, v);
+      for (size_t i = 0; i < n; ++i) {
+	if (*pv != v[i]) {
+	  if (bad_csum) {
+	    *bad_csum = v[i];
+	  }
+	  Alg::fini(&state);
+	  return pos;
 	}
-	Alg::fini(&state);
-	return pos;
+	++pv;
+	pos += csum_block_size;
+	length -= csum_block_size;
       }
-      ++pv;
-      pos += csum_block_size;
-      length -= csum_block_size;
     }
     Alg::fini(&state);
     return -1;  // no errors
@@ -45,44 +45,32 @@ void *Finisher::finisher_thread_entry()
   ldout(cct, 10) << "finisher_thread start" << dendl;
 
   utime_t start;
-  uint64_t count = 0;
   while (!finisher_stop) {
     /// Every time we are woken up, we process the queue until it is empty.
     while (!finisher_queue.empty()) {
-      // To reduce lock contention, we swap out the queue to process.
-      // This way other threads can submit new contexts to complete while we are working.
-      vector<Context*> ls;
-      list<pair<Context*,int> > ls_rval;
-      ls.swap(finisher_queue);
-      ls_rval.swap(finisher_queue_rval);
+      // Take everything queued so far. Producers never touch
+      // finisher_lock unless we are asleep, so they are not held up
+      // while we work.
       finisher_running = true;
       finisher_lock.Unlock();
-      ldout(cct, 10) << "finisher_thread doing " << ls << dendl;
+      Context *ls = finisher_queue.pop_all();
 
-      if (logger) {
+      if (logger)
 	start = ceph_clock_now();
-	count = ls.size();
-      }
 
-      // Now actually process the contexts.
-      for (vector<Context*>::iterator p = ls.begin();
-	   p != ls.end();
-	   ++p) {
-	if (*p) {
-	  (*p)->complete(0);
-	} else {
-	  // When an item is NULL in the finisher_queue, it means
-	  // we should instead process an item from finisher_queue_rval,
-	  // which has a parameter for complete() other than zero.
-	  // This preserves the order while saving some storage.
-	  assert(!ls_rval.empty());
-	  Context *c = ls_rval.front().first;
-	  c->complete(ls_rval.front().second);
-	  ls_rval.pop_front();
-	}
+      // Now actually process the contexts, in the order they were queued.
+      uint64_t count = 0;
+      while (ls) {
+	// complete() usually deletes the context
+	Context *next = ls->queue_next;
+	ls->queue_next = nullptr;
+	ls->queued = false;
+	ls->complete(ls->queue_r);
+	++count;
+	ls = next;
       }
-      ldout(cct, 10) << "finisher_thread done with " << ls << dendl;
-      ls.clear();
+      ldout(cct, 10) << "finisher_thread done with " << count << " contexts"
+		     << dendl;
       if (logger) {
 	logger->dec(l_finisher_queue_len, count);
 	logger->tinc(l_finisher_complete_lat, ceph_clock_now() - start);
@@ -98,7 +86,10 @@ void *Finisher::finisher_thread_entry()
       break;
     
     ldout(cct, 10) << "finisher_thread sleeping" << dendl;
-    finisher_cond.Wait(finisher_lock);
+    finisher_sleeping = true;
+    if (finisher_queue.empty())
+      finisher_cond.Wait(finisher_lock);
+    finisher_sleeping = false;
   }
   // If we are exiting, we signal the thread waiting in stop(),
   // otherwise it would never unblock
@@ -15,8 +15,11 @@
 #ifndef CEPH_FINISHER_H
 #define CEPH_FINISHER_H
 
+#include <atomic>
+
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/mpsc_queue.h"
 #include "common/perf_counters.h"
 
 class CephContext;
@@ -33,26 +36,26 @@ enum {
  * Finisher asynchronously completes Contexts, which are simple classes
  * representing callbacks, in a dedicated worker thread. Enqueuing
  * contexts to complete is thread-safe.
+ *
+ * Queueing is lock-free: contexts go onto an MPSC list, linked through
+ * Context itself so nothing is allocated, and the lock is only taken to
+ * wake the worker when it is asleep. The worker takes everything queued
+ * so far in one go and completes it as a batch.
  */
 class Finisher {
   CephContext *cct;
-  Mutex        finisher_lock; ///< Protects access to queues and finisher_running.
+  Mutex        finisher_lock; ///< Protects finisher_running and the wait/stop flags.
   Cond         finisher_cond; ///< Signaled when there is something to process.
   Cond         finisher_empty_cond; ///< Signaled when the finisher has nothing more to process.
   bool         finisher_stop; ///< Set when the finisher should stop.
   bool         finisher_running; ///< True when the finisher is currently executing contexts.
   bool	       finisher_empty_wait; ///< True mean someone wait finisher empty.
-  /// Queue for contexts for which complete(0) will be called.
-  /// NULLs in this queue indicate that an item from finisher_queue_rval
-  /// should be completed in that place instead.
-  vector<Context*> finisher_queue;
+  std::atomic<bool> finisher_sleeping; ///< True while the worker waits on finisher_cond.
+  /// Contexts to complete, in queue order.
+  ceph::mpsc_queue<Context, &Context::queue_next> finisher_queue;
 
   string thread_name;
 
-  /// Queue for contexts for which the complete function will be called
-  /// with a parameter other than 0.
-  list<pair<Context*,int> > finisher_queue_rval;
-
   /// Performance counter for the finisher's queue length.
   /// Only active for named finishers.
   PerfCounters *logger;
@@ -65,54 +68,57 @@ class Finisher {
     void* entry() override { return (void*)fin->finisher_thread_entry(); }
   } finisher_thread;
 
- public:
-  /// Add a context to complete, optionally specifying a parameter for the complete function.
-  void queue(Context *c, int r = 0) {
-    finisher_lock.Lock();
-    if (finisher_queue.empty()) {
+  void _queue(Context *newest, Context *oldest, uint64_t n) {
+    if (logger)
+      logger->inc(l_finisher_queue_len, n);
+    finisher_queue.push(newest, oldest);
+    // finisher_sleeping is set before the worker looks at the queue for
+    // the last time, so either it sees our item or we see it asleep.
+    if (finisher_sleeping) {
+      Mutex::Locker l(finisher_lock);
       finisher_cond.Signal();
     }
-    if (r) {
-      finisher_queue_rval.push_back(pair<Context*, int>(c, r));
-      finisher_queue.push_back(NULL);
-    } else
-      finisher_queue.push_back(c);
-    if (logger)
-      logger->inc(l_finisher_queue_len);
-    finisher_lock.Unlock();
   }
-  void queue(vector<Context*>& ls) {
-    finisher_lock.Lock();
-    if (finisher_queue.empty()) {
-      finisher_cond.Signal();
+
+  /// A context can only be on one queue at a time: queueing it twice
+  /// would silently cut off whatever was queued after it.
+  static void _mark_queued(Context *c) {
+    assert(!c->queued);
+    assert(c->queue_next == nullptr);
+    c->queued = true;
+  }
+
+  /// Link a batch up privately, so it is queued with a single push.
+  template <typename T>
+  void _queue_all(T& ls) {
+    if (ls.empty())
+      return;
+    Context *newest = nullptr;
+    for (auto c : ls) {
+      _mark_queued(c);
+      c->queue_next = newest;
+      c->queue_r = 0;
+      newest = c;
     }
-    finisher_queue.insert(finisher_queue.end(), ls.begin(), ls.end());
-    if (logger)
-      logger->inc(l_finisher_queue_len, ls.size());
-    finisher_lock.Unlock();
+    _queue(newest, ls.front(), ls.size());
     ls.clear();
   }
+
+ public:
+  /// Add a context to complete, optionally specifying a parameter for the complete function.
+  void queue(Context *c, int r = 0) {
+    _mark_queued(c);
+    c->queue_r = r;
+    _queue(c, c, 1);
+  }
+  void queue(vector<Context*>& ls) {
+    _queue_all(ls);
+  }
   void queue(deque<Context*>& ls) {
-    finisher_lock.Lock();
-    if (finisher_queue.empty()) {
-      finisher_cond.Signal();
-    }
-    finisher_queue.insert(finisher_queue.end(), ls.begin(), ls.end());
-    if (logger)
-      logger->inc(l_finisher_queue_len, ls.size());
-    finisher_lock.Unlock();
-    ls.clear();
+    _queue_all(ls);
   }
   void queue(list<Context*>& ls) {
-    finisher_lock.Lock();
-    if (finisher_queue.empty()) {
-      finisher_cond.Signal();
-    }
-    finisher_queue.insert(finisher_queue.end(), ls.begin(), ls.end());
-    if (logger)
-      logger->inc(l_finisher_queue_len, ls.size());
-    finisher_lock.Unlock();
-    ls.clear();
+    _queue_all(ls);
   }
 
   /// Start the worker thread.
@@ -136,14 +142,14 @@ class Finisher {
   explicit Finisher(CephContext *cct_) :
     cct(cct_), finisher_lock("Finisher::finisher_lock"),
     finisher_stop(false), finisher_running(false), finisher_empty_wait(false),
-    thread_name("fn_anonymous"), logger(0),
+    finisher_sleeping(false), thread_name("fn_anonymous"), logger(0),
     finisher_thread(this) {}
 
   /// Construct a named Finisher that logs its queue length.
   Finisher(CephContext *cct_, string name, string tn) :
     cct(cct_), finisher_lock("Finisher::" + name),
     finisher_stop(false), finisher_running(false), finisher_empty_wait(false),
-    thread_name(tn), logger(0),
+    finisher_sleeping(false), thread_name(tn), logger(0),
     finisher_thread(this) {
     PerfCountersBuilder b(cct, string("finisher-") + name,
 			  l_finisher_first, l_finisher_last);
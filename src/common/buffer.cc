@@ -12,6 +12,7 @@
  * 
  */
 
+#include <algorithm>
 #include <atomic>
 #include <errno.h>
 #include <limits.h>
@@ -1383,6 +1384,45 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
     return crc;
   }
 
+  template<bool is_const>
+  void buffer::list::iterator_impl<is_const>::crc32c_blocks(
+    size_t length, size_t n, uint32_t crc, uint32_t *crcs)
+  {
+    const unsigned batch = 16;
+    const unsigned char *data[batch];
+    size_t i = 0;
+    while (i < n) {
+      const char *p;
+      size_t l = length ? get_ptr_and_advance((n - i) * length, &p) : 0;
+      if (l == 0) {
+	// nothing left to add
+	for (; i < n; ++i) {
+	  crcs[i] = crc;
+	}
+	break;
+      }
+      // blocks that lie within this segment go through interleaved
+      size_t whole = l / length;
+      for (size_t j = 0; j < whole; j += batch) {
+	unsigned k = MIN(batch, whole - j);
+	for (unsigned q = 0; q < k; ++q) {
+	  data[q] = (const unsigned char*)p + (j + q) * length;
+	  crcs[i + j + q] = crc;
+	}
+	ceph_crc32c_multi(crcs + i + j, data, length, k);
+      }
+      i += whole;
+      // the block that continues in the next segment
+      size_t partial = l - whole * length;
+      if (partial) {
+	crcs[i] = ceph_crc32c(crc, (const unsigned char*)p + whole * length,
+			      partial);
+	crcs[i] = crc32c(length - partial, crcs[i]);
+	++i;
+      }
+    }
+  }
+
   // explicitly instantiate only the iterator types we need, so we can hide the
   // details in this compilation unit without introducing unnecessary link time
   // dependencies.
@@ -1495,7 +1535,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
     if (p == ls->end())
       seek(off);
     unsigned left = len;
-    for (std::list<ptr>::const_iterator i = otherl._buffers.begin();
+    for (buffers_t::const_iterator i = otherl._buffers.begin();
 	 i != otherl._buffers.end();
 	 ++i) {
       unsigned l = (*i).length();
@@ -1508,6 +1548,127 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
     }
   }
 
+  // -- buffer::list::buffers_t --
+
+  buffer::list::buffers_t::buffers_t(const buffers_t& other)
+    : buffers_t()
+  {
+    reserve(other._size);
+    for (unsigned i = 0; i < other._size; ++i)
+      new (_data + i) ptr(other._data[i]);
+    _size = other._size;
+  }
+
+  buffer::list::buffers_t::buffers_t(buffers_t&& other) noexcept
+    : buffers_t()
+  {
+    _steal(other);
+  }
+
+  buffer::list::buffers_t&
+  buffer::list::buffers_t::operator=(const buffers_t& other)
+  {
+    if (this != &other) {
+      clear();
+      reserve(other._size);
+      for (unsigned i = 0; i < other._size; ++i)
+	new (_data + i) ptr(other._data[i]);
+      _size = other._size;
+    }
+    return *this;
+  }
+
+  buffer::list::buffers_t&
+  buffer::list::buffers_t::operator=(buffers_t&& other) noexcept
+  {
+    if (this != &other) {
+      clear();
+      if (_data != _inline_data()) {
+	::operator delete(_data);
+	_data = _inline_data();
+	_cap = INLINE_SEGMENTS;
+      }
+      _steal(other);
+    }
+    return *this;
+  }
+
+  void buffer::list::buffers_t::_steal(buffers_t& other)
+  {
+    // we are empty and inline
+    if (other._data != other._inline_data()) {
+      _data = other._data;
+      _size = other._size;
+      _cap = other._cap;
+      other._data = other._inline_data();
+      other._size = 0;
+      other._cap = INLINE_SEGMENTS;
+      return;
+    }
+    for (unsigned i = 0; i < other._size; ++i)
+      new (_data + i) ptr(std::move(other._data[i]));
+    _size = other._size;
+    other.clear();
+  }
+
+  void buffer::list::buffers_t::_grow(size_t want)
+  {
+    size_t cap = std::max<size_t>(want, _cap * 2);
+    ptr *data = static_cast<ptr*>(::operator new(cap * sizeof(ptr)));
+    for (unsigned i = 0; i < _size; ++i) {
+      new (data + i) ptr(std::move(_data[i]));
+      _data[i].~ptr();
+    }
+    if (_data != _inline_data())
+      ::operator delete(_data);
+    _data = data;
+    _cap = cap;
+  }
+
+  buffer::list::buffers_t::iterator
+  buffer::list::buffers_t::insert(iterator pos, ptr bp)
+  {
+    size_t i = pos.i;
+    emplace_back(std::move(bp));
+    std::rotate(_data + i, _data + _size - 1, _data + _size);
+    return iterator(this, i);
+  }
+
+  buffer::list::buffers_t::iterator
+  buffer::list::buffers_t::erase(iterator pos)
+  {
+    size_t i = pos.i;
+    std::move(_data + i + 1, _data + _size, _data + i);
+    _data[--_size].~ptr();
+    return iterator(this, i);
+  }
+
+  void buffer::list::buffers_t::splice(iterator pos, buffers_t& other)
+  {
+    if (other.empty())
+      return;
+    if (empty() && other._data != other._inline_data()) {
+      // just take the other guy's array
+      *this = std::move(other);
+      return;
+    }
+    size_t i = pos.i;
+    size_t old_size = _size;
+    reserve(_size + other._size);
+    for (unsigned j = 0; j < other._size; ++j)
+      new (_data + _size++) ptr(std::move(other._data[j]));
+    other.clear();
+    if (i != old_size)
+      std::rotate(_data + i, _data + old_size, _data + _size);
+  }
+
+  void buffer::list::buffers_t::swap(buffers_t& other)
+  {
+    buffers_t tmp(std::move(other));
+    other = std::move(*this);
+    *this = std::move(tmp);
+  }
+
   // -- buffer::list --
 
   buffer::list::list(list&& other)
@@ -1542,8 +1703,8 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
 
     // buffer-wise comparison
     if (true) {
-      std::list<ptr>::const_iterator a = _buffers.begin();
-      std::list<ptr>::const_iterator b = other._buffers.begin();
+      buffers_t::const_iterator a = _buffers.begin();
+      buffers_t::const_iterator b = other._buffers.begin();
       unsigned aoff = 0, boff = 0;
       while (a != _buffers.end()) {
 	unsigned len = a->length() - aoff;
@@ -1582,7 +1743,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
 
   bool buffer::list::can_zero_copy() const
   {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it)
       if (!it->can_zero_copy())
@@ -1599,7 +1760,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
 
   bool buffer::list::is_aligned(unsigned align) const
   {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it) 
       if (!it->is_aligned(align))
@@ -1609,7 +1770,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
 
   bool buffer::list::is_n_align_sized(unsigned align) const
   {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it) 
       if (!it->is_n_align_sized(align))
@@ -1620,7 +1781,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
   bool buffer::list::is_aligned_size_and_memory(unsigned align_size,
 						  unsigned align_memory) const
   {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it) {
       if (!it->is_aligned(align_memory) || !it->is_n_align_sized(align_size))
@@ -1630,7 +1791,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
   }
 
   bool buffer::list::is_zero() const {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it) {
       if (!it->is_zero()) {
@@ -1642,7 +1803,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
 
   void buffer::list::zero()
   {
-    for (std::list<ptr>::iterator it = _buffers.begin();
+    for (buffers_t::iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it)
       it->zero();
@@ -1652,7 +1813,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
   {
     assert(o+l <= _len);
     unsigned p = 0;
-    for (std::list<ptr>::iterator it = _buffers.begin();
+    for (buffers_t::iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it) {
       if (p + it->length() > o) {
@@ -1682,7 +1843,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
 
   bool buffer::list::is_contiguous() const
   {
-    return &(*_buffers.begin()) == &(*_buffers.rbegin());
+    return _buffers.size() <= 1;
   }
 
   bool buffer::list::is_n_page_sized() const
@@ -1740,7 +1901,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
   void buffer::list::rebuild(ptr& nb)
   {
     unsigned pos = 0;
-    for (std::list<ptr>::iterator it = _buffers.begin();
+    for (buffers_t::iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it) {
       nb.copy_in(pos, it->length(), it->c_str(), false);
@@ -1763,7 +1924,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
   						   unsigned align_memory)
   {
     unsigned old_memcopy_count = _memcopy_count;
-    std::list<ptr>::iterator p = _buffers.begin();
+    buffers_t::iterator p = _buffers.begin();
     while (p != _buffers.end()) {
       // keep anything that's already align and sized aligned
       if (p->is_aligned(align_memory) && p->is_n_align_sized(align_size)) {
@@ -1788,7 +1949,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
         */
         offset += p->length();
         unaligned.push_back(*p);
-        _buffers.erase(p++);
+        p = _buffers.erase(p);
       } while (p != _buffers.end() &&
   	     (!p->is_aligned(align_memory) ||
   	      !p->is_n_align_sized(align_size) ||
@@ -1798,7 +1959,8 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
         unaligned.rebuild(nb);
         _memcopy_count += unaligned._len;
       }
-      _buffers.insert(p, unaligned._buffers.front());
+      p = _buffers.insert(p, unaligned._buffers.front());
+      ++p;
     }
     last_p = begin();
 
@@ -1851,7 +2013,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
   void buffer::list::claim_append_piecewise(list& bl)
   {
     // steal the other guy's buffers
-    for (std::list<buffer::ptr>::const_iterator i = bl.buffers().begin();
+    for (buffer::list::buffers_t::const_iterator i = bl.buffers().begin();
         i != bl.buffers().end(); i++) {
       append(*i, 0, i->length());
     }
@@ -1976,7 +2138,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
   void buffer::list::append(const list& bl)
   {
     _len += bl._len;
-    for (std::list<ptr>::const_iterator p = bl._buffers.begin();
+    for (buffers_t::const_iterator p = bl._buffers.begin();
 	 p != bl._buffers.end();
 	 ++p) 
       _buffers.push_back(*p);
@@ -2017,7 +2179,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
     if (n >= _len)
       throw end_of_buffer();
     
-    for (std::list<ptr>::const_iterator p = _buffers.begin();
+    for (buffers_t::const_iterator p = _buffers.begin();
 	 p != _buffers.end();
 	 ++p) {
       if (n >= p->length()) {
@@ -2037,7 +2199,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
     if (_buffers.empty())
       return 0;                         // no buffers
 
-    std::list<ptr>::const_iterator iter = _buffers.begin();
+    buffers_t::const_iterator iter = _buffers.begin();
     ++iter;
 
     if (iter != _buffers.end())
@@ -2048,7 +2210,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
   string buffer::list::to_str() const {
     string s;
     s.reserve(length());
-    for (std::list<ptr>::const_iterator p = _buffers.begin();
+    for (buffers_t::const_iterator p = _buffers.begin();
 	 p != _buffers.end();
 	 ++p) {
       if (p->length()) {
@@ -2068,7 +2230,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
     }
 
     unsigned off = orig_off;
-    std::list<ptr>::iterator curbuf = _buffers.begin();
+    buffers_t::iterator curbuf = _buffers.begin();
     while (off > 0 && off >= curbuf->length()) {
       off -= curbuf->length();
       ++curbuf;
@@ -2092,6 +2254,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
 
       tmp.rebuild();
       _buffers.insert(curbuf, tmp._buffers.front());
+      last_p = begin();  // we modified _buffers
       return tmp.c_str() + off;
     }
 
@@ -2108,7 +2271,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
     clear();
 
     // skip off
-    std::list<ptr>::const_iterator curbuf = other._buffers.begin();
+    buffers_t::const_iterator curbuf = other._buffers.begin();
     while (off > 0 &&
 	   off >= curbuf->length()) {
       // skip this buffer
@@ -2151,7 +2314,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
     //cout << "splice off " << off << " len " << len << " ... mylen = " << length() << std::endl;
       
     // skip off
-    std::list<ptr>::iterator curbuf = _buffers.begin();
+    buffers_t::iterator curbuf = _buffers.begin();
     while (off > 0) {
       assert(curbuf != _buffers.end());
       if (off >= (*curbuf).length()) {
@@ -2170,7 +2333,8 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
       // add a reference to the front bit
       //  insert it before curbuf (which we'll hose)
       //cout << "keeping front " << off << " of " << *curbuf << std::endl;
-      _buffers.insert( curbuf, ptr( *curbuf, 0, off ) );
+      curbuf = _buffers.insert( curbuf, ptr( *curbuf, 0, off ) );
+      ++curbuf;
       _len += off;
     }
     
@@ -2193,7 +2357,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
       if (claim_by) 
 	claim_by->append( *curbuf, off, howmuch );
       _len -= (*curbuf).length();
-      _buffers.erase( curbuf++ );
+      curbuf = _buffers.erase( curbuf );
       len -= howmuch;
       off = 0;
     }
@@ -2207,7 +2371,7 @@ static std::atomic_flag buffer_debug_lock = ATOMIC_FLAG_INIT;
   {
     list s;
     s.substr_of(*this, off, len);
-    for (std::list<ptr>::const_iterator it = s._buffers.begin(); 
+    for (buffers_t::const_iterator it = s._buffers.begin(); 
 	 it != s._buffers.end(); 
 	 ++it)
       if (it->length())
@@ -2399,7 +2563,7 @@ int buffer::list::write_fd(int fd) const
   int iovlen = 0;
   ssize_t bytes = 0;
 
-  std::list<ptr>::const_iterator p = _buffers.begin();
+  buffers_t::const_iterator p = _buffers.begin();
   while (p != _buffers.end()) {
     if (p->length() > 0) {
       iov[iovlen].iov_base = (void *)p->c_str();
@@ -2448,7 +2612,7 @@ int buffer::list::write_fd(int fd, uint64_t offset) const
 {
   iovec iov[IOV_MAX];
 
-  std::list<ptr>::const_iterator p = _buffers.begin();
+  buffers_t::const_iterator p = _buffers.begin();
   uint64_t left_pbrs = _buffers.size();
   while (left_pbrs) {
     ssize_t bytes = 0;
@@ -2485,7 +2649,7 @@ int buffer::list::write_fd_zero_copy(int fd) const
     return -errno;
   if (errno == ESPIPE)
     off_p = NULL;
-  for (std::list<ptr>::const_iterator it = _buffers.begin();
+  for (buffers_t::const_iterator it = _buffers.begin();
        it != _buffers.end(); ++it) {
     int r = it->zero_copy_to_fd(fd, off_p);
     if (r < 0)
@@ -2498,7 +2662,7 @@ int buffer::list::write_fd_zero_copy(int fd) const
 
 __u32 buffer::list::crc32c(__u32 crc) const
 {
-  for (std::list<ptr>::const_iterator it = _buffers.begin();
+  for (buffers_t::const_iterator it = _buffers.begin();
        it != _buffers.end();
        ++it) {
     if (it->length()) {
@@ -2538,7 +2702,7 @@ __u32 buffer::list::crc32c(__u32 crc) const
 
 void buffer::list::invalidate_crc()
 {
-  for (std::list<ptr>::const_iterator p = _buffers.begin(); p != _buffers.end(); ++p) {
+  for (buffers_t::const_iterator p = _buffers.begin(); p != _buffers.end(); ++p) {
     raw *r = p->get_raw();
     if (r) {
       r->invalidate_crc();
@@ -2551,7 +2715,7 @@ void buffer::list::invalidate_crc()
  */
 void buffer::list::write_stream(std::ostream &out) const
 {
-  for (std::list<ptr>::const_iterator p = _buffers.begin(); p != _buffers.end(); ++p) {
+  for (buffers_t::const_iterator p = _buffers.begin(); p != _buffers.end(); ++p) {
     if (p->length() > 0) {
       out.write(p->c_str(), p->length());
     }
@@ -2669,7 +2833,7 @@ std::ostream& buffer::operator<<(std::ostream& out, const buffer::ptr& bp) {
 std::ostream& buffer::operator<<(std::ostream& out, const buffer::list& bl) {
   out << "buffer::list(len=" << bl.length() << "," << std::endl;
 
-  std::list<buffer::ptr>::const_iterator it = bl.buffers().begin();
+  buffer::list::buffers_t::const_iterator it = bl.buffers().begin();
   while (it != bl.buffers().end()) {
     out << "\t" << *it;
     if (++it == bl.buffers().end()) break;
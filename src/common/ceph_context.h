@@ -276,7 +276,7 @@ private:
   md_config_obs_t *_lockdep_obs;
 
 public:
-  DECLARE_KVSDBG;
+  KvsTrace kvsdbg;
   CrushLocation crush_location;
 private:
 
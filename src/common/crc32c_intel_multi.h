@@ -0,0 +1,31 @@
+#ifndef CEPH_COMMON_CRC32C_INTEL_MULTI_H
+#define CEPH_COMMON_CRC32C_INTEL_MULTI_H
+
+#include "include/int_types.h"
+#include "include/crc32c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef __x86_64__
+
+extern void ceph_crc32c_intel_multi(uint32_t *crcs, unsigned char const * const *data, unsigned length, unsigned n);
+
+#else
+
+/* no interleaved kernel here: one buffer at a time */
+static inline void ceph_crc32c_intel_multi(uint32_t *crcs, unsigned char const * const *data, unsigned length, unsigned n)
+{
+  unsigned i;
+  for (i = 0; i < n; i++)
+    crcs[i] = ceph_crc32c(crcs[i], data[i], length);
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
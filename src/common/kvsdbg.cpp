@@ -1,206 +1,311 @@
 
 #include "kvsdbg.h"
-#include "include/Context.h"
-#include <sys/socket.h>
-#include <stdlib.h>
-#include <netinet/in.h>
+#include "common/admin_socket.h"
+#include "common/ceph_context.h"
+#include "common/ceph_time.h"
+#include "common/config_obs.h"
+#include "common/Formatter.h"
+#include "common/io_priority.h"
+#include <algorithm>
+#include <map>
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
-#include <arpa/inet.h>
-#include <string>
-#include <stdarg.h>
-
-#define dout_context cct
-#define dout_subsys ceph_subsys_ms
-#undef dout_prefix
-#define dout_prefix *_dout << "DebugTerminal "
-
-std::string get_module_name(int type) {
-    switch(type) {
-        case CEPH_ENTITY_TYPE_MON:
-            return "mon";
-        case CEPH_ENTITY_TYPE_MDS:
-            return "mds";
-        case CEPH_ENTITY_TYPE_OSD:
-            return "osd";
-        case CEPH_ENTITY_TYPE_CLIENT:
-            return "client";
-        case CEPH_ENTITY_TYPE_MGR:
-            return "mgr";
-        case CEPH_ENTITY_TYPE_AUTH:
-            return "auth";
-        case CEPH_ENTITY_TYPE_ANY:
-            return "any";
-        default:
-            return "unknown";
-    };
-
-}
-
-KvsDebugTerminal::KvsDebugTerminal(int module_type_, CephContext *c):
-    sock(-1), connected(false),cct(c), module(get_module_name(module_type_)){
-
-}
-
-// true if connected
-bool KvsDebugTerminal::ensureconnection() {
-#ifdef NODEBUG
-    return true;
-#else
-    return connect("127.0.0.1", 1234, module);
-#endif
-}
-
-bool KvsDebugTerminal::connect(const std::string &ip, int port, const std::string &name) {
-    #ifdef NODEBUG
-        return true;
-    #endif
-    if (port == -1)  { return false; }
 
-    if (sock != -1 || connected) {
-        // already connected
-        return true;
+const char *kvs_trace_event_name(uint32_t ev) {
+    switch (ev) {
+        case KVS_EV_NONE:           return "none";
+        case KVS_EV_FUNC_ENTER:     return "enter";
+        case KVS_EV_FUNC_EXIT:      return "exit";
+        case KVS_EV_MSG:            return "msg";
+        case KVS_EV_TXC_STATE:      return "txc_state";
+        case KVS_EV_TXC_JOURNAL:    return "txc_journal";
+        case KVS_EV_TXC_AIO_SUBMIT: return "txc_aio_submit";
+        case KVS_EV_TXC_AIO_DONE:   return "txc_aio_done";
+        case KVS_EV_WBUF_FLUSH:     return "wbuf_flush";
+        default:                    return "unknown";
     }
+}
 
-    struct sockaddr_in serv_addr;
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-    {
-            lderr(cct) << "cannot create a socket" << dendl;
-            return false;
-    }
+// ----------------------------------------------------------------------------
+// KvsTraceRing
 
-    memset(&serv_addr, '0', sizeof(serv_addr));
+KvsTraceRing::KvsTraceRing(pid_t t, uint64_t size) : tid(t) {
+    uint64_t n = 1;
+    while (n < size) n <<= 1;
+    events.resize(n);
+    mask = n - 1;
+    memset(name, 0, sizeof(name));
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+}
 
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(port);
+void KvsTraceRing::reuse(pid_t t) {
+    tid = t;
+    memset(name, 0, sizeof(name));
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    tail.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    retired = false;
+}
 
-    // Convert IPv4 and IPv6 addresses from text to binary form
-    if(::inet_pton(AF_INET, ip.c_str(), &serv_addr.sin_addr)<=0)
-    {
-            lderr(cct) << "cannot create configure the Ip address: "<< ip.c_str() << dendl;
-            return false;
-    }
+void KvsTraceRing::add(uint32_t ev, uint64_t id, const char *label, uint64_t a0, uint64_t a1) {
+    const uint64_t h = head.load(std::memory_order_relaxed);
+    kvs_trace_event_t &e = events[h & mask];
+    e.stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        ceph::mono_clock::now().time_since_epoch()).count();
+    e.event = ev;
+    e.cpu = sched_getcpu();
+    e.id = id;
+    e.label = label;
+    e.a0 = a0;
+    e.a1 = a1;
+    head.store(h + 1, std::memory_order_release);
+}
 
-    if (::connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
-    {
-            lderr(cct) << "cannot connect to the server: " << ip.c_str() << ", port = " << port << dendl;
-            return false;
+void KvsTraceRing::snapshot(std::vector<kvs_trace_event_t> &out) const {
+    const uint64_t size = events.size();
+    const uint64_t h = head.load(std::memory_order_acquire);
+    uint64_t first = std::max(tail.load(std::memory_order_relaxed), h > size ? h - size : 0);
+    std::vector<kvs_trace_event_t> copy;
+    copy.reserve(h - first);
+    for (uint64_t i = first; i < h; i++)
+        copy.push_back(events[i & mask]);
+
+    // the writer may have lapped the oldest slots while we were copying
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t h2 = head.load(std::memory_order_relaxed);
+    uint64_t skip = 0;
+    if (h2 > size && h2 - size > first)
+        skip = std::min<uint64_t>(h2 - size - first, copy.size());
+    out.insert(out.end(), copy.begin() + skip, copy.end());
+}
+
+// ----------------------------------------------------------------------------
+// config observer and admin socket commands
+
+class KvsTraceHook : public md_config_obs_t, public AdminSocketHook {
+    CephContext *cct;
+    KvsTrace *trace;
+public:
+    KvsTraceHook(CephContext *c, KvsTrace *t) : cct(c), trace(t) {}
+
+    const char** get_tracked_conf_keys() const override {
+        static const char *KEYS[] = {
+            "kvsdbg_trace",
+            "kvsdbg_trace_entries",
+            NULL
+        };
+        return KEYS;
     }
 
-    connected = true;
+    void handle_conf_change(const md_config_t *conf,
+                            const std::set <std::string> &changed) override {
+        if (changed.count("kvsdbg_trace_entries"))
+            trace->set_ring_entries(conf->kvsdbg_trace_entries);
+        if (changed.count("kvsdbg_trace"))
+            trace->set_enabled(conf->kvsdbg_trace);
+    }
 
-    if (!sendmsg_nolock(name)) {
-        lderr(cct) << "cannot send the name to the server" << dendl;
-        return false;
+    bool call(std::string command, cmdmap_t& cmdmap, std::string format,
+              bufferlist& out) override {
+        Formatter *f = Formatter::create(format, "json-pretty", "json-pretty");
+        if (command == "kvsdbg trace dump") {
+            int64_t count = 0;
+            cmd_getval(cct, cmdmap, "count", count);
+            trace->dump(f, count > 0 ? count : 0);
+        } else if (command == "kvsdbg trace reset") {
+            trace->reset();
+            f->open_object_section("reset");
+            f->close_section();
+        } else {
+            assert(0 == "registered under wrong command?");
+        }
+        f->flush(out);
+        delete f;
+        return true;
     }
+};
 
-    lderr(cct) << "[" << name.c_str() << "] connected to the debug terminal" << dendl;
+// ----------------------------------------------------------------------------
+// KvsTrace
 
-    return true;
+static std::atomic<uint64_t> kvs_trace_uid = { 1 };
 
+// tracers by uid, so that exiting threads never touch a destroyed one
+static std::mutex &kvs_trace_registry_lock() {
+    static std::mutex l;
+    return l;
+}
+static std::map<uint64_t, KvsTrace *> &kvs_trace_registry() {
+    static std::map<uint64_t, KvsTrace *> m;
+    return m;
 }
 
-bool KvsDebugTerminal::sendmsg_dp(const int depth, const std::string fmt, ...) {
-    #ifdef NODEBUG
-        return true;
-    #endif
-    //ensureconnection();
-    std::unique_lock<std::mutex> lock(mlock);
-
-    int size = ((int)fmt.size()) * 2 + 250;   // Use a rubric appropriate for your code
-    std::string str;
-    va_list ap;
-
-    if (depth > 0) str.insert(str.begin(), depth, ' ');
-
-    while (1) {     // Maximum two passes on a POSIX system...
-            str.resize(size);
-            va_start(ap, fmt);
-            int n = vsnprintf((char *)str.data() + depth, size - depth, fmt.c_str(), ap);
-            va_end(ap);
-            if (n > -1 && n < (size-depth)) {  // Everything worked
-                    str.resize(n + depth);
-                    return sendmsg_nolock(str);
-            }
-            if (n > -1)  // Needed size returned
-                    size = n + depth + 1;   // For null char
-            else
-                    size *= 2;      // Guess at a larger size (OS specific)
+// the calling thread's rings; the last one used is looked up first
+struct KvsTraceThread {
+    uint64_t uid = 0;
+    KvsTraceRing *ring = nullptr;
+    std::vector<std::pair<uint64_t, KvsTraceRing *> > rings;
+
+    ~KvsTraceThread() {
+        std::lock_guard<std::mutex> l(kvs_trace_registry_lock());
+        for (const auto &p : rings) {
+            auto it = kvs_trace_registry().find(p.first);
+            if (it != kvs_trace_registry().end())
+                it->second->retire_ring(p.second);
+        }
     }
-    return sendmsg_nolock(str);
-}
+};
+static thread_local KvsTraceThread tls_trace;
 
+KvsTrace::KvsTrace(CephContext *c) :
+    cct(c), uid(kvs_trace_uid++), ring_entries(8192) {
+    std::lock_guard<std::mutex> l(kvs_trace_registry_lock());
+    kvs_trace_registry()[uid] = this;
+}
 
-bool KvsDebugTerminal::sendmsg_ex(const std::string fmt, ...) {
-    #ifdef NODEBUG
-        return true;
-    #endif
-    //ensureconnection();
-    std::unique_lock<std::mutex> lock(mlock);
-
-    int size = ((int)fmt.size()) * 2 + 50;   // Use a rubric appropriate for your code
-    std::string str;
-    va_list ap;
-    while (1) {     // Maximum two passes on a POSIX system...
-            str.resize(size);
-            va_start(ap, fmt);
-            int n = vsnprintf((char *)str.data(), size, fmt.c_str(), ap);
-            va_end(ap);
-            if (n > -1 && n < size) {  // Everything worked
-                    str.resize(n);
-                    return sendmsg_nolock(str);
-            }
-            if (n > -1)  // Needed size returned
-                    size = n + 1;   // For null char
-            else
-                    size *= 2;      // Guess at a larger size (OS specific)
+KvsTrace::~KvsTrace() {
+    stop();
+    {
+        std::lock_guard<std::mutex> l(kvs_trace_registry_lock());
+        kvs_trace_registry().erase(uid);
     }
-    return sendmsg_nolock(str);
+    for (KvsTraceRing *r : rings)
+        delete r;
 }
 
-bool KvsDebugTerminal::sendmsg_nolock(const std::string &msg) {
-    #ifdef NODEBUG
-        return true;
-    #endif
-    if (!ensureconnection()) {
-        if (cct) lderr(cct) << "can't send the message: not connected yet. MSG = " << msg << "connected = " << connected << ", sock = " << sock << dendl;
-        return false;
-    }
+void KvsTrace::start() {
+    if (hook) return;
+    hook = new KvsTraceHook(cct, this);
+    cct->_conf->add_observer(hook);
+    AdminSocket *admin_socket = cct->get_admin_socket();
+    admin_socket->register_command("kvsdbg trace dump",
+                                   "kvsdbg trace dump name=count,type=CephInt,req=false",
+                                   hook, "dump the per-thread KvsStore trace rings");
+    admin_socket->register_command("kvsdbg trace reset", "kvsdbg trace reset",
+                                   hook, "discard the recorded KvsStore trace events");
+}
 
-    long size= 0;
+void KvsTrace::stop() {
+    if (!hook) return;
+    AdminSocket *admin_socket = cct->get_admin_socket();
+    admin_socket->unregister_command("kvsdbg trace dump");
+    admin_socket->unregister_command("kvsdbg trace reset");
+    cct->_conf->remove_observer(hook);
+    delete hook;
+    hook = nullptr;
+}
 
-    bool retry = false;
-    do {
-        retry = false;
-        size = send(sock , msg.c_str() , msg.length() , 0 );
+void KvsTrace::set_ring_entries(uint64_t n) {
+    // applies to rings of threads that have not recorded yet
+    ring_entries.store(std::max<uint64_t>(n, 16));
+}
 
-        if (size == -1) {
-            sock = -1;
-            connected = false;
-            if (!ensureconnection()) break;
-            retry = true;
-        }
-    } while (errno == EINTR || retry == true);
+KvsTraceRing *KvsTrace::get_ring() {
+    if (likely(tls_trace.uid == uid))
+        return tls_trace.ring;
 
-    if (size != (long)msg.length()) {
-        if (cct) lderr(cct) << "can't send the message: size " << size << ", msg length " << msg.length() << ", errno " << errno << ", module " << module << dendl;
-        return false;
+    KvsTraceRing *ring = nullptr;
+    for (const auto &p : tls_trace.rings) {
+        if (p.first == uid) { ring = p.second; break; }
     }
+    if (!ring) {
+        const pid_t tid = ceph_gettid();
+        const uint64_t entries = ring_entries.load();
+        std::lock_guard<std::mutex> l(lock);
+        for (auto it = rings.begin(); it != rings.end(); ++it) {
+            if ((*it)->retired && (*it)->events.size() >= entries) {
+                // the oldest retired ring that is large enough; keep live ones first
+                ring = *it;
+                rings.erase(it);
+                ring->reuse(tid);
+                break;
+            }
+        }
+        if (!ring)
+            ring = new KvsTraceRing(tid, entries);
+        auto live = std::find_if(rings.begin(), rings.end(),
+                                 [](const KvsTraceRing *r) { return r->retired; });
+        rings.insert(live, ring);
+        tls_trace.rings.push_back(std::make_pair(uid, ring));
+    }
+    tls_trace.uid = uid;
+    tls_trace.ring = ring;
+    return ring;
+}
 
-    do { if (size > 0 && msg[msg.length()-1] != '\n') size = send(sock , "\n", 1 , 0 ); } while (errno == EINTR);
-
-    if (size < 0) {
-        connected = false;
-        sock = -1;
+void KvsTrace::retire_ring(KvsTraceRing *ring) {
+    std::lock_guard<std::mutex> l(lock);
+    auto it = std::find(rings.begin(), rings.end(), ring);
+    assert(it != rings.end());
+    rings.erase(it);
+    ring->retired = true;
+    rings.push_back(ring);
+
+    // free the oldest retired rings beyond the limit
+    unsigned retired = 0;
+    for (auto p = rings.rbegin(); p != rings.rend() && (*p)->retired; ++p)
+        retired++;
+    auto first = rings.end() - retired;
+    while (retired > MAX_RETIRED_RINGS) {
+        delete *first;
+        first = rings.erase(first);
+        retired--;
     }
+}
 
-    return true;
+size_t KvsTrace::num_rings() {
+    std::lock_guard<std::mutex> l(lock);
+    return rings.size();
 }
 
-bool KvsDebugTerminal::sendmsg(const std::string &msg) {
-    #ifdef NODEBUG
-        return true;
-    #endif
-    std::unique_lock<std::mutex> lock(mlock);
-    return sendmsg_nolock(msg);
+void KvsTrace::record(uint32_t ev, uint64_t id, const char *label, uint64_t a0, uint64_t a1) {
+    get_ring()->add(ev, id, label, a0, a1);
 }
 
+void KvsTrace::dump(ceph::Formatter *f, uint64_t max_events) {
+    std::vector<std::pair<const KvsTraceRing *, kvs_trace_event_t> > all;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        std::vector<kvs_trace_event_t> evs;
+        for (const KvsTraceRing *r : rings) {
+            evs.clear();
+            r->snapshot(evs);
+            for (const auto &e : evs)
+                all.push_back(std::make_pair(r, e));
+        }
+    }
+    std::stable_sort(all.begin(), all.end(),
+                     [](const std::pair<const KvsTraceRing *, kvs_trace_event_t> &a,
+                        const std::pair<const KvsTraceRing *, kvs_trace_event_t> &b) {
+                         return a.second.stamp < b.second.stamp;
+                     });
+    auto begin = all.begin();
+    if (max_events && all.size() > max_events)
+        begin = all.end() - max_events;
+
+    f->open_object_section("kvsdbg_trace");
+    f->dump_bool("enabled", enabled());
+    f->open_array_section("events");
+    for (auto p = begin; p != all.end(); ++p) {
+        const kvs_trace_event_t &e = p->second;
+        f->open_object_section("event");
+        f->dump_unsigned("stamp_ns", e.stamp);
+        f->dump_int("tid", p->first->tid);
+        f->dump_string("thread", p->first->name);
+        f->dump_unsigned("cpu", e.cpu);
+        f->dump_string("event", kvs_trace_event_name(e.event));
+        f->dump_format("id", "0x%llx", (unsigned long long)e.id);
+        f->dump_string("label", e.label ? e.label : "");
+        f->dump_unsigned("a0", e.a0);
+        f->dump_unsigned("a1", e.a1);
+        f->close_section();
+    }
+    f->close_section();
+    f->close_section();
+}
+
+void KvsTrace::reset() {
+    std::lock_guard<std::mutex> l(lock);
+    for (KvsTraceRing *r : rings)
+        r->tail.store(r->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
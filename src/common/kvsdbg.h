@@ -1,51 +1,123 @@
-#ifndef CEPH_KVS_DEBUG_TERMINAL_H
-#define CEPH_KVS_DEBUG_TERMINAL_H
+#ifndef CEPH_KVS_DEBUG_TRACE_H
+#define CEPH_KVS_DEBUG_TRACE_H
 
-#include <string>
+#include <atomic>
 #include <mutex>
+#include <vector>
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "common/likely.h"
 
 class CephContext;
+namespace ceph { class Formatter; }
+
+/// event ids of the binary trace; keep kvs_trace_event_name() in sync
+enum {
+    KVS_EV_NONE = 0,
+    KVS_EV_FUNC_ENTER,       ///< label = function
+    KVS_EV_FUNC_EXIT,        ///< label = function
+    KVS_EV_MSG,              ///< label = message, a0 = depth
+    KVS_EV_TXC_STATE,        ///< id = txc, label = new state, a0 = pending ios, a1 = bytes
+    KVS_EV_TXC_JOURNAL,      ///< id = txc, a0 = journal seq, a1 = journal entries
+    KVS_EV_TXC_AIO_SUBMIT,   ///< id = txc, a0 = ios
+    KVS_EV_TXC_AIO_DONE,     ///< id = txc, a0 = result
+    KVS_EV_WBUF_FLUSH,       ///< a0 = journal seq, a1 = flushed keys
+    KVS_EV_MAX
+};
+
+const char *kvs_trace_event_name(uint32_t ev);
+
+/// fixed-size trace record; label must point to storage with static duration
+struct kvs_trace_event_t {
+    uint64_t stamp;          ///< ns, mono clock
+    uint32_t event;
+    uint32_t cpu;
+    uint64_t id;
+    const char *label;
+    uint64_t a0;
+    uint64_t a1;
+};
+
+/// single-writer ring owned by one thread
+struct KvsTraceRing {
+    pid_t tid;
+    char name[16];
+    std::vector<kvs_trace_event_t> events;   ///< power of two
+    uint64_t mask;
+    std::atomic<uint64_t> head = { 0 };      ///< next slot to be written
+    std::atomic<uint64_t> tail = { 0 };      ///< first slot not yet reset
+    bool retired = false;                    ///< owner thread has exited
+
+    KvsTraceRing(pid_t t, uint64_t size);
+
+    /// hand a retired ring to the calling thread, dropping its old records
+    void reuse(pid_t t);
+
+    void add(uint32_t ev, uint64_t id, const char *label, uint64_t a0, uint64_t a1);
+
+    /// copy the live records; records overwritten while copying are dropped
+    void snapshot(std::vector<kvs_trace_event_t> &out) const;
+};
+
+/// per-thread binary trace rings, dumped through the admin socket
+class KvsTrace {
+    CephContext *cct;
+    const uint64_t uid;                      ///< distinguishes tracers in thread-local lookups
+    std::atomic<bool> on = { false };
+    std::atomic<uint64_t> ring_entries;
+    std::mutex lock;                         ///< protects rings
+    std::vector<KvsTraceRing *> rings;       ///< live rings, then retired ones oldest first
+    class KvsTraceHook *hook = nullptr;
+
+    KvsTraceRing *get_ring();
 
-class KvsDebugTerminal {
-private:
-        int sock;
-        bool connected;
-        std::mutex mlock;
-        CephContext *cct;
-        std::string module;
-        bool connect(const std::string &ip, int port, const std::string &name);
 public:
-        KvsDebugTerminal(int module_type, CephContext *c);
+    /// retired rings kept for dumps until a new thread reuses them
+    static const unsigned MAX_RETIRED_RINGS = 8;
+
+    explicit KvsTrace(CephContext *c);
+    ~KvsTrace();
+
+    /// register the config observer and admin socket commands
+    void start();
+    void stop();
+
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+    void set_enabled(bool b) { on.store(b, std::memory_order_relaxed); }
+    void set_ring_entries(uint64_t n);
 
-        bool ensureconnection();
+    void record(uint32_t ev, uint64_t id, const char *label, uint64_t a0 = 0, uint64_t a1 = 0);
 
-        bool sendmsg_ex(const std::string fmt, ...);
-        bool sendmsg_dp(const int depth, const std::string fmt, ...);
-        bool sendmsg(const std::string &msg);
-        bool sendmsg_nolock(const std::string &msg);
+    /// all threads' records in time order, the most recent max_events if non-zero
+    void dump(ceph::Formatter *f, uint64_t max_events = 0);
+    void reset();
+
+    /// called when the owner thread of ring exits
+    void retire_ring(KvsTraceRing *ring);
+    size_t num_rings();
 };
 
-#define NODEBUG
-
-#ifdef NODEBUG
-#define DECLARE_KVSDBG
-#define INIT_KVSDBG
-#define KVS_DEBUG(ct)
-#define KVS_MSG_EX(ct,depth,format, ...)
-#define KVS_FTRACE(ct)
-#define KVS_FTRACE_DONE(ct)
-#define KVS_FTRACE2(ct, msg)
-#define KVS_BT(ct)
-#else
-#define DECLARE_KVSDBG KvsDebugTerminal kvsdbg
-#define INIT_KVSDBG kvsdbg(module_type_, this),
-#define KVS_DEBUG(ct) (ct)->kvsdbg.sendmsg_ex("%s, %d\n", __func__, __line__);
-#define KVS_MSG_EX(ct,depth,format, ...) do { (ct)->kvsdbg.sendmsg_dp(depth,"" format "", ##__VA_ARGS__); } while (0)
-#define KVS_FTRACE(ct) do { (ct)->kvsdbg.sendmsg_ex("KvsStore::%s() - start\n", __func__); } while (0)
-#define KVS_FTRACE_DONE(ct) do { (ct)->kvsdbg.sendmsg_ex("KvsStore::%s() - done\n", __func__);  } while (0)
-#define KVS_FTRACE2(ct, msg) (ct)->kvsdbg.sendmsg_ex("%s - %s\n", __func__, (msg))
-#define KVS_BT(ct) do { BackTrace bt(0); std::stringstream ss; bt.print(ss); (ct)->kvsdbg.sendmsg_ex("FUNC: KvsStore::%s, Stack Trace: \n %s\n", __func__, ss.str().c_str()); } while (0);
-#endif
+/// records a function enter/exit pair if tracing was on at entry
+struct KvsTraceScope {
+    KvsTrace *t;
+    const char *func;
+    KvsTraceScope(KvsTrace *tr, const char *f) : t(nullptr), func(f) {
+        if (unlikely(tr->enabled())) {
+            t = tr;
+            t->record(KVS_EV_FUNC_ENTER, 0, func);
+        }
+    }
+    ~KvsTraceScope() {
+        if (t) t->record(KVS_EV_FUNC_EXIT, 0, func);
+    }
+};
 
-#endif
+#define KVS_TRACE(ct, ev, id, label, a0, a1) \
+    do { if (unlikely((ct)->kvsdbg.enabled())) (ct)->kvsdbg.record((ev), (uint64_t)(id), (label), (uint64_t)(a0), (uint64_t)(a1)); } while (0)
+#define KVS_MSG_EX(ct, depth, format, ...) KVS_TRACE(ct, KVS_EV_MSG, 0, "" format "", depth, 0)
+#define KVS_FTRACE(ct) KVS_TRACE(ct, KVS_EV_FUNC_ENTER, 0, __func__, 0, 0)
+#define KVS_FTRACE_DONE(ct) KVS_TRACE(ct, KVS_EV_FUNC_EXIT, 0, __func__, 0, 0)
+#define KVS_FTRACE_SCOPE(ct) KvsTraceScope _kvs_trace_scope(&(ct)->kvsdbg, __func__)
 
+#endif
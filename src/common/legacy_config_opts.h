@@ -120,6 +120,8 @@ OPTION(ms_cluster_type, OPT_STR)   // messenger backend
 OPTION(ms_tcp_nodelay, OPT_BOOL)
 OPTION(ms_tcp_rcvbuf, OPT_INT)
 OPTION(ms_tcp_prefetch_max_size, OPT_INT) // max prefetch size, we limit this to avoid extra memcpy
+OPTION(ms_tcp_zerocopy, OPT_BOOL) // MSG_ZEROCOPY sends, page-aligned message data reads
+OPTION(ms_tcp_zerocopy_min_size, OPT_U64)
 OPTION(ms_initial_backoff, OPT_DOUBLE)
 OPTION(ms_max_backoff, OPT_DOUBLE)
 OPTION(ms_crc_data, OPT_BOOL)
@@ -150,6 +152,7 @@ OPTION(ms_dump_on_send, OPT_BOOL)           // hexdump msg to log on send
 OPTION(ms_dump_corrupt_message_level, OPT_INT)  // debug level to hexdump undecodeable messages at
 OPTION(ms_async_op_threads, OPT_U64)            // number of worker processing threads for async messenger created on init
 OPTION(ms_async_max_op_threads, OPT_U64)        // max number of worker processing threads for async messenger
+OPTION(ms_async_max_send_batch, OPT_U32)        // max messages encoded and written per send batch
 OPTION(ms_async_set_affinity, OPT_BOOL)
 // example: ms_async_affinity_cores = 0,1
 // The number of coreset is expected to equal to ms_async_op_threads, otherwise
@@ -195,6 +198,7 @@ OPTION(mon_osd_cache_size, OPT_INT)  // the size of osdmaps cache, not to rely o
 
 OPTION(mon_cpu_threads, OPT_INT)
 OPTION(mon_osd_mapping_pgs_per_chunk, OPT_INT)
+OPTION(mon_osd_mapping_incremental, OPT_BOOL)
 OPTION(mon_osd_max_creating_pgs, OPT_INT)
 OPTION(mon_tick_interval, OPT_INT)
 OPTION(mon_session_timeout, OPT_INT)    // must send keepalive or subscribe
@@ -964,6 +968,9 @@ OPTION(bdev_aio, OPT_BOOL)
 OPTION(bdev_aio_poll_ms, OPT_INT)  // milliseconds
 OPTION(bdev_aio_max_queue_depth, OPT_INT)
 OPTION(bdev_aio_reap_max, OPT_INT)
+OPTION(bdev_ioring, OPT_BOOL)
+OPTION(bdev_ioring_shards, OPT_U64)
+OPTION(bdev_ioring_sqthread_poll, OPT_BOOL)
 OPTION(bdev_block_size, OPT_INT)
 OPTION(bdev_debug_aio, OPT_BOOL)
 OPTION(bdev_debug_aio_suicide_timeout, OPT_FLOAT)
@@ -986,7 +993,7 @@ OPTION(bluefs_min_flush_size, OPT_U64)  // ignore flush until its this big
 OPTION(bluefs_compact_log_sync, OPT_BOOL)  // sync or async log compaction?
 OPTION(bluefs_buffered_io, OPT_BOOL)
 OPTION(bluefs_sync_write, OPT_BOOL)
-OPTION(bluefs_allocator, OPT_STR)     // stupid | bitmap
+OPTION(bluefs_allocator, OPT_STR)     // stupid | bitmap | avl
 OPTION(bluefs_preextend_wal_files, OPT_BOOL)  // this *requires* that rocksdb has recycling enabled
 
 OPTION(bluestore_bluefs, OPT_BOOL)
@@ -1079,10 +1086,14 @@ OPTION(bluestore_cache_meta_ratio, OPT_DOUBLE)
 OPTION(bluestore_cache_kv_ratio, OPT_DOUBLE)
 OPTION(bluestore_cache_kv_max, OPT_U64) // limit the maximum amount of cache for the kv store
 OPTION(bluestore_kvbackend, OPT_STR)
-OPTION(bluestore_allocator, OPT_STR)     // stupid | bitmap
+OPTION(bluestore_allocator, OPT_STR)     // stupid | bitmap | avl
 OPTION(bluestore_freelist_blocks_per_key, OPT_INT)
 OPTION(bluestore_bitmapallocator_blocks_per_zone, OPT_INT) // must be power of 2 aligned, e.g., 512, 1024, 2048...
 OPTION(bluestore_bitmapallocator_span_size, OPT_INT) // must be power of 2 aligned, e.g., 512, 1024, 2048...
+OPTION(bluestore_avl_alloc_bf_threshold, OPT_U64)
+OPTION(bluestore_avl_alloc_bf_free_pct, OPT_U64)
+OPTION(bluestore_avl_alloc_ff_max_search_count, OPT_U64)
+OPTION(bluestore_avl_alloc_mem_cap, OPT_U64)
 OPTION(bluestore_max_deferred_txc, OPT_U64)
 OPTION(bluestore_rocksdb_options, OPT_STR)
 OPTION(bluestore_fsck_on_mount, OPT_BOOL)
@@ -1120,8 +1131,8 @@ OPTION(bluestore_debug_permit_any_bdev_label, OPT_BOOL)
 OPTION(bluestore_shard_finishers, OPT_BOOL)
 OPTION(bluestore_debug_random_read_err, OPT_DOUBLE)
 
-OPTION(kvsdbg_server, OPT_STR)
-OPTION(kvsdbg_port, OPT_INT)
+OPTION(kvsdbg_trace, OPT_BOOL)
+OPTION(kvsdbg_trace_entries, OPT_U64)
 OPTION(op_scheduler, OPT_STR)
 OPTION(mon_max_pool_per_osd, OPT_U64)
 OPTION(kvsstore_dev_path, OPT_STR)
@@ -1129,9 +1140,20 @@ OPTION(kvsstore_readcache_bytes, OPT_U64)
 OPTION(kvsstore_max_cached_onodes, OPT_U64)
 OPTION(enable_onode_prefetch, OPT_STR)
 OPTION(kvsstore_csum_type, OPT_STR)
+OPTION(kvsstore_reaper_max_keys_per_sec, OPT_U64)
+OPTION(kvsstore_reaper_batch_size, OPT_U64)
+OPTION(kvsstore_reaper_max_pending_ios, OPT_U64)
+OPTION(kvsstore_reaper_iter_delete, OPT_BOOL)
+OPTION(kvsstore_write_buffer_max_bytes, OPT_U64)
+OPTION(kvsstore_write_buffer_max_value_size, OPT_U64)
+OPTION(kvsstore_write_buffer_flush_age, OPT_DOUBLE)
+OPTION(kvsstore_pglog_segment_entries, OPT_U64)
+OPTION(kvsstore_statfs_refresh_interval, OPT_DOUBLE)
+OPTION(kvsstore_statfs_journal_max_bytes, OPT_U64)
 
 OPTION(kstore_max_ops, OPT_U64)
 OPTION(kstore_max_bytes, OPT_U64)
+OPTION(kadistore_dev_path, OPT_STR)
 OPTION(kstore_backend, OPT_STR)
 OPTION(kstore_rocksdb_options, OPT_STR)
 OPTION(kstore_fsck_on_mount, OPT_BOOL)
@@ -1339,6 +1361,7 @@ OPTION(rgw_data, OPT_STR)
 OPTION(rgw_enable_apis, OPT_STR)
 OPTION(rgw_cache_enabled, OPT_BOOL)   // rgw cache enabled
 OPTION(rgw_cache_lru_size, OPT_INT)   // num of entries in rgw cache
+OPTION(rgw_cache_shards, OPT_INT)   // num of shards in rgw cache
 OPTION(rgw_socket_path, OPT_STR)   // path to unix domain socket, if not specified, rgw will not run as external fcgi
 OPTION(rgw_host, OPT_STR)  // host for radosgw, can be an IP, default is 0.0.0.0
 OPTION(rgw_port, OPT_STR)  // port to listen, format as "8080" "5000", if not specified, rgw will not run external fcgi
@@ -0,0 +1,74 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_MPSC_QUEUE_H
+#define CEPH_COMMON_MPSC_QUEUE_H
+
+#include <atomic>
+
+namespace ceph {
+
+/**
+ * Unbounded multi-producer, single-consumer queue of intrusive nodes.
+ *
+ * push() never blocks: it is a single compare-and-swap on the head.
+ * The consumer takes everything queued so far with pop_all(), oldest
+ * first.  The link is a "T *next" member unless another is named, and
+ * belongs to the queue while the node is queued.  push() and empty()
+ * are sequentially consistent, so a producer may publish a node and then
+ * check some other atomic state that the consumer sets before it looks
+ * at the queue.
+ */
+template <typename T, T* T::*Next = &T::next>
+class mpsc_queue {
+  std::atomic<T*> head{nullptr};  ///< newest first
+
+public:
+  mpsc_queue() = default;
+  mpsc_queue(const mpsc_queue&) = delete;
+  mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+  /// queue a node; returns true if the queue was empty
+  bool push(T *node) {
+    return push(node, node);
+  }
+
+  /// queue a chain linked newest to oldest through the link, in one go
+  bool push(T *newest, T *oldest) {
+    T *h = head.load(std::memory_order_relaxed);
+    do {
+      oldest->*Next = h;
+    } while (!head.compare_exchange_weak(h, newest));
+    return h == nullptr;
+  }
+
+  bool empty() const {
+    return head.load() == nullptr;
+  }
+
+  /// take every queued node, oldest first, linked through the link
+  T *pop_all() {
+    T *h = head.exchange(nullptr);
+    T *prev = nullptr;
+    while (h) {
+      T *n = h->*Next;
+      h->*Next = prev;
+      prev = h;
+      h = n;
+    }
+    return prev;
+  }
+};
+
+}
+
+#endif
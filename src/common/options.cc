@@ -308,7 +308,8 @@ std::vector<Option> get_global_options() {
 
     Option("log_max_new", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(1000)
-    .set_description("max unwritten log entries to allow before waiting to flush to the log")
+    .set_description("max unwritten log entries per thread before new entries are dropped")
+    .set_long_description("Each logging thread queues entries in its own buffer of this many entries (rounded up to a power of two), sized when the thread first logs.  When the log thread falls behind, further entries are dropped and counted instead of blocking the caller.")
     .add_see_also("log_max_recent"),
 
     Option("log_max_recent", Option::TYPE_INT, Option::LEVEL_ADVANCED)
@@ -604,6 +605,17 @@ std::vector<Option> get_global_options() {
     .set_default(4096)
     .set_description(""),
 
+    Option("ms_tcp_zerocopy", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Avoid copying message payloads in the posix async stack")
+    .set_long_description("Large sends use MSG_ZEROCOPY (Linux 4.14 and later) and hold their buffers until the kernel reports completion. Message data is read into a single page-aligned buffer sized from the message header, which object stores can keep without copying.")
+    .add_see_also("ms_tcp_zerocopy_min_size"),
+
+    Option("ms_tcp_zerocopy_min_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64 << 10)
+    .set_description("Smallest send done with MSG_ZEROCOPY")
+    .set_long_description("Smaller sends are copied, which is cheaper than pinning pages and reaping the completion."),
+
     Option("ms_initial_backoff", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
     .set_default(.2)
     .set_description(""),
@@ -735,6 +747,11 @@ std::vector<Option> get_global_options() {
     .set_default(5)
     .set_description(""),
 
+    Option("ms_async_max_send_batch", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64)
+    .set_min(1)
+    .set_description("Maximum number of messages a connection encodes and writes to its socket in one batch"),
+
     Option("ms_async_set_affinity", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(true)
     .set_description(""),
@@ -879,6 +896,11 @@ std::vector<Option> get_global_options() {
     .set_default(4096)
     .set_description(""),
 
+    Option("mon_osd_mapping_incremental", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_description("Only remap pools and pgs an osdmap incremental can affect")
+    .set_long_description("When a single new osdmap epoch is applied, keep the pg mappings of pools whose crush rule, placement parameters and reachable osds did not change, and remap only the pgs whose temp or upmap overrides changed."),
+
     Option("mon_osd_max_creating_pgs", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(1024)
     .set_description(""),
@@ -3078,6 +3100,24 @@ std::vector<Option> get_global_options() {
     .set_default(16)
     .set_description(""),
 
+    Option("bdev_ioring", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Use io_uring instead of libaio for kernel block devices")
+    .set_long_description("Falls back to libaio if the kernel or build does not support io_uring.")
+    .add_see_also("bdev_ioring_shards"),
+
+    Option("bdev_ioring_shards", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4)
+    .set_min(1)
+    .set_description("Number of io_uring rings per block device")
+    .set_long_description("Each submitting thread is bound to one ring, and each ring is reaped by its own completion thread."),
+
+    Option("bdev_ioring_sqthread_poll", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Have a kernel thread poll each io_uring submission queue")
+    .set_long_description("Saves the submit system call at the cost of a busy kernel thread per ring.")
+    .add_see_also("bdev_ioring"),
+
     Option("bdev_block_size", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(4096)
     .set_description(""),
@@ -3140,6 +3180,7 @@ std::vector<Option> get_global_options() {
 
     Option("bluefs_allocator", Option::TYPE_STR, Option::LEVEL_DEV)
     .set_default("stupid")
+    .set_enum_allowed({"bitmap", "stupid", "avl"})
     .set_description(""),
 
     Option("bluefs_preextend_wal_files", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
@@ -3456,9 +3497,28 @@ std::vector<Option> get_global_options() {
 
     Option("bluestore_allocator", Option::TYPE_STR, Option::LEVEL_DEV)
     .set_default("stupid")
-    .set_enum_allowed({"bitmap", "stupid"})
+    .set_enum_allowed({"bitmap", "stupid", "avl"})
     .set_description("Allocator policy"),
 
+    Option("bluestore_avl_alloc_bf_threshold", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(131072)
+    .set_description("Avl allocator switches to best-fit when the largest free extent is shorter than this")
+    .add_see_also("bluestore_avl_alloc_bf_free_pct"),
+
+    Option("bluestore_avl_alloc_bf_free_pct", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(4)
+    .set_description("Avl allocator switches to best-fit when less than this percentage of the device is free")
+    .add_see_also("bluestore_avl_alloc_bf_threshold"),
+
+    Option("bluestore_avl_alloc_ff_max_search_count", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(100)
+    .set_description("Free extents the avl allocator looks at before giving up on first-fit"),
+
+    Option("bluestore_avl_alloc_mem_cap", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(64ul << 20)
+    .set_description("Memory the avl allocator may use for its free extent trees")
+    .set_long_description("Past this, the shortest free extents are tracked in a bitmap instead, which is only used when the trees cannot satisfy an allocation. 0 means no limit."),
+
     Option("bluestore_freelist_blocks_per_key", Option::TYPE_INT, Option::LEVEL_DEV)
     .set_default(128)
     .set_description("Block (and bits) per database key"),
@@ -3630,13 +3690,14 @@ std::vector<Option> get_global_options() {
     // ------------------------------------------
     // kvsdbg
 
-    Option("kvsdbg_server", Option::TYPE_STR,  Option::LEVEL_ADVANCED)
-    .set_default("127.0.0.1")
-    .set_description("IP address of the remote terminal server"),
+    Option("kvsdbg_trace", Option::TYPE_BOOL, Option::LEVEL_DEV)
+    .set_default(false)
+    .set_description("record KvsStore trace events in per-thread rings")
+    .set_long_description("Events are dumped with the 'kvsdbg trace dump' admin socket command."),
 
-    Option("kvsdbg_port", Option::TYPE_INT,  Option::LEVEL_ADVANCED)
-    .set_default(-1)
-    .set_description("port number of the remote terminal server"),
+    Option("kvsdbg_trace_entries", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(8192)
+    .set_description("number of events kept per thread, rounded up to a power of two"),
     Option("op_scheduler", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("sharded")
     .set_description("type of scheduler: rr, epoll, sharded"),
@@ -3645,7 +3706,8 @@ std::vector<Option> get_global_options() {
     .set_description("Max number of pools per OSD the cluster will allow"),
     Option("kvsstore_dev_path", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("/dev/nvme0n1")
-    .set_description("Default KV device if nothing is mentioned"),
+    .set_description("KV device(s) backing the store")
+    .set_long_description("A comma or space separated list of KV-SSD namespaces. Objects are spread across them by hash; the first device also holds the superblock, collections and journal. The list must not change after mkfs."),
     Option("kvsstore_readcache_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(1024*1024*1024ul)
     .set_description("the size of read cache (default: 1GB)"),
@@ -3665,6 +3727,46 @@ std::vector<Option> get_global_options() {
     .set_enum_allowed({"none", "crc32c"})
     .set_safe()
     .set_description("Default checksum algorithm to use"),
+    Option("kvsstore_reaper_max_keys_per_sec", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(20000)
+    .set_description("Max number of keys the background reaper deletes per second (0 = unlimited)"),
+    Option("kvsstore_reaper_batch_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64)
+    .set_min(1)
+    .set_description("Number of deletes the background reaper keeps in flight"),
+    Option("kvsstore_reaper_max_pending_ios", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(256)
+    .set_description("Pause the background reaper while more client writes than this are queued on the device (0 = never pause)"),
+    Option("kvsstore_reaper_iter_delete", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Let the background reaper use device-side prefix deletes")
+    .set_long_description("When enabled, the reaper deletes a whole key prefix with a single ITER_OPTION_DEL_KEY_VALUE iterator request, after verifying with a key-only scan that every key under the prefix is dead. Falls back to individual deletes if the device rejects the request."),
+    Option("kvsstore_write_buffer_max_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(8*1024*1024ul)
+    .set_description("Max bytes of journaled omap updates held in memory before they are written to the device (0 = disabled)"),
+    Option("kvsstore_write_buffer_max_value_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4096)
+    .set_description("Largest omap value that is absorbed by the write buffer"),
+    Option("kvsstore_write_buffer_flush_age", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(1.0)
+    .set_description("Seconds an absorbed omap update may stay in memory before it is written to the device")
+    .set_long_description("Rewrites of the same omap key within this window are coalesced so that only the latest value reaches the device. The update is protected by the KvsStore journal while it is buffered."),
+
+    Option("kvsstore_pglog_segment_entries", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(32)
+    .set_description("Number of PG log versions stored together in one pglog segment value")
+    .set_long_description("KvsStore packs the PG log and dup entries of a PG into segment values of this many versions, so that appending to the log rewrites one segment and trimming it drops whole segments, instead of writing and deleting one key per entry. 0 keeps one key per entry for PGs that do not use segments yet. A PG keeps the segment size it started with."),
+
+    Option("kvsstore_statfs_refresh_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(5)
+    .set_description("Seconds between device capacity queries and usage checkpoints")
+    .set_long_description("statfs reports the device capacity and utilization cached by a background thread, which queries the device at this interval and also writes the per-pool usage counters next to the superblock if they changed. 0 disables the refresh after mount."),
+
+    Option("kvsstore_statfs_journal_max_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(2048)
+    .set_description("Largest encoded per-pool usage record carried in a journal entry")
+    .set_long_description("Each journaled transaction carries the per-pool usage counters so that they survive a crash. With more pools than fit, only the periodic checkpoint is kept, and usage after a crash may lag by up to kvsstore_statfs_refresh_interval.")
+    .add_see_also("kvsstore_statfs_refresh_interval"),
 
     // -----------------------------------------
     // kstore
@@ -3677,6 +3779,11 @@ std::vector<Option> get_global_options() {
     .set_default(64*1024*1024)
     .set_description(""),
 
+    Option("kadistore_dev_path", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_description("KV-SSD namespace(s) backing a 'kadi' KeyValueDB")
+    .set_long_description("Used by the experimental 'kadi' backend of mon_keyvaluedb, kstore_backend and ceph-kvstore-tool. The namespace must not be shared with a KvsStore."),
+
     Option("kstore_backend", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("rocksdb")
     .set_description(""),
@@ -4343,6 +4450,12 @@ std::vector<Option> get_rgw_options() {
     .set_default(10000)
     .set_description(""),
 
+    Option("rgw_cache_shards", Option::TYPE_INT, Option::LEVEL_ADVANCED)
+    .set_default(16)
+    .set_min(1)
+    .set_description("number of independently locked shards of the rgw cache")
+    .set_long_description("rgw_cache_lru_size is split evenly between the shards."),
+
     Option("rgw_socket_path", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("")
     .set_description(""),
@@ -5229,6 +5342,31 @@ static std::vector<Option> get_rbd_options() {
     .set_default(false)
     .set_description("whether to block writes to the cache before the aio_write call completes"),
 
+    Option("rbd_persistent_cache", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("whether to log writes to a local file and write them back to the image later")
+    .set_long_description("Writes are acknowledged once they are in the local log, so the log has to survive a client crash.  rbd_cache is ignored when this is enabled.  Images using journaling are not cached."),
+
+    Option("rbd_persistent_cache_path", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_description("directory holding the persistent cache logs, ideally on a local SSD")
+    .set_long_description("The logs hold acknowledged writes until they are written back, so the directory must be on persistent local storage, e.g. /var/lib/ceph/rbd-cache.  The persistent cache is not enabled while this is unset."),
+
+    Option("rbd_persistent_cache_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1ull*1024*1024*1024)
+    .set_min(32ull*1024*1024)
+    .set_description("size of the persistent cache log of each image"),
+
+    Option("rbd_persistent_cache_destage_max_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4ull*1024*1024)
+    .set_description("most log bytes written back to the image in one batch"),
+
+    Option("rbd_persistent_cache_discard_dirty", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("whether to discard the dirty data another client left in its persistent cache when opening an image for write")
+    .set_long_description("An image whose writes are still in the persistent cache of another client, e.g. one that crashed, cannot be opened for write elsewhere (EBUSY) until that client has written them back.  With this enabled the open goes ahead, and those writes are lost.")
+    .add_see_also("rbd_persistent_cache"),
+
     Option("rbd_concurrent_management_ops", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(10)
     .set_min(1)
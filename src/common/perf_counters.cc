@@ -19,6 +19,31 @@
 
 using std::ostringstream;
 
+namespace {
+
+/// the shard of sharded counters this thread updates
+unsigned my_shard()
+{
+  static std::atomic<unsigned> next = { 0 };
+  static thread_local unsigned mine =
+    next++ % PerfCounters::perf_counter_data_any_d::num_shards;
+  return mine;
+}
+
+template <typename T>
+void add_to(T& d, bool avg, uint64_t amt)
+{
+  if (avg) {
+    d.avgcount++;
+    d.u64 += amt;
+    d.avgcount2++;
+  } else {
+    d.u64 += amt;
+  }
+}
+
+}
+
 PerfCountersCollection::PerfCountersCollection(CephContext *cct)
   : m_cct(cct),
     m_lock("PerfCountersCollection")
@@ -172,13 +197,7 @@ void PerfCounters::inc(int idx, uint64_t amt)
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_U64))
     return;
-  if (data.type & PERFCOUNTER_LONGRUNAVG) {
-    data.avgcount++;
-    data.u64 += amt;
-    data.avgcount2++;
-  } else {
-    data.u64 += amt;
-  }
+  add_to(data, data.type & PERFCOUNTER_LONGRUNAVG, amt);
 }
 
 void PerfCounters::dec(int idx, uint64_t amt)
@@ -208,6 +227,12 @@ void PerfCounters::set(int idx, uint64_t amt)
 
   ANNOTATE_BENIGN_RACE_SIZED(&data.u64, sizeof(data.u64),
                              "perf counter atomic");
+  if (data.shards) {
+    // not atomic with respect to concurrent updates of the shards
+    for (unsigned i = 0; i < perf_counter_data_any_d::num_shards; ++i) {
+      data.shards[i].u64 = 0;
+    }
+  }
   if (data.type & PERFCOUNTER_LONGRUNAVG) {
     data.avgcount++;
     data.u64 = amt;
@@ -227,7 +252,7 @@ uint64_t PerfCounters::get(int idx) const
   const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_U64))
     return 0;
-  return data.u64;
+  return data.read_u64();
 }
 
 void PerfCounters::tinc(int idx, utime_t amt, uint32_t avgcount)
@@ -240,13 +265,7 @@ void PerfCounters::tinc(int idx, utime_t amt, uint32_t avgcount)
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_TIME))
     return;
-  if (data.type & PERFCOUNTER_LONGRUNAVG) {
-    data.avgcount++;
-    data.u64 += amt.to_nsec();
-    data.avgcount2++;
-  } else {
-    data.u64 += amt.to_nsec();
-  }
+  add_to(data, data.type & PERFCOUNTER_LONGRUNAVG, amt.to_nsec());
 }
 
 void PerfCounters::tinc(int idx, ceph::timespan amt, uint32_t avgcount)
@@ -259,13 +278,51 @@ void PerfCounters::tinc(int idx, ceph::timespan amt, uint32_t avgcount)
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_TIME))
     return;
-  if (data.type & PERFCOUNTER_LONGRUNAVG) {
-    data.avgcount++;
-    data.u64 += amt.count();
-    data.avgcount2++;
-  } else {
-    data.u64 += amt.count();
-  }
+  add_to(data, data.type & PERFCOUNTER_LONGRUNAVG, amt.count());
+}
+
+void PerfCounters::inc_sharded(int idx, uint64_t amt)
+{
+  if (!m_cct->_conf->perf)
+    return;
+
+  assert(idx > m_lower_bound);
+  assert(idx < m_upper_bound);
+  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  assert(data.shards);
+  if (!(data.type & PERFCOUNTER_U64))
+    return;
+  add_to(data.shards[my_shard()], data.type & PERFCOUNTER_LONGRUNAVG, amt);
+}
+
+void PerfCounters::tinc_sharded(int idx, utime_t amt)
+{
+  if (!m_cct->_conf->perf)
+    return;
+
+  assert(idx > m_lower_bound);
+  assert(idx < m_upper_bound);
+  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  assert(data.shards);
+  if (!(data.type & PERFCOUNTER_TIME))
+    return;
+  add_to(data.shards[my_shard()], data.type & PERFCOUNTER_LONGRUNAVG,
+	 amt.to_nsec());
+}
+
+void PerfCounters::tinc_sharded(int idx, ceph::timespan amt)
+{
+  if (!m_cct->_conf->perf)
+    return;
+
+  assert(idx > m_lower_bound);
+  assert(idx < m_upper_bound);
+  perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
+  assert(data.shards);
+  if (!(data.type & PERFCOUNTER_TIME))
+    return;
+  add_to(data.shards[my_shard()], data.type & PERFCOUNTER_LONGRUNAVG,
+	 amt.count());
 }
 
 void PerfCounters::tset(int idx, utime_t amt)
@@ -278,9 +335,14 @@ void PerfCounters::tset(int idx, utime_t amt)
   perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_TIME))
     return;
-  data.u64 = amt.to_nsec();
   if (data.type & PERFCOUNTER_LONGRUNAVG)
     ceph_abort();
+  if (data.shards) {
+    for (unsigned i = 0; i < perf_counter_data_any_d::num_shards; ++i) {
+      data.shards[i].u64 = 0;
+    }
+  }
+  data.u64 = amt.to_nsec();
 }
 
 utime_t PerfCounters::tget(int idx) const
@@ -293,7 +355,7 @@ utime_t PerfCounters::tget(int idx) const
   const perf_counter_data_any_d& data(m_data[idx - m_lower_bound - 1]);
   if (!(data.type & PERFCOUNTER_TIME))
     return utime_t();
-  uint64_t v = data.u64;
+  uint64_t v = data.read_u64();
   return utime_t(v / 1000000000ull, v % 1000000000ull);
 }
 
@@ -431,7 +493,7 @@ void PerfCounters::dump_formatted_generic(Formatter *f, bool schema,
         d->histogram->dump_formatted(f);
         f->close_section();
       } else {
-	uint64_t v = d->u64;
+	uint64_t v = d->read_u64();
 	if (d->type & PERFCOUNTER_U64) {
 	  f->dump_unsigned(d->name, v);
 	} else if (d->type & PERFCOUNTER_TIME) {
@@ -549,6 +611,21 @@ void PerfCountersBuilder::add_impl(
   data.histogram = std::move(histogram);
 }
 
+void PerfCountersBuilder::set_sharded(int idx)
+{
+  assert(idx > m_perf_counters->m_lower_bound);
+  assert(idx < m_perf_counters->m_upper_bound);
+  PerfCounters::perf_counter_data_any_d
+    &data(m_perf_counters->m_data[idx - m_perf_counters->m_lower_bound - 1]);
+  // a gauge read while other threads move it could come out as the sum
+  // of shards from different moments; only totals add up safely
+  assert(data.type & (PERFCOUNTER_COUNTER | PERFCOUNTER_LONGRUNAVG));
+  assert(!(data.type & PERFCOUNTER_HISTOGRAM));
+  data.shards.reset(
+    new PerfCounters::perf_counter_data_any_d::shard_t[
+      PerfCounters::perf_counter_data_any_d::num_shards]);
+}
+
 PerfCounters *PerfCountersBuilder::create_perf_counters()
 {
   PerfCounters::perf_counter_data_vec_t::const_iterator d = m_perf_counters->m_data.begin();
@@ -103,6 +103,12 @@ public:
     prio_default = prio_;
   }
 
+  /// Give counter @p key per-thread shards, which are only added up when
+  /// read.  For counters and averages that many threads bump at high
+  /// rates; call after adding the counter, and update it with
+  /// inc_sharded() or tinc_sharded().
+  void set_sharded(int key);
+
   PerfCounters* create_perf_counters();
 private:
   PerfCountersBuilder(const PerfCountersBuilder &rhs);
@@ -157,7 +163,7 @@ public:
         description(other.description),
         nick(other.nick),
 	type(other.type),
-	u64(other.u64.load()) {
+	u64(other.read_u64()) {
       pair<uint64_t,uint64_t> a = other.read_avg();
       u64 = a.first;
       avgcount = a.second;
@@ -177,27 +183,69 @@ public:
     std::atomic<uint64_t> avgcount2 = { 0 };
     std::unique_ptr<PerfHistogram<>> histogram;
 
+    /// one thread's slice of a sharded counter, padded so that no two
+    /// shards share a cache line
+    struct shard_t {
+      std::atomic<uint64_t> u64 = { 0 };
+      std::atomic<uint64_t> avgcount = { 0 };
+      std::atomic<uint64_t> avgcount2 = { 0 };
+      char pad[128 - 3 * sizeof(std::atomic<uint64_t>)];
+    };
+    enum { num_shards = 16 };
+    /// set for sharded counters; readers add them to u64 and avgcount,
+    /// so plain updates of a sharded counter still count
+    std::unique_ptr<shard_t[]> shards;
+
     void reset()
     {
       if (type != PERFCOUNTER_U64) {
 	    u64 = 0;
 	    avgcount = 0;
 	    avgcount2 = 0;
+	    if (shards) {
+	      for (unsigned i = 0; i < num_shards; ++i) {
+		shards[i].u64 = 0;
+		shards[i].avgcount = 0;
+		shards[i].avgcount2 = 0;
+	      }
+	    }
       }
       if (histogram) {
         histogram->reset();
       }
     }
 
+    uint64_t read_u64() const {
+      uint64_t sum = u64;
+      if (shards) {
+	for (unsigned i = 0; i < num_shards; ++i)
+	  sum += shards[i].u64;
+      }
+      return sum;
+    }
+
     // read <sum, count> safely by making sure the post- and pre-count
     // are identical; in other words the whole loop needs to be run
     // without any intervening calls to inc, set, or tinc.
     pair<uint64_t,uint64_t> read_avg() const {
+      pair<uint64_t,uint64_t> r = read_avg(*this);
+      if (shards) {
+	for (unsigned i = 0; i < num_shards; ++i) {
+	  pair<uint64_t,uint64_t> a = read_avg(shards[i]);
+	  r.first += a.first;
+	  r.second += a.second;
+	}
+      }
+      return r;
+    }
+
+    template <typename T>
+    static pair<uint64_t,uint64_t> read_avg(const T& d) {
       uint64_t sum, count;
       do {
-	count = avgcount;
-	sum = u64;
-      } while (avgcount2 != count);
+	count = d.avgcount;
+	sum = d.u64;
+      } while (d.avgcount2 != count);
       return make_pair(sum, count);
     }
   };
@@ -228,6 +276,13 @@ public:
   void tset(int idx, utime_t v);
   void tinc(int idx, utime_t v, uint32_t avgcount = 1);
   void tinc(int idx, ceph::timespan v, uint32_t avgcount = 1);
+
+  /// inc() and tinc() for counters built with set_sharded(): which one
+  /// applies is fixed at the call site, so the others never test for
+  /// shards
+  void inc_sharded(int idx, uint64_t v = 1);
+  void tinc_sharded(int idx, utime_t v);
+  void tinc_sharded(int idx, ceph::timespan v);
   utime_t tget(int idx) const;
 
   void hinc(int idx, int64_t x, int64_t y);
@@ -0,0 +1,94 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_SHARDED_SHARED_MUTEX_H
+#define CEPH_COMMON_SHARDED_SHARED_MUTEX_H
+
+#include <atomic>
+#include <boost/thread/shared_mutex.hpp>
+
+namespace ceph {
+
+/**
+ * Reader-writer lock for read-mostly state used by many threads.
+ *
+ * A shared lock takes one of num_shards shared mutexes, picked per
+ * thread, so readers on different threads do not bounce a common lock
+ * word between cores.  An exclusive lock takes every shard in order.
+ * A shared lock has to be released by the thread that took it.
+ *
+ * Provides what std::unique_lock, boost::shared_lock and
+ * ceph::shunique_lock use.
+ */
+template <unsigned N>
+class basic_sharded_shared_mutex {
+public:
+  enum { num_shards = N };
+
+private:
+  // Padded rather than aligned: these are embedded in objects made by
+  // plain new, which does not honour over-alignment before C++17.  A
+  // full line of padding keeps neighbouring shards off a common line
+  // wherever the array starts.
+  struct shard_t {
+    boost::shared_mutex m;
+    char pad[64];
+  };
+  shard_t shards[num_shards];
+
+  static unsigned my_shard() {
+    static std::atomic<unsigned> next = { 0 };
+    static thread_local unsigned mine = next++ % num_shards;
+    return mine;
+  }
+
+public:
+  basic_sharded_shared_mutex() = default;
+  basic_sharded_shared_mutex(const basic_sharded_shared_mutex&) = delete;
+  basic_sharded_shared_mutex& operator=(
+    const basic_sharded_shared_mutex&) = delete;
+
+  void lock() {
+    for (auto& s : shards)
+      s.m.lock();
+  }
+  bool try_lock() {
+    for (unsigned i = 0; i < num_shards; ++i) {
+      if (!shards[i].m.try_lock()) {
+	while (i-- > 0)
+	  shards[i].m.unlock();
+	return false;
+      }
+    }
+    return true;
+  }
+  void unlock() {
+    for (unsigned i = num_shards; i-- > 0; )
+      shards[i].m.unlock();
+  }
+
+  void lock_shared() {
+    shards[my_shard()].m.lock_shared();
+  }
+  bool try_lock_shared() {
+    return shards[my_shard()].m.try_lock_shared();
+  }
+  void unlock_shared() {
+    shards[my_shard()].m.unlock_shared();
+  }
+};
+
+using sharded_shared_mutex = basic_sharded_shared_mutex<16>;
+
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include "CrushTester.h"
 #include "CrushTreeDumper.h"
 #include "include/ceph_features.h"
+#include "common/ceph_time.h"
 
 #include <algorithm>
 #include <stdlib.h>
@@ -469,6 +470,62 @@ void CrushTester::check_overlapped_rules() const
   }
 }
 
+int CrushTester::bench_batch(const vector<__u32>& weight)
+{
+  vector<int> xs;
+  for (int x = min_x; x <= max_x; x++)
+    xs.push_back(x);
+
+  int ret = 0;
+  for (int r = min_rule; r < crush.get_max_rules() && r <= max_rule; r++) {
+    if (!crush.rule_exists(r))
+      continue;
+    if (ruleset >= 0 &&
+	crush.get_rule_mask_ruleset(r) != ruleset)
+      continue;
+    int minr = min_rep, maxr = max_rep;
+    if (min_rep < 0 || max_rep < 0) {
+      minr = crush.get_rule_mask_min_size(r);
+      maxr = crush.get_rule_mask_max_size(r);
+    }
+    for (int nr = minr; nr <= maxr; nr++) {
+      if (nr <= 0)
+	continue;
+      vector<int> out;
+      vector<vector<int>> scalar(xs.size());
+      auto start = ceph::mono_clock::now();
+      for (unsigned i = 0; i < xs.size(); i++)
+	crush.do_rule(r, xs[i], scalar[i], nr, weight, pool_id);
+      auto mid = ceph::mono_clock::now();
+      vector<int> batch, batch_len;
+      crush.do_rule_batch(r, xs, nr, weight, pool_id, &batch, &batch_len);
+      auto end = ceph::mono_clock::now();
+
+      unsigned mismatches = 0;
+      for (unsigned i = 0; i < xs.size(); i++) {
+	auto p = batch.begin() + i * nr;
+	if (scalar[i] != vector<int>(p, p + batch_len[i]))
+	  mismatches++;
+      }
+      auto scalar_us = std::chrono::duration_cast<std::chrono::microseconds>(
+	mid - start).count();
+      auto batch_us = std::chrono::duration_cast<std::chrono::microseconds>(
+	end - mid).count();
+      err << "rule " << r << " (" << crush.get_rule_name(r)
+	  << ") num_rep " << nr
+	  << " x " << min_x << ".." << max_x
+	  << ": per-input " << scalar_us << " us"
+	  << ", batch " << batch_us << " us";
+      if (batch_us)
+	err << " (" << (double)scalar_us / batch_us << "x)";
+      err << ", " << mismatches << " mismatches" << std::endl;
+      if (mismatches)
+	ret = -EINVAL;
+    }
+  }
+  return ret;
+}
+
 int CrushTester::test()
 {
   if (min_rule < 0 || max_rule < 0) {
@@ -503,6 +560,8 @@ int CrushTester::test()
   // make adjustments
   adjust_weights(weight);
 
+  if (batch_bench)
+    return bench_batch(weight);
 
   int num_devices_active = 0;
   for (vector<__u32>::iterator p = weight.begin(); p != weight.end(); ++p)
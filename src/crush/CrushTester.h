@@ -31,6 +31,7 @@ class CrushTester {
   bool output_mappings;
   bool output_bad_mappings;
   bool output_choose_tries;
+  bool batch_bench;
 
   bool output_data_file;
   bool output_csv;
@@ -75,6 +76,13 @@ class CrushTester {
    */
   int random_placement(int ruleno, vector<int>& out, int maxout, vector<__u32>& weight);
 
+  /*
+   * Time CrushWrapper::do_rule_batch against one do_rule call per input over
+   * the selected rules, replica counts and inputs, and check that both give
+   * the same mappings.
+   */
+  int bench_batch(const vector<__u32>& weight);
+
   // scaffolding to store data for off-line processing
    struct tester_data_set {
      vector <string> device_utilization;
@@ -183,6 +191,7 @@ public:
       output_mappings(false),
       output_bad_mappings(false),
       output_choose_tries(false),
+      batch_bench(false),
       output_data_file(false),
       output_csv(false),
       output_data_file_name("")
@@ -252,6 +261,13 @@ public:
     return output_choose_tries;
   }
 
+  void set_batch_bench(bool b) {
+    batch_bench = b;
+  }
+  bool get_batch_bench() const {
+    return batch_bench;
+  }
+
   void set_batches(int b) {
     num_batches = b;
   }
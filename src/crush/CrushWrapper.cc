@@ -7,6 +7,7 @@
 #include "common/errno.h"
 #include "common/TextTable.h"
 #include "include/stringify.h"
+#include "include/crc32c.h"
 
 #include "CrushWrapper.h"
 #include "CrushTreeDumper.h"
@@ -1674,6 +1675,80 @@ int CrushWrapper::get_rule_weight_osd_map(unsigned ruleno,
   return 0;
 }
 
+uint32_t CrushWrapper::get_rule_digest(int ruleno, int64_t choose_args_index,
+				       set<int> *leaves) const
+{
+  if (ruleno < 0 || ruleno >= (int)crush->max_rules ||
+      crush->rules[ruleno] == NULL)
+    return 0;
+  const crush_rule *rule = crush->rules[ruleno];
+
+  auto crc = [](uint32_t c, const void *p, size_t len) {
+    return ceph_crc32c(c, (const unsigned char *)p, len);
+  };
+  uint32_t c = -1;
+  int32_t tunables[] = {
+    (int32_t)crush->max_devices,
+    (int32_t)crush->choose_local_tries,
+    (int32_t)crush->choose_local_fallback_tries,
+    (int32_t)crush->choose_total_tries,
+    (int32_t)crush->chooseleaf_descend_once,
+    (int32_t)crush->chooseleaf_vary_r,
+    (int32_t)crush->chooseleaf_stable,
+    ruleno
+  };
+  c = crc(c, tunables, sizeof(tunables));
+  c = crc(c, &rule->mask, sizeof(rule->mask));
+  c = crc(c, rule->steps, rule->len * sizeof(rule->steps[0]));
+
+  crush_choose_arg_map arg_map = choose_args_get_with_fallback(
+    choose_args_index);
+  set<int> seen;
+  list<int> q;
+  for (unsigned i = 0; i < rule->len; ++i) {
+    if (rule->steps[i].op == CRUSH_RULE_TAKE)
+      q.push_back(rule->steps[i].arg1);
+  }
+  while (!q.empty()) {
+    int id = q.front();
+    q.pop_front();
+    if (!seen.insert(id).second)
+      continue;
+    if (id >= 0) {
+      if (leaves)
+	leaves->insert(id);
+      continue;
+    }
+    const crush_bucket *b = get_bucket(id);
+    if (IS_ERR(b))
+      continue;
+    int32_t h[] = { b->id, b->type, b->alg, b->hash, (int32_t)b->size };
+    c = crc(c, h, sizeof(h));
+    c = crc(c, b->items, b->size * sizeof(b->items[0]));
+    for (unsigned j = 0; j < b->size; ++j) {
+      uint32_t w = crush_get_bucket_item_weight(b, j);
+      c = crc(c, &w, sizeof(w));
+      q.push_back(b->items[j]);
+    }
+    if (b->alg == CRUSH_BUCKET_STRAW) {
+      // straws depend on straw_calc_version at the time they were built
+      const crush_bucket_straw *sb = (const crush_bucket_straw *)b;
+      c = crc(c, sb->straws, b->size * sizeof(sb->straws[0]));
+    }
+    unsigned bidx = -1 - id;
+    if (bidx < arg_map.size) {
+      const crush_choose_arg& arg = arg_map.args[bidx];
+      if (arg.ids)
+	c = crc(c, arg.ids, arg.ids_size * sizeof(arg.ids[0]));
+      for (unsigned p = 0; p < arg.weight_set_size; ++p) {
+	c = crc(c, arg.weight_set[p].weights,
+		arg.weight_set[p].size * sizeof(arg.weight_set[p].weights[0]));
+      }
+    }
+  }
+  return c;
+}
+
 int CrushWrapper::remove_rule(int ruleno)
 {
   if (ruleno >= (int)crush->max_rules)
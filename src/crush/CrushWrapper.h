@@ -1054,6 +1054,21 @@ public:
    */
   int get_rule_weight_osd_map(unsigned ruleno, map<int,float> *pmap) const;
 
+  /**
+   * fingerprint everything a mapping through a rule depends on
+   *
+   * Covers the tunables, the rule, and every bucket the rule can reach
+   * together with its choose_args.  Two maps give the same mappings
+   * for the rule (for the same device weights) if the digests match.
+   *
+   * @param ruleno [in] rule id
+   * @param choose_args_index [in] choose_args used with the rule
+   * @param leaves [out] devices the rule can reach, if not NULL
+   * @return the digest, 0 if the rule does not exist
+   */
+  uint32_t get_rule_digest(int ruleno, int64_t choose_args_index,
+			   set<int> *leaves) const;
+
   /**
    * calculate a map of osds to weights for a given starting root
    *
@@ -1487,6 +1502,32 @@ public:
       out[i] = rawout[i];
   }
 
+  /**
+   * map every input in xs with one rule, as repeated do_rule() calls would
+   *
+   * The items for xs[i] end up in (*out)[i * maxout, i * maxout + (*out_len)[i]).
+   *
+   * @return 0 on success, -EINVAL if the rule does not exist
+   */
+  template<typename WeightVector>
+  int do_rule_batch(int rule, const vector<int>& xs, int maxout,
+		    const WeightVector& weight,
+		    uint64_t choose_args_index,
+		    vector<int> *out, vector<int> *out_len) const {
+    out->resize(xs.size() * maxout);
+    out_len->resize(xs.size());
+    if (xs.empty())
+      return 0;
+    vector<char> work(crush_work_size(crush, maxout));
+    crush_init_workspace(crush, work.data());
+    crush_choose_arg_map arg_map = choose_args_get_with_fallback(
+      choose_args_index);
+    return crush_do_rule_batch(crush, rule, xs.data(), xs.size(),
+			       out->data(), maxout, out_len->data(),
+			       &weight[0], weight.size(), work.data(),
+			       arg_map.args);
+  }
+
   int _choose_type_stack(
     CephContext *cct,
     const vector<pair<int,int>>& stack,
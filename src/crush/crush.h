@@ -540,6 +540,14 @@ struct crush_work_bucket {
 	__u32 perm_x; /* @x for which *perm is defined */
 	__u32 perm_n; /* num elements of *perm that are permuted/defined */
 	__u32 *perm;  /* Permutation of the bucket's items */
+	/*
+	 * straw2: reciprocals of the item weights for each choose_args
+	 * position, set up by crush_do_rule_batch() and NULL otherwise.
+	 * entry [pos * size + i] gives ln / weight as (ln * mult) >> shift.
+	 */
+	const __u64 *recip_mult;
+	const __u8 *recip_shift;
+	__u32 recip_positions;
 };
 
 struct crush_work {
@@ -2,6 +2,10 @@
 # include <linux/crush/hash.h>
 #else
 # include "hash.h"
+# if defined(__SSE2__)
+#  include <emmintrin.h>
+#  define CRUSH_HASH_SSE2
+# endif
 #endif
 
 /*
@@ -140,6 +144,80 @@ __u32 crush_hash32_5(int type, __u32 a, __u32 b, __u32 c, __u32 d, __u32 e)
 	}
 }
 
+#ifdef CRUSH_HASH_SSE2
+/* crush_hashmix() on four lanes at once */
+#define crush_hashmix_x4(a, b, c) do {					\
+		a = _mm_sub_epi32(_mm_sub_epi32(a, b), c);		\
+		a = _mm_xor_si128(a, _mm_srli_epi32(c, 13));		\
+		b = _mm_sub_epi32(_mm_sub_epi32(b, c), a);		\
+		b = _mm_xor_si128(b, _mm_slli_epi32(a, 8));		\
+		c = _mm_sub_epi32(_mm_sub_epi32(c, a), b);		\
+		c = _mm_xor_si128(c, _mm_srli_epi32(b, 13));		\
+		a = _mm_sub_epi32(_mm_sub_epi32(a, b), c);		\
+		a = _mm_xor_si128(a, _mm_srli_epi32(c, 12));		\
+		b = _mm_sub_epi32(_mm_sub_epi32(b, c), a);		\
+		b = _mm_xor_si128(b, _mm_slli_epi32(a, 16));		\
+		c = _mm_sub_epi32(_mm_sub_epi32(c, a), b);		\
+		c = _mm_xor_si128(c, _mm_srli_epi32(b, 5));		\
+		a = _mm_sub_epi32(_mm_sub_epi32(a, b), c);		\
+		a = _mm_xor_si128(a, _mm_srli_epi32(c, 3));		\
+		b = _mm_sub_epi32(_mm_sub_epi32(b, c), a);		\
+		b = _mm_xor_si128(b, _mm_slli_epi32(a, 10));		\
+		c = _mm_sub_epi32(_mm_sub_epi32(c, a), b);		\
+		c = _mm_xor_si128(c, _mm_srli_epi32(b, 15));		\
+	} while (0)
+
+static void crush_hash32_rjenkins1_3_multi(__u32 a, const __s32 *b, __u32 c,
+					   __u32 *out, unsigned int n)
+{
+	unsigned int i;
+	const __m128i va = _mm_set1_epi32(a);
+	const __m128i vc = _mm_set1_epi32(c);
+	const __m128i vseed = _mm_set1_epi32(crush_hash_seed ^ a ^ c);
+	const __m128i vx = _mm_set1_epi32(231232);
+	const __m128i vy = _mm_set1_epi32(1232);
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i a1 = va, c1 = vc, x = vx, y = vy;
+		__m128i b1 = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i hash = _mm_xor_si128(vseed, b1);
+		crush_hashmix_x4(a1, b1, hash);
+		crush_hashmix_x4(c1, x, hash);
+		crush_hashmix_x4(y, a1, hash);
+		crush_hashmix_x4(b1, x, hash);
+		crush_hashmix_x4(y, c1, hash);
+		_mm_storeu_si128((__m128i *)(out + i), hash);
+	}
+	for (; i < n; i++)
+		out[i] = crush_hash32_rjenkins1_3(a, b[i], c);
+}
+#else
+static void crush_hash32_rjenkins1_3_multi(__u32 a, const __s32 *b, __u32 c,
+					   __u32 *out, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		out[i] = crush_hash32_rjenkins1_3(a, b[i], c);
+}
+#endif
+
+void crush_hash32_3_multi(int type, __u32 a, const __s32 *b, __u32 c,
+			  __u32 *out, unsigned int n)
+{
+	unsigned int i;
+
+	switch (type) {
+	case CRUSH_HASH_RJENKINS1:
+		crush_hash32_rjenkins1_3_multi(a, b, c, out, n);
+		break;
+	default:
+		for (i = 0; i < n; i++)
+			out[i] = 0;
+		break;
+	}
+}
+
 const char *crush_hash_name(int type)
 {
 	switch (type) {
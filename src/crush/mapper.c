@@ -18,6 +18,7 @@
 # include <linux/crush/crush.h>
 # include <linux/crush/hash.h>
 #else
+# include <errno.h>
 # include "crush_compat.h"
 # include "crush.h"
 # include "hash.h"
@@ -319,19 +320,53 @@ static inline __s32 *get_choose_arg_ids(const struct crush_bucket_straw2 *bucket
   return arg->ids;
 }
 
+#if defined(__SIZEOF_INT128__) && !defined(__KERNEL__)
+# define CRUSH_STRAW2_RECIP
+#endif
+
+/*
+ * |ln| is at most 2^48, so it fits in CRUSH_LN_BITS bits.  with
+ * l = ceil(log2(w)) and m = ceil(2^(CRUSH_LN_BITS + l) / w),
+ * (|ln| * m) >> (CRUSH_LN_BITS + l) == |ln| / w for every |ln| that
+ * fits, which lets straw2 trade the division for a multiply.
+ */
+#define CRUSH_LN_BITS 49
+
+#define CRUSH_STRAW2_CHUNK 64
+
 static int bucket_straw2_choose(const struct crush_bucket_straw2 *bucket,
+				struct crush_work_bucket *work,
 				int x, int r, const struct crush_choose_arg *arg,
                                 int position)
 {
-	unsigned int i, high = 0;
+	unsigned int i, n, high = 0;
 	unsigned int u;
 	__s64 ln, draw, high_draw = 0;
+	__u32 hashes[CRUSH_STRAW2_CHUNK];
         __u32 *weights = get_choose_arg_weights(bucket, arg, position);
         __s32 *ids = get_choose_arg_ids(bucket, arg);
+	const __u64 *recip_mult = NULL;
+	const __u8 *recip_shift = NULL;
+
+	if (work && work->recip_mult) {
+		__u32 p = position;
+		if (p >= work->recip_positions)
+			p = work->recip_positions - 1;
+		recip_mult = work->recip_mult + p * bucket->h.size;
+		recip_shift = work->recip_shift + p * bucket->h.size;
+	}
+
 	for (i = 0; i < bucket->h.size; i++) {
+		if (i % CRUSH_STRAW2_CHUNK == 0) {
+			n = bucket->h.size - i;
+			if (n > CRUSH_STRAW2_CHUNK)
+				n = CRUSH_STRAW2_CHUNK;
+			crush_hash32_3_multi(bucket->h.hash, x, ids + i, r,
+					     hashes, n);
+		}
                 dprintk("weight 0x%x item %d\n", weights[i], ids[i]);
 		if (weights[i]) {
-			u = crush_hash32_3(bucket->h.hash, x, ids[i], r);
+			u = hashes[i % CRUSH_STRAW2_CHUNK];
 			u &= 0xffff;
 
 			/*
@@ -352,6 +387,13 @@ static int bucket_straw2_choose(const struct crush_bucket_straw2 *bucket,
 			 * weight means a larger (less negative) value
 			 * for draw.
 			 */
+#ifdef CRUSH_STRAW2_RECIP
+			if (recip_mult)
+				draw = -(__s64)(((unsigned __int128)(__u64)-ln *
+						 recip_mult[i]) >>
+						recip_shift[i]);
+			else
+#endif
 			draw = div64_s64(ln, weights[i]);
 		} else {
 			draw = S64_MIN;
@@ -393,7 +435,7 @@ static int crush_bucket_choose(const struct crush_bucket *in,
 	case CRUSH_BUCKET_STRAW2:
 		return bucket_straw2_choose(
 			(const struct crush_bucket_straw2 *)in,
-			x, r, arg, position);
+			work, x, r, arg, position);
 	default:
 		dprintk("unknown bucket %d alg %d\n", in->id, in->alg);
 		return in->items[0];
@@ -863,6 +905,9 @@ void crush_init_workspace(const struct crush_map *m, void *v) {
 		}
 		w->work[b]->perm_x = 0;
 		w->work[b]->perm_n = 0;
+		w->work[b]->recip_mult = NULL;
+		w->work[b]->recip_shift = NULL;
+		w->work[b]->recip_positions = 0;
 		w->work[b]->perm = (__u32 *)point;
 		point += m->buckets[b]->size * sizeof(__u32);
 	}
@@ -1086,3 +1131,144 @@ int crush_do_rule(const struct crush_map *map,
 
 	return result_len;
 }
+
+#ifndef __KERNEL__
+#ifdef CRUSH_STRAW2_RECIP
+static void crush_straw2_recip(__u32 w, __u64 *mult, __u8 *shift)
+{
+	unsigned int l = 0;
+
+	if (w == 0) {
+		/* never used: a zero weight draws S64_MIN */
+		*mult = 0;
+		*shift = 0;
+		return;
+	}
+	while (l < 32 && ((__u64)1 << l) < w)
+		l++;
+	*shift = CRUSH_LN_BITS + l;
+	*mult = (__u64)((((unsigned __int128)1 << *shift) + w - 1) / w);
+}
+
+/*
+ * fill in the straw2 reciprocal tables for every bucket; the tables
+ * are carved out of one allocation that is returned to the caller.
+ */
+static void *crush_setup_recip(const struct crush_map *map,
+			       struct crush_work *cw,
+			       const struct crush_choose_arg *choose_args)
+{
+	size_t entries = 0;
+	__u64 *mult;
+	__u8 *shift;
+	void *mem;
+	__s32 b;
+
+	for (b = 0; b < map->max_buckets; b++) {
+		const struct crush_bucket *bucket = map->buckets[b];
+		__u32 npos = 1;
+
+		if (!bucket || bucket->alg != CRUSH_BUCKET_STRAW2)
+			continue;
+		if (choose_args && choose_args[b].weight_set &&
+		    choose_args[b].weight_set_size > 0)
+			npos = choose_args[b].weight_set_size;
+		entries += (size_t)npos * bucket->size;
+	}
+	if (entries == 0)
+		return NULL;
+	mem = malloc(entries * (sizeof(__u64) + sizeof(__u8)));
+	if (!mem)
+		return NULL;
+	mult = (__u64 *)mem;
+	shift = (__u8 *)(mult + entries);
+
+	for (b = 0; b < map->max_buckets; b++) {
+		const struct crush_bucket_straw2 *bucket =
+			(const struct crush_bucket_straw2 *)map->buckets[b];
+		const struct crush_choose_arg *arg =
+			choose_args ? &choose_args[b] : NULL;
+		struct crush_work_bucket *work = cw->work[b];
+		__u32 npos = 1, p, i;
+
+		if (!bucket || bucket->h.alg != CRUSH_BUCKET_STRAW2)
+			continue;
+		if (arg && arg->weight_set && arg->weight_set_size > 0)
+			npos = arg->weight_set_size;
+		work->recip_mult = mult;
+		work->recip_shift = shift;
+		work->recip_positions = npos;
+		for (p = 0; p < npos; p++) {
+			const __u32 *weights =
+				get_choose_arg_weights(bucket, arg, p);
+			for (i = 0; i < bucket->h.size; i++)
+				crush_straw2_recip(weights[i], mult++, shift++);
+		}
+	}
+	return mem;
+}
+
+static void crush_clear_recip(const struct crush_map *map,
+			      struct crush_work *cw, void *mem)
+{
+	__s32 b;
+
+	if (!mem)
+		return;
+	for (b = 0; b < map->max_buckets; b++) {
+		if (!map->buckets[b])
+			continue;
+		cw->work[b]->recip_mult = NULL;
+		cw->work[b]->recip_shift = NULL;
+		cw->work[b]->recip_positions = 0;
+	}
+	free(mem);
+}
+#endif
+
+/**
+ * crush_do_rule_batch - map many inputs with the same rule
+ * @map: the crush_map
+ * @ruleno: the rule id
+ * @x: @count hash inputs
+ * @count: number of inputs
+ * @result: @count * @result_max result slots; x[i] maps to
+ *          result[i * result_max, i * result_max + result_len[i])
+ * @result_max: maximum result size per input
+ * @result_len: @count result sizes
+ * @weight: weight vector (for map leaves)
+ * @weight_max: size of weight vector
+ * @cwin: Pointer to at least crush_work_size() bytes of memory,
+ *        initialized by crush_init_workspace().
+ * @choose_args: weights and ids for each known bucket, or NULL
+ */
+int crush_do_rule_batch(const struct crush_map *map,
+			int ruleno, const int *x, int count,
+			int *result, int result_max, int *result_len,
+			const __u32 *weight, int weight_max,
+			void *cwin, const struct crush_choose_arg *choose_args)
+{
+	int i;
+#ifdef CRUSH_STRAW2_RECIP
+	struct crush_work *cw = cwin;
+	void *recip;
+#endif
+
+	if ((__u32)ruleno >= map->max_rules || !map->rules[ruleno])
+		return -EINVAL;
+
+#ifdef CRUSH_STRAW2_RECIP
+	/* without the tables we still map, just with a division per item */
+	recip = crush_setup_recip(map, cw, choose_args);
+#endif
+	for (i = 0; i < count; i++)
+		result_len[i] = crush_do_rule(map, ruleno, x[i],
+					      result + i * result_max,
+					      result_max, weight, weight_max,
+					      cwin, choose_args);
+#ifdef CRUSH_STRAW2_RECIP
+	crush_clear_recip(map, cw, recip);
+#endif
+	return 0;
+}
+#endif
@@ -78,6 +78,28 @@ extern int crush_do_rule(const struct crush_map *map,
 			 const __u32 *weights, int weight_max,
 			 void *cwin, const struct crush_choose_arg *choose_args);
 
+#ifndef __KERNEL__
+/** @ingroup API
+ *
+ * Map each of the __count__ inputs in __x__ with rule __ruleno__, as
+ * crush_do_rule() would, and store the items for __x[i]__ in
+ * __result[i * result_max]__ and their number in __result_len[i]__.
+ *
+ * Before mapping, the item weights of every straw2 bucket (for each
+ * choose_args position) are turned into fixed-point reciprocals, so
+ * the per-item division of the straw2 draw becomes a multiply.  The
+ * results are identical to those of crush_do_rule().
+ *
+ * @return 0 on success, -EINVAL if __ruleno__ does not exist
+ */
+extern int crush_do_rule_batch(const struct crush_map *map,
+			       int ruleno, const int *x, int count,
+			       int *result, int result_max, int *result_len,
+			       const __u32 *weights, int weight_max,
+			       void *cwin,
+			       const struct crush_choose_arg *choose_args);
+#endif
+
 /* Returns the exact amount of workspace that will need to be used
    for a given combination of crush_map and result_max. The caller can
    then allocate this much on its own, either on the stack, in a
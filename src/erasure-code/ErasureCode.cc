@@ -222,6 +222,108 @@ int ErasureCode::decode_chunks(const set<int> &want_to_read,
   assert("ErasureCode::decode_chunks not implemented" == 0);
 }
 
+int ErasureCode::encode_stripes(const set<int> &want_to_encode,
+                                unsigned int chunk_size,
+                                map<int, bufferlist> *chunks)
+{
+  unsigned int k = get_data_chunk_count();
+  unsigned int m = get_chunk_count() - k;
+  if (chunk_size == 0 || chunks->size() < k)
+    return -EINVAL;
+  unsigned length = chunks->find(chunk_index(0))->second.length();
+  if (length == 0 || length % chunk_size)
+    return -EINVAL;
+  for (unsigned int i = 0; i < k; i++) {
+    map<int, bufferlist>::iterator chunk = chunks->find(chunk_index(i));
+    if (chunk == chunks->end() || chunk->second.length() != length)
+      return -EINVAL;
+  }
+
+  if (!chunks_span_stripes()) {
+    // one stripe at a time, appended to the per chunk layout
+    map<int, bufferlist> out;
+    for (unsigned off = 0; off < length; off += chunk_size) {
+      bufferlist stripe;
+      for (unsigned int i = 0; i < k; i++) {
+	bufferlist chunk;
+	chunk.substr_of(chunks->find(chunk_index(i))->second, off, chunk_size);
+	stripe.claim_append(chunk);
+      }
+      map<int, bufferlist> encoded;
+      int r = encode(want_to_encode, stripe, &encoded);
+      if (r)
+	return r;
+      for (map<int, bufferlist>::iterator i = encoded.begin();
+	   i != encoded.end();
+	   ++i)
+	out[i->first].claim_append(i->second);
+    }
+    chunks->swap(out);
+    return 0;
+  }
+
+  // the whole length of every chunk is coded in a single pass
+  for (unsigned int i = 0; i < k; i++) {
+    bufferlist &chunk = (*chunks)[chunk_index(i)];
+    chunk.rebuild_aligned_size_and_memory(length, SIMD_ALIGN);
+    assert(chunk.is_contiguous());
+  }
+  for (unsigned int i = k; i < k + m; i++) {
+    bufferlist &chunk = (*chunks)[chunk_index(i)];
+    chunk.clear();
+    chunk.push_back(buffer::create_aligned(length, SIMD_ALIGN));
+  }
+  int r = encode_chunks(want_to_encode, chunks);
+  if (r)
+    return r;
+  for (unsigned int i = 0; i < k + m; i++) {
+    if (want_to_encode.count(i) == 0)
+      chunks->erase(i);
+  }
+  return 0;
+}
+
+int ErasureCode::decode_stripes(const set<int> &want_to_read,
+                                unsigned int chunk_size,
+                                const map<int, bufferlist> &chunks,
+                                map<int, bufferlist> *decoded)
+{
+  if (chunk_size == 0 || chunks.empty())
+    return -EINVAL;
+  unsigned length = chunks.begin()->second.length();
+  if (length == 0 || length % chunk_size)
+    return -EINVAL;
+  for (map<int, bufferlist>::const_iterator i = chunks.begin();
+       i != chunks.end();
+       ++i) {
+    if (i->second.length() != length)
+      return -EINVAL;
+  }
+
+  if (!chunks_span_stripes()) {
+    for (unsigned off = 0; off < length; off += chunk_size) {
+      map<int, bufferlist> stripe;
+      for (map<int, bufferlist>::const_iterator i = chunks.begin();
+	   i != chunks.end();
+	   ++i)
+	stripe[i->first].substr_of(i->second, off, chunk_size);
+      map<int, bufferlist> out;
+      int r = decode(want_to_read, stripe, &out);
+      if (r)
+	return r;
+      for (set<int>::const_iterator i = want_to_read.begin();
+	   i != want_to_read.end();
+	   ++i)
+	(*decoded)[*i].claim_append(out[*i]);
+    }
+    return 0;
+  }
+
+  // decode() only looks at the chunk length, which here spans all
+  // the stripes: every missing chunk is allocated once
+  return decode(want_to_read, chunks, decoded);
+}
+
 int ErasureCode::parse(const ErasureCodeProfile &profile,
 		       ostream *ss)
 {
@@ -82,6 +82,15 @@ namespace ceph {
                               const std::map<int, bufferlist> &chunks,
                               std::map<int, bufferlist> *decoded) override;
 
+    int encode_stripes(const std::set<int> &want_to_encode,
+                       unsigned int chunk_size,
+                       std::map<int, bufferlist> *chunks) override;
+
+    int decode_stripes(const std::set<int> &want_to_read,
+                       unsigned int chunk_size,
+                       const std::map<int, bufferlist> &chunks,
+                       std::map<int, bufferlist> *decoded) override;
+
     const std::vector<int> &get_chunk_mapping() const override;
 
     int to_mapping(const ErasureCodeProfile &profile,
@@ -112,6 +121,17 @@ namespace ceph {
     int parse(const ErasureCodeProfile &profile,
 	      std::ostream *ss);
 
+    /**
+     * True if encode_chunks and decode_chunks give the same result on
+     * chunks holding many stripes back to back as on each stripe
+     * alone, so encode_stripes and decode_stripes can run them once
+     * over all the stripes. Otherwise the stripes are coded one at a
+     * time with encode and decode.
+     */
+    virtual bool chunks_span_stripes() const {
+      return false;
+    }
+
   private:
     int chunk_index(unsigned int i) const;
   };
@@ -399,6 +399,51 @@ namespace ceph {
                               const std::map<int, bufferlist> &chunks,
                               std::map<int, bufferlist> *decoded) = 0;
 
+    /**
+     * Encode many stripes with a single call.
+     *
+     * Each data chunk in **chunks** holds that chunk of every stripe
+     * back to back: the chunk of stripe N starts at N * **chunk_size**.
+     * All data chunks must be present and have the same length, a
+     * multiple of **chunk_size**. The coding chunks are added to
+     * **chunks** with the same layout and, as with **encode**, the
+     * chunks not listed in **want_to_encode** are removed. The data
+     * chunks may be replaced by aligned copies.
+     *
+     * **chunk_size** must be the size of the chunks **encode** would
+     * produce for one stripe.
+     *
+     * Returns 0 on success.
+     *
+     * @param [in] want_to_encode chunk indexes to be encoded
+     * @param [in] chunk_size size of the chunk of one stripe
+     * @param [in,out] chunks map chunk indexes to chunk data
+     * @return **0** on success or a negative errno on error.
+     */
+    virtual int encode_stripes(const std::set<int> &want_to_encode,
+                               unsigned int chunk_size,
+                               std::map<int, bufferlist> *chunks) = 0;
+
+    /**
+     * Decode many stripes with a single call.
+     *
+     * **chunks** and **decoded** use the layout of **encode_stripes**:
+     * each chunk holds that chunk of every stripe back to back. The
+     * requirements and guarantees are otherwise those of **decode**.
+     *
+     * Returns 0 on success.
+     *
+     * @param [in] want_to_read chunk indexes to be decoded
+     * @param [in] chunk_size size of the chunk of one stripe
+     * @param [in] chunks map chunk indexes to chunk data
+     * @param [out] decoded map chunk indexes to chunk data
+     * @return **0** on success or a negative errno on error.
+     */
+    virtual int decode_stripes(const std::set<int> &want_to_read,
+                               unsigned int chunk_size,
+                               const std::map<int, bufferlist> &chunks,
+                               std::map<int, bufferlist> *decoded) = 0;
+
     /**
      * Return the ordered list of chunks or an empty vector
      * if no remapping is necessary.
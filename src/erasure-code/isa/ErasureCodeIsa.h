@@ -96,6 +96,12 @@ public:
 
   virtual void prepare() = 0;
 
+ protected:
+  // the region kernels code back to back stripes as one larger region
+  bool chunks_span_stripes() const override {
+    return true;
+  }
+
  private:
   virtual int parse(ErasureCodeProfile &profile,
                     std::ostream *ss) = 0;
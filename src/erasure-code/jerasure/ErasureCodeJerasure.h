@@ -77,6 +77,11 @@ public:
   static bool is_prime(int value);
 protected:
   virtual int parse(ErasureCodeProfile &profile, std::ostream *ss);
+  // chunk sizes are multiples of w * packetsize, so the region
+  // kernels code back to back stripes as one larger region
+  bool chunks_span_stripes() const override {
+    return true;
+  }
 };
 
 class ErasureCodeJerasureReedSolomonVandermonde : public ErasureCodeJerasure {
@@ -60,6 +60,12 @@ class Context {
   Context(const Context& other);
   const Context& operator=(const Context& other);
 
+  // while queued on a Finisher, so queueing does not allocate
+  friend class Finisher;
+  Context *queue_next = nullptr;
+  int queue_r = 0;
+  bool queued = false;  ///< the oldest queued context has no queue_next
+
  protected:
   virtual void finish(int r) = 0;
 
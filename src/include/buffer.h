@@ -44,6 +44,7 @@
 #include <vector>
 #include <string>
 #include <exception>
+#include <new>
 #include <type_traits>
 
 #include "page.h"
@@ -349,8 +350,154 @@ namespace buffer CEPH_BUFFER_API {
    */
 
   class CEPH_BUFFER_API list {
+  public:
+    /*
+     * the segments of a list.
+     *
+     * a vector whose first INLINE_SEGMENTS entries live inside the list
+     * itself: most lists have only a few segments, and those need no
+     * allocation besides their raw buffers.  iterators are positions,
+     * so they survive push_back, but insert, erase and push_front shift
+     * everything after the point they modify.
+     */
+    class CEPH_BUFFER_API buffers_t {
+    public:
+      static const unsigned INLINE_SEGMENTS = 4;
+
+      template <bool is_const>
+      class iterator_impl
+	: public std::iterator<std::bidirectional_iterator_tag,
+			       typename std::conditional<is_const,
+							 const ptr,
+							 ptr>::type> {
+	typedef typename std::conditional<is_const,
+					  const buffers_t,
+					  buffers_t>::type bt_t;
+	typedef typename std::conditional<is_const,
+					  const ptr,
+					  ptr>::type ptr_t;
+	bt_t *bt;
+	size_t i;
+	friend class buffers_t;
+	friend class iterator_impl<true>;
+
+      public:
+	iterator_impl() : bt(nullptr), i(0) {}
+	iterator_impl(bt_t *bt, size_t i) : bt(bt), i(i) {}
+	iterator_impl(const iterator_impl<false>& other)
+	  : bt(other.bt), i(other.i) {}
+
+	ptr_t& operator*() const { return bt->_data[i]; }
+	ptr_t* operator->() const { return bt->_data + i; }
+
+	iterator_impl& operator++() { ++i; return *this; }
+	iterator_impl operator++(int) { iterator_impl t = *this; ++i; return t; }
+	iterator_impl& operator--() { --i; return *this; }
+	iterator_impl operator--(int) { iterator_impl t = *this; --i; return t; }
+
+	friend bool operator==(const iterator_impl& lhs,
+			       const iterator_impl& rhs) {
+	  return lhs.i == rhs.i;
+	}
+	friend bool operator!=(const iterator_impl& lhs,
+			       const iterator_impl& rhs) {
+	  return lhs.i != rhs.i;
+	}
+      };
+      typedef iterator_impl<false> iterator;
+      typedef iterator_impl<true> const_iterator;
+
+    private:
+      ptr *_data;
+      unsigned _size;
+      unsigned _cap;
+      typename std::aligned_storage<sizeof(ptr), alignof(ptr)>::type
+        _inline[INLINE_SEGMENTS];
+
+      ptr *_inline_data() {
+	return reinterpret_cast<ptr*>(_inline);
+      }
+      void _grow(size_t want);
+      void _steal(buffers_t& other);
+
+    public:
+      buffers_t() : _data(_inline_data()), _size(0), _cap(INLINE_SEGMENTS) {}
+      buffers_t(const buffers_t& other);
+      buffers_t(buffers_t&& other) noexcept;
+      ~buffers_t() {
+	clear();
+	if (_data != _inline_data())
+	  ::operator delete(_data);
+      }
+      buffers_t& operator=(const buffers_t& other);
+      buffers_t& operator=(buffers_t&& other) noexcept;
+
+      size_t size() const { return _size; }
+      bool empty() const { return _size == 0; }
+
+      ptr& front() { return _data[0]; }
+      const ptr& front() const { return _data[0]; }
+      ptr& back() { return _data[_size - 1]; }
+      const ptr& back() const { return _data[_size - 1]; }
+
+      iterator begin() { return iterator(this, 0); }
+      iterator end() { return iterator(this, _size); }
+      const_iterator begin() const { return const_iterator(this, 0); }
+      const_iterator end() const { return const_iterator(this, _size); }
+
+      void reserve(size_t n) {
+	if (n > _cap)
+	  _grow(n);
+      }
+
+      template <typename... Args>
+      void emplace_back(Args&&... args) {
+	if (_size == _cap) {
+	  // args may refer to one of our own segments
+	  ptr tmp(std::forward<Args>(args)...);
+	  _grow(_size + 1);
+	  new (_data + _size) ptr(std::move(tmp));
+	} else {
+	  new (_data + _size) ptr(std::forward<Args>(args)...);
+	}
+	++_size;
+      }
+      void push_back(const ptr& bp) {
+	emplace_back(bp);
+      }
+      void push_back(ptr&& bp) {
+	emplace_back(std::move(bp));
+      }
+
+      /// insert before pos, return an iterator to the new segment
+      iterator insert(iterator pos, ptr bp);
+      template <typename... Args>
+      void emplace_front(Args&&... args) {
+	insert(begin(), ptr(std::forward<Args>(args)...));
+      }
+      void push_front(const ptr& bp) {
+	insert(begin(), bp);
+      }
+      void push_front(ptr&& bp) {
+	insert(begin(), std::move(bp));
+      }
+
+      /// return an iterator to the segment that followed pos
+      iterator erase(iterator pos);
+      /// move all of other's segments in before pos
+      void splice(iterator pos, buffers_t& other);
+      void swap(buffers_t& other);
+
+      void clear() {
+	for (unsigned i = 0; i < _size; ++i)
+	  _data[i].~ptr();
+	_size = 0;
+      }
+    };
+
+  private:
     // my private bits
-    std::list<ptr> _buffers;
+    buffers_t _buffers;
     unsigned _len;
     unsigned _memcopy_count; //the total of memcopy using rebuild().
     ptr append_buffer;  // where i put small appends.
@@ -367,11 +514,11 @@ namespace buffer CEPH_BUFFER_API {
 					const list,
 					list>::type bl_t;
       typedef typename std::conditional<is_const,
-					const std::list<ptr>,
-					std::list<ptr> >::type list_t;
+					const buffers_t,
+					buffers_t>::type list_t;
       typedef typename std::conditional<is_const,
-					typename std::list<ptr>::const_iterator,
-					typename std::list<ptr>::iterator>::type list_iter_t;
+					typename buffers_t::const_iterator,
+					typename buffers_t::iterator>::type list_iter_t;
       bl_t* bl;
       list_t* ls;  // meh.. just here to avoid an extra pointer dereference..
       unsigned off; // in bl
@@ -427,6 +574,11 @@ namespace buffer CEPH_BUFFER_API {
       /// calculate crc from iterator position
       uint32_t crc32c(size_t length, uint32_t crc);
 
+      /// calculate crcs of @p n consecutive @p length byte blocks from
+      /// iterator position, each seeded with @p crc, into @p crcs
+      void crc32c_blocks(size_t length, size_t n, uint32_t crc,
+			 uint32_t *crcs);
+
       friend bool operator==(const iterator_impl& lhs,
 			     const iterator_impl& rhs) {
 	return &lhs.get_bl() == &rhs.get_bl() && lhs.get_off() == rhs.get_off();
@@ -705,13 +857,13 @@ namespace buffer CEPH_BUFFER_API {
     }
 
     unsigned get_memcopy_count() const {return _memcopy_count; }
-    const std::list<ptr>& buffers() const { return _buffers; }
+    const buffers_t& buffers() const { return _buffers; }
     void swap(list& other);
     unsigned length() const {
 #if 0
       // DEBUG: verify _len
       unsigned len = 0;
-      for (std::list<ptr>::const_iterator it = _buffers.begin();
+      for (buffers_t::const_iterator it = _buffers.begin();
 	   it != _buffers.end();
 	   it++) {
 	len += (*it).length();
@@ -799,7 +951,7 @@ namespace buffer CEPH_BUFFER_API {
 
     // clone non-shareable buffers (make shareable)
     void make_shareable() {
-      std::list<buffer::ptr>::iterator pb;
+      buffers_t::iterator pb;
       for (pb = _buffers.begin(); pb != _buffers.end(); ++pb) {
         (void) pb->make_shareable();
       }
@@ -810,7 +962,7 @@ namespace buffer CEPH_BUFFER_API {
     {
       if (this != &bl) {
         clear();
-        std::list<buffer::ptr>::const_iterator pb;
+        buffers_t::const_iterator pb;
         for (pb = bl._buffers.begin(); pb != bl._buffers.end(); ++pb) {
           push_back(*pb);
         }
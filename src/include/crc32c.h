@@ -50,6 +50,36 @@ static inline uint32_t ceph_crc32c(uint32_t crc, unsigned char const *data, unsi
   return ceph_crc32c_func(crc, data, length);
 }
 
+typedef void (*ceph_crc32c_multi_func_t)(uint32_t *crcs,
+					 unsigned char const * const *data,
+					 unsigned length, unsigned n);
+
+/*
+ * the chosen multi-buffer crc32c implementation, see ceph_crc32c_multi()
+ */
+extern ceph_crc32c_multi_func_t ceph_crc32c_multi_func;
+
+extern ceph_crc32c_multi_func_t ceph_choose_crc32c_multi(void);
+
+/**
+ * calculate crc32c of several independent buffers of the same length
+ *
+ * Equivalent to crcs[i] = ceph_crc32c(crcs[i], data[i], length) for
+ * each i < n, but the buffers are walked in one interleaved pass where
+ * the CPU can overlap the CRC computations.
+ *
+ * @param crcs initial values in, crcs out
+ * @param data pointers to the n buffers; none may be NULL
+ * @param length length of each buffer
+ * @param n number of buffers
+ */
+static inline void ceph_crc32c_multi(uint32_t *crcs,
+				     unsigned char const * const *data,
+				     unsigned length, unsigned n)
+{
+  ceph_crc32c_multi_func(crcs, data, length, n);
+}
+
 #ifdef __cplusplus
 }
 #endif
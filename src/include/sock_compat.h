@@ -24,4 +24,11 @@
 # endif
 #endif
 
+/*
+ * MSG_ZEROCOPY needs Linux 4.14 or later.
+ */
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+# define CEPH_HAVE_MSG_ZEROCOPY
+#endif
+
 #endif
@@ -0,0 +1,690 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <set>
+#include <map>
+#include <string>
+#include <memory>
+#include <errno.h>
+#include <endian.h>
+#include <string.h>
+
+#include "common/perf_counters.h"
+#include "common/debug.h"
+#include "common/errno.h"
+#include "include/assert.h"
+#include "os/kvsstore/kadi/KADI.h"
+#include "os/kvsstore/kvsstore_types.h"
+#include "KADIStore.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_kvs
+#undef dout_prefix
+#define dout_prefix *_dout << "kadistore: "
+
+// Device keys are <bucket:4><group:1><body>. The bucket is the iterator
+// prefix, so the whole key space or the whole journal is one device
+// iteration.
+//   data:    body = prefix '\0' key
+//   journal: body = seq:8 part:2 nparts:2
+static const uint32_t KADISTORE_DATA_BUCKET    = 0x4244564b;   // "KVDB"
+static const uint32_t KADISTORE_JOURNAL_BUCKET = 0x4a44564b;   // "KVDJ"
+static const int KADISTORE_HDR_LEN = 5;
+static const int KADISTORE_JOURNAL_KEY_LEN = KADISTORE_HDR_LEN + 12;
+
+// every device value carries a one-byte trailer so that empty values
+// can be stored
+static const uint32_t KADISTORE_MAX_VALUE = 2 * 1024 * 1024 - 1;
+static const unsigned KADISTORE_MAX_INFLIGHT = 128;
+
+static string make_key(const string &prefix, const string &k)
+{
+  string out;
+  out.reserve(prefix.size() + 1 + k.size());
+  out.append(prefix);
+  out.push_back(0);
+  out.append(k);
+  return out;
+}
+
+static void split_key(const string &in, string *prefix, string *key)
+{
+  size_t pos = in.find('\0');
+  assert(pos != string::npos);
+  if (prefix)
+    *prefix = in.substr(0, pos);
+  if (key)
+    *key = in.substr(pos + 1);
+}
+
+static string device_key(uint32_t bucket, const char *body, size_t len)
+{
+  string out;
+  out.reserve(KADISTORE_HDR_LEN + len);
+  out.append((const char *)&bucket, sizeof(bucket));
+  out.push_back((char)GROUP_PREFIX_KVDB);
+  out.append(body, len);
+  return out;
+}
+
+static string data_key(const string &k)
+{
+  return device_key(KADISTORE_DATA_BUCKET, k.data(), k.size());
+}
+
+static string journal_key(uint64_t seq, uint16_t part, uint16_t nparts)
+{
+  char body[12];
+  uint64_t s = htobe64(seq);
+  uint16_t p = htobe16(part), n = htobe16(nparts);
+  memcpy(body, &s, 8);
+  memcpy(body + 8, &p, 2);
+  memcpy(body + 10, &n, 2);
+  return device_key(KADISTORE_JOURNAL_BUCKET, body, sizeof(body));
+}
+
+/// calls fn(key, length) for every device key in bucket
+template <typename Fn>
+static int scan_bucket(CephContext *cct, KADI *db, uint32_t bucket, Fn fn)
+{
+  kv_iter_context iter_ctx;
+  std::list<std::pair<void *, int> > buflist;
+  iter_ctx.prefix = bucket;
+  iter_ctx.bitmask = 0xFFFFFFFF;
+  iter_ctx.buflen = ITER_BUFSIZE;
+  iter_ctx.routed = true;
+
+  int r = db->iter_readall(&iter_ctx, buflist);
+  if (r == 0) {
+    for (const auto &p : buflist) {
+      iterbuf_reader reader(cct, p.first, p.second, db);
+      void *key;
+      int length;
+      while (reader.nextkey(&key, &length)) {
+        if (length < KADISTORE_HDR_LEN || length > 255) break;
+        fn((const char *)key, length);
+      }
+    }
+  }
+  for (const auto &p : buflist)
+    free(p.first);
+  return r == 0 ? 0 : -EIO;
+}
+
+KADIStore::KADIStore(CephContext *c, const string &path_, void *p) :
+  cct(c), path(path_), callback_thread(this)
+{
+}
+
+KADIStore::~KADIStore()
+{
+  close();
+}
+
+void KADIStore::_callback_thread()
+{
+  while (!callback_stop) {
+    uint32_t n = 0;
+    db->poll_completion(n, 10000);
+  }
+}
+
+int KADIStore::do_open(ostream &out, bool create)
+{
+  string devpath = cct->_conf->kadistore_dev_path;
+  if (devpath.empty()) {
+    derr << __func__ << " kadistore_dev_path is not set" << dendl;
+    out << "kadistore_dev_path is not set" << std::endl;
+    return -EINVAL;
+  }
+
+  db = new KADI(cct);
+  if (db->open(devpath, 0) != 0) {
+    derr << __func__ << " failed to open " << devpath << dendl;
+    out << "failed to open " << devpath << std::endl;
+    delete db;
+    db = nullptr;
+    return -EIO;
+  }
+  callback_stop = false;
+  callback_thread.create("kadi_cb");
+
+  int r = create ? _wipe() : _replay_journal();
+  if (r == 0)
+    r = _load_index();
+  if (r < 0) {
+    out << "failed to load " << devpath << ": " << cpp_strerror(r) << std::endl;
+    close();
+    return r;
+  }
+
+  PerfCountersBuilder plb(cct, "kadistore", l_kadistore_first, l_kadistore_last);
+  plb.add_u64_counter(l_kadistore_gets, "get", "Gets");
+  plb.add_u64_counter(l_kadistore_txns, "submit_transaction", "Submit transactions");
+  plb.add_u64_counter(l_kadistore_journaled_txns, "journaled_transaction",
+                      "Transactions written to the journal first");
+  plb.add_u64_counter(l_kadistore_set_keys, "set_keys", "Keys written");
+  plb.add_u64_counter(l_kadistore_rm_keys, "rm_keys", "Keys removed");
+  plb.add_time_avg(l_kadistore_submit_lat, "submit_latency", "Submit latency");
+  plb.add_time_avg(l_kadistore_get_lat, "get_latency", "Get latency");
+  logger = plb.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+
+  dout(1) << __func__ << " " << devpath << " with " << index.size() << " keys" << dendl;
+  return 0;
+}
+
+void KADIStore::close()
+{
+  if (logger) {
+    cct->get_perfcounters_collection()->remove(logger);
+    delete logger;
+    logger = nullptr;
+  }
+  if (db) {
+    callback_stop = true;
+    callback_thread.join();
+    db->close();
+    delete db;
+    db = nullptr;
+  }
+  std::lock_guard<std::mutex> l(lock);
+  index.clear();
+  overlay.clear();
+}
+
+int KADIStore::_load_index()
+{
+  std::set<string> keys;
+  int r = scan_bucket(cct, db, KADISTORE_DATA_BUCKET,
+    [&](const char *k, int len) {
+      keys.insert(string(k + KADISTORE_HDR_LEN, len - KADISTORE_HDR_LEN));
+    });
+  if (r < 0) {
+    derr << __func__ << " failed to iterate the key space" << dendl;
+    return r;
+  }
+  std::lock_guard<std::mutex> l(lock);
+  index.swap(keys);
+  return 0;
+}
+
+// apply journaled transactions whose parts are all on the device, then
+// drop every journal key
+int KADIStore::_replay_journal()
+{
+  std::map<uint64_t, std::map<uint16_t, string> > parts;
+  std::map<uint64_t, uint16_t> nparts;
+  std::list<string> jkeys;
+  int r = scan_bucket(cct, db, KADISTORE_JOURNAL_BUCKET,
+    [&](const char *k, int len) {
+      if (len != KADISTORE_JOURNAL_KEY_LEN)
+        return;
+      uint64_t s;
+      uint16_t p, n;
+      memcpy(&s, k + KADISTORE_HDR_LEN, 8);
+      memcpy(&p, k + KADISTORE_HDR_LEN + 8, 2);
+      memcpy(&n, k + KADISTORE_HDR_LEN + 10, 2);
+      parts[be64toh(s)][be16toh(p)] = string(k, len);
+      nparts[be64toh(s)] = be16toh(n);
+      jkeys.push_back(string(k, len));
+    });
+  if (r < 0) {
+    derr << __func__ << " failed to iterate the journal" << dendl;
+    return r;
+  }
+
+  for (auto &p : parts) {
+    journal_seq = std::max(journal_seq, p.first + 1);
+    if (p.second.size() != nparts[p.first]) {
+      dout(1) << __func__ << " dropping incomplete journal record " << p.first << dendl;
+      continue;
+    }
+    bufferlist bl;
+    for (auto &q : p.second) {
+      r = _read(q.second, &bl);
+      if (r < 0) {
+        derr << __func__ << " failed to read journal record " << p.first
+             << ": " << cpp_strerror(r) << dendl;
+        return r;
+      }
+    }
+    std::list<op_t> ops;
+    try {
+      bufferlist::iterator it = bl.begin();
+      uint32_t n;
+      ::decode(n, it);
+      while (n--) {
+        string k;
+        bool has_value;
+        ::decode(k, it);
+        ::decode(has_value, it);
+        ops.push_back(op_t(data_key(k), boost::none));
+        if (has_value) {
+          bufferlist v;
+          ::decode(v, it);
+          ops.back().second = v;
+        }
+      }
+    } catch (buffer::error &e) {
+      derr << __func__ << " corrupt journal record " << p.first << dendl;
+      return -EIO;
+    }
+    dout(1) << __func__ << " replaying journal record " << p.first
+            << " with " << ops.size() << " updates" << dendl;
+    r = _write_ops(ops);
+    if (r < 0)
+      return r;
+  }
+  return _delete_keys(jkeys);
+}
+
+int KADIStore::_wipe()
+{
+  std::list<string> keys;
+  auto collect = [&](const char *k, int len) { keys.push_back(string(k, len)); };
+  int r = scan_bucket(cct, db, KADISTORE_DATA_BUCKET, collect);
+  if (r == 0)
+    r = scan_bucket(cct, db, KADISTORE_JOURNAL_BUCKET, collect);
+  if (r == 0)
+    r = _delete_keys(keys);
+  return r;
+}
+
+int KADIStore::_write_ops(const std::list<op_t> &ops)
+{
+  auto it = ops.begin();
+  while (it != ops.end()) {
+    std::list<KvsSyncWriteContext> ctxs;
+    for (; it != ops.end() && ctxs.size() < KADISTORE_MAX_INFLIGHT; ++it) {
+      ctxs.emplace_back(cct);
+      KvsSyncWriteContext &ctx = ctxs.back();
+      ctx.key = KvsMemPool::Alloc_key(it->first.size());
+      ctx.key->length = it->first.size();
+      memcpy(ctx.key->key, it->first.data(), it->first.size());
+      if (it->second) {
+        const bufferlist &v = *it->second;
+        ctx.value = KvsMemPool::Alloc_value(v.length() + 1);
+        v.copy(0, v.length(), (char *)ctx.value->value);
+        ((char *)ctx.value->value)[v.length()] = 0;
+      }
+      if (db->aio_submit(&ctx) != 0) {
+        ctx.num_running = 0;
+        ctx.retcode = -1;
+      }
+    }
+
+    int r = 0;
+    for (auto &ctx : ctxs) {
+      kv_result ret = ctx.write_wait();
+      if (ret != KV_SUCCESS && !(ctx.value == 0 && ret == KV_ERR_KEY_NOT_EXIST)) {
+        derr << __func__ << " write failed, error = " << ret << dendl;
+        r = -EIO;
+      }
+    }
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+int KADIStore::_delete_keys(const std::list<string> &keys)
+{
+  std::list<op_t> ops;
+  for (const auto &k : keys)
+    ops.push_back(op_t(k, boost::none));
+  return _write_ops(ops);
+}
+
+int KADIStore::_write_journal(uint64_t seq, bufferlist &bl, std::list<string> *jkeys)
+{
+  const uint32_t nparts = (bl.length() + KADISTORE_MAX_VALUE - 1) / KADISTORE_MAX_VALUE;
+  if (nparts > 0xFFFF)
+    return -EFBIG;
+
+  std::list<op_t> ops;
+  for (uint32_t part = 0; part < nparts; part++) {
+    const uint32_t off = part * KADISTORE_MAX_VALUE;
+    bufferlist chunk;
+    chunk.substr_of(bl, off, std::min(KADISTORE_MAX_VALUE, bl.length() - off));
+    ops.push_back(op_t(journal_key(seq, part, nparts), chunk));
+    jkeys->push_back(ops.back().first);
+  }
+  return _write_ops(ops);
+}
+
+int KADIStore::_read(const string &k, bufferlist *out)
+{
+  kv_key *key = KvsMemPool::Alloc_key(k.size());
+  key->length = k.size();
+  memcpy(key->key, k.data(), k.size());
+  kv_value *value = KvsMemPool::Alloc_value();
+
+  int r = 0;
+  kv_result ret = db->kv_retrieve_sync(key, value);
+  if (ret == KV_SUCCESS) {
+    if (value->length > 0)
+      out->append((const char *)value->value, value->length - 1);
+  } else if (ret == KV_ERR_KEY_NOT_EXIST) {
+    r = -ENOENT;
+  } else {
+    derr << __func__ << " read failed, error = " << ret << dendl;
+    r = -EIO;
+  }
+  KvsMemPool::Release_key(key);
+  KvsMemPool::Release_value(value);
+  return r;
+}
+
+int KADIStore::submit_transaction(KeyValueDB::Transaction tsession)
+{
+  utime_t start = ceph_clock_now();
+  KADITransactionImpl *t = static_cast<KADITransactionImpl *>(tsession.get());
+
+  std::lock_guard<std::mutex> sl(submit_lock);
+
+  // resolve prefix and range removals against the key space; the
+  // submit lock keeps other writers from changing it meanwhile
+  std::map<string, boost::optional<bufferlist> > updates;
+  {
+    std::lock_guard<std::mutex> l(lock);
+    auto rm_range = [&](const string &first, const string &last, bool to_end) {
+      for (auto p = index.lower_bound(first);
+           p != index.end() && (to_end ? p->compare(0, first.size(), first) == 0 : *p < last);
+           ++p)
+        updates[*p] = boost::none;
+      for (auto p = updates.lower_bound(first);
+           p != updates.end() && (to_end ? p->first.compare(0, first.size(), first) == 0 : p->first < last); ) {
+        if (index.count(p->first)) {
+          p->second = boost::none;
+          ++p;
+        } else {
+          p = updates.erase(p);
+        }
+      }
+    };
+    for (auto &op : t->ops) {
+      switch (op.type) {
+      case KADITransactionImpl::SET:
+        updates[make_key(op.prefix, op.key)] = op.value;
+        break;
+      case KADITransactionImpl::RMKEY:
+        updates[make_key(op.prefix, op.key)] = boost::none;
+        break;
+      case KADITransactionImpl::RMPREFIX:
+        rm_range(make_key(op.prefix, string()), string(), true);
+        break;
+      case KADITransactionImpl::RMRANGE:
+        rm_range(make_key(op.prefix, op.key), make_key(op.prefix, op.end), false);
+        break;
+      }
+    }
+  }
+  if (updates.empty())
+    return 0;
+
+  std::list<op_t> ops;
+  uint64_t nset = 0, nrm = 0;
+  for (auto &u : updates) {
+    if (KADISTORE_HDR_LEN + u.first.size() > 255) {
+      derr << __func__ << " key too long (" << u.first.size() << " bytes)" << dendl;
+      return -ENAMETOOLONG;
+    }
+    if (u.second && u.second->length() > KADISTORE_MAX_VALUE) {
+      derr << __func__ << " value too large (" << u.second->length() << " bytes)" << dendl;
+      return -EFBIG;
+    }
+    ops.push_back(op_t(data_key(u.first), u.second));
+    if (u.second) nset++; else nrm++;
+  }
+
+  // a single update is atomic on the device; anything larger is
+  // journaled so that open can finish an interrupted apply
+  std::list<string> jkeys;
+  if (ops.size() > 1) {
+    bufferlist bl;
+    ::encode((uint32_t)updates.size(), bl);
+    for (auto &u : updates) {
+      ::encode(u.first, bl);
+      ::encode((bool)u.second, bl);
+      if (u.second)
+        ::encode(*u.second, bl);
+    }
+    int r = _write_journal(journal_seq++, bl, &jkeys);
+    if (r < 0) {
+      derr << __func__ << " journal write failed: " << cpp_strerror(r) << dendl;
+      return r;
+    }
+    logger->inc(l_kadistore_journaled_txns);
+  }
+
+  // readers see the whole transaction through the overlay until the
+  // device has it
+  {
+    std::lock_guard<std::mutex> l(lock);
+    for (auto &u : updates) {
+      overlay[u.first] = u.second;
+      if (u.second)
+        index.insert(u.first);
+      else
+        index.erase(u.first);
+    }
+  }
+
+  int r = _write_ops(ops);
+  if (r < 0) {
+    derr << __func__ << " apply failed: " << cpp_strerror(r) << dendl;
+    ceph_abort_msg(cct, "KADIStore::submit_transaction - write failed");
+  }
+  if (!jkeys.empty())
+    _delete_keys(jkeys);
+
+  {
+    std::lock_guard<std::mutex> l(lock);
+    for (auto &u : updates)
+      overlay.erase(u.first);
+  }
+
+  logger->inc(l_kadistore_txns);
+  logger->inc(l_kadistore_set_keys, nset);
+  logger->inc(l_kadistore_rm_keys, nrm);
+  logger->tinc(l_kadistore_submit_lat, ceph_clock_now() - start);
+  return 0;
+}
+
+int KADIStore::get(const string &prefix, const std::set<string> &keys,
+                   std::map<string, bufferlist> *out)
+{
+  for (const auto &k : keys) {
+    bufferlist bl;
+    int r = get(prefix, k, &bl);
+    if (r == 0)
+      out->insert(make_pair(k, bl));
+    else if (r != -ENOENT)
+      return r;
+  }
+  return 0;
+}
+
+int KADIStore::get(const string &prefix, const string &key, bufferlist *out)
+{
+  utime_t start = ceph_clock_now();
+  const string k = make_key(prefix, key);
+  {
+    std::lock_guard<std::mutex> l(lock);
+    auto p = overlay.find(k);
+    if (p != overlay.end()) {
+      if (!p->second)
+        return -ENOENT;
+      out->append(*p->second);
+      return 0;
+    }
+    if (!index.count(k))
+      return -ENOENT;
+  }
+  int r = _read(data_key(k), out);
+  logger->inc(l_kadistore_gets);
+  logger->tinc(l_kadistore_get_lat, ceph_clock_now() - start);
+  return r;
+}
+
+uint64_t KADIStore::get_estimated_size(std::map<string,uint64_t> &extra)
+{
+  uint64_t used = 0, capacity = 0;
+  double util;
+  if (db && db->get_freespace(used, capacity, util) != 0)
+    return 0;
+  return used;
+}
+
+int KADIStore::get_statfs(struct store_statfs_t *buf)
+{
+  uint64_t used = 0, capacity = 0;
+  double util;
+  buf->reset();
+  if (!db || db->get_freespace(used, capacity, util) != 0)
+    return -EIO;
+  buf->total = capacity;
+  buf->available = capacity - used;
+  buf->allocated = used;
+  buf->stored = used;
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+// transactions
+
+void KADIStore::KADITransactionImpl::set(
+  const string &prefix, const string &k, const bufferlist &bl)
+{
+  ops.push_back(op{SET, prefix, k, string(), bl});
+}
+
+void KADIStore::KADITransactionImpl::rmkey(const string &prefix, const string &k)
+{
+  ops.push_back(op{RMKEY, prefix, k, string(), bufferlist()});
+}
+
+void KADIStore::KADITransactionImpl::rmkeys_by_prefix(const string &prefix)
+{
+  ops.push_back(op{RMPREFIX, prefix, string(), string(), bufferlist()});
+}
+
+void KADIStore::KADITransactionImpl::rm_range_keys(
+  const string &prefix, const string &start, const string &end)
+{
+  ops.push_back(op{RMRANGE, prefix, start, end, bufferlist()});
+}
+
+// ----------------------------------------------------------------------------
+// iterator: walks the in-memory key space by value, so updates made
+// while it is open never invalidate it
+
+int KADIStore::KADIWholeSpaceIteratorImpl::_set(std::set<string>::iterator it)
+{
+  have_value = false;
+  cur_value.clear();
+  if (it == store->index.end()) {
+    cur.clear();
+    return -1;
+  }
+  cur = *it;
+  return 0;
+}
+
+int KADIStore::KADIWholeSpaceIteratorImpl::seek_to_first()
+{
+  std::lock_guard<std::mutex> l(store->lock);
+  return _set(store->index.begin());
+}
+
+int KADIStore::KADIWholeSpaceIteratorImpl::seek_to_first(const string &prefix)
+{
+  std::lock_guard<std::mutex> l(store->lock);
+  return _set(store->index.lower_bound(prefix));
+}
+
+int KADIStore::KADIWholeSpaceIteratorImpl::seek_to_last()
+{
+  std::lock_guard<std::mutex> l(store->lock);
+  if (store->index.empty())
+    return _set(store->index.end());
+  return _set(--store->index.end());
+}
+
+int KADIStore::KADIWholeSpaceIteratorImpl::seek_to_last(const string &prefix)
+{
+  std::lock_guard<std::mutex> l(store->lock);
+  // last key of prefix: the one before the first key past prefix '\0' ...
+  string limit = prefix;
+  limit.push_back(1);
+  auto it = store->index.lower_bound(limit);
+  if (it == store->index.begin())
+    return _set(store->index.end());
+  return _set(--it);
+}
+
+int KADIStore::KADIWholeSpaceIteratorImpl::upper_bound(const string &prefix,
+                                                       const string &after)
+{
+  std::lock_guard<std::mutex> l(store->lock);
+  return _set(store->index.upper_bound(make_key(prefix, after)));
+}
+
+int KADIStore::KADIWholeSpaceIteratorImpl::lower_bound(const string &prefix,
+                                                       const string &to)
+{
+  std::lock_guard<std::mutex> l(store->lock);
+  return _set(store->index.lower_bound(make_key(prefix, to)));
+}
+
+int KADIStore::KADIWholeSpaceIteratorImpl::next()
+{
+  if (cur.empty())
+    return -1;
+  std::lock_guard<std::mutex> l(store->lock);
+  return _set(store->index.upper_bound(cur));
+}
+
+int KADIStore::KADIWholeSpaceIteratorImpl::prev()
+{
+  if (cur.empty())
+    return -1;
+  std::lock_guard<std::mutex> l(store->lock);
+  auto it = store->index.lower_bound(cur);
+  if (it == store->index.begin())
+    return _set(store->index.end());
+  return _set(--it);
+}
+
+string KADIStore::KADIWholeSpaceIteratorImpl::key()
+{
+  string k;
+  split_key(cur, nullptr, &k);
+  return k;
+}
+
+std::pair<string,string> KADIStore::KADIWholeSpaceIteratorImpl::raw_key()
+{
+  string p, k;
+  split_key(cur, &p, &k);
+  return make_pair(p, k);
+}
+
+bool KADIStore::KADIWholeSpaceIteratorImpl::raw_key_is_prefixed(const string &prefix)
+{
+  return cur.size() > prefix.size() &&
+         cur.compare(0, prefix.size(), prefix) == 0 &&
+         cur[prefix.size()] == 0;
+}
+
+bufferlist KADIStore::KADIWholeSpaceIteratorImpl::value()
+{
+  if (!have_value && !cur.empty()) {
+    string p, k;
+    split_key(cur, &p, &k);
+    if (store->get(p, k, &cur_value) == 0)
+      have_value = true;
+  }
+  return cur_value;
+}
@@ -0,0 +1,172 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * KeyValueDB on a KV-SSD namespace, driven through KADI
+ *
+ * The device stores unordered keys, so the sorted key space is kept in
+ * memory (keys only) and rebuilt from a device iteration at open.
+ * Transactions with more than one update are written to a small journal
+ * first and replayed at open if the apply was interrupted.
+ */
+
+#ifndef CEPH_KV_KADISTORE_H
+#define CEPH_KV_KADISTORE_H
+
+#include "include/buffer.h"
+#include <ostream>
+#include <set>
+#include <map>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <boost/optional.hpp>
+#include "common/Thread.h"
+#include "KeyValueDB.h"
+#include "osd/osd_types.h"
+
+using std::string;
+
+class KADI;
+class PerfCounters;
+
+enum {
+  l_kadistore_first = 35100,
+  l_kadistore_gets,
+  l_kadistore_txns,
+  l_kadistore_journaled_txns,
+  l_kadistore_set_keys,
+  l_kadistore_rm_keys,
+  l_kadistore_submit_lat,
+  l_kadistore_get_lat,
+  l_kadistore_last,
+};
+
+class KADIStore : public KeyValueDB
+{
+  CephContext *cct;
+  string path;            ///< data dir; the device comes from kadistore_dev_path
+  PerfCounters *logger = nullptr;
+  KADI *db = nullptr;
+
+  /// one buffered update: a value, or none for a delete
+  typedef std::pair<string, boost::optional<bufferlist> > op_t;
+
+  // sorted key space and the updates that are not on the device yet
+  std::mutex lock;                                  ///< protects index and overlay
+  std::set<string> index;                           ///< prefix '\0' key
+  std::map<string, boost::optional<bufferlist> > overlay;
+
+  std::mutex submit_lock;                           ///< serializes transactions
+  uint64_t journal_seq = 0;
+
+  // completions are reaped by a dedicated thread
+  struct CallbackThread : public Thread {
+    KADIStore *store;
+    explicit CallbackThread(KADIStore *s) : store(s) {}
+    void *entry() override {
+      store->_callback_thread();
+      return NULL;
+    }
+  } callback_thread;
+  std::atomic<bool> callback_stop = { false };
+  void _callback_thread();
+
+  int _load_index();
+  int _replay_journal();
+  int _wipe();
+  int _write_ops(const std::list<op_t> &ops);
+  int _write_journal(uint64_t seq, bufferlist &bl, std::list<string> *jkeys);
+  int _delete_keys(const std::list<string> &keys);
+  int _read(const string &k, bufferlist *out);
+
+public:
+  KADIStore(CephContext *c, const string &path, void *p);
+  ~KADIStore() override;
+
+  static int _test_init(const string& dir) { return 0; }
+
+  class KADITransactionImpl : public KeyValueDB::TransactionImpl {
+  public:
+    enum op_type { SET = 1, RMKEY, RMPREFIX, RMRANGE };
+    struct op {
+      op_type type;
+      string prefix;
+      string key;       ///< RMRANGE: start
+      string end;       ///< RMRANGE
+      bufferlist value;
+    };
+    std::list<op> ops;
+
+    void set(const string &prefix, const string &k,
+             const bufferlist &bl) override;
+    using KeyValueDB::TransactionImpl::set;
+    void rmkey(const string &prefix, const string &k) override;
+    using KeyValueDB::TransactionImpl::rmkey;
+    void rmkeys_by_prefix(const string &prefix) override;
+    void rm_range_keys(const string &prefix,
+                       const string &start,
+                       const string &end) override;
+  };
+
+  int init(string option_str="") override { return 0; }
+  int do_open(ostream &out, bool create);
+  int open(ostream &out) override { return do_open(out, false); }
+  int create_and_open(ostream &out) override { return do_open(out, true); }
+  void close() override;
+
+  KeyValueDB::Transaction get_transaction() override {
+    return std::make_shared<KADITransactionImpl>();
+  }
+
+  int submit_transaction(KeyValueDB::Transaction t) override;
+  int submit_transaction_sync(KeyValueDB::Transaction t) override {
+    // every completed device write is durable
+    return submit_transaction(t);
+  }
+
+  int get(const string &prefix, const std::set<string> &keys,
+          std::map<string, bufferlist> *out) override;
+  int get(const string &prefix, const string &key,
+          bufferlist *out) override;
+  using KeyValueDB::get;
+
+  class KADIWholeSpaceIteratorImpl : public KeyValueDB::WholeSpaceIteratorImpl {
+    KADIStore *store;
+    string cur;          ///< prefix '\0' key, empty if invalid
+    bool have_value = false;
+    bufferlist cur_value;
+
+    int _set(std::set<string>::iterator it);
+  public:
+    explicit KADIWholeSpaceIteratorImpl(KADIStore *s) : store(s) {}
+
+    int seek_to_first() override;
+    int seek_to_first(const string &prefix) override;
+    int seek_to_last() override;
+    int seek_to_last(const string &prefix) override;
+    int upper_bound(const string &prefix, const string &after) override;
+    int lower_bound(const string &prefix, const string &to) override;
+    bool valid() override { return !cur.empty(); }
+    int next() override;
+    int prev() override;
+    string key() override;
+    std::pair<string,string> raw_key() override;
+    bool raw_key_is_prefixed(const string &prefix) override;
+    bufferlist value() override;
+    int status() override { return 0; }
+  };
+
+  uint64_t get_estimated_size(std::map<string,uint64_t> &extra) override;
+  int get_statfs(struct store_statfs_t *buf) override;
+
+  PerfCounters *get_perf_counters() override {
+    return logger;
+  }
+
+protected:
+  WholeSpaceIterator _get_iterator() override {
+    return std::make_shared<KADIWholeSpaceIteratorImpl>(this);
+  }
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include "LevelDBStore.h"
 #endif
 #include "MemDB.h"
+#include "KADIStore.h"
 #ifdef HAVE_LIBROCKSDB
 #include "RocksDBStore.h"
 #endif
@@ -38,6 +39,11 @@ KeyValueDB *KeyValueDB::create(CephContext *cct, const string& type,
     cct->check_experimental_feature_enabled("memdb")) {
     return new MemDB(cct, dir, p);
   }
+
+  if ((type == "kadi") &&
+    cct->check_experimental_feature_enabled("kadi")) {
+    return new KADIStore(cct, dir, p);
+  }
   return NULL;
 }
 
@@ -62,5 +68,9 @@ int KeyValueDB::test_init(const string& type, const string& dir)
   if (type == "memdb") {
     return MemDB::_test_init(dir);
   }
+
+  if (type == "kadi") {
+    return KADIStore::_test_init(dir);
+  }
   return -EINVAL;
 }
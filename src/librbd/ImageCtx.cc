@@ -24,6 +24,7 @@
 #include "librbd/operation/ResizeRequest.h"
 #include "librbd/Utils.h"
 #include "librbd/LibrbdWriteback.h"
+#include "librbd/cache/ImageCache.h"
 #include "librbd/exclusive_lock/AutomaticPolicy.h"
 #include "librbd/exclusive_lock/StandardPolicy.h"
 #include "librbd/io/AioCompletion.h"
@@ -100,6 +101,18 @@ struct C_FlushCache : public Context {
   }
 };
 
+struct C_FlushImageCache : public Context {
+  ImageCtx *image_ctx;
+  Context *on_safe;
+
+  C_FlushImageCache(ImageCtx *_image_ctx, Context *_on_safe)
+    : image_ctx(_image_ctx), on_safe(_on_safe) {
+  }
+  void finish(int r) override {
+    image_ctx->image_cache->flush(on_safe);
+  }
+};
+
 struct C_ShutDownCache : public Context {
   ImageCtx *image_ctx;
   Context *on_finish;
@@ -163,6 +176,7 @@ struct C_InvalidateCache : public Context {
 } // anonymous namespace
 
   const string ImageCtx::METADATA_CONF_PREFIX = "conf_";
+  const string ImageCtx::PERSISTENT_CACHE_OWNER_KEY = "rbd_persistent_cache_owner";
 
   ImageCtx::ImageCtx(const string &image_name, const string &image_id,
 		     const char *snap, IoCtx& p, bool ro)
@@ -274,7 +288,12 @@ struct C_InvalidateCache : public Context {
     trace_endpoint.copy_name(pname);
     perf_start(pname);
 
-    if (cache) {
+    if (persistent_cache && persistent_cache_path.empty()) {
+      lderr(cct) << "rbd_persistent_cache_path is not set, not enabling the "
+                 << "persistent cache" << dendl;
+    }
+
+    if (cache && !persistent_cache_enabled()) {
       Mutex::Locker l(cache_lock);
       ldout(cct, 20) << "enabling caching..." << dendl;
       writeback_handler = new LibrbdWriteback(this, cache_lock);
@@ -790,6 +809,16 @@ struct C_InvalidateCache : public Context {
   }
 
   void ImageCtx::shut_down_cache(Context *on_finish) {
+    if (image_cache != nullptr) {
+      image_cache->shut_down(new FunctionContext(
+        [this, on_finish](int r) {
+          delete image_cache;
+          image_cache = nullptr;
+          on_finish->complete(r);
+        }));
+      return;
+    }
+
     if (object_cacher == NULL) {
       on_finish->complete(0);
       return;
@@ -805,6 +834,11 @@ struct C_InvalidateCache : public Context {
 
   int ImageCtx::invalidate_cache(bool purge_on_error) {
     flush_async_operations();
+    if (image_cache != nullptr) {
+      C_SaferCond ctx;
+      image_cache->invalidate(&ctx);
+      return ctx.wait();
+    }
     if (object_cacher == NULL) {
       return 0;
     }
@@ -821,6 +855,10 @@ struct C_InvalidateCache : public Context {
   }
 
   void ImageCtx::invalidate_cache(bool purge_on_error, Context *on_finish) {
+    if (image_cache != nullptr) {
+      image_cache->invalidate(on_finish);
+      return;
+    }
     if (object_cacher == NULL) {
       op_work_queue->queue(on_finish, 0);
       return;
@@ -845,6 +883,11 @@ struct C_InvalidateCache : public Context {
     return object_cacher->set_is_empty(object_set);
   }
 
+  bool ImageCtx::persistent_cache_enabled() const {
+    return persistent_cache && !persistent_cache_path.empty() &&
+           !read_only && snap_name.empty();
+  }
+
   void ImageCtx::register_watch(Context *on_finish) {
     assert(image_watcher == NULL);
     image_watcher = new ImageWatcher<>(*this);
@@ -906,6 +949,10 @@ struct C_InvalidateCache : public Context {
       // flush cache after completing all in-flight AIO ops
       on_safe = new C_FlushCache(this, on_safe);
     }
+    if (image_cache != nullptr) {
+      // destage the image cache after completing all in-flight AIO ops
+      on_safe = new C_FlushImageCache(this, on_safe);
+    }
     flush_async_operations(on_safe);
   }
 
@@ -975,6 +1022,11 @@ struct C_InvalidateCache : public Context {
         "rbd_cache_max_dirty_age", false)(
         "rbd_cache_max_dirty_object", false)(
         "rbd_cache_block_writes_upfront", false)(
+        "rbd_persistent_cache", false)(
+        "rbd_persistent_cache_path", false)(
+        "rbd_persistent_cache_size", false)(
+        "rbd_persistent_cache_destage_max_bytes", false)(
+        "rbd_persistent_cache_discard_dirty", false)(
         "rbd_concurrent_management_ops", false)(
         "rbd_balance_snap_reads", false)(
         "rbd_localize_snap_reads", false)(
@@ -1033,6 +1085,11 @@ struct C_InvalidateCache : public Context {
     ASSIGN_OPTION(cache_max_dirty_age, double);
     ASSIGN_OPTION(cache_max_dirty_object, int64_t);
     ASSIGN_OPTION(cache_block_writes_upfront, bool);
+    ASSIGN_OPTION(persistent_cache, bool);
+    ASSIGN_OPTION(persistent_cache_path, std::string);
+    ASSIGN_OPTION(persistent_cache_size, uint64_t);
+    ASSIGN_OPTION(persistent_cache_destage_max_bytes, uint64_t);
+    ASSIGN_OPTION(persistent_cache_discard_dirty, bool);
     ASSIGN_OPTION(concurrent_management_ops, int64_t);
     ASSIGN_OPTION(balance_snap_reads, bool);
     ASSIGN_OPTION(localize_snap_reads, bool);
@@ -162,6 +162,7 @@ namespace librbd {
 
     // Configuration
     static const string METADATA_CONF_PREFIX;
+    static const string PERSISTENT_CACHE_OWNER_KEY;
     bool non_blocking_aio;
     bool cache;
     bool cache_writethrough_until_flush;
@@ -171,6 +172,11 @@ namespace librbd {
     double cache_max_dirty_age;
     uint32_t cache_max_dirty_object;
     bool cache_block_writes_upfront;
+    bool persistent_cache;
+    std::string persistent_cache_path;
+    uint64_t persistent_cache_size;
+    uint64_t persistent_cache_destage_max_bytes;
+    bool persistent_cache_discard_dirty;
     uint32_t concurrent_management_ops;
     bool balance_snap_reads;
     bool localize_snap_reads;
@@ -296,6 +302,7 @@ namespace librbd {
     void invalidate_cache(bool purge_on_error, Context *on_finish);
     void clear_nonexistence_cache();
     bool is_cache_empty();
+    bool persistent_cache_enabled() const;
     void register_watch(Context *on_finish);
     uint64_t prune_parent_extents(vector<pair<uint64_t,uint64_t> >& objectx,
 				  uint64_t overlap);
@@ -0,0 +1,1331 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "FileImageCache.h"
+#include "include/buffer.h"
+#include "include/byteorder.h"
+#include "include/Context.h"
+#include "include/crc32c.h"
+#include "include/intarith.h"
+#include "include/stringify.h"
+#include "cls/rbd/cls_rbd_client.h"
+#include "common/dout.h"
+#include "common/errno.h"
+#include "common/hostname.h"
+#include "common/safe_io.h"
+#include "common/WorkQueue.h"
+#include "librbd/ExclusiveLock.h"
+#include "librbd/ImageCtx.h"
+#include "librbd/Utils.h"
+#include <fcntl.h>
+#include <memory>
+#include <unistd.h>
+
+#define dout_subsys ceph_subsys_rbd
+#undef dout_prefix
+#define dout_prefix *_dout << "librbd::FileImageCache: " << this << " " \
+                           <<  __func__ << ": "
+
+namespace librbd {
+namespace cache {
+
+namespace {
+
+const uint32_t SUPER_MAGIC = 0x52424443;  // "RBDC"
+const uint32_t ENTRY_MAGIC = 0x52424445;  // "RBDE"
+const uint32_t LOG_VERSION = 1;
+
+const uint64_t SUPER_SIZE = 4096;
+const uint64_t ENTRY_ALIGN = 512;
+const uint64_t MAX_ENTRY_DATA = 4 << 20;
+
+const std::string &OWNER_KEY = ImageCtx::PERSISTENT_CACHE_OWNER_KEY;
+
+struct log_super_t {
+  ceph_le32 magic;
+  ceph_le32 version;
+  ceph_le64 log_size;
+  ceph_le64 head_off;
+  ceph_le64 head_seq;
+  ceph_le64 log_id;
+  ceph_le64 image_size;  ///< image generation the entries were written in
+  ceph_le64 snap_seq;
+  ceph_le32 crc;  ///< of everything above
+} __attribute__ ((packed));
+
+struct log_entry_header_t {
+  ceph_le32 magic;
+  ceph_le32 type;
+  ceph_le64 seq;
+  ceph_le64 image_off;
+  ceph_le64 length;    ///< image bytes, or log bytes for a pad
+  ceph_le64 data_len;
+  ceph_le32 data_crc;
+  ceph_le32 crc;       ///< of everything above
+  uint8_t reserved[16];
+} __attribute__ ((packed));
+
+const uint64_t HEADER_SIZE = sizeof(log_entry_header_t);
+static_assert(HEADER_SIZE == 64, "log entry header must be 64 bytes");
+
+} // anonymous namespace
+
+template <typename I>
+FileImageCache<I>::FileImageCache(I &image_ctx)
+  : m_image_ctx(image_ctx), m_image_writeback(image_ctx),
+    m_lock("librbd::cache::FileImageCache::m_lock"),
+    m_log_thread(this) {
+  m_path = image_ctx.persistent_cache_path + "/rbd-pcache." +
+           stringify(image_ctx.md_ctx.get_id()) + "." + image_ctx.id;
+  m_log_size = P2ALIGN(image_ctx.persistent_cache_size, SUPER_SIZE);
+  m_destage_max_bytes = image_ctx.persistent_cache_destage_max_bytes;
+}
+
+template <typename I>
+FileImageCache<I>::~FileImageCache() {
+  assert(m_fd < 0);
+}
+
+template <typename I>
+uint64_t FileImageCache<I>::entry_log_len(uint64_t data_len) {
+  return P2ROUNDUP(HEADER_SIZE + data_len, ENTRY_ALIGN);
+}
+
+template <typename I>
+void FileImageCache<I>::map_insert(DirtyMap *map, uint64_t off, uint64_t len,
+                                   uint64_t data_off, uint64_t seq) {
+  uint64_t end = off + len;
+  auto it = map->lower_bound(off);
+  if (it != map->begin()) {
+    auto prev = std::prev(it);
+    if (prev->first + prev->second.length > off) {
+      it = prev;
+    }
+  }
+
+  // trim whatever the new extent overlaps
+  while (it != map->end() && it->first < end) {
+    uint64_t e_off = it->first;
+    DirtyExtent e = it->second;
+    uint64_t e_end = e_off + e.length;
+    it = map->erase(it);
+    if (e_off < off) {
+      map->emplace(e_off, DirtyExtent{off - e_off, e.data_off, e.seq});
+    }
+    if (e_end > end) {
+      uint64_t skip = end - e_off;
+      map->emplace(end, DirtyExtent{e_end - end,
+                                    e.data_off ? e.data_off + skip : 0,
+                                    e.seq});
+    }
+  }
+  map->emplace(off, DirtyExtent{len, data_off, seq});
+}
+
+template <typename I>
+void FileImageCache<I>::aio_read(Extents &&image_extents, bufferlist *bl,
+                                 int fadvise_flags, Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "image_extents=" << image_extents << ", "
+                 << "on_finish=" << on_finish << dendl;
+
+  struct ReadPiece {
+    uint64_t length;
+    uint64_t data_off;
+    bool miss;
+    bufferlist bl;
+  };
+  auto pieces = std::make_shared<std::vector<ReadPiece> >();
+  Extents miss_extents;
+  uint64_t miss_len = 0;
+  bool log_reader = false;
+  {
+    Mutex::Locker locker(m_lock);
+    for (auto &extent : image_extents) {
+      uint64_t off = extent.first;
+      uint64_t end = off + extent.second;
+      auto it = m_dirty.lower_bound(off);
+      if (it != m_dirty.begin()) {
+        auto prev = std::prev(it);
+        if (prev->first + prev->second.length > off) {
+          it = prev;
+        }
+      }
+      while (off < end) {
+        uint64_t miss_end = end;
+        if (it != m_dirty.end() && it->first < end) {
+          miss_end = std::max(off, it->first);
+        }
+        if (miss_end > off) {
+          pieces->push_back({miss_end - off, 0, true, {}});
+          miss_extents.emplace_back(off, miss_end - off);
+          miss_len += miss_end - off;
+          off = miss_end;
+          continue;
+        }
+
+        uint64_t skip = off - it->first;
+        uint64_t len = std::min(it->first + it->second.length, end) - off;
+        uint64_t data_off = it->second.data_off ? it->second.data_off + skip : 0;
+        pieces->push_back({len, data_off, false, {}});
+        log_reader = log_reader || data_off != 0;
+        off += len;
+        ++it;
+      }
+    }
+    if (log_reader) {
+      ++m_log_readers;
+    }
+  }
+
+  // dirty data is read from the log right away; the space it sits in
+  // is not reused until the read is done
+  int r = 0;
+  for (auto &piece : *pieces) {
+    if (piece.miss) {
+      continue;
+    }
+    if (piece.data_off == 0) {
+      piece.bl.append_zero(piece.length);
+      continue;
+    }
+    bufferptr bp = buffer::create(piece.length);
+    r = safe_pread_exact(m_fd, bp.c_str(), piece.length, piece.data_off);
+    if (r < 0) {
+      lderr(cct) << "failed to read from cache log: " << cpp_strerror(r)
+                 << dendl;
+      break;
+    }
+    piece.bl.push_back(std::move(bp));
+  }
+  if (log_reader) {
+    Mutex::Locker locker(m_lock);
+    release_log_reader();
+  }
+  if (r < 0) {
+    on_finish->complete(r);
+    return;
+  }
+
+  auto miss_bl = std::make_shared<bufferlist>();
+  auto ctx = new FunctionContext(
+    [pieces, miss_bl, miss_len, bl, on_finish](int r) {
+      if (r < 0) {
+        on_finish->complete(r);
+        return;
+      }
+      if (miss_bl->length() < miss_len) {
+        miss_bl->append_zero(miss_len - miss_bl->length());
+      }
+      uint64_t miss_off = 0;
+      for (auto &piece : *pieces) {
+        if (piece.miss) {
+          bufferlist sub;
+          sub.substr_of(*miss_bl, miss_off, piece.length);
+          miss_off += piece.length;
+          bl->claim_append(sub);
+        } else {
+          bl->claim_append(piece.bl);
+        }
+      }
+      on_finish->complete(0);
+    });
+
+  if (miss_extents.empty()) {
+    ctx->complete(0);
+    return;
+  }
+  m_image_writeback.aio_read(std::move(miss_extents), miss_bl.get(),
+                             fadvise_flags, ctx);
+}
+
+template <typename I>
+void FileImageCache<I>::aio_write(Extents &&image_extents,
+                                  bufferlist&& bl,
+                                  int fadvise_flags,
+                                  Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "image_extents=" << image_extents << ", "
+                 << "on_finish=" << on_finish << dendl;
+
+  LogEntries entries;
+  split_op(ENTRY_WRITE, image_extents, bl, &entries);
+  if (entries.empty()) {
+    m_image_ctx.op_work_queue->queue(on_finish, 0);
+    return;
+  }
+  entries.back().on_safe = on_finish;
+
+  uint64_t image_size;
+  uint64_t snap_seq;
+  get_generation(&image_size, &snap_seq);
+
+  Mutex::Locker locker(m_lock);
+  if (m_log_error < 0) {
+    m_image_ctx.op_work_queue->queue(on_finish, m_log_error);
+    return;
+  }
+  update_generation(image_size, snap_seq);
+  m_dirty_since_flush = true;
+  queue_op(std::move(entries));
+}
+
+template <typename I>
+void FileImageCache<I>::aio_discard(uint64_t offset, uint64_t length,
+                                    bool skip_partial_discard,
+                                    Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "offset=" << offset << ", "
+                 << "length=" << length << ", "
+                 << "on_finish=" << on_finish << dendl;
+
+  // partial discards are always zeroed on destage, so it does not
+  // matter whether the zeros were read from the log or the image
+  LogEntries entries;
+  bufferlist bl;
+  split_op(ENTRY_DISCARD, {{offset, length}}, bl, &entries);
+  if (entries.empty()) {
+    m_image_ctx.op_work_queue->queue(on_finish, 0);
+    return;
+  }
+  entries.back().on_safe = on_finish;
+
+  uint64_t image_size;
+  uint64_t snap_seq;
+  get_generation(&image_size, &snap_seq);
+
+  Mutex::Locker locker(m_lock);
+  if (m_log_error < 0) {
+    m_image_ctx.op_work_queue->queue(on_finish, m_log_error);
+    return;
+  }
+  update_generation(image_size, snap_seq);
+  m_dirty_since_flush = true;
+  queue_op(std::move(entries));
+}
+
+template <typename I>
+void FileImageCache<I>::aio_flush(Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "on_finish=" << on_finish << dendl;
+
+  Mutex::Locker locker(m_lock);
+  if (m_log_error < 0) {
+    m_image_ctx.op_work_queue->queue(on_finish, m_log_error);
+    return;
+  }
+
+  // writes are only acked once they are in the log, so a flush only
+  // has to wait for whatever is still being appended.  The barrier it
+  // leaves in the log keeps destage from reordering across it.
+  if (!m_dirty_since_flush && m_blocked_ops.empty() &&
+      m_synced_seq + 1 == m_next_seq) {
+    m_image_ctx.op_work_queue->queue(on_finish, 0);
+    return;
+  }
+
+  LogEntries entries;
+  bufferlist bl;
+  split_op(ENTRY_FLUSH, {}, bl, &entries);
+  entries.back().on_safe = on_finish;
+  m_dirty_since_flush = false;
+  queue_op(std::move(entries));
+}
+
+template <typename I>
+void FileImageCache<I>::aio_writesame(uint64_t offset, uint64_t length,
+                                      bufferlist&& bl, int fadvise_flags,
+                                      Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "offset=" << offset << ", "
+                 << "length=" << length << ", "
+                 << "data_len=" << bl.length() << ", "
+                 << "on_finish=" << on_finish << dendl;
+
+  // not cached: destage what is dirty and pass it on
+  auto ctx = new FunctionContext(
+    [this, offset, length, bl=std::move(bl), fadvise_flags, on_finish]
+    (int r) mutable {
+      if (r < 0) {
+        on_finish->complete(r);
+        return;
+      }
+      m_image_writeback.aio_writesame(offset, length, std::move(bl),
+                                      fadvise_flags, on_finish);
+    });
+  destage_all(ctx);
+}
+
+template <typename I>
+void FileImageCache<I>::aio_compare_and_write(Extents &&image_extents,
+                                              bufferlist&& cmp_bl,
+                                              bufferlist&& bl,
+                                              uint64_t *mismatch_offset,
+                                              int fadvise_flags,
+                                              Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "image_extents=" << image_extents << ", "
+                 << "on_finish=" << on_finish << dendl;
+
+  // the compare has to see the latest data, so destage first
+  auto ctx = new FunctionContext(
+    [this, image_extents=std::move(image_extents), cmp_bl=std::move(cmp_bl),
+     bl=std::move(bl), mismatch_offset, fadvise_flags, on_finish]
+    (int r) mutable {
+      if (r < 0) {
+        on_finish->complete(r);
+        return;
+      }
+      m_image_writeback.aio_compare_and_write(
+        std::move(image_extents), std::move(cmp_bl), std::move(bl),
+        mismatch_offset, fadvise_flags, on_finish);
+    });
+  destage_all(ctx);
+}
+
+template <typename I>
+void FileImageCache<I>::init(Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 5) << "path=" << m_path << dendl;
+
+  int r = open_log();
+  if (r < 0) {
+    on_finish->complete(r);
+    return;
+  }
+  check_owner(on_finish);
+}
+
+template <typename I>
+void FileImageCache<I>::check_owner(Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 10) << dendl;
+
+  librados::ObjectReadOperation op;
+  cls_client::metadata_get_start(&op, OWNER_KEY);
+
+  auto out_bl = std::make_shared<bufferlist>();
+  auto ctx = new FunctionContext([this, out_bl, on_finish](int r) {
+      std::string owner;
+      if (r == 0) {
+        bufferlist::iterator it = out_bl->begin();
+        r = cls_client::metadata_get_finish(&it, &owner);
+      }
+      handle_check_owner(owner, r, on_finish);
+    });
+  librados::AioCompletion *comp = util::create_rados_callback(ctx);
+  int r = m_image_ctx.md_ctx.aio_operate(m_image_ctx.header_oid, comp, &op,
+                                         out_bl.get());
+  assert(r == 0);
+  comp->release();
+}
+
+template <typename I>
+void FileImageCache<I>::handle_check_owner(const std::string &owner, int r,
+                                           Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 10) << "owner=" << owner << ", r=" << r << dendl;
+
+  if (r < 0 && r != -ENOENT) {
+    lderr(cct) << "failed to read cache owner: " << cpp_strerror(r) << dendl;
+    close_log();
+    on_finish->complete(r);
+    return;
+  }
+
+  // the image was written, resized or snapshotted without this log
+  // since it was last open: replaying it would revert all of that
+  uint64_t image_size;
+  uint64_t snap_seq;
+  get_generation(&image_size, &snap_seq);
+  if (!m_entries.empty() &&
+      (owner != m_owner || image_size != m_image_size ||
+       snap_seq != m_snap_seq)) {
+    lderr(cct) << "discarding " << m_entries.size() << " stale log entries: "
+               << "owner=" << owner << " (log " << m_owner << "), "
+               << "size=" << image_size << " (log " << m_image_size << "), "
+               << "snap_seq=" << snap_seq << " (log " << m_snap_seq << ")"
+               << dendl;
+    r = discard_log();
+    if (r < 0) {
+      lderr(cct) << "failed to discard log: " << cpp_strerror(r) << dendl;
+      close_log();
+      on_finish->complete(r);
+      return;
+    }
+  }
+
+  // only the owner can destage its dirty data
+  if (!owner.empty() && owner != m_owner) {
+    if (!m_image_ctx.persistent_cache_discard_dirty) {
+      lderr(cct) << "image has dirty data cached by " << owner << ": close "
+                 << "it there, or set rbd_persistent_cache_discard_dirty to "
+                 << "discard it" << dendl;
+      close_log();
+      on_finish->complete(-EBUSY);
+      return;
+    }
+    lderr(cct) << "discarding dirty data cached by " << owner << dendl;
+  }
+
+  if (owner == m_owner) {
+    recover(on_finish);
+    return;
+  }
+  set_owner(on_finish);
+}
+
+template <typename I>
+void FileImageCache<I>::set_owner(Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 10) << "owner=" << m_owner << dendl;
+
+  std::map<std::string, bufferlist> data;
+  data[OWNER_KEY].append(m_owner);
+
+  librados::ObjectWriteOperation op;
+  cls_client::metadata_set(&op, data);
+
+  auto ctx = new FunctionContext([this, on_finish](int r) {
+      if (r < 0) {
+        CephContext *cct = m_image_ctx.cct;
+        lderr(cct) << "failed to set cache owner: " << cpp_strerror(r)
+                   << dendl;
+        close_log();
+        on_finish->complete(r);
+        return;
+      }
+      recover(on_finish);
+    });
+  librados::AioCompletion *comp = util::create_rados_callback(ctx);
+  int r = m_image_ctx.md_ctx.aio_operate(m_image_ctx.header_oid, comp, &op);
+  assert(r == 0);
+  comp->release();
+}
+
+template <typename I>
+void FileImageCache<I>::remove_owner(Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 10) << dendl;
+
+  librados::ObjectWriteOperation op;
+  cls_client::metadata_remove(&op, OWNER_KEY);
+
+  auto ctx = new FunctionContext([this, on_finish](int r) {
+      if (r == -ENOENT) {
+        r = 0;
+      } else if (r < 0) {
+        CephContext *cct = m_image_ctx.cct;
+        lderr(cct) << "failed to remove cache owner: " << cpp_strerror(r)
+                   << dendl;
+      }
+      on_finish->complete(r);
+    });
+  librados::AioCompletion *comp = util::create_rados_callback(ctx);
+  int r = m_image_ctx.md_ctx.aio_operate(m_image_ctx.header_oid, comp, &op);
+  assert(r == 0);
+  comp->release();
+}
+
+template <typename I>
+void FileImageCache<I>::recover(Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  m_log_thread.create("rbd_pcache");
+
+  {
+    Mutex::Locker locker(m_lock);
+    if (m_entries.empty()) {
+      m_image_ctx.op_work_queue->queue(on_finish, 0);
+      return;
+    }
+    ldout(cct, 5) << "destaging " << m_entries.size() << " recovered log "
+                  << "entries" << dendl;
+  }
+
+  on_finish = new FunctionContext([this, on_finish](int r) {
+      if (r < 0) {
+        stop_log();
+      }
+      on_finish->complete(r);
+    });
+
+  // recovered writes can only be destaged by the lock owner
+  auto ctx = new FunctionContext([this, on_finish](int r) {
+      CephContext *cct = m_image_ctx.cct;
+      {
+        RWLock::RLocker owner_locker(m_image_ctx.owner_lock);
+        if (r == 0 && m_image_ctx.exclusive_lock != nullptr &&
+            !m_image_ctx.exclusive_lock->is_lock_owner()) {
+          r = -EROFS;
+        }
+      }
+      if (r < 0) {
+        lderr(cct) << "failed to acquire exclusive lock for recovered "
+                   << "writes: " << cpp_strerror(r) << dendl;
+        on_finish->complete(r);
+        return;
+      }
+      destage_all(on_finish);
+    });
+
+  RWLock::RLocker owner_locker(m_image_ctx.owner_lock);
+  if (m_image_ctx.exclusive_lock != nullptr &&
+      !m_image_ctx.exclusive_lock->is_lock_owner()) {
+    m_image_ctx.exclusive_lock->acquire_lock(ctx);
+  } else {
+    m_image_ctx.op_work_queue->queue(ctx, 0);
+  }
+}
+
+template <typename I>
+void FileImageCache<I>::shut_down(Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 5) << dendl;
+
+  auto ctx = new FunctionContext([this, on_finish](int r) {
+      auto finish_ctx = new FunctionContext([this, on_finish](int r) {
+          stop_log();
+
+          // the owner may delete us on completion
+          m_image_ctx.op_work_queue->queue(on_finish, r);
+        });
+
+      if (r < 0) {
+        // keep the owner: the dirty data is still ours to destage
+        CephContext *cct = m_image_ctx.cct;
+        lderr(cct) << "failed to destage cache, leaving dirty data in "
+                   << m_path << ": " << cpp_strerror(r) << dendl;
+        finish_ctx->complete(r);
+        return;
+      }
+      remove_owner(finish_ctx);
+    });
+  destage_all(ctx);
+}
+
+template <typename I>
+void FileImageCache<I>::invalidate(Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "on_finish=" << on_finish << dendl;
+
+  // there is nothing clean to drop: once destaged, nothing is cached
+  destage_all(on_finish);
+}
+
+template <typename I>
+void FileImageCache<I>::flush(Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "on_finish=" << on_finish << dendl;
+
+  destage_all(on_finish);
+}
+
+template <typename I>
+int FileImageCache<I>::open_log() {
+  CephContext *cct = m_image_ctx.cct;
+
+  m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (m_fd < 0) {
+    int r = -errno;
+    lderr(cct) << "failed to open " << m_path << ": " << cpp_strerror(r)
+               << dendl;
+    return r;
+  }
+
+  int r = read_super();
+  if (r == -ENOENT) {
+    ldout(cct, 5) << "creating log, size=" << m_log_size << dendl;
+    librados::Rados rados(m_image_ctx.md_ctx);
+    m_log_id = rados.get_instance_id();
+    get_generation(&m_image_size, &m_snap_seq);
+    m_head_off = SUPER_SIZE;
+    m_head_seq = 1;
+    m_tail_off = SUPER_SIZE;
+    m_next_seq = 1;
+    m_synced_seq = 0;
+    if (::ftruncate(m_fd, m_log_size) < 0) {
+      r = -errno;
+    } else {
+      r = write_super(m_head_off, m_head_seq, m_image_size, m_snap_seq);
+    }
+    if (r == 0 && ::fdatasync(m_fd) < 0) {
+      r = -errno;
+    }
+  } else if (r == 0) {
+    r = replay_log();
+  }
+
+  if (r < 0) {
+    lderr(cct) << "failed to open log " << m_path << ": " << cpp_strerror(r)
+               << dendl;
+    close_log();
+    return r;
+  }
+
+  std::ostringstream owner;
+  owner << ceph_get_hostname() << ":" << std::hex << m_log_id;
+  m_owner = owner.str();
+  m_max_entry_data = std::min(
+    MAX_ENTRY_DATA, P2ALIGN((m_log_size - SUPER_SIZE) / 8, ENTRY_ALIGN));
+  return 0;
+}
+
+template <typename I>
+void FileImageCache<I>::stop_log() {
+  m_lock.Lock();
+  m_log_stop = true;
+  m_log_cond.Signal();
+  m_lock.Unlock();
+  m_log_thread.join();
+
+  close_log();
+}
+
+template <typename I>
+void FileImageCache<I>::close_log() {
+  VOID_TEMP_FAILURE_RETRY(::close(m_fd));
+  m_fd = -1;
+}
+
+template <typename I>
+int FileImageCache<I>::read_super() {
+  CephContext *cct = m_image_ctx.cct;
+
+  log_super_t super;
+  int r = safe_pread(m_fd, &super, sizeof(super), 0);
+  if (r < 0) {
+    return r;
+  } else if (r < (int)sizeof(super)) {
+    return -ENOENT;
+  }
+
+  if (super.magic != SUPER_MAGIC) {
+    lderr(cct) << m_path << " is not an image cache log" << dendl;
+    return -EINVAL;
+  }
+  if (super.crc != ceph_crc32c(-1, (const unsigned char*)&super,
+                               offsetof(log_super_t, crc))) {
+    lderr(cct) << "bad superblock crc in " << m_path << dendl;
+    return -EIO;
+  }
+  if (super.version != LOG_VERSION) {
+    lderr(cct) << "unsupported log version " << super.version << dendl;
+    return -EINVAL;
+  }
+
+  // the ring geometry is fixed once the log exists
+  if (super.log_size != m_log_size) {
+    ldout(cct, 1) << "keeping log size " << super.log_size << " of existing "
+                  << "log, not " << m_log_size << dendl;
+    m_log_size = super.log_size;
+  }
+  m_head_off = super.head_off;
+  m_head_seq = super.head_seq;
+  m_log_id = super.log_id;
+  m_image_size = super.image_size;
+  m_snap_seq = super.snap_seq;
+  if (m_head_off < SUPER_SIZE || m_head_off >= m_log_size) {
+    lderr(cct) << "bad log head " << m_head_off << dendl;
+    return -EIO;
+  }
+  return 0;
+}
+
+template <typename I>
+int FileImageCache<I>::write_super(uint64_t head_off, uint64_t head_seq,
+                                   uint64_t image_size, uint64_t snap_seq) {
+  bufferptr bp = buffer::create_page_aligned(SUPER_SIZE);
+  bp.zero();
+  log_super_t *super = reinterpret_cast<log_super_t*>(bp.c_str());
+  super->magic = SUPER_MAGIC;
+  super->version = LOG_VERSION;
+  super->log_size = m_log_size;
+  super->head_off = head_off;
+  super->head_seq = head_seq;
+  super->log_id = m_log_id;
+  super->image_size = image_size;
+  super->snap_seq = snap_seq;
+  super->crc = ceph_crc32c(-1, (const unsigned char*)super,
+                           offsetof(log_super_t, crc));
+  return safe_pwrite(m_fd, bp.c_str(), SUPER_SIZE, 0);
+}
+
+template <typename I>
+int FileImageCache<I>::replay_log() {
+  CephContext *cct = m_image_ctx.cct;
+  uint64_t capacity = m_log_size - SUPER_SIZE;
+  uint64_t off = m_head_off;
+  uint64_t seq = m_head_seq;
+
+  // the log ends at the first entry that is torn or left over from an
+  // earlier lap of the ring
+  m_used = 0;
+  while (m_used < capacity) {
+    log_entry_header_t h;
+    int r = safe_pread_exact(m_fd, &h, sizeof(h), off);
+    if (r < 0) {
+      break;
+    }
+    if (h.magic != ENTRY_MAGIC || h.seq != seq ||
+        h.crc != ceph_crc32c(-1, (const unsigned char*)&h,
+                             offsetof(log_entry_header_t, crc))) {
+      break;
+    }
+
+    LogEntry e;
+    e.seq = seq;
+    e.type = h.type;
+    e.image_off = h.image_off;
+    e.length = h.length;
+    e.log_off = off;
+    e.log_len = e.type == ENTRY_PAD ? (uint64_t)h.length :
+                                      entry_log_len(h.data_len);
+    if (e.log_len == 0 || off + e.log_len > m_log_size ||
+        m_used + e.log_len > capacity) {
+      break;
+    }
+    if (e.type == ENTRY_WRITE) {
+      if (h.data_len != e.length) {
+        break;
+      }
+      bufferptr bp = buffer::create(h.data_len);
+      r = safe_pread_exact(m_fd, bp.c_str(), h.data_len, off + HEADER_SIZE);
+      if (r < 0 ||
+          h.data_crc != ceph_crc32c(-1, (const unsigned char*)bp.c_str(),
+                                    h.data_len)) {
+        break;
+      }
+      map_insert(&m_dirty, e.image_off, e.length, off + HEADER_SIZE, seq);
+    } else if (e.type == ENTRY_DISCARD) {
+      map_insert(&m_dirty, e.image_off, e.length, 0, seq);
+    } else if (e.type != ENTRY_FLUSH && e.type != ENTRY_PAD) {
+      break;
+    }
+
+    m_entries.push_back(e);
+    m_used += e.log_len;
+    off += e.log_len;
+    if (off == m_log_size) {
+      off = SUPER_SIZE;
+    }
+    ++seq;
+  }
+
+  m_tail_off = off;
+  m_next_seq = seq;
+  m_synced_seq = seq - 1;
+  ldout(cct, 5) << "replayed " << m_entries.size() << " entries, "
+                << m_used << " bytes, "
+                << m_dirty.size() << " dirty extents" << dendl;
+  return 0;
+}
+
+template <typename I>
+int FileImageCache<I>::discard_log() {
+  m_entries.clear();
+  m_dirty.clear();
+  m_used = 0;
+  m_head_off = m_tail_off;
+  m_head_seq = m_next_seq;
+  get_generation(&m_image_size, &m_snap_seq);
+
+  int r = write_super(m_head_off, m_head_seq, m_image_size, m_snap_seq);
+  if (r == 0 && ::fdatasync(m_fd) < 0) {
+    r = -errno;
+  }
+  return r;
+}
+
+template <typename I>
+void FileImageCache<I>::get_generation(uint64_t *image_size,
+                                       uint64_t *snap_seq) {
+  RWLock::RLocker snap_locker(m_image_ctx.snap_lock);
+  *image_size = m_image_ctx.size;
+  *snap_seq = m_image_ctx.snapc.seq;
+}
+
+template <typename I>
+void FileImageCache<I>::update_generation(uint64_t image_size,
+                                          uint64_t snap_seq) {
+  assert(m_lock.is_locked());
+  if (image_size == m_image_size && snap_seq == m_snap_seq) {
+    return;
+  }
+
+  // resized or snapshotted since the super was written, which destages
+  // everything first: the new generation covers the whole log
+  m_image_size = image_size;
+  m_snap_seq = snap_seq;
+  m_super_dirty = true;
+}
+
+template <typename I>
+void FileImageCache<I>::log_thread_entry() {
+  CephContext *cct = m_image_ctx.cct;
+  Mutex::Locker locker(m_lock);
+  while (true) {
+    if (m_to_append.empty() && !m_super_dirty) {
+      if (m_log_stop) {
+        break;
+      }
+      m_log_cond.Wait(m_lock);
+      continue;
+    }
+
+    // group commit everything queued so far
+    LogEntries appends;
+    appends.swap(m_to_append);
+    bool super = m_super_dirty;
+    uint64_t head_off = m_head_off;
+    uint64_t head_seq = m_head_seq;
+    uint64_t image_size = m_image_size;
+    uint64_t snap_seq = m_snap_seq;
+    uint64_t freed = m_freed;
+    m_super_dirty = false;
+    m_freed = 0;
+    m_lock.Unlock();
+
+    int r = 0;
+    bufferlist run;
+    uint64_t run_off = 0;
+    for (auto &e : appends) {
+      if (run.length() > 0 && run_off + run.length() != e.log_off) {
+        r = run.write_fd(m_fd, run_off);
+        run.clear();
+        if (r < 0) {
+          break;
+        }
+      }
+      if (run.length() == 0) {
+        run_off = e.log_off;
+      }
+
+      bufferptr hp(HEADER_SIZE);
+      hp.zero();
+      log_entry_header_t *h = reinterpret_cast<log_entry_header_t*>(
+        hp.c_str());
+      h->magic = ENTRY_MAGIC;
+      h->type = e.type;
+      h->seq = e.seq;
+      h->image_off = e.image_off;
+      h->length = e.type == ENTRY_PAD ? e.log_len : e.length;
+      h->data_len = e.bl.length();
+      h->data_crc = e.bl.crc32c(-1);
+      h->crc = ceph_crc32c(-1, (const unsigned char*)h,
+                           offsetof(log_entry_header_t, crc));
+      run.append(std::move(hp));
+      run.claim_append(e.bl);
+      if (e.type != ENTRY_PAD) {
+        run.append_zero(e.log_len - HEADER_SIZE - h->data_len);
+      }
+    }
+    if (r == 0 && run.length() > 0) {
+      r = run.write_fd(m_fd, run_off);
+    }
+    if (r == 0 && super) {
+      r = write_super(head_off, head_seq, image_size, snap_seq);
+    }
+    if (r == 0 && ::fdatasync(m_fd) < 0) {
+      r = -errno;
+    }
+
+    m_lock.Lock();
+    if (r < 0) {
+      lderr(cct) << "failed to write log: " << cpp_strerror(r) << dendl;
+      m_log_error = r;
+    }
+
+    for (auto &e : appends) {
+      m_synced_seq = e.seq;
+      if (r < 0) {
+        // never made it: leave nothing behind for reads or destage
+        for (auto &l : m_entries) {
+          if (l.seq == e.seq) {
+            l.type = ENTRY_PAD;
+            break;
+          }
+        }
+      } else if (e.type == ENTRY_WRITE) {
+        map_insert(&m_dirty, e.image_off, e.length, e.log_off + HEADER_SIZE,
+                   e.seq);
+      } else if (e.type == ENTRY_DISCARD) {
+        map_insert(&m_dirty, e.image_off, e.length, 0, e.seq);
+      }
+      if (e.on_safe != nullptr) {
+        m_image_ctx.op_work_queue->queue(e.on_safe, r);
+      }
+    }
+    if (super && r == 0) {
+      release_space(freed);
+    }
+    maybe_destage();
+  }
+}
+
+template <typename I>
+void FileImageCache<I>::split_op(uint32_t type, const Extents &extents,
+                                 bufferlist &bl, LogEntries *entries) {
+  if (type == ENTRY_FLUSH) {
+    LogEntry e;
+    e.type = type;
+    e.log_len = entry_log_len(0);
+    entries->push_back(std::move(e));
+    return;
+  }
+
+  uint64_t bl_off = 0;
+  for (auto &extent : extents) {
+    uint64_t off = extent.first;
+    uint64_t left = extent.second;
+    while (left > 0) {
+      uint64_t len = left;
+      if (type == ENTRY_WRITE) {
+        len = std::min(left, m_max_entry_data);
+      }
+
+      LogEntry e;
+      e.type = type;
+      e.image_off = off;
+      e.length = len;
+      if (type == ENTRY_WRITE) {
+        e.bl.substr_of(bl, bl_off, len);
+        bl_off += len;
+        e.log_len = entry_log_len(len);
+      } else {
+        e.log_len = entry_log_len(0);
+      }
+      entries->push_back(std::move(e));
+      off += len;
+      left -= len;
+    }
+  }
+}
+
+template <typename I>
+void FileImageCache<I>::queue_op(LogEntries &&entries) {
+  assert(m_lock.is_locked());
+
+  // keep ops in order behind any that are waiting for space
+  if (m_blocked_ops.empty() && try_reserve(&entries)) {
+    return;
+  }
+
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 10) << "log full, used=" << m_used << dendl;
+  m_blocked_ops.push_back(std::move(entries));
+  maybe_destage();
+}
+
+template <typename I>
+bool FileImageCache<I>::try_reserve(LogEntries *entries) {
+  assert(m_lock.is_locked());
+
+  uint64_t capacity = m_log_size - SUPER_SIZE;
+  bool reserved = false;
+  while (!entries->empty()) {
+    LogEntry &e = entries->front();
+
+    // entries never wrap: pad out the end of the ring instead
+    uint64_t pad = 0;
+    if (m_tail_off + e.log_len > m_log_size) {
+      pad = m_log_size - m_tail_off;
+    }
+    if (m_used + pad + e.log_len > capacity) {
+      break;
+    }
+    if (pad > 0) {
+      LogEntry p;
+      p.seq = m_next_seq++;
+      p.type = ENTRY_PAD;
+      p.log_off = m_tail_off;
+      p.log_len = pad;
+      m_entries.push_back(p);
+      m_to_append.push_back(std::move(p));
+      m_used += pad;
+      m_tail_off = SUPER_SIZE;
+    }
+
+    e.seq = m_next_seq++;
+    e.log_off = m_tail_off;
+    m_used += e.log_len;
+    m_tail_off += e.log_len;
+    if (m_tail_off == m_log_size) {
+      m_tail_off = SUPER_SIZE;
+    }
+
+    LogEntry l;
+    l.seq = e.seq;
+    l.type = e.type;
+    l.image_off = e.image_off;
+    l.length = e.length;
+    l.log_off = e.log_off;
+    l.log_len = e.log_len;
+    m_entries.push_back(std::move(l));
+    m_to_append.splice(m_to_append.end(), *entries, entries->begin());
+    reserved = true;
+  }
+
+  if (reserved) {
+    m_log_cond.Signal();
+  }
+  return entries->empty();
+}
+
+template <typename I>
+void FileImageCache<I>::dispatch_blocked_ops() {
+  assert(m_lock.is_locked());
+  while (!m_blocked_ops.empty()) {
+    if (!try_reserve(&m_blocked_ops.front())) {
+      break;
+    }
+    m_blocked_ops.pop_front();
+  }
+}
+
+template <typename I>
+void FileImageCache<I>::release_log_reader() {
+  assert(m_lock.is_locked());
+  assert(m_log_readers > 0);
+  if (--m_log_readers == 0 && m_deferred_free > 0) {
+    m_used -= m_deferred_free;
+    m_deferred_free = 0;
+    dispatch_blocked_ops();
+  }
+}
+
+template <typename I>
+void FileImageCache<I>::release_space(uint64_t bytes) {
+  assert(m_lock.is_locked());
+  if (m_log_readers > 0) {
+    m_deferred_free += bytes;
+    return;
+  }
+  m_used -= bytes;
+  dispatch_blocked_ops();
+}
+
+template <typename I>
+void FileImageCache<I>::destage_all(Context *on_finish) {
+  Mutex::Locker locker(m_lock);
+  if (m_blocked_ops.empty()) {
+    wait_for_destage(m_next_seq - 1, on_finish);
+    return;
+  }
+
+  // ops waiting for space have no seq yet: queue a barrier behind them
+  LogEntries entries;
+  bufferlist bl;
+  split_op(ENTRY_FLUSH, {}, bl, &entries);
+  entries.back().on_safe = new FunctionContext([this, on_finish](int r) {
+      if (r < 0) {
+        on_finish->complete(r);
+        return;
+      }
+      Mutex::Locker locker(m_lock);
+      wait_for_destage(m_synced_seq, on_finish);
+    });
+  m_dirty_since_flush = false;
+  queue_op(std::move(entries));
+}
+
+template <typename I>
+void FileImageCache<I>::wait_for_destage(uint64_t seq, Context *on_finish) {
+  assert(m_lock.is_locked());
+  if (m_entries.empty() || m_entries.front().seq > seq) {
+    m_image_ctx.op_work_queue->queue(on_finish, 0);
+    return;
+  }
+  m_destage_waiters.emplace_back(seq, on_finish);
+  maybe_destage();
+}
+
+template <typename I>
+void FileImageCache<I>::complete_destage_waiters(int r) {
+  assert(m_lock.is_locked());
+  uint64_t head_seq = m_entries.empty() ? m_next_seq : m_entries.front().seq;
+  for (auto it = m_destage_waiters.begin(); it != m_destage_waiters.end(); ) {
+    if (r < 0 || it->first < head_seq) {
+      m_image_ctx.op_work_queue->queue(it->second, r);
+      it = m_destage_waiters.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+template <typename I>
+void FileImageCache<I>::maybe_destage() {
+  assert(m_lock.is_locked());
+  if (m_destaging) {
+    return;
+  }
+
+  // consecutive synced entries from the head, up to and including the
+  // next flush barrier
+  std::vector<LogEntry> batch;
+  uint64_t bytes = 0;
+  for (auto &e : m_entries) {
+    if (e.seq > m_synced_seq) {
+      break;
+    }
+    if (!batch.empty() && bytes + e.log_len > m_destage_max_bytes) {
+      break;
+    }
+    batch.push_back(e);
+    bytes += e.log_len;
+    if (e.type == ENTRY_FLUSH) {
+      break;
+    }
+  }
+  if (batch.empty()) {
+    return;
+  }
+
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "seq " << batch.front().seq << "~" << batch.size()
+                 << ", bytes=" << bytes << dendl;
+  m_destaging = true;
+  m_image_ctx.op_work_queue->queue(new FunctionContext(
+    [this, batch](int r) mutable {
+      destage_batch(std::move(batch));
+    }), 0);
+}
+
+template <typename I>
+void FileImageCache<I>::destage_batch(std::vector<LogEntry> &&batch) {
+  CephContext *cct = m_image_ctx.cct;
+  uint64_t last_seq = batch.back().seq;
+
+  // replay the batch so overwrites within it are only written once
+  auto batch_map = std::make_shared<DirtyMap>();
+  for (auto &e : batch) {
+    if (e.type == ENTRY_WRITE) {
+      map_insert(batch_map.get(), e.image_off, e.length,
+                 e.log_off + HEADER_SIZE, e.seq);
+    } else if (e.type == ENTRY_DISCARD) {
+      map_insert(batch_map.get(), e.image_off, e.length, 0, e.seq);
+    }
+  }
+
+  auto ctx = new FunctionContext([this, batch_map, last_seq](int r) {
+      finish_destage(*batch_map, last_seq, r);
+    });
+
+  RWLock::RLocker owner_locker(m_image_ctx.owner_lock);
+  if (!batch_map->empty() && m_image_ctx.exclusive_lock != nullptr &&
+      !m_image_ctx.exclusive_lock->is_lock_owner()) {
+    lderr(cct) << "exclusive lock not held, cannot destage" << dendl;
+    ctx->complete(-EROFS);
+    return;
+  }
+
+  // one multi-extent write per object set, one discard per zeroed range
+  uint64_t period = m_image_ctx.get_stripe_period();
+  C_GatherBuilder gather(cct, ctx);
+  Extents extents;
+  bufferlist bl;
+  uint64_t cur_set = 0;
+  for (auto &p : *batch_map) {
+    uint64_t off = p.first;
+    uint64_t end = off + p.second.length;
+    if (p.second.data_off == 0) {
+      m_image_writeback.aio_discard(off, p.second.length, false,
+                                    gather.new_sub());
+      continue;
+    }
+
+    while (off < end) {
+      uint64_t set = off / period;
+      uint64_t len = std::min(end, (set + 1) * period) - off;
+      if (!extents.empty() && set != cur_set) {
+        m_image_writeback.aio_write(std::move(extents), std::move(bl), 0,
+                                    gather.new_sub());
+        extents.clear();
+        bl.clear();
+      }
+      cur_set = set;
+
+      bufferptr bp = buffer::create(len);
+      int r = safe_pread_exact(m_fd, bp.c_str(), len,
+                               p.second.data_off + (off - p.first));
+      if (r < 0) {
+        lderr(cct) << "failed to read from cache log: " << cpp_strerror(r)
+                   << dendl;
+        gather.new_sub()->complete(r);
+        extents.clear();
+        bl.clear();
+        break;
+      }
+      if (!extents.empty() &&
+          extents.back().first + extents.back().second == off) {
+        extents.back().second += len;
+      } else {
+        extents.emplace_back(off, len);
+      }
+      bl.push_back(std::move(bp));
+      off += len;
+    }
+  }
+  if (!extents.empty()) {
+    m_image_writeback.aio_write(std::move(extents), std::move(bl), 0,
+                                gather.new_sub());
+  }
+  if (!gather.has_subs()) {
+    // only barriers and pads
+    gather.new_sub()->complete(0);
+  }
+  gather.activate();
+}
+
+template <typename I>
+void FileImageCache<I>::finish_destage(const DirtyMap &batch_map,
+                                       uint64_t last_seq, int r) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "last_seq=" << last_seq << ", r=" << r << dendl;
+
+  Mutex::Locker locker(m_lock);
+  m_destaging = false;
+  if (r < 0) {
+    lderr(cct) << "failed to destage: " << cpp_strerror(r) << dendl;
+    complete_destage_waiters(r);
+    return;
+  }
+
+  // anything not overwritten since is clean now
+  for (auto &p : batch_map) {
+    auto it = m_dirty.lower_bound(p.first);
+    while (it != m_dirty.end() && it->first < p.first + p.second.length) {
+      if (it->second.seq <= last_seq) {
+        it = m_dirty.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  uint64_t freed = 0;
+  while (!m_entries.empty() && m_entries.front().seq <= last_seq) {
+    freed += m_entries.front().log_len;
+    m_entries.pop_front();
+  }
+  if (m_entries.empty()) {
+    m_head_off = m_tail_off;
+    m_head_seq = m_next_seq;
+  } else {
+    m_head_off = m_entries.front().log_off;
+    m_head_seq = m_entries.front().seq;
+  }
+
+  // the space is reused only once the new head is on disk
+  m_freed += freed;
+  m_super_dirty = true;
+  m_log_cond.Signal();
+
+  complete_destage_waiters(0);
+  maybe_destage();
+}
+
+} // namespace cache
+} // namespace librbd
+
+template class librbd::cache::FileImageCache<librbd::ImageCtx>;
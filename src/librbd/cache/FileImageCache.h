@@ -0,0 +1,215 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_LIBRBD_CACHE_FILE_IMAGE_CACHE
+#define CEPH_LIBRBD_CACHE_FILE_IMAGE_CACHE
+
+#include "ImageCache.h"
+#include "ImageWriteback.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "include/buffer.h"
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace librbd {
+
+struct ImageCtx;
+
+namespace cache {
+
+/**
+ * Persistent write-back image extent cache
+ *
+ * Writes and discards are appended to a log in a local file (which may
+ * live on a local SSD) and are acknowledged once the log has been
+ * synced.  Appends are group committed by a dedicated thread, so many
+ * small writes share one fdatasync.  Reads of dirty ranges are served
+ * from the log, everything else is read from the image.
+ *
+ * The log is destaged to the image in order, one batch at a time.  A
+ * batch never crosses a flush barrier; within a batch, overlapping
+ * writes are coalesced and the result is issued as one multi-extent
+ * request per object.  Once a batch is stable the log head is advanced
+ * and its space reused.
+ *
+ * After a crash the log is replayed from the head recorded in the
+ * superblock, and whatever survives is destaged when the image is
+ * opened again.  The log assumes a single writer, i.e. that writes are
+ * only issued while holding the exclusive lock.
+ *
+ * While the cache is open, the image metadata names its owner (host
+ * and log id); the key is only removed once everything is destaged on
+ * close.  Another cache refuses to open the image while it is set.  A
+ * recovered log is only replayed if the image still names it as owner
+ * and the image size and snapshot sequence match the ones recorded in
+ * the superblock, otherwise it is stale and discarded.
+ *
+ * <pre>
+ * log file layout:
+ *
+ *   0        SUPER_SIZE                                     log_size
+ *   | super  | entry | entry | ... | pad | entry | ...          |
+ *                    ^ head                      ^ tail
+ * </pre>
+ */
+template <typename ImageCtxT = librbd::ImageCtx>
+class FileImageCache : public ImageCache {
+public:
+  FileImageCache(ImageCtxT &image_ctx);
+  ~FileImageCache() override;
+
+  /// client AIO methods
+  void aio_read(Extents&& image_extents, ceph::bufferlist *bl,
+                int fadvise_flags, Context *on_finish) override;
+  void aio_write(Extents&& image_extents, ceph::bufferlist&& bl,
+                 int fadvise_flags, Context *on_finish) override;
+  void aio_discard(uint64_t offset, uint64_t length,
+                   bool skip_partial_discard, Context *on_finish) override;
+  void aio_flush(Context *on_finish) override;
+  void aio_writesame(uint64_t offset, uint64_t length,
+                     ceph::bufferlist&& bl,
+                     int fadvise_flags, Context *on_finish) override;
+  void aio_compare_and_write(Extents&& image_extents,
+                             ceph::bufferlist&& cmp_bl, ceph::bufferlist&& bl,
+                             uint64_t *mismatch_offset, int fadvise_flags,
+                             Context *on_finish) override;
+
+  /// internal state methods
+  void init(Context *on_finish) override;
+  void shut_down(Context *on_finish) override;
+
+  void invalidate(Context *on_finish) override;
+  void flush(Context *on_finish) override;
+
+private:
+  enum {
+    ENTRY_WRITE = 1,
+    ENTRY_DISCARD = 2,
+    ENTRY_FLUSH = 3,
+    ENTRY_PAD = 4,
+  };
+
+  /// a log entry, from its header up to the next entry
+  struct LogEntry {
+    uint64_t seq = 0;
+    uint32_t type = 0;
+    uint64_t image_off = 0;
+    uint64_t length = 0;     ///< image bytes covered
+    uint64_t log_off = 0;    ///< offset of the header in the file
+    uint64_t log_len = 0;    ///< bytes taken in the log
+    ceph::bufferlist bl;     ///< payload, only until it is on disk
+    Context *on_safe = nullptr;
+  };
+
+  /// a dirty image range, pointing at its latest data in the log
+  struct DirtyExtent {
+    uint64_t length;
+    uint64_t data_off;  ///< payload offset in the file, or 0 for zeros
+    uint64_t seq;
+  };
+  typedef std::map<uint64_t, DirtyExtent> DirtyMap;
+
+  /// the entries of one write, discard or flush, in order
+  typedef std::list<LogEntry> LogEntries;
+
+  struct LogThread : public Thread {
+    FileImageCache *cache;
+    explicit LogThread(FileImageCache *cache) : cache(cache) {}
+    void *entry() override {
+      cache->log_thread_entry();
+      return nullptr;
+    }
+  };
+
+  ImageCtxT &m_image_ctx;
+  ImageWriteback<ImageCtxT> m_image_writeback;
+
+  std::string m_path;
+  int m_fd = -1;
+  uint64_t m_log_size = 0;
+  uint64_t m_max_entry_data = 0;
+  uint64_t m_destage_max_bytes = 0;
+  uint64_t m_log_id = 0;       ///< picked when the log is created
+  std::string m_owner;         ///< host and log id, kept in image metadata
+
+  Mutex m_lock;
+  Cond m_log_cond;
+  LogThread m_log_thread;
+  bool m_log_stop = false;
+  int m_log_error = 0;
+
+  uint64_t m_head_off = 0;     ///< oldest entry still needed
+  uint64_t m_head_seq = 0;
+  uint64_t m_tail_off = 0;     ///< where the next entry goes
+  uint64_t m_used = 0;         ///< bytes between head and tail
+  uint64_t m_next_seq = 0;
+  uint64_t m_synced_seq = 0;   ///< last entry known to be on disk
+  bool m_dirty_since_flush = false;
+  uint64_t m_image_size = 0;   ///< image generation the log was written in
+  uint64_t m_snap_seq = 0;
+
+  std::deque<LogEntry> m_entries;        ///< head to tail, minus payloads
+  LogEntries m_to_append;                ///< reserved, not yet written
+  std::list<LogEntries> m_blocked_ops;   ///< waiting for log space
+  DirtyMap m_dirty;
+
+  bool m_super_dirty = false;            ///< head moved, super not written
+  uint64_t m_freed = 0;                  ///< freed once the super is safe
+  uint64_t m_deferred_free = 0;          ///< freed once readers are done
+  uint32_t m_log_readers = 0;            ///< reads of dirty data in flight
+
+  bool m_destaging = false;
+  std::list<std::pair<uint64_t, Context*> > m_destage_waiters;
+
+  static uint64_t entry_log_len(uint64_t data_len);
+  static void map_insert(DirtyMap *map, uint64_t off, uint64_t len,
+                         uint64_t data_off, uint64_t seq);
+
+  void log_thread_entry();
+
+  int open_log();
+  void close_log();
+  void stop_log();
+  int read_super();
+  int write_super(uint64_t head_off, uint64_t head_seq, uint64_t image_size,
+                  uint64_t snap_seq);
+  int replay_log();
+  int discard_log();
+
+  void check_owner(Context *on_finish);
+  void handle_check_owner(const std::string &owner, int r,
+                          Context *on_finish);
+  void set_owner(Context *on_finish);
+  void remove_owner(Context *on_finish);
+  void recover(Context *on_finish);
+  void get_generation(uint64_t *image_size, uint64_t *snap_seq);
+  void update_generation(uint64_t image_size, uint64_t snap_seq);
+
+  void split_op(uint32_t type, const Extents &extents, ceph::bufferlist &bl,
+                LogEntries *entries);
+  void queue_op(LogEntries &&entries);
+  bool try_reserve(LogEntries *entries);
+  void dispatch_blocked_ops();
+
+  void release_log_reader();
+  void release_space(uint64_t bytes);
+
+  void destage_all(Context *on_finish);
+  void wait_for_destage(uint64_t seq, Context *on_finish);
+  void complete_destage_waiters(int r);
+  void maybe_destage();
+  void destage_batch(std::vector<LogEntry> &&batch);
+  void finish_destage(const DirtyMap &batch_map, uint64_t last_seq, int r);
+};
+
+} // namespace cache
+} // namespace librbd
+
+extern template class librbd::cache::FileImageCache<librbd::ImageCtx>;
+
+#endif // CEPH_LIBRBD_CACHE_FILE_IMAGE_CACHE
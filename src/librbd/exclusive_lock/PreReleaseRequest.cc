@@ -161,7 +161,8 @@ void PreReleaseRequest<I>::handle_wait_for_ops(int r) {
 
 template <typename I>
 void PreReleaseRequest<I>::send_invalidate_cache(bool purge_on_error) {
-  if (m_image_ctx.object_cacher == nullptr) {
+  if (m_image_ctx.object_cacher == nullptr &&
+      m_image_ctx.image_cache == nullptr) {
     send_flush_notifies();
     return;
   }
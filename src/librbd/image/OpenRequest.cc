@@ -7,6 +7,7 @@
 #include "cls/rbd/cls_rbd_client.h"
 #include "librbd/ImageCtx.h"
 #include "librbd/Utils.h"
+#include "librbd/cache/FileImageCache.h"
 #include "librbd/image/CloseRequest.h"
 #include "librbd/image/RefreshRequest.h"
 #include "librbd/image/SetSnapRequest.h"
@@ -528,8 +529,136 @@ Context *OpenRequest<I>::handle_refresh(int *result) {
     send_close_image(*result);
     return nullptr;
   } else {
+    return send_init_cache(result);
+  }
+}
+
+template <typename I>
+Context *OpenRequest<I>::send_init_cache(int *result) {
+  if (!m_image_ctx->persistent_cache_enabled()) {
+    return send_check_cache_owner(result);
+  }
+
+  CephContext *cct = m_image_ctx->cct;
+  if (m_image_ctx->test_features(RBD_FEATURE_JOURNALING)) {
+    ldout(cct, 5) << "persistent cache disabled: image uses journaling"
+                  << dendl;
+    return send_check_cache_owner(result);
+  }
+
+  ldout(cct, 10) << this << " " << __func__ << dendl;
+
+  m_image_ctx->image_cache = new cache::FileImageCache<I>(*m_image_ctx);
+
+  using klass = OpenRequest<I>;
+  Context *ctx = create_context_callback<
+    klass, &klass::handle_init_cache>(this);
+  m_image_ctx->image_cache->init(ctx);
+  return nullptr;
+}
+
+template <typename I>
+Context *OpenRequest<I>::handle_init_cache(int *result) {
+  CephContext *cct = m_image_ctx->cct;
+  ldout(cct, 10) << __func__ << ": r=" << *result << dendl;
+
+  if (*result < 0) {
+    lderr(cct) << "failed to init persistent cache: " << cpp_strerror(*result)
+               << dendl;
+    delete m_image_ctx->image_cache;
+    m_image_ctx->image_cache = nullptr;
+    send_close_image(*result);
+    return nullptr;
+  }
+
+  return send_set_snap(result);
+}
+
+template <typename I>
+Context *OpenRequest<I>::send_check_cache_owner(int *result) {
+  // writes that bypass the persistent cache of another client would be
+  // reverted when it writes back its dirty data
+  if (m_image_ctx->read_only || !m_image_ctx->snap_name.empty()) {
+    return send_set_snap(result);
+  }
+
+  CephContext *cct = m_image_ctx->cct;
+  ldout(cct, 10) << this << " " << __func__ << dendl;
+
+  librados::ObjectReadOperation op;
+  cls_client::metadata_get_start(&op, ImageCtx::PERSISTENT_CACHE_OWNER_KEY);
+
+  using klass = OpenRequest<I>;
+  librados::AioCompletion *comp =
+    create_rados_callback<klass, &klass::handle_check_cache_owner>(this);
+  m_out_bl.clear();
+  m_image_ctx->md_ctx.aio_operate(m_image_ctx->header_oid, comp, &op,
+                                  &m_out_bl);
+  comp->release();
+  return nullptr;
+}
+
+template <typename I>
+Context *OpenRequest<I>::handle_check_cache_owner(int *result) {
+  CephContext *cct = m_image_ctx->cct;
+  ldout(cct, 10) << __func__ << ": r=" << *result << dendl;
+
+  std::string owner;
+  if (*result == 0) {
+    bufferlist::iterator it = m_out_bl.begin();
+    *result = cls_client::metadata_get_finish(&it, &owner);
+  }
+
+  if (*result == -ENOENT || *result == -EOPNOTSUPP || *result == -EIO) {
     return send_set_snap(result);
+  } else if (*result < 0) {
+    lderr(cct) << "failed to read persistent cache owner: "
+               << cpp_strerror(*result) << dendl;
+    send_close_image(*result);
+    return nullptr;
   }
+
+  if (!m_image_ctx->persistent_cache_discard_dirty) {
+    lderr(cct) << "image has dirty data cached by " << owner << ": open it "
+               << "there with rbd_persistent_cache enabled, or set "
+               << "rbd_persistent_cache_discard_dirty to discard it" << dendl;
+    send_close_image(-EBUSY);
+    return nullptr;
+  }
+
+  lderr(cct) << "discarding dirty data cached by " << owner << dendl;
+  send_remove_cache_owner();
+  return nullptr;
+}
+
+template <typename I>
+void OpenRequest<I>::send_remove_cache_owner() {
+  CephContext *cct = m_image_ctx->cct;
+  ldout(cct, 10) << this << " " << __func__ << dendl;
+
+  librados::ObjectWriteOperation op;
+  cls_client::metadata_remove(&op, ImageCtx::PERSISTENT_CACHE_OWNER_KEY);
+
+  using klass = OpenRequest<I>;
+  librados::AioCompletion *comp =
+    create_rados_callback<klass, &klass::handle_remove_cache_owner>(this);
+  m_image_ctx->md_ctx.aio_operate(m_image_ctx->header_oid, comp, &op);
+  comp->release();
+}
+
+template <typename I>
+Context *OpenRequest<I>::handle_remove_cache_owner(int *result) {
+  CephContext *cct = m_image_ctx->cct;
+  ldout(cct, 10) << __func__ << ": r=" << *result << dendl;
+
+  if (*result < 0 && *result != -ENOENT) {
+    lderr(cct) << "failed to remove persistent cache owner: "
+               << cpp_strerror(*result) << dendl;
+    send_close_image(*result);
+    return nullptr;
+  }
+
+  return send_set_snap(result);
 }
 
 template <typename I>
@@ -64,6 +64,15 @@ private:
    *                                             REFRESH
    *                                                |
    *                                                v
+   *                                             INIT_CACHE (skip if no
+   *                                                |        persistent cache)
+   *                                                v
+   *                                             CHECK_CACHE_OWNER (skip if
+   *                                                |   read-only or cached)
+   *                                                v
+   *                                             REMOVE_CACHE_OWNER (skip if
+   *                                                |   no dirty data to discard)
+   *                                                v
    *                                             SET_SNAP (skip if no snap)
    *                                                |
    *                                                v
@@ -123,6 +132,15 @@ private:
   void send_refresh();
   Context *handle_refresh(int *result);
 
+  Context *send_init_cache(int *result);
+  Context *handle_init_cache(int *result);
+
+  Context *send_check_cache_owner(int *result);
+  Context *handle_check_cache_owner(int *result);
+
+  void send_remove_cache_owner();
+  Context *handle_remove_cache_owner(int *result);
+
   Context *send_set_snap(int *result);
   Context *handle_set_snap(int *result);
 
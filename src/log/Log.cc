@@ -6,6 +6,8 @@
 #include <errno.h>
 #include <syslog.h>
 
+#include <algorithm>
+
 #include "common/errno.h"
 #include "common/safe_io.h"
 #include "common/Clock.h"
@@ -24,12 +26,113 @@
 
 #define PREALLOC 1000000
 
+#define MIN_THREAD_RING 16
+#define SLAB_SIZE       1024  ///< bytes per recycled entry, Entry included
+#define MAX_FREE_SLABS  4096
+
 
 namespace ceph {
 namespace logging {
 
 static OnExitManager exit_callbacks;
 
+/// memory of a destroyed slab entry, waiting to be reused
+struct FreeSlab {
+  FreeSlab *next;
+};
+
+/**
+ * Entries submitted by one thread, drained by the flusher.
+ *
+ * Single producer (the owning thread), single consumer (whoever holds
+ * m_queue_mutex in flush()).  The ring is shared with the Log and with
+ * the thread's thread-local state, so either side may go away first.
+ */
+struct ThreadBuffer {
+  const unsigned m_mask;
+  std::unique_ptr<Entry*[]> m_ring;
+  std::atomic<unsigned> m_head = { 0 };  ///< next slot the thread fills
+  std::atomic<unsigned> m_tail = { 0 };  ///< next slot the flusher drains
+  std::atomic<bool> m_exited = { false };
+  FreeSlab *m_free = nullptr;  ///< slabs only the owning thread uses
+
+  explicit ThreadBuffer(unsigned size)
+    : m_mask(size - 1), m_ring(new Entry*[size]) {}
+  ~ThreadBuffer() {
+    Entry *e;
+    while ((e = pop()) != NULL)
+      delete e;
+    while (m_free) {
+      FreeSlab *n = m_free->next;
+      ::operator delete(m_free);
+      m_free = n;
+    }
+  }
+
+  bool push(Entry *e) {
+    unsigned h = m_head.load(std::memory_order_relaxed);
+    if (h - m_tail.load(std::memory_order_acquire) > m_mask)
+      return false;
+    m_ring[h & m_mask] = e;
+    // seq_cst: pairs with the flusher setting m_flusher_sleeping before
+    // it looks at the rings
+    m_head.store(h + 1);
+    return true;
+  }
+  Entry *pop() {
+    unsigned t = m_tail.load(std::memory_order_relaxed);
+    if (t == m_head.load())
+      return NULL;
+    Entry *e = m_ring[t & m_mask];
+    m_tail.store(t + 1, std::memory_order_release);
+    return e;
+  }
+  bool empty() const {
+    return m_tail.load() == m_head.load();
+  }
+};
+
+namespace {
+
+std::atomic<uint64_t> next_log_id = { 1 };
+
+/// this thread's rings, one per Log it has submitted to
+struct ThreadBuffers {
+  std::vector<std::pair<uint64_t, std::shared_ptr<ThreadBuffer>>> bufs;
+  ~ThreadBuffers();
+};
+
+// trivially destructible, so they are usable while the thread's
+// non-trivial thread_locals are being destroyed
+thread_local bool tls_exited = false;
+thread_local uint64_t tls_last_id = 0;
+thread_local ThreadBuffer *tls_last = nullptr;
+thread_local ThreadBuffers tls_buffers;
+
+ThreadBuffers::~ThreadBuffers()
+{
+  tls_exited = true;
+  tls_last_id = 0;
+  tls_last = nullptr;
+  for (auto& p : bufs)
+    p.second->m_exited = true;
+}
+
+unsigned ring_size(int max_new)
+{
+  unsigned n = MIN_THREAD_RING;
+  while (n < (unsigned)max_new && n < (1u << 20))
+    n <<= 1;
+  return n;
+}
+
+bool entry_stamp_lt(const Entry *a, const Entry *b)
+{
+  return a->m_stamp < b->m_stamp;
+}
+
+} // anonymous namespace
+
 static void log_on_exit(void *p)
 {
   Log *l = *(Log **)p;
@@ -44,6 +147,12 @@ Log::Log(SubsystemMap *s)
     m_queue_mutex_holder(0),
     m_flush_mutex_holder(0),
     m_new(), m_recent(),
+    m_id(next_log_id++),
+    m_flusher_sleeping(false),
+    m_free_slabs(nullptr),
+    m_num_free_slabs(0),
+    m_dropped(0),
+    m_dropped_reported(0),
     m_fd(-1),
     m_uid(0),
     m_gid(0),
@@ -64,9 +173,6 @@ Log::Log(SubsystemMap *s)
   ret = pthread_mutex_init(&m_queue_mutex, NULL);
   assert(ret == 0);
 
-  ret = pthread_cond_init(&m_cond_loggers, NULL);
-  assert(ret == 0);
-
   ret = pthread_cond_init(&m_cond_flusher, NULL);
   assert(ret == 0);
 
@@ -86,9 +192,17 @@ Log::~Log()
   if (m_fd >= 0)
     VOID_TEMP_FAILURE_RETRY(::close(m_fd));
 
+  // unflushed entries go with the rings once their threads let go
+  m_threads.clear();
+  FreeSlab *f = m_free_slabs.exchange(nullptr);
+  while (f) {
+    FreeSlab *n = f->next;
+    ::operator delete(f);
+    f = n;
+  }
+
   pthread_mutex_destroy(&m_queue_mutex);
   pthread_mutex_destroy(&m_flush_mutex);
-  pthread_cond_destroy(&m_cond_loggers);
   pthread_cond_destroy(&m_cond_flusher);
 }
 
@@ -203,24 +317,149 @@ void Log::stop_graylog()
   pthread_mutex_unlock(&m_flush_mutex);
 }
 
-void Log::submit_entry(Entry *e)
+ThreadBuffer *Log::_get_thread_buffer()
 {
+  if (tls_last_id == m_id)
+    return tls_last;
+  if (tls_exited)
+    return nullptr;
+
+  for (auto& p : tls_buffers.bufs) {
+    if (p.first == m_id) {
+      tls_last_id = m_id;
+      tls_last = p.second.get();
+      return tls_last;
+    }
+  }
+
+  // forget rings of Logs that are gone
+  auto& bufs = tls_buffers.bufs;
+  bufs.erase(std::remove_if(bufs.begin(), bufs.end(),
+			    [](const std::pair<uint64_t,
+					       std::shared_ptr<ThreadBuffer>>& p) {
+			      return p.second.use_count() == 1;
+			    }),
+	     bufs.end());
+
+  // the ring size is fixed when a thread first logs; later changes to
+  // max_new apply to threads that show up afterwards
+  auto tb = std::make_shared<ThreadBuffer>(ring_size(m_max_new));
   pthread_mutex_lock(&m_queue_mutex);
   m_queue_mutex_holder = pthread_self();
+  m_threads.push_back(tb);
+  m_queue_mutex_holder = 0;
+  pthread_mutex_unlock(&m_queue_mutex);
+  tls_buffers.bufs.emplace_back(m_id, tb);
+  tls_last_id = m_id;
+  tls_last = tb.get();
+  return tls_last;
+}
 
+void *Log::_get_slab(ThreadBuffer *tb)
+{
+  if (!tb->m_free && m_free_slabs.load(std::memory_order_relaxed)) {
+    tb->m_free = m_free_slabs.exchange(nullptr, std::memory_order_acquire);
+    m_num_free_slabs = 0;
+  }
+  if (tb->m_free) {
+    FreeSlab *f = tb->m_free;
+    tb->m_free = f->next;
+    return f;
+  }
+  return ::operator new(SLAB_SIZE);
+}
+
+void Log::_recycle(Entry *e)
+{
+  if (e->m_exp_len == NULL ||
+      e->m_buf_len != SLAB_SIZE - sizeof(Entry) ||
+      m_num_free_slabs.load(std::memory_order_relaxed) >= MAX_FREE_SLABS) {
+    delete e;
+    return;
+  }
+  e->~Entry();
+  FreeSlab *f = new(e) FreeSlab;
+  f->next = m_free_slabs.load(std::memory_order_relaxed);
+  while (!m_free_slabs.compare_exchange_weak(f->next, f,
+					     std::memory_order_release,
+					     std::memory_order_relaxed))
+    ;
+  ++m_num_free_slabs;
+}
+
+void Log::submit_entry(Entry *e)
+{
   if (m_inject_segv)
     *(volatile int *)(0) = 0xdead;
 
-  // wait for flush to catch up
-  while (m_new.m_len > m_max_new)
-    pthread_cond_wait(&m_cond_loggers, &m_queue_mutex);
+  ThreadBuffer *tb = _get_thread_buffer();
+  if (tb) {
+    if (!tb->push(e)) {
+      // the flusher is behind; never make the caller wait for it
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      _recycle(e);
+      return;
+    }
+    if (m_flusher_sleeping.load()) {
+      pthread_mutex_lock(&m_queue_mutex);
+      pthread_cond_signal(&m_cond_flusher);
+      pthread_mutex_unlock(&m_queue_mutex);
+    }
+    return;
+  }
 
-  m_new.enqueue(e);
-  pthread_cond_signal(&m_cond_flusher);
+  // thread is exiting and its ring is gone
+  pthread_mutex_lock(&m_queue_mutex);
+  m_queue_mutex_holder = pthread_self();
+  if (m_new.m_len > m_max_new) {
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    _recycle(e);
+  } else {
+    m_new.enqueue(e);
+    pthread_cond_signal(&m_cond_flusher);
+  }
   m_queue_mutex_holder = 0;
   pthread_mutex_unlock(&m_queue_mutex);
 }
 
+bool Log::_have_new()
+{
+  if (!m_new.empty())
+    return true;
+  for (auto& tb : m_threads) {
+    if (!tb->empty())
+      return true;
+  }
+  return false;
+}
+
+void Log::_take_new(EntryQueue *q)
+{
+  // drain every ring and merge them by time, so the log reads in order
+  // even though threads queue independently
+  std::vector<Entry*> v;
+  Entry *e;
+  while ((e = m_new.dequeue()) != NULL)
+    v.push_back(e);
+  bool from_rings = false;
+  for (auto p = m_threads.begin(); p != m_threads.end(); ) {
+    ThreadBuffer *tb = p->get();
+    bool exited = tb->m_exited;
+    while ((e = tb->pop()) != NULL) {
+      v.push_back(e);
+      from_rings = true;
+    }
+    if (exited && tb->empty())
+      p = m_threads.erase(p);
+    else
+      ++p;
+  }
+  if (from_rings)
+    std::stable_sort(v.begin(), v.end(), entry_stamp_lt);
+  for (auto i : v)
+    q->enqueue(i);
+}
+
 
 Entry *Log::create_entry(int level, int subsys)
 {
@@ -245,6 +484,15 @@ Entry *Log::create_entry(int level, int subsys, size_t* expected_size)
     ANNOTATE_BENIGN_RACE_SIZED(expected_size, sizeof(*expected_size),
                                "Log hint");
     size_t size = __atomic_load_n(expected_size, __ATOMIC_RELAXED);
+    ThreadBuffer *tb;
+    if (sizeof(Entry) + size <= SLAB_SIZE &&
+	(tb = _get_thread_buffer()) != nullptr) {
+      void *ptr = _get_slab(tb);
+      return new(ptr) Entry(ceph_clock_now(),
+	 pthread_self(), level, subsys,
+	 reinterpret_cast<char*>(ptr) + sizeof(Entry),
+	 SLAB_SIZE - sizeof(Entry), expected_size);
+    }
     void *ptr = ::operator new(sizeof(Entry) + size);
     return new(ptr) Entry(ceph_clock_now(),
        pthread_self(), level, subsys,
@@ -267,15 +515,23 @@ void Log::flush()
   pthread_mutex_lock(&m_queue_mutex);
   m_queue_mutex_holder = pthread_self();
   EntryQueue t;
-  t.swap(m_new);
-  pthread_cond_broadcast(&m_cond_loggers);
+  _take_new(&t);
   m_queue_mutex_holder = 0;
   pthread_mutex_unlock(&m_queue_mutex);
   _flush(&t, &m_recent, false);
 
+  uint64_t dropped = get_dropped();
+  if (dropped != m_dropped_reported) {
+    char buf[80];
+    snprintf(buf, sizeof(buf), "--- %llu log entries dropped ---",
+	     (unsigned long long)(dropped - m_dropped_reported));
+    _log_message(buf, false);
+    m_dropped_reported = dropped;
+  }
+
   // trim
   while (m_recent.m_len > m_max_recent) {
-    delete m_recent.dequeue();
+    _recycle(m_recent.dequeue());
   }
 
   m_flush_mutex_holder = 0;
@@ -381,7 +637,7 @@ void Log::dump_recent()
   m_queue_mutex_holder = pthread_self();
 
   EntryQueue t;
-  t.swap(m_new);
+  _take_new(&t);
 
   m_queue_mutex_holder = 0;
   pthread_mutex_unlock(&m_queue_mutex);
@@ -408,6 +664,8 @@ void Log::dump_recent()
   _log_message(buf, true);
   sprintf(buf, "  max_new    %9d", m_max_new);
   _log_message(buf, true);
+  sprintf(buf, "  dropped    %9llu", (unsigned long long)get_dropped());
+  _log_message(buf, true);
   sprintf(buf, "  log_file %s", m_log_file.c_str());
   _log_message(buf, true);
 
@@ -432,7 +690,6 @@ void Log::stop()
   pthread_mutex_lock(&m_queue_mutex);
   m_stop = true;
   pthread_cond_signal(&m_cond_flusher);
-  pthread_cond_broadcast(&m_cond_loggers);
   pthread_mutex_unlock(&m_queue_mutex);
   join();
 }
@@ -442,7 +699,11 @@ void *Log::entry()
   pthread_mutex_lock(&m_queue_mutex);
   m_queue_mutex_holder = pthread_self();
   while (!m_stop) {
-    if (!m_new.empty()) {
+    // announce we are about to sleep before looking at the rings; a
+    // thread that pushes after our look sees the flag and wakes us
+    m_flusher_sleeping = true;
+    if (_have_new()) {
+      m_flusher_sleeping = false;
       m_queue_mutex_holder = 0;
       pthread_mutex_unlock(&m_queue_mutex);
       flush();
@@ -451,8 +712,11 @@ void *Log::entry()
       continue;
     }
 
+    m_queue_mutex_holder = 0;
     pthread_cond_wait(&m_cond_flusher, &m_queue_mutex);
+    m_queue_mutex_holder = pthread_self();
   }
+  m_flusher_sleeping = false;
   m_queue_mutex_holder = 0;
   pthread_mutex_unlock(&m_queue_mutex);
   flush();
@@ -4,6 +4,10 @@
 #ifndef __CEPH_LOG_LOG_H
 #define __CEPH_LOG_LOG_H
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include "common/Thread.h"
 
 #include "EntryQueue.h"
@@ -14,6 +18,8 @@ namespace logging {
 class Graylog;
 class SubsystemMap;
 class Entry;
+struct ThreadBuffer;
+struct FreeSlab;
 
 class Log : private Thread
 {
@@ -21,17 +27,24 @@ class Log : private Thread
 
   SubsystemMap *m_subs;
 
-  pthread_mutex_t m_queue_mutex;
+  pthread_mutex_t m_queue_mutex;  ///< m_new, m_threads and flusher wakeups
   pthread_mutex_t m_flush_mutex;
-  pthread_cond_t m_cond_loggers;
   pthread_cond_t m_cond_flusher;
 
   pthread_t m_queue_mutex_holder;
   pthread_t m_flush_mutex_holder;
 
-  EntryQueue m_new;    ///< new entries
+  EntryQueue m_new;    ///< new entries from threads without a ring buffer
   EntryQueue m_recent; ///< recent (less new) entries we've already written at low detail
 
+  const uint64_t m_id;  ///< tells Log instances apart in thread-local state
+  std::vector<std::shared_ptr<ThreadBuffer>> m_threads;  ///< ring buffer per submitting thread
+  std::atomic<bool> m_flusher_sleeping;
+  std::atomic<FreeSlab*> m_free_slabs;  ///< entry slabs to reuse
+  std::atomic<int> m_num_free_slabs;
+  std::atomic<uint64_t> m_dropped;  ///< entries dropped because a ring was full
+  uint64_t m_dropped_reported;
+
   std::string m_log_file;
   int m_fd;
   uid_t m_uid;
@@ -53,6 +66,11 @@ class Log : private Thread
 
   void *entry() override;
 
+  ThreadBuffer *_get_thread_buffer();
+  void *_get_slab(ThreadBuffer *tb);
+  void _recycle(Entry *e);
+  bool _have_new();
+  void _take_new(EntryQueue *q);
   void _flush(EntryQueue *q, EntryQueue *requeue, bool crash);
 
   void _log_message(const char *s, bool crash);
@@ -84,8 +102,15 @@ public:
 
   Entry *create_entry(int level, int subsys);
   Entry *create_entry(int level, int subsys, size_t* expected_size);
+  /// queue an entry for the flusher; never blocks, drops e if the
+  /// calling thread's ring buffer is full
   void submit_entry(Entry *e);
 
+  /// number of entries dropped so far
+  uint64_t get_dropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
   void start();
   void stop();
 
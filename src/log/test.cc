@@ -233,3 +233,26 @@ TEST(Log, LargeLog)
   log.flush();
   log.stop();
 }
+
+TEST(Log, DropWhenBehind)
+{
+  SubsystemMap subs;
+  subs.add(1, "foo", 20, 10);
+  Log log(&subs);
+  log.set_max_new(16);
+  log.set_stderr_level(-1, -1);
+  // no flusher running: submitting must still never block
+  for (int i = 0; i < 100; i++)
+    log.submit_entry(new Entry(ceph_clock_now(), pthread_self(), 10, 1));
+  ASSERT_EQ(84u, log.get_dropped());
+  log.flush();
+
+  size_t hint = 100;
+  for (int i = 0; i < 16; i++) {
+    Entry *e = log.create_entry(10, 1, &hint);
+    e->set_str("slab");
+    log.submit_entry(e);
+  }
+  ASSERT_EQ(84u, log.get_dropped());
+  log.flush();
+}
@@ -284,10 +284,14 @@ void MgrClient::send_report()
 	session->declared.insert(path);
       }
 
-      ::encode(static_cast<uint64_t>(data.u64), report->packed);
       if (data.type & PERFCOUNTER_LONGRUNAVG) {
-        ::encode(static_cast<uint64_t>(data.avgcount), report->packed);
-        ::encode(static_cast<uint64_t>(data.avgcount2), report->packed);
+        // sum and count from one consistent read
+        auto avg = data.read_avg();
+        ::encode(static_cast<uint64_t>(avg.first), report->packed);
+        ::encode(static_cast<uint64_t>(avg.second), report->packed);
+        ::encode(static_cast<uint64_t>(avg.second), report->packed);
+      } else {
+        ::encode(static_cast<uint64_t>(data.read_u64()), report->packed);
       }
     }
     ENCODE_FINISH(report->packed);
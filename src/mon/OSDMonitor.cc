@@ -374,6 +374,7 @@ void OSDMonitor::update_from_paxos(bool *need_bootstrap)
   // walk through incrementals
   MonitorDBStore::TransactionRef t;
   size_t tx_size = 0;
+  unsigned num_applied = 0;
   while (version > osdmap.epoch) {
     bufferlist inc_bl;
     int err = get_version(osdmap.epoch+1, inc_bl);
@@ -385,6 +386,10 @@ void OSDMonitor::update_from_paxos(bool *need_bootstrap)
     OSDMap::Incremental inc(inc_bl);
     err = osdmap.apply_incremental(inc);
     assert(err == 0);
+    if (num_applied++ == 0)
+      mapping_inc.reset(new OSDMap::Incremental(inc));
+    else
+      mapping_inc.reset();
 
     if (!t)
       t.reset(new MonitorDBStore::Transaction);
@@ -418,6 +423,7 @@ void OSDMonitor::update_from_paxos(bool *need_bootstrap)
 	     << dendl;
 	osdmap = OSDMap();
 	osdmap.decode(orig_full_bl);
+	mapping_inc.reset();
       }
     } else {
       assert(!inc.have_crc);
@@ -516,8 +522,14 @@ void OSDMonitor::start_mapping()
   }
   if (!osdmap.get_pools().empty()) {
     auto fin = new C_UpdateCreatingPGs(this, osdmap.get_epoch());
-    mapping_job = mapping.start_update(osdmap, mapper,
-				       g_conf->mon_osd_mapping_pgs_per_chunk);
+    if (mapping_inc && g_conf->mon_osd_mapping_incremental) {
+      // falls back to a full update unless mapping is for the prior epoch
+      mapping_job = mapping.start_update(osdmap, *mapping_inc, mapper,
+					 g_conf->mon_osd_mapping_pgs_per_chunk);
+    } else {
+      mapping_job = mapping.start_update(osdmap, mapper,
+					 g_conf->mon_osd_mapping_pgs_per_chunk);
+    }
     dout(10) << __func__ << " started mapping job " << mapping_job.get()
 	     << " at " << fin->start << dendl;
     mapping_job->set_finish_event(fin);
@@ -525,6 +537,7 @@ void OSDMonitor::start_mapping()
     dout(10) << __func__ << " no pools, no mapping job" << dendl;
     mapping_job = nullptr;
   }
+  mapping_inc.reset();
 }
 
 void OSDMonitor::update_msgr_features()
@@ -4049,7 +4062,7 @@ namespace {
     RECOVERY_PRIORITY, RECOVERY_OP_PRIORITY, SCRUB_PRIORITY,
     COMPRESSION_MODE, COMPRESSION_ALGORITHM, COMPRESSION_REQUIRED_RATIO,
     COMPRESSION_MAX_BLOB_SIZE, COMPRESSION_MIN_BLOB_SIZE,
-    CSUM_TYPE, CSUM_MAX_BLOCK, CSUM_MIN_BLOCK };
+    CSUM_TYPE, CSUM_MAX_BLOCK, CSUM_MIN_BLOCK, EC_PARITY_DELTA };
 
   std::set<osd_pool_get_choices>
     subtract_second_from_first(const std::set<osd_pool_get_choices>& first,
@@ -4670,6 +4683,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
       {"csum_type", CSUM_TYPE},
       {"csum_max_block", CSUM_MAX_BLOCK},
       {"csum_min_block", CSUM_MIN_BLOCK},
+      {"ec_parity_delta", EC_PARITY_DELTA},
     };
 
     typedef std::set<osd_pool_get_choices> choices_set_t;
@@ -4684,7 +4698,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
       HIT_SET_GRADE_DECAY_RATE, HIT_SET_SEARCH_LAST_N
     };
     const choices_set_t ONLY_ERASURE_CHOICES = {
-      ERASURE_CODE_PROFILE
+      ERASURE_CODE_PROFILE, EC_PARITY_DELTA
     };
 
     choices_set_t selected_choices;
@@ -4876,6 +4890,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	  case CSUM_TYPE:
 	  case CSUM_MAX_BLOCK:
 	  case CSUM_MIN_BLOCK:
+	  case EC_PARITY_DELTA:
             pool_opts_t::key_t key = pool_opts_t::get_opt_desc(i->first).key;
             if (p->opts.is_set(key)) {
               f->open_object_section("pool");
@@ -5034,6 +5049,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	  case CSUM_TYPE:
 	  case CSUM_MAX_BLOCK:
 	  case CSUM_MIN_BLOCK:
+	  case EC_PARITY_DELTA:
 	    for (i = ALL_CHOICES.begin(); i != ALL_CHOICES.end(); ++i) {
 	      if (i->second == *it)
 		break;
@@ -6677,6 +6693,20 @@ int OSDMonitor::prepare_command_pool_set(map<string,cmd_vartype> &cmdmap,
         ss << "error parsing int value '" << val << "': " << interr;
         return -EINVAL;
       }
+    } else if (var == "ec_parity_delta") {
+      if (!p.is_erasure()) {
+        ss << "ec_parity_delta only applies to erasure coded pools";
+        return -EINVAL;
+      }
+      if (val == "true" || (interr.empty() && n == 1)) {
+        n = 1;
+      } else if (unset || val == "false" || (interr.empty() && n == 0)) {
+        n = 0;
+      } else {
+        ss << "expecting value 'true', 'false', '0', or '1'";
+        return -EINVAL;
+      }
+      interr.clear();
     }
 
     pool_opts_t::opt_desc_t desc = pool_opts_t::get_opt_desc(var);
@@ -227,6 +227,8 @@ private:
   ParallelPGMapper mapper;                        ///< for background pg work
   OSDMapMapping mapping;                          ///< pg <-> osd mappings
   unique_ptr<ParallelPGMapper::Job> mapping_job;  ///< background mapping job
+  /// the one incremental applied since mapping was last started, if any
+  unique_ptr<OSDMap::Incremental> mapping_inc;
   void start_mapping();
 
   void update_logger();
@@ -30,6 +30,7 @@
 #include "msg_types.h"
 
 #include "common/RefCountedObj.h"
+#include "common/ceph_time.h"
 #include "msg/Connection.h"
 
 #include "common/debug.h"
@@ -248,6 +249,16 @@ protected:
 
   bi::list_member_hook<> dispatch_q;
 
+  // while queued by AsyncConnection::send_message, so queueing does not
+  // allocate
+  friend class AsyncConnection;
+  Message *send_q_next = nullptr;
+  bufferlist send_q_bl;              ///< encoded with send_q_features, or empty
+  uint64_t send_q_features = 0;
+  ceph::mono_time send_q_stamp;
+  bool send_q_early = false;         ///< encoded before the session was up
+  bool send_q_queued = false;
+
 public:
   // zipkin tracing
   ZTracer::Trace trace;
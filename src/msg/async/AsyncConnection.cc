@@ -125,6 +125,7 @@ AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, DispatchQu
     logger(w->get_perf_counter()), global_seq(0), connect_seq(0), peer_global_seq(0),
     state(STATE_NONE), state_after_send(STATE_NONE), port(-1),
     dispatch_queue(q), can_write(WriteStatus::NOWRITE),
+    max_send_batch(MAX(cct->_conf->ms_async_max_send_batch, 1u)),
     keepalive(false), recv_buf(NULL),
     recv_max_prefetch(MAX(msgr->cct->_conf->ms_tcp_prefetch_max_size, TCP_PREFETCH_MIN_SIZE)),
     recv_start(0), recv_end(0),
@@ -148,6 +149,7 @@ AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, DispatchQu
 AsyncConnection::~AsyncConnection()
 {
   assert(out_q.empty());
+  assert(in_q.empty());
   assert(sent.empty());
   delete authorizer;
   if (recv_buf)
@@ -621,6 +623,11 @@ void AsyncConnection::process()
               if (data_buf.length() < data_len)
                 data_buf.push_back(buffer::create(data_len - data_buf.length()));
               data_blp = data_buf.begin();
+            } else if (async_msgr->cct->_conf->ms_tcp_zerocopy) {
+              // one page-aligned buffer the store can keep without a copy
+              ldout(async_msgr->cct,20) << __func__ << " allocating page-aligned rx buffer len " << data_len << dendl;
+              data_buf.push_back(buffer::create_page_aligned(data_len));
+              data_blp = data_buf.begin();
             } else {
               ldout(async_msgr->cct,20) << __func__ << " allocating new rx buffer at offset " << data_off << dendl;
               alloc_aligned_buffer(data_buf, data_len, data_off);
@@ -1946,41 +1953,84 @@ int AsyncConnection::send_message(Message *m)
   if (can_fast_prepare)
     prepare_send_message(f, m, bl);
 
-  std::lock_guard<std::mutex> l(write_lock);
-  // "features" changes will change the payload encoding
-  if (can_fast_prepare && (can_write == WriteStatus::NOWRITE || get_features() != f)) {
-    // ensure the correctness of message encoding
-    bl.clear();
-    m->get_payload().clear();
-    ldout(async_msgr->cct, 5) << __func__ << " clear encoded buffer previous "
-                              << f << " != " << get_features() << dendl;
-  }
-  if (can_write == WriteStatus::CLOSED) {
+  WriteStatus status = can_write;
+  if (status == WriteStatus::CLOSED) {
     ldout(async_msgr->cct, 10) << __func__ << " connection closed."
                                << " Drop message " << m << dendl;
     m->put();
-  } else {
-    m->trace.event("async enqueueing message");
-    out_q[m->get_priority()].emplace_back(std::move(bl), m);
-    ldout(async_msgr->cct, 15) << __func__ << " inline write is denied, reschedule m=" << m << dendl;
-    if (can_write != WriteStatus::REPLACING)
-      center->dispatch_event_external(write_handler);
+    return 0;
+  }
+
+  // no write_lock here: the writer checks the encoding when it takes
+  // the message off in_q
+  m->trace.event("async enqueueing message");
+  // a message can only be on one queue at a time
+  assert(!m->send_q_queued);
+  m->send_q_queued = true;
+  m->send_q_bl.swap(bl);
+  m->send_q_stamp = ceph::mono_clock::now();
+  m->send_q_features = f;
+  m->send_q_early = status == WriteStatus::NOWRITE;
+  bool was_empty = in_q.push(m);
+  ldout(async_msgr->cct, 15) << __func__ << " inline write is denied, reschedule m=" << m << dendl;
+
+  // _stop() sets CLOSED before it discards the queues, so if it is not
+  // CLOSED yet the message will be discarded with the rest
+  status = can_write;
+  if (status == WriteStatus::CLOSED) {
+    std::lock_guard<std::mutex> l(write_lock);
+    discard_out_queue();
+  } else if (was_empty && status != WriteStatus::REPLACING) {
+    // otherwise the writer is already scheduled for the earlier ones
+    center->dispatch_event_external(write_handler);
   }
   return 0;
 }
 
+/*
+ * Moves what send_message queued to out_q.
+ * Must hold write_lock prior to calling.
+ */
+void AsyncConnection::_drain_in_q()
+{
+  Message *m = in_q.pop_all();
+  while (m) {
+    Message *next = m->send_q_next;
+    m->send_q_next = nullptr;
+    m->send_q_queued = false;
+    // "features" changes will change the payload encoding
+    if (m->send_q_bl.length() &&
+        (m->send_q_early || m->send_q_features != get_features())) {
+      // ensure the correctness of message encoding
+      m->send_q_bl.clear();
+      m->get_payload().clear();
+      ldout(async_msgr->cct, 5) << __func__ << " clear encoded buffer previous "
+                                << m->send_q_features << " != " << get_features() << dendl;
+    }
+    OutgoingMessage om;
+    om.bl.swap(m->send_q_bl);
+    om.m = m;
+    om.queued = m->send_q_stamp;
+    out_q[m->get_priority()].push_back(std::move(om));
+    m = next;
+  }
+}
+
 void AsyncConnection::requeue_sent()
 {
   if (sent.empty())
     return;
 
-  list<pair<bufferlist, Message*> >& rq = out_q[CEPH_MSG_PRIO_HIGHEST];
+  list<OutgoingMessage>& rq = out_q[CEPH_MSG_PRIO_HIGHEST];
+  auto now = ceph::mono_clock::now();
   while (!sent.empty()) {
     Message* m = sent.back();
     sent.pop_back();
     ldout(async_msgr->cct, 10) << __func__ << " " << *m << " for resend "
                                << " (" << m->get_seq() << ")" << dendl;
-    rq.push_front(make_pair(bufferlist(), m));
+    rq.emplace_front();
+    rq.front().m = m;
+    rq.front().queued = now;
     out_seq--;
   }
 }
@@ -1991,14 +2041,14 @@ void AsyncConnection::discard_requeued_up_to(uint64_t seq)
   std::lock_guard<std::mutex> l(write_lock);
   if (out_q.count(CEPH_MSG_PRIO_HIGHEST) == 0)
     return;
-  list<pair<bufferlist, Message*> >& rq = out_q[CEPH_MSG_PRIO_HIGHEST];
+  list<OutgoingMessage>& rq = out_q[CEPH_MSG_PRIO_HIGHEST];
   while (!rq.empty()) {
-    pair<bufferlist, Message*> p = rq.front();
-    if (p.second->get_seq() == 0 || p.second->get_seq() > seq)
+    Message *m = rq.front().m;
+    if (m->get_seq() == 0 || m->get_seq() > seq)
       break;
-    ldout(async_msgr->cct, 10) << __func__ << " " << *(p.second) << " for resend seq " << p.second->get_seq()
+    ldout(async_msgr->cct, 10) << __func__ << " " << *m << " for resend seq " << m->get_seq()
                          << " <= " << seq << ", discarding" << dendl;
-    p.second->put();
+    m->put();
     rq.pop_front();
     out_seq++;
   }
@@ -2019,10 +2069,11 @@ void AsyncConnection::discard_out_queue()
     (*p)->put();
   }
   sent.clear();
-  for (map<int, list<pair<bufferlist, Message*> > >::iterator p = out_q.begin(); p != out_q.end(); ++p)
-    for (list<pair<bufferlist, Message*> >::iterator r = p->second.begin(); r != p->second.end(); ++r) {
-      ldout(async_msgr->cct, 20) << __func__ << " discard " << r->second << dendl;
-      r->second->put();
+  _drain_in_q();
+  for (map<int, list<OutgoingMessage> >::iterator p = out_q.begin(); p != out_q.end(); ++p)
+    for (list<OutgoingMessage>::iterator r = p->second.begin(); r != p->second.end(); ++r) {
+      ldout(async_msgr->cct, 20) << __func__ << " discard " << r->m << dendl;
+      r->m->put();
     }
   out_q.clear();
 }
@@ -2161,6 +2212,8 @@ void AsyncConnection::_stop()
   ldout(async_msgr->cct, 2) << __func__ << dendl;
   std::lock_guard<std::mutex> l(write_lock);
 
+  // before discarding: send_message checks it after queueing
+  can_write = WriteStatus::CLOSED;
   reset_recv_state();
   dispatch_queue->discard_queue(conn_id);
   discard_out_queue();
@@ -2169,7 +2222,6 @@ void AsyncConnection::_stop()
 
   state = STATE_CLOSED;
   open_write = false;
-  can_write = WriteStatus::CLOSED;
   state_offset = 0;
   // Make sure in-queue events will been processed
   center->dispatch_event_external(EventCallbackRef(new C_clean_handler(this)));
@@ -2195,7 +2247,10 @@ void AsyncConnection::prepare_send_message(uint64_t features, Message *m, buffer
   bl.append(m->get_data());
 }
 
-ssize_t AsyncConnection::write_message(Message *m, bufferlist& bl, bool more)
+/*
+ * Appends m to outcoming_bl; the caller sends it.
+ */
+void AsyncConnection::write_message(Message *m, bufferlist& bl)
 {
   FUNCTRACE();
   assert(center->in_thread());
@@ -2276,26 +2331,13 @@ ssize_t AsyncConnection::write_message(Message *m, bufferlist& bl, bool more)
 
   m->trace.event("async writing message");
   ldout(async_msgr->cct, 20) << __func__ << " sending " << m->get_seq()
-                             << " " << m << dendl;
-  ssize_t total_send_size = outcoming_bl.length();
-  ssize_t rc = _try_send(more);
-  if (rc < 0) {
-    ldout(async_msgr->cct, 1) << __func__ << " error sending " << m << ", "
-                              << cpp_strerror(rc) << dendl;
-  } else if (rc == 0) {
-    logger->inc(l_msgr_send_bytes, total_send_size - original_bl_len);
-    ldout(async_msgr->cct, 10) << __func__ << " sending " << m << " done." << dendl;
-  } else {
-    logger->inc(l_msgr_send_bytes, total_send_size - outcoming_bl.length());
-    ldout(async_msgr->cct, 10) << __func__ << " sending " << m << " continuely." << dendl;
-  }
+                             << " " << m << " len "
+                             << outcoming_bl.length() - original_bl_len << dendl;
   if (m->get_type() == CEPH_MSG_OSD_OP)
     OID_EVENT_TRACE_WITH_MSG(m, "SEND_MSG_OSD_OP_END", false);
   else if (m->get_type() == CEPH_MSG_OSD_OPREPLY)
     OID_EVENT_TRACE_WITH_MSG(m, "SEND_MSG_OSD_OPREPLY_END", false);
   m->put();
-
-  return rc;
 }
 
 void AsyncConnection::reset_recv_state()
@@ -2452,28 +2494,55 @@ void AsyncConnection::handle_write()
 
     auto start = ceph::mono_clock::now();
     bool more;
+    vector<OutgoingMessage> batch;
+    batch.reserve(max_send_batch);
     do {
-      bufferlist data;
-      Message *m = _get_next_outgoing(&data);
-      if (!m)
-        break;
-
-      if (!policy.lossy) {
-        // put on sent list
-        sent.push_back(m);
-        m->get();
+      // take every ready message, up to max_send_batch
+      _drain_in_q();
+      OutgoingMessage om;
+      while (batch.size() < max_send_batch && _get_next_outgoing(&om)) {
+        if (!policy.lossy) {
+          // put on sent list
+          sent.push_back(om.m);
+          om.m->get();
+        }
+        batch.push_back(std::move(om));
       }
+      if (batch.empty())
+        break;
       more = _has_next_outgoing();
       write_lock.unlock();
 
-      // send_message or requeue messages may not encode message
-      if (!data.length())
-        prepare_send_message(get_features(), m, data);
-
-      r = write_message(m, data, more);
+      // encode and sign the whole batch, then hand it to the socket in
+      // one go
+      auto now = ceph::mono_clock::now();
+      uint64_t batch_bytes = 0;
+      unsigned original_bl_len = outcoming_bl.length();
+      for (auto &o : batch) {
+        // send_message or requeue messages may not encode message
+        if (!o.bl.length())
+          prepare_send_message(get_features(), o.m, o.bl);
+        batch_bytes += o.bl.length();
+        logger->hinc(l_msgr_send_queue_wait_histogram,
+                     std::chrono::nanoseconds(now - o.queued).count(),
+                     o.bl.length());
+        write_message(o.m, o.bl);
+      }
+      logger->hinc(l_msgr_send_batch_histogram, batch.size(), batch_bytes);
+      ldout(async_msgr->cct, 10) << __func__ << " sending " << batch.size()
+                                 << " messages, " << batch_bytes << " bytes"
+                                 << dendl;
+      batch.clear();
+
+      ssize_t total_send_size = outcoming_bl.length();
+      r = _try_send(more);
       if (r < 0) {
         ldout(async_msgr->cct, 1) << __func__ << " send msg failed" << dendl;
         goto fail;
+      } else if (r == 0) {
+        logger->inc(l_msgr_send_bytes, total_send_size - original_bl_len);
+      } else {
+        logger->inc(l_msgr_send_bytes, total_send_size - outcoming_bl.length());
       }
       write_lock.lock();
       if (r > 0)
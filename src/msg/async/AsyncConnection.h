@@ -27,6 +27,7 @@ using namespace std;
 
 #include "auth/AuthSessionHandler.h"
 #include "common/ceph_time.h"
+#include "common/mpsc_queue.h"
 #include "common/perf_counters.h"
 #include "include/buffer.h"
 #include "msg/Connection.h"
@@ -68,12 +69,13 @@ class AsyncConnection : public Connection {
   void was_session_reset();
   void fault();
   void discard_out_queue();
+  void _drain_in_q();
   void discard_requeued_up_to(uint64_t seq);
   void requeue_sent();
   int randomize_out_seq();
   void handle_ack(uint64_t seq);
   void _append_keepalive_or_ack(bool ack=false, utime_t *t=NULL);
-  ssize_t write_message(Message *m, bufferlist& bl, bool more);
+  void write_message(Message *m, bufferlist& bl);
   void inject_delay();
   ssize_t _reply_accept(char tag, ceph_msg_connect &connect, ceph_msg_connect_reply &reply,
                     bufferlist &authorizer_reply) {
@@ -95,7 +97,7 @@ class AsyncConnection : public Connection {
     return 0;
   }
   bool is_queued() const {
-    return !out_q.empty() || outcoming_bl.length();
+    return !out_q.empty() || !in_q.empty() || outcoming_bl.length();
   }
   void shutdown_socket() {
     for (auto &&t : register_time_events)
@@ -111,24 +113,23 @@ class AsyncConnection : public Connection {
       cs.close();
     }
   }
-  Message *_get_next_outgoing(bufferlist *bl) {
-    Message *m = 0;
-    while (!m && !out_q.empty()) {
-      map<int, list<pair<bufferlist, Message*> > >::reverse_iterator it = out_q.rbegin();
+  struct OutgoingMessage;
+  bool _get_next_outgoing(OutgoingMessage *om) {
+    bool got = false;
+    while (!got && !out_q.empty()) {
+      map<int, list<OutgoingMessage> >::reverse_iterator it = out_q.rbegin();
       if (!it->second.empty()) {
-        list<pair<bufferlist, Message*> >::iterator p = it->second.begin();
-        m = p->second;
-        if (bl)
-          bl->swap(p->first);
-        it->second.erase(p);
+        *om = std::move(it->second.front());
+        it->second.pop_front();
+        got = true;
       }
       if (it->second.empty())
         out_q.erase(it->first);
     }
-    return m;
+    return got;
   }
   bool _has_next_outgoing() const {
-    return !out_q.empty();
+    return !out_q.empty() || !in_q.empty();
   }
   void reset_recv_state();
 
@@ -316,7 +317,18 @@ class AsyncConnection : public Connection {
   };
   std::atomic<WriteStatus> can_write;
   list<Message*> sent; // the first bufferlist need to inject seq
-  map<int, list<pair<bufferlist, Message*> > > out_q;  // priority queue for outbound msgs
+
+  struct OutgoingMessage {
+    bufferlist bl;                  // encoded message, empty if not yet
+    Message *m = nullptr;
+    ceph::mono_time queued;
+  };
+  // send_message queues here without write_lock, linked through the
+  // Message itself; the writer moves the messages to out_q under
+  // write_lock
+  ceph::mpsc_queue<Message, &Message::send_q_next> in_q;
+  map<int, list<OutgoingMessage> > out_q;  // priority queue for outbound msgs
+  const unsigned max_send_batch;
   bool keepalive;
 
   std::mutex lock;
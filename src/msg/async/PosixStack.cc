@@ -21,6 +21,7 @@
 #include <errno.h>
 
 #include <algorithm>
+#include <deque>
 
 #include "PosixStack.h"
 
@@ -33,6 +34,10 @@
 #include "msg/Messenger.h"
 #include "include/sock_compat.h"
 
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
+
 #define dout_subsys ceph_subsys_ms
 #undef dout_prefix
 #define dout_prefix *_dout << "PosixStack "
@@ -43,9 +48,24 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   entity_addr_t sa;
   bool connected;
 
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+  // With MSG_ZEROCOPY the kernel transmits from our pages, so the
+  // buffers of each zerocopy sendmsg are held until its completion is
+  // read back from the socket error queue.  Completion ids count the
+  // zerocopy sendmsg calls; TCP completes them in order.
+  uint64_t zerocopy_min_size;  ///< smallest send done zerocopy, 0 if off
+  uint32_t zerocopy_next_id = 0;
+  std::deque<std::pair<uint32_t, bufferlist> > zerocopy_inflight; ///< last id
+#endif
+
  public:
-  explicit PosixConnectedSocketImpl(NetHandler &h, const entity_addr_t &sa, int f, bool connected)
-      : handler(h), _fd(f), sa(sa), connected(connected) {}
+  explicit PosixConnectedSocketImpl(NetHandler &h, const entity_addr_t &sa, int f, bool connected,
+                                    uint64_t zerocopy_min_size = 0)
+      : handler(h), _fd(f), sa(sa), connected(connected)
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+      , zerocopy_min_size(zerocopy_min_size)
+#endif
+      {}
 
   int is_connected() override {
     if (connected)
@@ -67,6 +87,10 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   }
 
   ssize_t read(char *buf, size_t len) override {
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+    // completions raise EPOLLERR until they are read
+    reap_zerocopy();
+#endif
     ssize_t r = ::read(_fd, buf, len);
     if (r < 0)
       r = -errno;
@@ -75,22 +99,35 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
 
   // return the sent length
   // < 0 means error occured
-  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more)
+  // *zerocopy_sends counts the calls that went out with MSG_ZEROCOPY
+  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more,
+                            int flags = 0, unsigned *zerocopy_sends = nullptr)
   {
     size_t sent = 0;
     while (1) {
       MSGR_SIGPIPE_STOPPER;
       ssize_t r;
-      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0) | flags);
       if (r < 0) {
         if (errno == EINTR) {
           continue;
         } else if (errno == EAGAIN) {
           break;
         }
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+        if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+          // too many completions outstanding, copy this one
+          flags &= ~MSG_ZEROCOPY;
+          continue;
+        }
+#endif
         return -errno;
       }
 
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+      if (flags & MSG_ZEROCOPY)
+        ++*zerocopy_sends;
+#endif
       sent += r;
       if (len == sent) break;
 
@@ -110,9 +147,44 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
     return (ssize_t)sent;
   }
 
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+  void reap_zerocopy() {
+    while (!zerocopy_inflight.empty()) {
+      struct msghdr msg;
+      char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+                   CMSG_SPACE(sizeof(struct sockaddr_in6))];
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (::recvmsg(_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        return;
+      for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+           cm = CMSG_NXTHDR(&msg, cm)) {
+        if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+            !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+          continue;
+        struct sock_extended_err *serr = (struct sock_extended_err*)CMSG_DATA(cm);
+        if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+          continue;
+        // ids ee_info..ee_data are done, and so is everything before
+        while (!zerocopy_inflight.empty() &&
+               (int32_t)(zerocopy_inflight.front().first - serr->ee_data) <= 0)
+          zerocopy_inflight.pop_front();
+      }
+    }
+  }
+#endif
+
   ssize_t send(bufferlist &bl, bool more) override {
     size_t sent_bytes = 0;
-    std::list<bufferptr>::const_iterator pb = bl.buffers().begin();
+    int flags = 0;
+    unsigned zerocopy_sends = 0;
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+    reap_zerocopy();
+    if (zerocopy_min_size && bl.length() >= zerocopy_min_size)
+      flags = MSG_ZEROCOPY;
+#endif
+    bufferlist::buffers_t::const_iterator pb = bl.buffers().begin();
     uint64_t left_pbrs = bl.buffers().size();
     while (left_pbrs) {
       struct msghdr msg;
@@ -132,7 +204,8 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
         size--;
       }
 
-      ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more);
+      ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more,
+                             flags, &zerocopy_sends);
       if (r < 0)
         return r;
 
@@ -149,8 +222,15 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
         bl.splice(sent_bytes, bl.length()-sent_bytes, &swapped);
         bl.swap(swapped);
       } else {
-        bl.clear();
+        bl.swap(swapped);
+      }
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+      // swapped now holds what was sent
+      if (zerocopy_sends) {
+        zerocopy_next_id += zerocopy_sends;
+        zerocopy_inflight.emplace_back(zerocopy_next_id - 1, std::move(swapped));
       }
+#endif
     }
 
     return static_cast<ssize_t>(sent_bytes);
@@ -160,6 +240,10 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   }
   void close() override {
     ::close(_fd);
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+    // the kernel holds its own page references
+    zerocopy_inflight.clear();
+#endif
   }
   int fd() const override {
     return _fd;
@@ -210,7 +294,11 @@ int PosixServerSocketImpl::accept(ConnectedSocket *sock, const SocketOptions &op
   out->set_sockaddr((sockaddr*)&ss);
   handler.set_priority(sd, opt.priority, out->get_family());
 
-  std::unique_ptr<PosixConnectedSocketImpl> csi(new PosixConnectedSocketImpl(handler, *out, sd, true));
+  uint64_t zerocopy_min_size = 0;
+  if (w->cct->_conf->ms_tcp_zerocopy && handler.set_zerocopy(sd) == 0)
+    zerocopy_min_size = w->cct->_conf->ms_tcp_zerocopy_min_size;
+
+  std::unique_ptr<PosixConnectedSocketImpl> csi(new PosixConnectedSocketImpl(handler, *out, sd, true, zerocopy_min_size));
   *sock = ConnectedSocket(std::move(csi));
   return 0;
 }
@@ -277,8 +365,11 @@ int PosixWorker::connect(const entity_addr_t &addr, const SocketOptions &opts, C
   }
 
   net.set_priority(sd, opts.priority, addr.get_family());
+  uint64_t zerocopy_min_size = 0;
+  if (cct->_conf->ms_tcp_zerocopy && net.set_zerocopy(sd) == 0)
+    zerocopy_min_size = cct->_conf->ms_tcp_zerocopy_min_size;
   *socket = ConnectedSocket(
-      std::unique_ptr<PosixConnectedSocketImpl>(new PosixConnectedSocketImpl(net, addr, sd, !opts.nonblock)));
+      std::unique_ptr<PosixConnectedSocketImpl>(new PosixConnectedSocketImpl(net, addr, sd, !opts.nonblock, zerocopy_min_size)));
   return 0;
 }
 
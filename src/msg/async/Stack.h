@@ -199,6 +199,9 @@ enum {
   l_msgr_running_recv_time,
   l_msgr_running_fast_dispatch_time,
 
+  l_msgr_send_batch_histogram,
+  l_msgr_send_queue_wait_histogram,
+
   l_msgr_last,
 };
 
@@ -239,6 +242,36 @@ class Worker {
     plb.add_time(l_msgr_running_recv_time, "msgr_running_recv_time", "The total time of message receiving");
     plb.add_time(l_msgr_running_fast_dispatch_time, "msgr_running_fast_dispatch_time", "The total time of fast dispatch");
 
+    PerfHistogramCommon::axis_config_d batch_x_axis_config{
+      "Batch size (messages)",
+      PerfHistogramCommon::SCALE_LOG2,
+      0,                               ///< Start at 0
+      1,                               ///< Quantization unit is 1 message
+      12,
+    };
+    PerfHistogramCommon::axis_config_d wait_x_axis_config{
+      "Queue wait (usec)",
+      PerfHistogramCommon::SCALE_LOG2,
+      0,                               ///< Start at 0
+      1000,                            ///< Quantization unit is 1usec
+      24,
+    };
+    PerfHistogramCommon::axis_config_d size_y_axis_config{
+      "Size (bytes)",
+      PerfHistogramCommon::SCALE_LOG2,
+      0,                               ///< Start at 0
+      512,                             ///< Quantization unit is 512 bytes
+      32,
+    };
+    plb.add_u64_counter_histogram(
+      l_msgr_send_batch_histogram, "msgr_send_batch_histogram",
+      batch_x_axis_config, size_y_axis_config,
+      "Histogram of messages and bytes written per send batch");
+    plb.add_u64_counter_histogram(
+      l_msgr_send_queue_wait_histogram, "msgr_send_queue_wait_histogram",
+      wait_x_axis_config, size_y_axis_config,
+      "Histogram of time messages wait in the outgoing queue + message size");
+
     perf_logger = plb.create_perf_counters();
     cct->get_perfcounters_collection()->add(perf_logger);
   }
@@ -24,6 +24,7 @@
 #include "net_handler.h"
 #include "common/errno.h"
 #include "common/debug.h"
+#include "include/sock_compat.h"
 
 #define dout_subsys ceph_subsys_ms
 #undef dout_prefix
@@ -130,6 +131,22 @@ int NetHandler::set_socket_options(int sd, bool nodelay, int size)
   return -r;
 }
 
+int NetHandler::set_zerocopy(int sd)
+{
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+  int val = 1;
+  int r = ::setsockopt(sd, SOL_SOCKET, SO_ZEROCOPY, (void*)&val, sizeof(val));
+  if (r < 0) {
+    r = errno;
+    ldout(cct, 1) << "couldn't set SO_ZEROCOPY: " << cpp_strerror(r) << dendl;
+    return -r;
+  }
+  return 0;
+#else
+  return -EOPNOTSUPP;
+#endif
+}
+
 void NetHandler::set_priority(int sd, int prio, int domain)
 {
 #ifdef SO_PRIORITY
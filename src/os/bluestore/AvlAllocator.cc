@@ -0,0 +1,427 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "AvlAllocator.h"
+#include "BitMapAllocator.h"
+#include "bluestore_types.h"
+#include "common/debug.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "avl " << this << " "
+
+MEMPOOL_DEFINE_OBJECT_FACTORY(range_seg_t, range_seg_t, bluestore_alloc);
+
+static uint64_t round_up(uint64_t offset, uint64_t align)
+{
+  uint64_t skew = offset % align;
+  return skew ? offset + align - skew : offset;
+}
+
+AvlAllocator::AvlAllocator(CephContext* cct,
+			   int64_t device_size,
+			   int64_t block_size)
+  : cct(cct),
+    device_size(device_size),
+    block_size(block_size),
+    range_size_alloc_threshold(
+      cct->_conf->bluestore_avl_alloc_bf_threshold),
+    range_size_alloc_free_pct(
+      cct->_conf->bluestore_avl_alloc_bf_free_pct),
+    max_search_count(
+      cct->_conf->bluestore_avl_alloc_ff_max_search_count),
+    range_count_cap(
+      cct->_conf->bluestore_avl_alloc_mem_cap / sizeof(range_seg_t))
+{
+  dout(10) << __func__ << " size 0x" << std::hex << device_size
+	   << " block_size 0x" << block_size << std::dec
+	   << " range_count_cap " << range_count_cap << dendl;
+}
+
+AvlAllocator::~AvlAllocator()
+{
+  _shutdown();
+}
+
+uint64_t AvlAllocator::_get_free()
+{
+  return num_free + (bmap ? bmap->get_free() : 0);
+}
+
+/*
+ * First fit at or after *cursor, wrapping around once.  Looks at no
+ * more than max_search_count extents.
+ */
+uint64_t AvlAllocator::_pick_first_fit(uint64_t *cursor,
+				       uint64_t size,
+				       uint64_t align)
+{
+  unsigned searched = 0;
+  auto rs = range_tree.lower_bound(range_t{*cursor, *cursor + size},
+				   range_tree.key_comp());
+  for (int pass = 0; pass < 2; ++pass) {
+    for (; rs != range_tree.end() && searched < max_search_count;
+	 ++rs, ++searched) {
+      uint64_t offset = round_up(rs->start, align);
+      if (offset + size <= rs->end) {
+	*cursor = offset + size;
+	return offset;
+      }
+    }
+    if (*cursor == 0)
+      break;
+    *cursor = 0;
+    rs = range_tree.begin();
+  }
+  return -1ULL;
+}
+
+/*
+ * Best fit: the shortest extent that holds size bytes at the given
+ * alignment.
+ */
+uint64_t AvlAllocator::_pick_best_fit(uint64_t size, uint64_t align)
+{
+  unsigned searched = 0;
+  auto rs = range_size_tree.lower_bound(range_t{0, size},
+					range_size_tree.key_comp());
+  for (; rs != range_size_tree.end() && searched < max_search_count;
+       ++rs, ++searched) {
+    uint64_t offset = round_up(rs->start, align);
+    if (offset + size <= rs->end)
+      return offset;
+  }
+  // extents this long fit however they are aligned
+  uint64_t slack = align % block_size == 0 ? align - block_size : align - 1;
+  rs = range_size_tree.lower_bound(range_t{0, size + slack},
+				   range_size_tree.key_comp());
+  if (rs != range_size_tree.end())
+    return round_up(rs->start, align);
+  return -1ULL;
+}
+
+int AvlAllocator::_allocate(uint64_t size, uint64_t unit, uint64_t hint,
+			    uint64_t *offset, uint64_t *length)
+{
+  if (range_size_tree.empty())
+    return -ENOSPC;
+
+  const range_seg_t& largest = *range_size_tree.rbegin();
+  uint64_t max_size = largest.length();
+  bool force_best_fit = false;
+  if (max_size < size) {
+    if (max_size < unit)
+      return -ENOSPC;
+    size = max_size / unit * unit;
+    force_best_fit = true;
+  }
+  if (cct->_conf->bluestore_debug_small_allocations) {
+    uint64_t max =
+      unit * (rand() % cct->_conf->bluestore_debug_small_allocations);
+    if (max && size > max) {
+      dout(10) << __func__ << " shortening allocation of 0x" << std::hex
+	       << size << " -> 0x"
+	       << max << " due to debug_small_allocations" << std::dec << dendl;
+      size = max;
+    }
+  }
+
+  uint64_t start = -1ULL;
+  unsigned free_pct = device_size ? _get_free() * 100 / device_size : 0;
+  if (!force_best_fit &&
+      max_size >= range_size_alloc_threshold &&
+      free_pct >= range_size_alloc_free_pct) {
+    // keep allocations of the same alignment together
+    uint64_t align = size & -size;
+    uint64_t *cursor = &lbas[cbits(align) - 1];
+    if (hint) {
+      // continue the caller's stream
+      *cursor = hint;
+    }
+    start = _pick_first_fit(cursor, size, unit);
+  }
+  if (start == -1ULL)
+    start = _pick_best_fit(size, unit);
+  if (start == -1ULL && force_best_fit) {
+    // the largest extent is too misaligned for size; take what it has
+    uint64_t aligned = round_up(largest.start, unit);
+    if (aligned + unit <= largest.end) {
+      start = aligned;
+      size = (largest.end - aligned) / unit * unit;
+    }
+  }
+  if (start == -1ULL)
+    return -ENOSPC;
+
+  dout(30) << __func__ << " got 0x" << std::hex << start << "~" << size
+	   << std::dec << (force_best_fit ? " (short)" : "") << dendl;
+  _remove_from_tree(start, size);
+  *offset = start;
+  *length = size;
+  return 0;
+}
+
+void AvlAllocator::_add_to_tree(uint64_t start, uint64_t size)
+{
+  assert(size != 0);
+  uint64_t end = start + size;
+
+  auto rs_after = range_tree.upper_bound(range_t{start, end},
+					 range_tree.key_comp());
+  auto rs_before = range_tree.end();
+  if (rs_after != range_tree.begin()) {
+    rs_before = std::prev(rs_after);
+    // releasing space that is already free
+    assert(rs_before->end <= start);
+  }
+
+  bool merge_before = (rs_before != range_tree.end() &&
+		       rs_before->end == start);
+  bool merge_after = (rs_after != range_tree.end() &&
+		      rs_after->start == end);
+
+  if (merge_before && merge_after) {
+    range_size_tree.erase(range_size_tree.iterator_to(*rs_before));
+    range_size_tree.erase(range_size_tree.iterator_to(*rs_after));
+    rs_before->end = rs_after->end;
+    range_tree.erase_and_dispose(rs_after, dispose_rs{});
+    range_size_tree.insert(*rs_before);
+  } else if (merge_before) {
+    range_size_tree.erase(range_size_tree.iterator_to(*rs_before));
+    rs_before->end = end;
+    range_size_tree.insert(*rs_before);
+  } else if (merge_after) {
+    range_size_tree.erase(range_size_tree.iterator_to(*rs_after));
+    rs_after->start = start;
+    range_size_tree.insert(*rs_after);
+  } else {
+    auto new_rs = new range_seg_t(start, end);
+    range_tree.insert_before(rs_after, *new_rs);
+    range_size_tree.insert(*new_rs);
+  }
+  num_free += size;
+  _spillover();
+}
+
+void AvlAllocator::_remove_from_tree(uint64_t start, uint64_t size)
+{
+  uint64_t end = start + size;
+
+  auto rs = range_tree.find(range_t{start, end}, range_tree.key_comp());
+  // the extent has to be free, and in one piece
+  assert(rs != range_tree.end());
+  assert(rs->start <= start);
+  assert(rs->end >= end);
+
+  bool left_over = (rs->start != start);
+  bool right_over = (rs->end != end);
+
+  range_size_tree.erase(range_size_tree.iterator_to(*rs));
+
+  if (left_over && right_over) {
+    auto new_rs = new range_seg_t(end, rs->end);
+    rs->end = start;
+    range_tree.insert(std::next(rs), *new_rs);
+    range_size_tree.insert(*new_rs);
+    range_size_tree.insert(*rs);
+  } else if (left_over) {
+    rs->end = start;
+    range_size_tree.insert(*rs);
+  } else if (right_over) {
+    rs->start = end;
+    range_size_tree.insert(*rs);
+  } else {
+    range_tree.erase_and_dispose(rs, dispose_rs{});
+  }
+  num_free -= size;
+  assert(num_free >= 0);
+  if (left_over && right_over)
+    _spillover();
+}
+
+/// move the shortest extents to the bitmap while over range_count_cap
+void AvlAllocator::_spillover()
+{
+  if (!range_count_cap)
+    return;
+  while (range_tree.size() > range_count_cap) {
+    if (!bmap) {
+      dout(1) << __func__ << " more than " << range_count_cap
+	      << " free extents, spilling the shortest to a bitmap" << dendl;
+      bmap.reset(new BitMapAllocator(cct, device_size, block_size));
+    }
+    range_seg_t& rs = *range_size_tree.begin();
+    uint64_t start = rs.start;
+    uint64_t len = rs.length();
+    dout(30) << __func__ << " 0x" << std::hex << start << "~" << len
+	     << std::dec << dendl;
+    range_size_tree.erase(range_size_tree.iterator_to(rs));
+    range_tree.erase_and_dispose(range_tree.iterator_to(rs), dispose_rs{});
+    num_free -= len;
+    bmap->init_add_free(start, len);
+  }
+}
+
+int AvlAllocator::reserve(uint64_t need)
+{
+  std::lock_guard<std::mutex> l(lock);
+  int64_t free = _get_free();
+  dout(10) << __func__ << " need 0x" << std::hex << need
+	   << " num_free 0x" << free
+	   << " num_reserved 0x" << num_reserved << std::dec << dendl;
+  if ((int64_t)need > free - num_reserved)
+    return -ENOSPC;
+  num_reserved += need;
+  return 0;
+}
+
+void AvlAllocator::unreserve(uint64_t unused)
+{
+  std::lock_guard<std::mutex> l(lock);
+  dout(10) << __func__ << " unused 0x" << std::hex << unused
+	   << " num_reserved 0x" << num_reserved << std::dec << dendl;
+  assert(num_reserved >= (int64_t)unused);
+  num_reserved -= unused;
+}
+
+int64_t AvlAllocator::allocate(
+  uint64_t want_size,
+  uint64_t alloc_unit,
+  uint64_t max_alloc_size,
+  int64_t hint,
+  mempool::bluestore_alloc::vector<AllocExtent> *extents)
+{
+  std::lock_guard<std::mutex> l(lock);
+  dout(10) << __func__ << " want_size 0x" << std::hex << want_size
+	   << " alloc_unit 0x" << alloc_unit
+	   << " hint 0x" << hint << std::dec
+	   << dendl;
+  assert(alloc_unit);
+
+  if (max_alloc_size == 0) {
+    max_alloc_size = want_size;
+  }
+
+  ExtentList block_list = ExtentList(extents, 1, max_alloc_size);
+  uint64_t allocated = 0;
+  while (allocated < want_size) {
+    uint64_t want = MIN(max_alloc_size, want_size - allocated);
+    uint64_t offset, length;
+    int r = _allocate(MAX(want, alloc_unit), alloc_unit, hint,
+		      &offset, &length);
+    if (r < 0)
+      break;
+    block_list.add_extents(offset, length);
+    allocated += length;
+    hint = offset + length;
+  }
+
+  if (allocated < want_size && bmap) {
+    uint64_t need = round_up(want_size - allocated, block_size);
+    if (bmap->reserve(need) == 0) {
+      AllocExtentVector spilled;
+      int64_t got = bmap->allocate(need, alloc_unit, max_alloc_size, hint,
+				   &spilled);
+      if (got < 0)
+	got = 0;
+      if ((uint64_t)got < need)
+	bmap->unreserve(need - got);
+      dout(20) << __func__ << " got 0x" << std::hex << got
+	       << std::dec << " from bitmap" << dendl;
+      for (auto& e : spilled)
+	block_list.add_extents(e.offset, e.length);
+      allocated += got;
+    }
+  }
+
+  if (allocated == 0) {
+    return -ENOSPC;
+  }
+  num_reserved -= allocated;
+  assert(num_reserved >= 0);
+  return allocated;
+}
+
+void AvlAllocator::release(
+  uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  dout(10) << __func__ << " 0x" << std::hex << offset << "~" << length
+	   << std::dec << dendl;
+  _add_to_tree(offset, length);
+}
+
+uint64_t AvlAllocator::get_free()
+{
+  std::lock_guard<std::mutex> l(lock);
+  return _get_free();
+}
+
+void AvlAllocator::dump()
+{
+  std::lock_guard<std::mutex> l(lock);
+  dout(0) << __func__ << " range_tree: " << range_tree.size()
+	  << " extents, 0x" << std::hex << num_free << std::dec
+	  << " bytes free" << dendl;
+  for (auto& rs : range_tree) {
+    dout(0) << __func__ << "  0x" << std::hex << rs.start << "~"
+	    << rs.length() << std::dec << dendl;
+  }
+  if (bmap) {
+    dout(0) << __func__ << " spilled to bitmap: 0x" << std::hex
+	    << bmap->get_free() << std::dec << " bytes free" << dendl;
+    bmap->dump();
+  }
+}
+
+void AvlAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  dout(10) << __func__ << " 0x" << std::hex << offset << "~" << length
+	   << std::dec << dendl;
+  _add_to_tree(offset, length);
+}
+
+void AvlAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  dout(10) << __func__ << " 0x" << std::hex << offset << "~" << length
+	   << std::dec << dendl;
+  // the range may be partly in the trees and partly spilled
+  uint64_t pos = offset;
+  uint64_t end = offset + length;
+  while (pos < end) {
+    auto rs = range_tree.lower_bound(range_t{pos, end},
+				     range_tree.key_comp());
+    uint64_t next = (rs == range_tree.end() || rs->start >= end) ?
+      end : MAX(rs->start, pos);
+    if (next > pos) {
+      assert(bmap);
+      bmap->init_rm_free(pos, next - pos);
+      pos = next;
+      continue;
+    }
+    uint64_t e = MIN(rs->end, end);
+    _remove_from_tree(pos, e - pos);
+    pos = e;
+  }
+}
+
+void AvlAllocator::_shutdown()
+{
+  range_size_tree.clear();
+  range_tree.clear_and_dispose(dispose_rs{});
+  num_free = 0;
+  if (bmap) {
+    bmap->shutdown();
+    bmap.reset();
+  }
+}
+
+void AvlAllocator::shutdown()
+{
+  std::lock_guard<std::mutex> l(lock);
+  dout(1) << __func__ << dendl;
+  _shutdown();
+}
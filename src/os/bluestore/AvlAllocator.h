@@ -0,0 +1,161 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_AVLALLOCATOR_H
+#define CEPH_OS_BLUESTORE_AVLALLOCATOR_H
+
+#include <memory>
+#include <mutex>
+
+#include <boost/intrusive/avl_set.hpp>
+
+#include "Allocator.h"
+#include "os/bluestore/bluestore_types.h"
+#include "include/mempool.h"
+
+class BitMapAllocator;
+
+/// a free extent [start, end) in both trees of an AvlAllocator
+struct range_seg_t {
+  MEMPOOL_CLASS_HELPERS();  ///< memory monitoring
+
+  range_seg_t(uint64_t start, uint64_t end)
+    : start{start},
+      end{end}
+  {}
+
+  uint64_t start;
+  uint64_t end;
+
+  uint64_t length() const {
+    return end - start;
+  }
+
+  /// order by offset; overlapping ranges compare equal
+  struct before_t {
+    template<typename KeyLeft, typename KeyRight>
+    bool operator()(const KeyLeft& lhs, const KeyRight& rhs) const {
+      return lhs.end <= rhs.start;
+    }
+  };
+  boost::intrusive::avl_set_member_hook<> offset_hook;
+
+  /// order by length, then by offset
+  struct shorter_t {
+    template<typename KeyLeft, typename KeyRight>
+    bool operator()(const KeyLeft& lhs, const KeyRight& rhs) const {
+      const uint64_t lhs_len = lhs.end - lhs.start;
+      const uint64_t rhs_len = rhs.end - rhs.start;
+      if (lhs_len != rhs_len)
+	return lhs_len < rhs_len;
+      return lhs.start < rhs.start;
+    }
+  };
+  boost::intrusive::avl_set_member_hook<> size_hook;
+};
+
+/**
+ * Allocator keeping free extents in two AVL trees, one ordered by
+ * offset and one by length.
+ *
+ * While there is plenty of contiguous free space, allocations are
+ * first-fit from a cursor per alignment, so a sequential stream of
+ * allocations stays sequential on disk.  When free space runs low or
+ * is fragmented, allocations are best-fit from the length tree, which
+ * is a single O(log n) lookup.  A release merges with its neighbours
+ * in the offset tree.
+ *
+ * If the trees would take more than bluestore_avl_alloc_mem_cap bytes,
+ * the smallest extents are moved to a bitmap allocator, which is only
+ * used once the trees cannot satisfy a request.
+ */
+class AvlAllocator : public Allocator {
+  struct range_t {
+    uint64_t start;
+    uint64_t end;
+  };
+  struct dispose_rs {
+    void operator()(range_seg_t *p) {
+      delete p;
+    }
+  };
+
+  typedef boost::intrusive::avl_set<
+    range_seg_t,
+    boost::intrusive::compare<range_seg_t::before_t>,
+    boost::intrusive::member_hook<
+      range_seg_t,
+      boost::intrusive::avl_set_member_hook<>,
+      &range_seg_t::offset_hook>> range_tree_t;
+  typedef boost::intrusive::avl_multiset<
+    range_seg_t,
+    boost::intrusive::compare<range_seg_t::shorter_t>,
+    boost::intrusive::member_hook<
+      range_seg_t,
+      boost::intrusive::avl_set_member_hook<>,
+      &range_seg_t::size_hook>> range_size_tree_t;
+
+  CephContext* cct;
+  std::mutex lock;
+
+  const uint64_t device_size;
+  const uint64_t block_size;
+
+  range_tree_t range_tree;            ///< free extents by offset
+  range_size_tree_t range_size_tree;  ///< free extents by length
+
+  int64_t num_free = 0;      ///< bytes in the trees
+  int64_t num_reserved = 0;  ///< reserved bytes
+
+  /// first-fit cursor per allocation alignment (lowest set bit)
+  uint64_t lbas[64] = {0};
+
+  /// below this largest free extent we go best-fit
+  const uint64_t range_size_alloc_threshold;
+  /// below this percentage of free space we go best-fit
+  const unsigned range_size_alloc_free_pct;
+  /// first-fit gives up after looking at this many extents
+  const unsigned max_search_count;
+  /// most extents kept in the trees; 0 means no limit
+  const uint64_t range_count_cap;
+
+  /// extents that did not fit under range_count_cap
+  std::unique_ptr<BitMapAllocator> bmap;
+
+  uint64_t _pick_first_fit(uint64_t *cursor, uint64_t size, uint64_t align);
+  uint64_t _pick_best_fit(uint64_t size, uint64_t align);
+  int _allocate(uint64_t size, uint64_t unit, uint64_t hint,
+		uint64_t *offset, uint64_t *length);
+
+  void _add_to_tree(uint64_t start, uint64_t size);
+  void _remove_from_tree(uint64_t start, uint64_t size);
+  void _spillover();
+  uint64_t _get_free();
+
+  void _shutdown();
+
+public:
+  AvlAllocator(CephContext* cct, int64_t device_size, int64_t block_size);
+  ~AvlAllocator() override;
+
+  int reserve(uint64_t need) override;
+  void unreserve(uint64_t unused) override;
+
+  int64_t allocate(
+    uint64_t want_size, uint64_t alloc_unit, uint64_t max_alloc_size,
+    int64_t hint, mempool::bluestore_alloc::vector<AllocExtent> *extents) override;
+
+  void release(
+    uint64_t offset, uint64_t length) override;
+
+  uint64_t get_free() override;
+
+  void dump() override;
+
+  void init_add_free(uint64_t offset, uint64_t length) override;
+  void init_rm_free(uint64_t offset, uint64_t length) override;
+
+  void shutdown() override;
+};
+
+#endif
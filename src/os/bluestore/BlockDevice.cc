@@ -18,6 +18,7 @@
 #include <unistd.h>
 
 #include "KernelDevice.h"
+#include "ioring.h"
 #if defined(HAVE_SPDK)
 #include "NVMEDevice.h"
 #endif
@@ -75,6 +76,15 @@ BlockDevice *BlockDevice::create(CephContext* cct, const string& path,
   }
 #endif
 
+  if (type == "kernel" && cct->_conf->bdev_ioring) {
+    if (ioring_queue_t::supported()) {
+      type = "ioring";
+    } else {
+      derr << __func__ << " bdev_ioring is set but io_uring is not available,"
+	   << " using libaio" << dendl;
+    }
+  }
+
   dout(1) << __func__ << " path " << path << " type " << type << dendl;
 
 #if defined(HAVE_PMEM)
@@ -86,6 +96,9 @@ BlockDevice *BlockDevice::create(CephContext* cct, const string& path,
   if (type == "kernel") {
     return new KernelDevice(cct, cb, cbpriv);
   }
+  if (type == "ioring") {
+    return new KernelDevice(cct, cb, cbpriv, true);
+  }
 #if defined(HAVE_SPDK)
   if (type == "ust-nvme") {
     return new NVMEDevice(cct, cb, cbpriv);
@@ -115,6 +128,8 @@ void BlockDevice::reap_ioc()
       delete p;
     }
     ioc_reap_queue.clear();
-    --ioc_reap_count;
+    // there may be several reaping threads; whoever gets here first
+    // empties the queue for all of them
+    ioc_reap_count = 0;
   }
 }
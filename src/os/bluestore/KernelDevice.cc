@@ -19,6 +19,7 @@
 #include <fcntl.h>
 
 #include "KernelDevice.h"
+#include "ioring.h"
 #include "include/types.h"
 #include "include/compat.h"
 #include "include/stringify.h"
@@ -33,20 +34,28 @@
 #undef dout_prefix
 #define dout_prefix *_dout << "bdev(" << this << " " << path << ") "
 
-KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv)
+KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv,
+			   bool use_ioring)
   : BlockDevice(cct),
     fd_direct(-1),
     fd_buffered(-1),
     size(0), block_size(0),
     fs(NULL), aio(false), dio(false),
+    use_ioring(use_ioring),
     debug_lock("KernelDevice::debug_lock"),
-    aio_queue(cct->_conf->bdev_aio_max_queue_depth),
     aio_callback(cb),
     aio_callback_priv(cbpriv),
     aio_stop(false),
-    aio_thread(this),
     injecting_crash(0)
 {
+  if (use_ioring) {
+    io_queue.reset(new ioring_queue_t(
+      cct->_conf->bdev_aio_max_queue_depth,
+      cct->_conf->bdev_ioring_shards,
+      cct->_conf->bdev_ioring_sqthread_poll));
+  } else {
+    io_queue.reset(new aio_queue_t(cct->_conf->bdev_aio_max_queue_depth));
+  }
 }
 
 int KernelDevice::_lock()
@@ -212,6 +221,7 @@ int KernelDevice::collect_metadata(string prefix, map<string,string> *pm) const
   (*pm)[prefix + "size"] = stringify(get_size());
   (*pm)[prefix + "block_size"] = stringify(get_block_size());
   (*pm)[prefix + "driver"] = "KernelDevice";
+  (*pm)[prefix + "aio_backend"] = use_ioring ? "io_uring" : "libaio";
   if (rotational) {
     (*pm)[prefix + "type"] = "hdd";
   } else {
@@ -311,10 +321,15 @@ int KernelDevice::flush()
 int KernelDevice::_aio_start()
 {
   if (aio) {
-    dout(10) << __func__ << dendl;
-    int r = aio_queue.init();
+    dout(10) << __func__ << (use_ioring ? " io_uring" : " libaio")
+	     << " shards " << io_queue->get_num_shards() << dendl;
+    std::vector<int> fds = { fd_direct, fd_buffered };
+    int r = io_queue->init(fds);
     if (r < 0) {
-      if (r == -EAGAIN) {
+      if (use_ioring) {
+	derr << __func__ << " io_uring setup failed: " << cpp_strerror(r)
+	     << dendl;
+      } else if (r == -EAGAIN) {
 	derr << __func__ << " io_setup(2) failed with EAGAIN; "
 	     << "try increasing /proc/sys/fs/aio-max-nr" << dendl;
       } else {
@@ -322,7 +337,10 @@ int KernelDevice::_aio_start()
       }
       return r;
     }
-    aio_thread.create("bstore_aio");
+    for (unsigned i = 0; i < io_queue->get_num_shards(); ++i) {
+      aio_threads.emplace_back(new AioCompletionThread(this, i));
+      aio_threads.back()->create("bstore_aio");
+    }
   }
   return 0;
 }
@@ -332,21 +350,23 @@ void KernelDevice::_aio_stop()
   if (aio) {
     dout(10) << __func__ << dendl;
     aio_stop = true;
-    aio_thread.join();
+    for (auto& t : aio_threads)
+      t->join();
+    aio_threads.clear();
     aio_stop = false;
-    aio_queue.shutdown();
+    io_queue->shutdown();
   }
 }
 
-void KernelDevice::_aio_thread()
+void KernelDevice::_aio_thread(unsigned shard)
 {
-  dout(10) << __func__ << " start" << dendl;
+  dout(10) << __func__ << " shard " << shard << " start" << dendl;
   int inject_crash_count = 0;
   while (!aio_stop) {
     dout(40) << __func__ << " polling" << dendl;
     int max = cct->_conf->bdev_aio_reap_max;
     aio_t *aio[max];
-    int r = aio_queue.get_next_completed(cct->_conf->bdev_aio_poll_ms,
+    int r = io_queue->get_next_completed(shard, cct->_conf->bdev_aio_poll_ms,
 					 aio, max);
     if (r < 0) {
       derr << __func__ << " got " << cpp_strerror(r) << dendl;
@@ -516,7 +536,7 @@ void KernelDevice::aio_submit(IOContext *ioc)
 
   void *priv = static_cast<void*>(ioc);
   int r, retries = 0;
-  r = aio_queue.submit_batch(ioc->running_aios.begin(), e, 
+  r = io_queue->submit_batch(ioc->running_aios.begin(), e, 
 			     ioc->num_running.load(), priv, &retries);
   
   if (retries)
@@ -525,6 +545,11 @@ void KernelDevice::aio_submit(IOContext *ioc)
     derr << " aio submit got " << cpp_strerror(r) << dendl;
     assert(r == 0);
   }
+  if (r < pending) {
+    // the rest of the batch would never complete
+    derr << " aio submit took only " << r << " of " << pending << " ios" << dendl;
+    assert(r == pending);
+  }
 }
 
 int KernelDevice::_sync_write(uint64_t off, bufferlist &bl, bool buffered)
@@ -16,6 +16,7 @@
 #define CEPH_OS_BLUESTORE_KERNELDEVICE_H
 
 #include <atomic>
+#include <memory>
 
 #include "os/fs/FS.h"
 #include "include/interval_set.h"
@@ -30,6 +31,7 @@ class KernelDevice : public BlockDevice {
   std::string path;
   FS *fs;
   bool aio, dio;
+  bool use_ioring;
 
   Mutex debug_lock;
   interval_set<uint64_t> debug_inflight;
@@ -37,23 +39,26 @@ class KernelDevice : public BlockDevice {
   std::atomic<bool> io_since_flush = {false};
   std::mutex flush_mutex;
 
-  aio_queue_t aio_queue;
+  std::unique_ptr<io_queue_t> io_queue;
   aio_callback_t aio_callback;
   void *aio_callback_priv;
   bool aio_stop;
 
+  /// reaps one shard of io_queue
   struct AioCompletionThread : public Thread {
     KernelDevice *bdev;
-    explicit AioCompletionThread(KernelDevice *b) : bdev(b) {}
+    unsigned shard;
+    AioCompletionThread(KernelDevice *b, unsigned s) : bdev(b), shard(s) {}
     void *entry() override {
-      bdev->_aio_thread();
+      bdev->_aio_thread(shard);
       return NULL;
     }
-  } aio_thread;
+  };
+  std::vector<std::unique_ptr<AioCompletionThread>> aio_threads;
 
   std::atomic_int injecting_crash;
 
-  void _aio_thread();
+  void _aio_thread(unsigned shard);
   int _aio_start();
   void _aio_stop();
 
@@ -75,7 +80,8 @@ class KernelDevice : public BlockDevice {
   void debug_aio_unlink(aio_t& aio);
 
 public:
-  KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv);
+  KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv,
+	       bool use_ioring = false);
 
   void aio_submit(IOContext *ioc) override;
 
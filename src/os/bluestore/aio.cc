@@ -65,7 +65,8 @@ int aio_queue_t::submit_batch(aio_iter begin, aio_iter end,
   return done;
 }
 
-int aio_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
+int aio_queue_t::get_next_completed(unsigned shard, int timeout_ms,
+				    aio_t **paio, int max)
 {
   io_event event[max];
   struct timespec t = {
@@ -0,0 +1,312 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "ioring.h"
+
+#if defined(HAVE_LIBURING)
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include <liburing.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "include/assert.h"
+#include "include/compat.h"
+
+struct ioring_data {
+  struct io_uring io_uring;
+  bool initialized = false;
+  int epoll_fd = -1;      ///< wakes the reaper when the cq has entries
+  std::mutex sq_mutex;    ///< only contended with more submitters than rings
+};
+
+static unsigned ioring_thread_shard()
+{
+  static std::atomic<unsigned> next = { 0 };
+  static thread_local unsigned mine = next++;
+  return mine;
+}
+
+ioring_queue_t::ioring_queue_t(unsigned iodepth, unsigned num_shards,
+			       bool sq_thread)
+  : iodepth(iodepth),
+    sq_thread(sq_thread)
+{
+  if (num_shards == 0)
+    num_shards = 1;
+  for (unsigned i = 0; i < num_shards; ++i)
+    rings.emplace_back(new ioring_data);
+}
+
+ioring_queue_t::~ioring_queue_t()
+{
+  for (auto& d : rings)
+    assert(!d->initialized);
+}
+
+bool ioring_queue_t::supported()
+{
+  struct io_uring ring;
+  int r = io_uring_queue_init(16, &ring, 0);
+  if (r < 0)
+    return false;
+  io_uring_queue_exit(&ring);
+  return true;
+}
+
+int ioring_queue_t::init(std::vector<int> &fds)
+{
+  unsigned flags = 0;
+  if (sq_thread)
+    flags |= IORING_SETUP_SQPOLL;
+
+  fixed_fds.clear();
+  for (unsigned i = 0; i < fds.size(); ++i)
+    fixed_fds[fds[i]] = i;
+
+  for (auto& d : rings) {
+    assert(!d->initialized);
+    int r = io_uring_queue_init(iodepth, &d->io_uring, flags);
+    if (r < 0) {
+      shutdown();
+      return r;
+    }
+    d->initialized = true;
+
+    r = io_uring_register_files(&d->io_uring, fds.data(), fds.size());
+    if (r < 0) {
+      shutdown();
+      return r;
+    }
+
+    d->epoll_fd = epoll_create1(0);
+    if (d->epoll_fd < 0) {
+      r = -errno;
+      shutdown();
+      return r;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, d->io_uring.ring_fd, &ev) < 0) {
+      r = -errno;
+      shutdown();
+      return r;
+    }
+  }
+  return 0;
+}
+
+void ioring_queue_t::shutdown()
+{
+  for (auto& d : rings) {
+    if (d->epoll_fd >= 0) {
+      VOID_TEMP_FAILURE_RETRY(::close(d->epoll_fd));
+      d->epoll_fd = -1;
+    }
+    if (d->initialized) {
+      io_uring_queue_exit(&d->io_uring);
+      d->initialized = false;
+    }
+  }
+}
+
+static void init_sqe(ioring_queue_t *q, struct io_uring_sqe *sqe, aio_t *io)
+{
+  auto p = q->fixed_fds.find(io->fd);
+  assert(p != q->fixed_fds.end());
+  int index = p->second;
+
+  if (io->iocb.aio_lio_opcode == IO_CMD_PWRITEV) {
+    io_uring_prep_writev(sqe, index, &io->iov[0], io->iov.size(), io->offset);
+  } else if (io->iocb.aio_lio_opcode == IO_CMD_PREAD) {
+    // IORING_OP_READ needs 5.6; IORING_OP_READV works on every io_uring kernel
+    if (io->iov.empty()) {
+      io->iov.push_back({io->iocb.u.c.buf, (size_t)io->iocb.u.c.nbytes});
+    }
+    io_uring_prep_readv(sqe, index, &io->iov[0], io->iov.size(), io->offset);
+  } else {
+    assert(0 == "unsupported aio opcode");
+  }
+  sqe->flags |= IOSQE_FIXED_FILE;
+  io_uring_sqe_set_data(sqe, io);
+}
+
+static int ioring_submit(ioring_data *d, int *retries)
+{
+  // 2^16 * 125us = ~8 seconds, so max sleep is ~16 seconds
+  int attempts = 16;
+  int delay = 125;
+  while (true) {
+    int r = io_uring_submit(&d->io_uring);
+    if ((r == -EAGAIN || r == -EBUSY) && attempts-- > 0) {
+      usleep(delay);
+      delay *= 2;
+      (*retries)++;
+      continue;
+    }
+    return r;
+  }
+}
+
+// the sqes that the kernel did not take are turned into nops whose
+// completions are dropped, so that the next submit on this ring does not
+// start ios the caller was told were not submitted
+static void ioring_cancel(std::vector<struct io_uring_sqe*>::iterator beg,
+			  std::vector<struct io_uring_sqe*>::iterator end)
+{
+  for (auto i = beg; i != end; ++i) {
+    io_uring_prep_nop(*i);
+    (*i)->flags = 0;
+    io_uring_sqe_set_data(*i, nullptr);
+  }
+}
+
+int ioring_queue_t::submit_batch(aio_iter beg, aio_iter end,
+				 uint16_t aios_size, void *priv,
+				 int *retries)
+{
+  ioring_data *d = rings[ioring_thread_shard() % rings.size()].get();
+  std::lock_guard<std::mutex> l(d->sq_mutex);
+
+  // queued but not yet taken by the kernel, in submission order. Entries
+  // left in the sq by an earlier failed submit are taken before them.
+  std::vector<struct io_uring_sqe*> queued;
+  queued.reserve(aios_size);
+  unsigned ahead = io_uring_sq_ready(&d->io_uring);
+  int submitted = 0;
+  auto taken = [&](unsigned n) {
+    unsigned skip = std::min(n, ahead);
+    ahead -= skip;
+    n = std::min<size_t>(n - skip, queued.size());
+    queued.erase(queued.begin(), queued.begin() + n);
+    submitted += n;
+  };
+
+  int r = 0;
+  for (aio_iter i = beg; i != end; ++i) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&d->io_uring);
+    while (!sqe) {
+      // the sq is full; hand what we have to the kernel to make room
+      r = ioring_submit(d, retries);
+      if (r < 0)
+	goto out;
+      taken(r);
+      sqe = io_uring_get_sqe(&d->io_uring);
+      if (!sqe) {
+	// an sq polling thread has not caught up yet
+	usleep(125);
+	(*retries)++;
+	sqe = io_uring_get_sqe(&d->io_uring);
+      }
+    }
+    i->priv = priv;
+    init_sqe(this, sqe, &*i);
+    queued.push_back(sqe);
+  }
+  r = ioring_submit(d, retries);
+  if (r >= 0)
+    taken(r);
+
+ out:
+  if (sq_thread) {
+    // the sqes are published to the polling thread, which takes them
+    // even if waking it up failed
+    submitted += queued.size();
+  } else {
+    ioring_cancel(queued.begin(), queued.end());
+  }
+  if (submitted == 0 && r < 0)
+    return r;
+  return submitted;
+}
+
+static int ioring_get_cqe(ioring_data *d, int max, aio_t **paio)
+{
+  struct io_uring *ring = &d->io_uring;
+  struct io_uring_cqe *cqe;
+  unsigned head;
+  int seen = 0;
+  int nr = 0;
+  io_uring_for_each_cqe(ring, head, cqe) {
+    ++seen;
+    aio_t *io = static_cast<aio_t*>(io_uring_cqe_get_data(cqe));
+    if (!io)
+      continue;  // cancelled by submit_batch
+    io->rval = cqe->res;
+    paio[nr++] = io;
+    if (nr == max)
+      break;
+  }
+  io_uring_cq_advance(ring, seen);
+  return nr;
+}
+
+int ioring_queue_t::get_next_completed(unsigned shard, int timeout_ms,
+				       aio_t **paio, int max)
+{
+  assert(shard < rings.size());
+  ioring_data *d = rings[shard].get();
+  while (true) {
+    int events = ioring_get_cqe(d, max, paio);
+    if (events)
+      return events;
+
+    struct epoll_event ev;
+    int r = epoll_wait(d->epoll_fd, &ev, 1, timeout_ms);
+    if (r < 0) {
+      if (errno == EINTR)
+	continue;
+      return -errno;
+    }
+    if (r == 0)
+      return 0;
+  }
+}
+
+#else // HAVE_LIBURING
+
+struct ioring_data {};
+
+ioring_queue_t::ioring_queue_t(unsigned iodepth, unsigned num_shards,
+			       bool sq_thread)
+  : iodepth(iodepth),
+    sq_thread(sq_thread)
+{
+}
+
+ioring_queue_t::~ioring_queue_t()
+{
+}
+
+bool ioring_queue_t::supported()
+{
+  return false;
+}
+
+int ioring_queue_t::init(std::vector<int> &fds)
+{
+  return -EOPNOTSUPP;
+}
+
+void ioring_queue_t::shutdown()
+{
+}
+
+int ioring_queue_t::submit_batch(aio_iter beg, aio_iter end,
+				 uint16_t aios_size, void *priv,
+				 int *retries)
+{
+  return -EOPNOTSUPP;
+}
+
+int ioring_queue_t::get_next_completed(unsigned shard, int timeout_ms,
+				       aio_t **paio, int max)
+{
+  return -EOPNOTSUPP;
+}
+
+#endif // HAVE_LIBURING
@@ -0,0 +1,53 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include "acconfig.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "aio.h"
+
+struct ioring_data;
+
+/**
+ * io_uring backed io_queue_t.
+ *
+ * There is one ring per shard.  A submitting thread always uses the
+ * same ring, so submitters on different shards never share a lock or
+ * a submission queue; the whole batch of an IOContext goes in with a
+ * single io_uring_submit().  The target files are registered with
+ * every ring.  With sq_thread each ring gets a kernel thread polling
+ * its submission queue, so a submit usually does not enter the kernel.
+ * If the kernel takes only part of a batch, submit_batch() returns how
+ * many ios it took and turns the rest into nops that are never reaped.
+ *
+ * Without liburing init() fails with -EOPNOTSUPP.
+ */
+struct ioring_queue_t final : public io_queue_t {
+  std::vector<std::unique_ptr<ioring_data>> rings;
+  unsigned iodepth = 0;
+  bool sq_thread = false;
+
+  std::map<int,int> fixed_fds;  ///< fd -> registered file index
+
+  ioring_queue_t(unsigned iodepth, unsigned num_shards, bool sq_thread);
+  ~ioring_queue_t() final;
+
+  /// true if this kernel lets us set up a ring
+  static bool supported();
+
+  int init(std::vector<int> &fds) final;
+  void shutdown() final;
+  unsigned get_num_shards() const final {
+    return rings.size();
+  }
+
+  int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size,
+		   void *priv, int *retries) final;
+  int get_next_completed(unsigned shard, int timeout_ms,
+			 aio_t **paio, int max) final;
+};
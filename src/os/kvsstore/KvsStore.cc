@@ -166,15 +166,18 @@ OnodeRef KvsCollection::get_onode(
     { // prefetched?
       KvsOnode* on = lookup_prefetch_map(oid, true);
       if (on) {
-          auto hit_type = l_prefetch_onode_cache_hit;
+          bool slow = false;
           { // prefetch is not done yet
               std::unique_lock<std::mutex> plock(on->prefetch_lock);
               if (!on->exists) {
                   on->prefetch_cond.wait(plock);
-                  hit_type = l_prefetch_onode_cache_slow;
+                  slow = true;
               }
           }
-          store->get_counters()->inc(hit_type);
+          if (slow)
+              store->get_counters()->inc(l_prefetch_onode_cache_slow);
+          else
+              store->get_counters()->inc_sharded(l_prefetch_onode_cache_hit);
           return onode_map.add(oid, on);
       }
     }
@@ -187,7 +190,7 @@ OnodeRef KvsCollection::get_onode(
              o->onode.lid = lid;
              o->onode.size = 0;
       }
-      store->get_counters()->inc(l_prefetch_onode_cache_hit);
+      store->get_counters()->inc_sharded(l_prefetch_onode_cache_hit);
       return o;
     }
 
@@ -229,10 +232,6 @@ OnodeRef KvsCollection::get_onode(
         auto v = bufferlist::static_from_mem((char*)ctx.value->value, ctx.value->length);
         bufferptr::iterator p = v.front().begin_deep();
         on->onode.decode(p);
-
-        for (auto &i : on->onode.attrs) {
-            i.second.reassign_to_mempool(mempool::mempool_kvsstore_cache_other);
-        }
         //lderr(store->cct) << "loaded a new onode " << oid << ", under " << cid << ", bits " << cnode.bits << dendl;
     } else {
         lderr(store->cct) << __func__ << "I/O Error: ret = " << ret << dendl;
@@ -253,6 +252,31 @@ void *KvsStore::MempoolThread::entry() {
 
         store->lscache.trim(1);
 
+        // write back buffered omap updates that have aged out, or all of
+        // them if the op path found the buffer over its limits
+        if (wbuf_kick.exchange(false)) {
+            store->_wbuf_flush(UINT64_MAX, utime_t(UINT32_MAX, 0));
+        } else {
+            utime_t stamp = ceph_clock_now();
+            stamp -= store->cct->_conf->kvsstore_write_buffer_flush_age;
+            store->_wbuf_flush(0, stamp);
+        }
+
+        // device space and a usage checkpoint, once per refresh interval
+        const double interval = store->cct->_conf->kvsstore_statfs_refresh_interval;
+        utime_t since;
+        {
+            std::lock_guard<std::mutex> sl(store->statfs_lock);
+            since = ceph_clock_now() - store->dev_space_stamp;
+        }
+        if (interval > 0 && (double)since >= interval) {
+            store->_refresh_device_space();
+            store->_write_statfs(true);
+            store->_omap_recount();
+        }
+
+        if (wbuf_kick)
+            continue;
         utime_t wait;
         wait += 0.2;
         cond.WaitInterval(lock, wait);
@@ -263,7 +287,7 @@ void *KvsStore::MempoolThread::entry() {
 
 
 KvsStore::KvsStore(CephContext *cct, const std::string &path)
-        : ObjectStore(cct, path), db(cct),lscache(cct), kv_callback_thread(this), kv_callback_thread2(this),kv_finalize_thread(this), mempool_thread(this) {
+        : ObjectStore(cct, path), db(cct),lscache(cct), kv_callback_thread(this), kv_callback_thread2(this),kv_finalize_thread(this), mempool_thread(this), kv_reaper_thread(this), wbuf(cct, &db) {
     FTRACE
     m_finisher_num = 1;
 
@@ -285,10 +309,36 @@ KvsStore::KvsStore(CephContext *cct, const std::string &path)
     b.add_u64_counter(l_prefetch_onode_cache_slow, "prefetch_onode_cache_wait", "# of onode cache waits");
     b.add_u64_counter(l_prefetch_onode_cache_miss, "prefetch_onode_cache_miss", "# of onode cache miss");
 
+    // background reaper
+    b.add_u64(l_kvsstore_reaper_pending, "reaper_pending", "# of reaper records waiting to be reclaimed");
+    b.add_u64_counter(l_kvsstore_reaper_reaped, "reaper_reaped", "# of reaper records reclaimed");
+    b.add_u64_counter(l_kvsstore_reaper_deleted_keys, "reaper_deleted_keys", "# of keys deleted by the reaper");
+    b.add_u64_counter(l_kvsstore_reaper_iter_deletes, "reaper_iter_deletes", "# of device-side prefix deletes");
+    b.add_u64_counter(l_kvsstore_reaper_throttled, "reaper_throttled", "# of times the reaper was throttled");
+
+    // omap write buffer
+    b.add_u64(l_kvsstore_wbuf_bytes, "wbuf_bytes", "# of bytes held in the write buffer");
+    b.add_u64_counter(l_kvsstore_wbuf_absorbed, "wbuf_absorbed", "# of omap updates absorbed by the write buffer");
+    b.add_u64_counter(l_kvsstore_wbuf_coalesced, "wbuf_coalesced", "# of buffered omap updates replaced before reaching the device");
+    b.add_u64_counter(l_kvsstore_wbuf_flushed, "wbuf_flushed", "# of omap keys written back from the write buffer");
+
+    // pglog segments
+    b.add_u64_counter(l_kvsstore_pglog_seg_writes, "pglog_seg_writes", "# of pglog segments written");
+    b.add_u64_counter(l_kvsstore_pglog_seg_reads, "pglog_seg_reads", "# of pglog segments read");
+    b.add_u64_counter(l_kvsstore_pglog_meta_writes, "pglog_meta_writes", "# of pglog meta keys written");
+    b.add_u64_counter(l_kvsstore_pglog_delta_writes, "pglog_delta_writes", "# of pglog delta records written");
+    b.add_u64_counter(l_kvsstore_omap_estimates, "omap_estimates", "# of omap key charges estimated");
+    b.add_u64_counter(l_kvsstore_omap_recounts, "omap_recounts", "# of object omaps recounted");
+
+    // updated on every I/O completion and onode lookup
+    b.set_sharded(l_kvsstore_tr_latency);
+    b.set_sharded(l_prefetch_onode_cache_hit);
+
     logger = b.create_perf_counters();
     cct->get_perfcounters_collection()->add(logger);
 
     logger->set(l_kvsstore_pending_trx_ios, 0);
+    logger->set(l_kvsstore_reaper_pending, 0);
 
     // create onode LRU cache
     set_cache_shards(2);
@@ -355,6 +405,12 @@ int KvsStore::mount() {
     if (r < 0)
         goto out_db;
 
+    _refresh_device_space();
+
+    r = _open_reaper();  // may update kvsb.lid_last
+    if (r < 0)
+        goto out_db;
+
     // load lid_last for atomic accesses
     this->lid_last = this->kvsb.lid_last;
 
@@ -369,6 +425,7 @@ int KvsStore::mount() {
         goto out_db;
 
     mempool_thread.init();
+    _start_reaper();
 
     mounted = true;
     return 0;
@@ -388,7 +445,7 @@ bool compare_journal_key(const kvs_journal_key *a, const kvs_journal_key *b) {
     return a->index > b->index;
 }
 
-int KvsStore::_kvs_replay_journal(kvs_journal_key *j) {
+int KvsStore::_kvs_replay_journal(kvs_journal_key *j, kvsstore_statfs_t *statfs) {
     // read a journal entry je
     KvsReadContext ctx(cct);
     ctx.read_journal(j);
@@ -404,6 +461,22 @@ int KvsStore::_kvs_replay_journal(kvs_journal_key *j) {
         uint64_t lid;
         KvsSyncWriteContext wctx(cct);
         curpos = wctx.write_journal_entry(curpos, lid);
+        if (is_statfs_key(wctx.key)) {
+            // usage as of this transaction; the newest one wins
+            kvsstore_statfs_t s;
+            bufferlist v;
+            v.append((const char *) wctx.value->value, wctx.value->length);
+            try {
+                bufferptr::iterator p = v.front().begin();
+                s.decode(p);
+            } catch (buffer::error &e) {
+                derr << __func__ << " skipping a corrupt usage record" << dendl;
+                continue;
+            }
+            if (s.jseq >= statfs->jseq)
+                *statfs = s;
+            continue;
+        }
         db.aio_submit(&wctx);
 
         ret = wctx.write_wait();
@@ -437,9 +510,21 @@ int KvsStore::_fsck() {
     int ret = _read_sb();
     if (ret < 0) return ret;
 
+    kvsstore_statfs_t statfs;
+    _read_statfs(&statfs);
+
+    // keys are routed by the device count; replaying or reading with a
+    // different device list would look for them in the wrong namespace
+    if (this->kvsb.num_devices != db.num_devices()) {
+        derr << __func__ << " store was created with " << this->kvsb.num_devices
+             << " device(s) but " << db.num_devices() << " are configured" << dendl;
+        return -EINVAL;
+    }
+
     iter_ctx.prefix = GROUP_PREFIX_JOURNAL;
     iter_ctx.bitmask = 0xFFFFFFFF;
     iter_ctx.buflen = ITER_BUFSIZE;
+    iter_ctx.routed = true;
 
     // check if there's any opened iterators
    
@@ -472,7 +557,7 @@ int KvsStore::_fsck() {
 
         // replay
         if (this->kvsb.is_uptodate == 0) {
-            _kvs_replay_journal(k);  // update kvsb->lid_last;
+            _kvs_replay_journal(k, &statfs);  // update kvsb->lid_last;
         }
 
         // delete journal
@@ -492,6 +577,10 @@ int KvsStore::_fsck() {
     for (const auto &p : buflist) {
         free(p.first);
     }
+
+    // journal sequence numbers of the next session are not comparable
+    statfs.jseq = 0;
+    _set_statfs(statfs);
     return 0;
 }
 
@@ -505,6 +594,9 @@ int KvsStore::umount() {
 
     mounted = false;
 
+    // the journal is not replayed once the superblock says it is up to date
+    _wbuf_flush(UINT64_MAX, utime_t(UINT32_MAX, 0));
+
     this->kvsb.is_uptodate = 1;
     this->kvsb.lid_last = this->lid_last;   // atomic -> local
 
@@ -513,6 +605,7 @@ int KvsStore::umount() {
         derr << __func__ << "err: could not store a superblock, closing anyway .. retcode = " << r << dendl;
 
     mempool_thread.shutdown();
+    _stop_reaper();
     lscache.clear();
 
     dout(20) << __func__ << " stopping kv thread" << dendl;
@@ -589,6 +682,7 @@ int KvsStore::_open_collections() {
     iter_ctx.prefix = GROUP_PREFIX_COLL;
     iter_ctx.bitmask = 0xFFFFFFFF;
     iter_ctx.buflen = ITER_BUFSIZE;
+    iter_ctx.routed = true;
     // check if there's any opened iterators
  
 
@@ -648,6 +742,7 @@ int KvsStore::_open_collections() {
                 }
 
                 coll_map[cid] = c;
+                _pglog_preload(c);
                 ret = 0;
             }
         }
@@ -700,6 +795,7 @@ int KvsStore::mkfs() {
         goto out_close_fsid;
 
     this->kvsb.is_uptodate = 1;
+    this->kvsb.num_devices = db.num_devices();
     r = _write_sb();
     if (r < 0)
         goto out_close_db;
@@ -728,19 +824,236 @@ int KvsStore::mkfs() {
 }
 
 
+// device space is refreshed by the mempool thread; usage is kept up to date
+// by the transaction path
 int KvsStore::statfs(struct store_statfs_t *buf) {
     FTRACE
     buf->reset();
 
+    if (dev_capacity == 0)
+        _refresh_device_space();
+    const uint64_t capacity = dev_capacity;
+    const uint64_t used = dev_used;
+    buf->total = capacity;
+    buf->available = capacity > used ? capacity - used : 0;
+    buf->allocated = used;
+
+    std::lock_guard<std::mutex> l(statfs_lock);
+    buf->stored = statfs_sum.stored + statfs_sum.omap;
+    return 0;
+}
+
+void KvsStore::get_db_statistics(Formatter *f) {
+    std::lock_guard<std::mutex> l(statfs_lock);
+    f->open_object_section("kvsstore_statfs");
+    f->dump_unsigned("capacity", dev_capacity);
+    f->dump_unsigned("used", dev_used);
+    f->dump_stream("refreshed") << dev_space_stamp;
+    f->open_object_section("total");
+    statfs_sum.dump(f);
+    f->close_section();
+    statfs_state.dump(f);
+    f->close_section();
+}
+
+void KvsStore::_refresh_device_space() {
     uint64_t bytesused, capacity;
     double utilization;
 
-    db.get_freespace(bytesused, capacity, utilization);
-    buf->total =    capacity;
-    buf->available = capacity - bytesused;
+    if (db.get_freespace(bytesused, capacity, utilization) != 0) {
+        derr << __func__ << " failed to query the device space" << dendl;
+        return;
+    }
+    dev_capacity = capacity;
+    dev_used = bytesused;
+
+    std::lock_guard<std::mutex> l(statfs_lock);
+    dev_space_stamp = ceph_clock_now();
+}
+
+void KvsStore::_set_statfs(const kvsstore_statfs_t &s) {
+    std::lock_guard<std::mutex> l(statfs_lock);
+    statfs_state = s;
+    statfs_sum = kvsstore_pool_stat_t();
+    for (auto &i : statfs_state.pools)
+        statfs_sum += i.second;
+    statfs_dirty = false;
+}
+
+void KvsStore::_statfs_add(KvsTransContext *txc, const OnodeRef &o,
+                           int64_t objects, int64_t stored, int64_t omap) {
+    int64_t pool = o->oid.hobj.pool;
+    if (o->oid.hobj.is_temp())
+        pool = -2 - pool;   // temp objects are charged to their pool
+    kvsstore_pool_stat_t &d = txc->statfs_delta[pool];
+    d.objects += objects;
+    d.stored += stored;
+    d.omap += omap;
+}
+
+// An object is charged the name and value length of each of its omap keys,
+// see _omap_recharge(). PG metadata objects rewrite the same keys on every
+// update and are not charged at all.
+void KvsStore::_omap_charge(KvsTransContext *txc, OnodeRef &o, int64_t bytes) {
+    if (o->oid.is_pgmeta())
+        return;
+    if (bytes < 0 && (uint64_t) -bytes > o->onode.omap_bytes)
+        bytes = -(int64_t) o->onode.omap_bytes;
+    if (bytes == 0)
+        return;
+    o->onode.omap_bytes += bytes;
+    txc->write_onode(o);
+    _statfs_add(txc, o, 0, 0, bytes);
+}
+
+// returns the change in the charge of o when key is set to a value of
+// charge - key.length() bytes, or removed if charge is 0. The old charge
+// comes from o->omap_charges. A key that was not written since the onode
+// was loaded is taken to be absent, and the omap of o recounted by
+// _omap_recount(), so that the transaction path does not read.
+int64_t KvsStore::_omap_recharge(KvsTransContext *txc, OnodeRef &o, const string &key, uint32_t charge) {
+    if (o->oid.is_pgmeta())
+        return 0;
+    _omap_changing(txc, o);
+
+    auto p = o->omap_charges.find(key);
+    if (p != o->omap_charges.end()) {
+        const uint32_t old = p->second;
+        p->second = charge;
+        return (int64_t) charge - old;
+    }
+
+    if (!o->omap_charges_complete) {
+        if (logger)
+            logger->inc(l_kvsstore_omap_estimates);
+        std::lock_guard<std::mutex> l(omap_recount_lock);
+        if (!o->omap_recount_queued && omap_recount_q.size() < KVS_OMAP_RECOUNT_MAX) {
+            o->omap_recount_queued = true;
+            omap_recount_q.push_back(o);
+        }
+    }
+    o->omap_charges[key] = charge;
+    return charge;
+}
+
+// called before the omap of o is changed by txc. The first change of a
+// transaction settles the charge of o against a recount taken since the
+// last change, if there is one.
+void KvsStore::_omap_changing(KvsTransContext *txc, OnodeRef &o) {
+    if (txc->omap_onodes.insert(o).second) {
+        // before omap_gen moves, see _omap_recount()
+        o->omap_inflight++;
+        if (o->omap_count_gen == o->omap_gen) {
+            dout(20) << __func__ << " " << o->oid << " omap_bytes " << o->onode.omap_bytes
+                     << " counted " << o->omap_count_bytes << dendl;
+            _omap_charge(txc, o, (int64_t) o->omap_count_bytes - (int64_t) o->onode.omap_bytes);
+            o->omap_count_gen = UINT64_MAX;
+        }
+    }
+    o->omap_gen++;
+}
+
+// sums the charges of the omap keys under lid as they are on the device
+int KvsStore::_omap_count(uint64_t lid, uint64_t *bytes) {
+    kv_iter_context iter_ctx;
+    std::list<std::pair<void *, int>> buflist;
+    std::set<string> keylist;
+
+    omap_iterator_init(cct, lid, &iter_ctx);
+    int r = db.iter_readall(&iter_ctx, buflist);
+    if (r == 0)
+        _omap_populate_keylist(lid, buflist, keylist);
+    for (const auto &p : buflist) {
+        free(p.first);
+    }
+    if (r != 0)
+        return -EIO;
+
+    kv_key *k = KvsMemPool::Alloc_key();
+    if (k == 0) { ceph_abort_msg(cct, "memory allocation failure"); }
+    *bytes = 0;
+    for (const auto &key : keylist) {
+        construct_omap_key(cct, lid, key.c_str(), key.length(), k);
+        uint32_t length;
+        if (wbuf.lookup_size(k, &length) == 0 || db.sync_value_size(k, &length) == KV_SUCCESS)
+            *bytes += key.length() + length;
+    }
+    KvsMemPool::Release_key(k);
     return 0;
 }
 
+// called from the mempool thread. Counts the omap of each object whose
+// charge was estimated, at a time when no transaction is changing it; the
+// next transaction that does applies the count, see _omap_changing().
+// An object that is never quiet is tried again on the next round.
+void KvsStore::_omap_recount() {
+    std::list<OnodeRef> q;
+    {
+        std::lock_guard<std::mutex> l(omap_recount_lock);
+        q.swap(omap_recount_q);
+    }
+
+    std::list<OnodeRef> retry;
+    int counted = 0;
+    for (auto &o : q) {
+        if (!o->exists)
+            continue;
+        const uint64_t gen = o->omap_gen;
+        if (o->omap_inflight) {
+            retry.push_back(o);
+            continue;
+        }
+        uint64_t bytes;
+        if (_omap_count(o->onode.lid, &bytes) < 0 ||
+            o->omap_inflight || o->omap_gen != gen) {
+            retry.push_back(o);
+            continue;
+        }
+        dout(20) << __func__ << " " << o->oid << " gen " << gen << " " << bytes << " bytes" << dendl;
+        o->omap_count_bytes = bytes;
+        o->omap_count_gen = gen;
+        counted++;
+    }
+    if (counted && logger)
+        logger->inc(l_kvsstore_omap_recounts, counted);
+
+    std::lock_guard<std::mutex> l(omap_recount_lock);
+    for (auto &o : q) {
+        o->omap_recount_queued = false;
+    }
+    for (auto &o : retry) {
+        if (!o->omap_recount_queued) {
+            o->omap_recount_queued = true;
+            omap_recount_q.push_back(o);
+        }
+    }
+}
+
+// called in journal order; the snapshot journaled with txc must include
+// every transaction journaled before it
+void KvsStore::_statfs_apply(KvsTransContext *txc, uint64_t jseq) {
+    std::lock_guard<std::mutex> l(statfs_lock);
+    for (auto &i : txc->statfs_delta) {
+        if (i.second.is_zero())
+            continue;
+        kvsstore_pool_stat_t &p = statfs_state.pools[i.first];
+        p += i.second;
+        if (p.is_zero())
+            statfs_state.pools.erase(i.first);
+        statfs_sum += i.second;
+        statfs_dirty = true;
+    }
+    statfs_state.jseq = jseq;
+
+    if (txc->ioc.journal_entries.empty())
+        return;
+    ::encode(statfs_state, txc->statfs_snapshot);
+    if (txc->statfs_snapshot.length() > cct->_conf->kvsstore_statfs_journal_max_bytes) {
+        // too many pools to carry along; the periodic checkpoint covers it
+        txc->statfs_snapshot.clear();
+    }
+}
+
 CollectionRef KvsStore::_get_collection(const coll_t &cid) {
     RWLock::RLocker l(coll_lock);
     ceph::unordered_map<coll_t, CollectionRef>::iterator cp = coll_map.find(cid);
@@ -1013,19 +1326,16 @@ int KvsStore::getattr(
     int r;
     {
         RWLock::RLocker l(c->lock);
-        mempool::kvsstore_cache_other::string k(name);
-
         OnodeRef o = c->get_onode(oid, false);
         if (!o || !o->exists) {
             r = -ENOENT;
             goto out;
         }
 
-        if (!o->onode.attrs.count(k)) {
+        if (!o->onode.get_attr(name, &value)) {
             r = -ENODATA;
             goto out;
         }
-        value = o->onode.attrs[k];
 
         r = 0;
     }
@@ -1064,9 +1374,7 @@ int KvsStore::getattrs(
             r = -ENOENT;
             goto out;
         }
-        for (auto& i : o->onode.attrs) {
-            aset.emplace(i.first.c_str(), i.second);
-        }
+        o->onode.get_attrs(aset);
         r = 0;
     }
 
@@ -1202,6 +1510,13 @@ static int get_coll_key_range(CephContext *cct, KvsCollection *c, struct iter_pa
     return 1;
 }
 
+// exclusive end of a pg's hash range; 1 << 32 for the last pg of a pool,
+// which get_coll_key_range() has to cap at 0xffffffff
+static uint64_t get_coll_end_hash(KvsCollection *c, uint32_t starthash)
+{
+    return (uint64_t) starthash + (1ull << (32 - c->cnode.bits));
+}
+
 // needs a collection lock
 int KvsStore::_prep_collection_list(KvsCollection *c, const ghobject_t& start, struct iter_param &temp, struct iter_param &other) {
     if (!c->exists) return -ENOENT;
@@ -1341,13 +1656,15 @@ int KvsStore::omap_get(
             goto release;
         }
 
-        r = populate_keylist(cct, o->onode.lid, buflist, keylist, &db);
+        r = _omap_populate_keylist(o->onode.lid, buflist, keylist);
         if (r == -1) {
             r = 0;
             goto release;
 
         }
 
+        std::map<string, bufferlist> segvalues;
+        _pglog_expand(o, keylist, &segvalues);
 
         kv_key *omapkey = KvsMemPool::Alloc_key();
 
@@ -1358,10 +1675,16 @@ int KvsStore::omap_get(
         for (std::set<string>::iterator it = keylist.begin(); it != keylist.end(); ++it) {
             const string &user_key = *it;
 
+            auto v = segvalues.find(user_key);
+            if (v != segvalues.end()) {
+                (*out)[user_key].claim(v->second);
+                continue;
+            }
+
             bl.clear();
             construct_omap_key(cct, o->onode.lid, user_key.c_str(), user_key.length(), omapkey);
 
-            kv_result res = db.sync_read(omapkey, bl, ITER_BUFSIZE);
+            kv_result res = omap_sync_read(omapkey, bl);
 
             if (res == 0) {
                 if (user_key.length() == 0) {
@@ -1429,7 +1752,7 @@ int KvsStore::omap_get_header(
     omapkey = KvsMemPool::Alloc_key();
     construct_omap_key(cct, o->onode.lid, 0, 0, omapkey);
 
-    r = db.sync_read(omapkey, *header, ITER_BUFSIZE);
+    r = omap_sync_read(omapkey, *header);
     KvsMemPool::Release_key(omapkey);
 
 out:
@@ -1485,11 +1808,12 @@ int KvsStore::omap_get_keys(
         goto release;
     }
 
-    r = populate_keylist(cct, lid, buflist, *keys, &db);
+    r = _omap_populate_keylist(lid, buflist, *keys);
     if (r != 0) {
         r = -ENOENT;
         goto release;
     }
+    _pglog_expand(o, *keys, nullptr);
 
     if (keys->size() > 0){
      auto it = keys->begin();
@@ -1546,11 +1870,15 @@ int KvsStore::omap_get_values(
 
     for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
         const string user_key = *p;
-        construct_omap_key(cct, o->onode.lid, user_key.c_str(), user_key.length(), omapkey);
-
         bl.clear();
+        if (_pglog_lookup(o, user_key, &bl)) {
+            (*out)[user_key] = bl;
+            continue;
+        }
+
+        construct_omap_key(cct, o->onode.lid, user_key.c_str(), user_key.length(), omapkey);
 
-        kv_result res = db.sync_read(omapkey, bl, ITER_BUFSIZE);
+        kv_result res = omap_sync_read(omapkey, bl);
 
         if (res == 0) {
             (*out)[user_key] = bl;
@@ -1610,11 +1938,16 @@ int KvsStore::omap_check_keys(
         for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
             const string user_key = *p;
 
+            if (_pglog_lookup(o, user_key, nullptr)) {
+                out->insert(user_key);
+                continue;
+            }
+
             construct_omap_key(cct, o->onode.lid, user_key.c_str(), user_key.length(), omapkey);
 
             bl.clear();
 
-            kv_result res = db.sync_read(omapkey, bl, ITER_BUFSIZE);
+            kv_result res = omap_sync_read(omapkey, bl);
             if (res == 0) {
                 out->insert(user_key);
             }
@@ -1669,7 +2002,8 @@ KvsOmapIterator* KvsStore::_get_kvsomapiterator(KvsCollection *c, OnodeRef &o) {
         return 0;
     }
     
-    populate_keylist(cct, o->onode.lid, impl->buflist, impl->keylist, &db);
+    _omap_populate_keylist(o->onode.lid, impl->buflist, impl->keylist);
+    _pglog_expand(o, impl->keylist, &impl->values);
     
     impl->makeready();
     return impl;
@@ -1719,12 +2053,15 @@ void KvsStore::_txc_aio_submit(KvsTransContext *txc) {
         txc->ioc.add_userdata(it.first, it.second);
     }
 
+    add_pending_write_ios(txc->ioc.pending_aios.size());
+    KVS_TRACE(cct, KVS_EV_TXC_AIO_SUBMIT, txc, nullptr, txc->ioc.pending_aios.size(), 0);
     db.aio_submit(txc);
 }
 
 // write callback
 void KvsStore::txc_aio_finish(kv_io_context *op, KvsTransContext *txc) {
     FTRACE
+    KVS_TRACE(cct, KVS_EV_TXC_AIO_DONE, txc, nullptr, op->retcode, op->opcode);
     if (op->retcode != KV_SUCCESS && op->retcode != 784) {
         derr << "I/O failed ( write_callback ): op " << op->opcode  << ", retcode = " << op->retcode << dendl;
         ceph_abort_msg(cct, "write failed: disk full?");
@@ -1754,7 +2091,7 @@ void KvsStore::txc_aio_finish(kv_io_context *op, KvsTransContext *txc) {
         logger->dec(l_kvsstore_pending_trx_ios, 1);
 
     if (--txc->ioc.num_running == 0) {
-        logger->tinc(l_kvsstore_tr_latency,
+        logger->tinc_sharded(l_kvsstore_tr_latency,
                      ceph_clock_now() - txc->ioc.start);
 
         // last I/O -> proceed the transaction status
@@ -1766,6 +2103,7 @@ void KvsStore::txc_aio_finish(kv_io_context *op, KvsTransContext *txc) {
 void KvsStore::_txc_state_proc(KvsTransContext *txc) {
     FTRACE
     while (true) {
+        KVS_TRACE(cct, KVS_EV_TXC_STATE, txc, txc->get_state_name(), txc->ioc.num_pending.load(), txc->bytes);
         switch (txc->state) {
             case KvsTransContext::STATE_PREPARE:
 
@@ -1820,6 +2158,12 @@ void KvsStore::_txc_finish_io(KvsTransContext *txc) {
      * even though aio will complete in any order.
      */
 
+    // the device writes are done; later versions may be buffered again
+    for (const auto &k : txc->wbuf_passthru) {
+        wbuf.end_passthru(k);
+    }
+    txc->wbuf_passthru.clear();
+
     KvsOpSequencer *osr = txc->osr.get();
     std::lock_guard<std::mutex> l(osr->qlock);
     txc->state = KvsTransContext::STATE_IO_DONE;
@@ -1887,6 +2231,15 @@ void KvsStore::_txc_finish(KvsTransContext *txc) {
         txc->removed_collections.pop_front();
     }
 
+    if (!txc->reaps.empty()) {
+        _queue_reap(txc->reaps);
+    }
+
+    for (auto &o : txc->omap_onodes) {
+        o->omap_inflight--;
+    }
+    txc->omap_onodes.clear();
+
     OpSequencerRef osr = txc->osr;
     bool empty = false;
 
@@ -1894,6 +2247,7 @@ void KvsStore::_txc_finish(KvsTransContext *txc) {
     {
         std::lock_guard<std::mutex> l(osr->qlock);
         txc->state = KvsTransContext::STATE_DONE;
+        KVS_TRACE(cct, KVS_EV_TXC_STATE, txc, txc->get_state_name(), 0, txc->bytes);
         bool notify = false;
         while (!osr->q.empty()) {
             KvsTransContext *txc = &osr->q.front();
@@ -1972,6 +2326,18 @@ void KvsStore::_txc_write_nodes(KvsTransContext *txc) {
         }
 
         txc->ioc.add_onode(o->oid, bl);
+
+        // once the transaction is prepared the cached charges can go; a
+        // key that is not cached is estimated and recounted later
+        if (o->omap_charges.size() > KVS_OMAP_CHARGE_CACHE_MAX) {
+            o->omap_charges.clear();
+            o->omap_charges_complete = false;
+        }
+    }
+
+    // pglog segments and meta changed by the transaction
+    for (auto o : txc->pglog_onodes) {
+        _pglog_write(txc, o);
     }
 }
 
@@ -2082,113 +2448,677 @@ void KvsStore::_reap_collections() {
 }
 
 /// -------------------
-///  TRANSACTIONS
+///  REAPER
 /// -------------------
 
-int KvsStore::queue_transactions(
-        Sequencer *posr,
-        vector<Transaction> &tls,
-        TrackedOpRef op,
-        ThreadPool::TPHandle *handle) {
-    static std::mutex journal_index_lock;
-    static const uint32_t MAX_JOURNAL_INDEX = 5000;
-    static uint32_t journal_index;
-    FTRACE;
-    Context *onreadable;
-    Context *ondisk;
-    Context *onreadable_sync;
-    ObjectStore::Transaction::collect_contexts(
-            tls, &onreadable, &ondisk, &onreadable_sync);
+kvsstore_reap_t KvsStore::_new_reap_record(uint8_t type) {
+    kvsstore_reap_t r;
+    r.seq = ++reaper_seq;
+    r.type = type;
+    return r;
+}
 
-    if (cct->_conf->objectstore_blackhole) {
-        delete ondisk;
-        delete onreadable;
-        delete onreadable_sync;
-        return 0;
-    }
+// load reaper records that were not reclaimed before the last umount
+int KvsStore::_open_reaper() {
+    FTRACE
+    kv_iter_context iter_ctx;
+    std::list<std::pair<void *, int> > buflist;
+    std::map<uint64_t, kvsstore_reap_t> records;
+    void *key;
+    int length;
 
-    // set up the sequencer
-    KvsOpSequencer *osr;
-    assert(posr);
-    if (posr->p) {
-        osr = static_cast<KvsOpSequencer *>(posr->p.get());
-        dout(10) << __func__ << " existing " << osr << " " << *osr << dendl;
-    } else {
-        osr = new KvsOpSequencer(cct, this);
-        osr->parent = posr;
-        posr->p = osr;
-        dout(10) << __func__ << " new " << osr << " " << *osr << dendl;
+    iter_ctx.prefix = GROUP_PREFIX_REAPER;
+    iter_ctx.bitmask = 0xFFFFFFFF;
+    iter_ctx.buflen = ITER_BUFSIZE;
+    iter_ctx.routed = true;
+
+    int ret = db.iter_readall(&iter_ctx, buflist);
+    if (ret != 0) return ret;
+
+    for (const auto &p : buflist) {
+        iterbuf_reader reader(cct, p.first, p.second, &db);
+
+        while (reader.nextkey(&key, &length)) {
+            if (length != sizeof(kvs_reaper_key)) continue;
+            kvs_reaper_key *k = (kvs_reaper_key *) key;
+            if (k->group != GROUP_PREFIX_REAPER) continue;
+
+            kv_key rkey = { key, (kv_key_t) length };
+            bufferlist bl;
+            if (db.sync_read(&rkey, bl) != 0) continue;
+
+            kvsstore_reap_t r;
+            try {
+                bufferlist::iterator bp = bl.begin();
+                decode(r, bp);
+            } catch (buffer::error &e) {
+                derr << __func__ << " failed to decode reaper record " << k->seq << dendl;
+                continue;
+            }
+            records[r.seq] = r;
+        }
     }
 
-    // prepare
-    KvsTransContext *txc = _txc_create(osr);
-    txc->onreadable = onreadable;
-    txc->onreadable_sync = onreadable_sync;
-    txc->oncommit = ondisk;
+    for (const auto &p : buflist) {
+        free(p.first);
+    }
 
-    for (vector<Transaction>::iterator p = tls.begin(); p != tls.end(); ++p) {
-        (*p).set_osr(osr);
-        _txc_add_transaction(txc, &(*p));
+    std::lock_guard<std::mutex> l(reaper_lock);
+    reaper_queue.clear();
+    reaper_seq = 0;
+    for (auto &p : records) {
+        // never hand out a lid that still has keys waiting to be reaped
+        if (p.second.lid > kvsb.lid_last)
+            kvsb.lid_last = p.second.lid;
+        reaper_seq = p.first;
+        reaper_queue.push_back(p.second);
     }
+    logger->set(l_kvsstore_reaper_pending, reaper_queue.size());
 
-    _txc_write_nodes(txc);
+    dout(10) << __func__ << " loaded " << reaper_queue.size() << " records, seq " << reaper_seq << dendl;
+    return 0;
+}
 
-    // meta journaling
+void KvsStore::_start_reaper() {
+    {
+        std::lock_guard<std::mutex> l(reaper_lock);
+        reaper_stop = false;
+        reaper_iter_delete_failed = false;
+    }
+    kv_reaper_thread.create("kvsreaper");
+}
 
-    uint32_t cur_journal_index;
+// records that are not reclaimed yet stay on the device and are
+// reloaded by the next mount
+void KvsStore::_stop_reaper() {
     {
-        std::lock_guard<std::mutex> lock(journal_index_lock);
-        cur_journal_index = journal_index++;
-        if (journal_index == MAX_JOURNAL_INDEX) journal_index = 0;
+        std::lock_guard<std::mutex> l(reaper_lock);
+        reaper_stop = true;
+        reaper_cond.notify_all();
     }
+    kv_reaper_thread.join();
+}
 
-    _txc_journal_meta(txc, cur_journal_index);
+void KvsStore::_queue_reap(list<kvsstore_reap_t> &reaps) {
+    std::lock_guard<std::mutex> l(reaper_lock);
+    logger->inc(l_kvsstore_reaper_pending, reaps.size());
+    for (auto &r : reaps) {
+        dout(20) << __func__ << " " << r << dendl;
+        reaper_queue.push_back(r);
+    }
+    reaps.clear();
+    reaper_cond.notify_all();
+}
 
-    // execute (start)
-    _txc_state_proc(txc);
+void KvsStore::_kv_reaper_thread() {
+    FTRACE
+    std::unique_lock<std::mutex> l(reaper_lock);
+    while (!reaper_stop) {
+        if (reaper_queue.empty()) {
+            reaper_cond.wait(l);
+            continue;
+        }
 
-    return 0;
+        // removed pgs of one pool are swept together: the sweep scans the
+        // whole pool, so doing it once per pg would rescan it for each
+        std::vector<kvsstore_reap_t> batch;
+        const kvsstore_reap_t &r = reaper_queue.front();
+        for (const auto &q : reaper_queue) {
+            if (&q == &r ||
+                (r.type == kvsstore_reap_t::REAP_COLL && q.type == r.type &&
+                 q.poolid == r.poolid && q.shardid == r.shardid))
+                batch.push_back(q);
+        }
+        l.unlock();
+
+        int ret = (batch[0].type == kvsstore_reap_t::REAP_COLL) ? _reap_coll(batch) : _reap_one(batch[0]);
+        for (auto it = batch.begin(); ret == 0 && it != batch.end(); ++it) {
+            KvsSyncWriteContext ctx(cct);
+            ctx.delete_reap(it->seq);
+            db.aio_submit(&ctx);
+            ret = ctx.write_wait();
+            if (ret == KV_ERR_KEY_NOT_EXIST) ret = 0;
+        }
+        l.lock();
+
+        if (ret == 0) {
+            for (const auto &b : batch) {
+                dout(10) << __func__ << " reaped " << b << dendl;
+                auto it = std::find_if(reaper_queue.begin(), reaper_queue.end(),
+                    [&b](const kvsstore_reap_t &q) { return q.seq == b.seq; });
+                assert(it != reaper_queue.end());
+                reaper_queue.erase(it);
+            }
+            logger->dec(l_kvsstore_reaper_pending, batch.size());
+            logger->inc(l_kvsstore_reaper_reaped, batch.size());
+        } else if (!reaper_stop) {
+            derr << __func__ << " failed to reap " << batch[0] << " (" << batch.size()
+                 << " records), ret = " << ret << ", will retry" << dendl;
+            reaper_cond.wait_for(l, std::chrono::seconds(1));
+        }
+    }
 }
 
-void KvsStore::_txc_journal_meta(KvsTransContext *txc, uint64_t index) {
-    KvsSyncWriteContext ctx(cct);
-    if (ctx.write_journal(index, txc->ioc.journal_entries) < 0)
-        return;
-    db.aio_submit(&ctx);
-    kv_result ret = ctx.write_wait();
-
-    if (ret != KV_SUCCESS) {
-        derr << "write failed, error = " << ret << dendl;
-        ceph_abort_msg(cct, "_txc_journal_meta - journal write failed");
+int KvsStore::_reap_one(const kvsstore_reap_t &r) {
+    switch (r.type) {
+        case kvsstore_reap_t::REAP_LID:
+            return _reap_lid(r.lid);
+        case kvsstore_reap_t::REAP_COLL:
+            return _reap_coll({ r });
+        default:
+            derr << __func__ << " unknown reaper record " << r << ", dropping" << dendl;
+            return 0;
     }
 }
 
+int KvsStore::_reap_lid(uint64_t lid) {
+    kv_iter_context iter_ctx;
 
-void KvsStore::_txc_add_transaction(KvsTransContext *txc, Transaction *t) {
-    FTRACE
+    // buffered updates of a dropped lid must not be written back later
+    wbuf.discard_lid(lid);
+    omap_iterator_init(cct, lid, &iter_ctx);
 
-    Transaction::iterator i = t->begin();
+    return _reap_prefix(iter_ctx.prefix, true,
+        [lid](const void *key, int length) {
+            const kvs_omap_key *okey = (const kvs_omap_key *) key;
+            return length >= (int) offsetof(kvs_omap_key, name) &&
+                   okey->group == GROUP_PREFIX_OMAP && okey->lid == lid;
+        },
+        [](const void *key, int length) { return true; });
+}
 
-    vector<CollectionRef> cvec(i.colls.size());
+// true if a live collection covers part of the hash range of a removed
+// one; needs coll_lock
+bool KvsStore::_reap_coll_is_live(const kvsstore_reap_t &r) {
+    const uint64_t poolid = r.poolid + 0x8000000000000000ull;
+    for (auto &p : coll_map) {
+        spg_t pgid;
+        if (!p.second->cid.is_pg(&pgid)) continue;
+        struct iter_param temp;
+        struct iter_param other;
+        get_coll_key_range(cct, p.second.get(), temp, other);
+        const uint64_t endhash = get_coll_end_hash(p.second.get(), other.starthash);
+        if (other.poolid == poolid && other.shardid == r.shardid &&
+            other.starthash < r.endhash && r.starthash < endhash) {
+            dout(10) << __func__ << " " << r << " overlaps " << p.first << dendl;
+            return true;
+        }
+    }
+    return false;
+}
 
-    unsigned j = 0;
-    for (vector<coll_t>::iterator p = i.colls.begin(); p != i.colls.end();
-         ++p, ++j) {
-        cvec[j] = _get_collection(*p);
+// sweeps the removed collections in rs, which all belong to one pool and
+// shard, with a single scan of each of the pool's key groups
+int KvsStore::_reap_coll(const std::vector<kvsstore_reap_t> &rs) {
+    // starthash -> record, for the ranges that are still to be swept
+    std::map<uint32_t, const kvsstore_reap_t *> ranges;
+    {
+        // the range may have been handed to a collection created after the
+        // removal; its objects are live and must not be swept.
+        RWLock::RLocker l(coll_lock);
+        for (const auto &r : rs) {
+            coll_t cid;
+            if (!cid.parse(r.cid)) {
+                derr << __func__ << " invalid collection name in " << r << dendl;
+                continue;
+            }
+            if (_reap_coll_is_live(r)) {
+                dout(10) << __func__ << " " << r << " is live again, skipping" << dendl;
+                continue;
+            }
+            ranges[r.starthash] = &r;
+        }
     }
+    if (ranges.empty()) return 0;
+
+    const kvsstore_reap_t &first = *ranges.begin()->second;
+    const uint64_t poolids[2] = {
+        first.poolid + 0x8000000000000000ull,
+        (-2ll - (int64_t) first.poolid) + 0x8000000000000000ull
+    };
+
+    auto find_range = [&ranges](uint32_t hash) -> const kvsstore_reap_t * {
+        auto it = ranges.upper_bound(hash);
+        if (it == ranges.begin()) return nullptr;
+        --it;
+        return hash < it->second->endhash ? it->second : nullptr;
+    };
+
+    for (const uint8_t group : { GROUP_PREFIX_ONODE, GROUP_PREFIX_DATA }) {
+        for (const uint64_t poolid : poolids) {
+            auto is_dead = [&](const void *key, int length) {
+                const kvs_var_object_key *k = (const kvs_var_object_key *) key;
+                return length > (int) offsetof(kvs_var_object_key, name) &&
+                       k->group == group && k->shardid == first.shardid &&
+                       k->poolid == poolid && find_range(k->bitwisekey) != nullptr;
+            };
+            auto on_delete = [&](const void *key, int length) {
+                const kvs_var_object_key *k = (const kvs_var_object_key *) key;
+                {
+                    // keep keys of a collection that has been recreated
+                    // over the range since the sweep started
+                    RWLock::RLocker l(coll_lock);
+                    if (_reap_coll_is_live(*find_range(k->bitwisekey)))
+                        return false;
+                }
+                if (group != GROUP_PREFIX_ONODE) return true;
 
+                // its omap keys are reclaimed before the onode goes away
+                kv_key okey = { (void *) key, (kv_key_t) length };
+                bufferlist bl;
+                if (db.sync_read(&okey, bl, 8192) == 0) {
+                    kvsstore_onode_t onode;
+                    try {
+                        bufferptr::iterator p = bl.front().begin();
+                        onode.decode(p);
+                        if (onode.has_omap())
+                            _reap_lid(onode.lid);
+                    } catch (buffer::error &e) {
+                    }
+                }
 
-    vector<OnodeRef> ovec(i.objects.size());
+                ghobject_t oid;
+                construct_ghobject_t(cct, (const char *) key, length, &oid);
+                RWLock::RLocker l(coll_lock);
+                if (_reap_coll_is_live(*find_range(k->bitwisekey)))
+                    return false;
+                lscache.remove(oid);
+                return true;
+            };
 
-    for (int pos = 0; i.have_op(); ++pos) {
-        Transaction::Op *op = i.decode_op();
-        int r = 0;
+            int ret = _reap_prefix(get_object_group_id(group, first.shardid, poolid), false, is_dead, on_delete);
+            if (ret < 0) return ret;
+        }
+    }
+    return 0;
+}
 
-        // no coll or obj
-        if (op->op == Transaction::OP_NOP)
-            continue;
-        
-         // collection operations
+// deletes the keys under prefix for which is_dead() is true. A
+// device-side prefix delete is used only when no live key shares the prefix.
+// on_delete() runs before each key is deleted and can keep it by
+// returning false.
+// routed: the prefix lives on a single device (see KADI::route)
+int KvsStore::_reap_prefix(uint32_t prefix, bool routed, std::function<bool(const void *, int)> is_dead,
+                           std::function<bool(const void *, int)> on_delete) {
+    kv_iter_context iter_ctx;
+    std::list<std::pair<void *, int> > buflist;
+    std::list<std::pair<void *, int> > dead;
+    bool shared = false;
+    bool prechecked = false;  // on_delete() already ran for every dead key
+    void *key;
+    int length;
+    int ret;
+
+    iter_ctx.prefix = prefix;
+    iter_ctx.bitmask = 0xFFFFFFFF;
+    iter_ctx.buflen = ITER_BUFSIZE;
+    iter_ctx.routed = routed;
+
+    ret = db.iter_readall(&iter_ctx, buflist);
+    if (ret != 0) { ret = -EIO; goto out; }
+
+    for (const auto &p : buflist) {
+        iterbuf_reader reader(cct, p.first, p.second, &db);
+        while (reader.nextkey(&key, &length)) {
+            if (length > 255) break;
+            if (is_dead(key, length))
+                dead.push_back(std::make_pair(key, length));
+            else
+                shared = true;
+        }
+    }
+
+    if (dead.empty()) goto out;
+
+    if (!shared && cct->_conf->kvsstore_reaper_iter_delete && !reaper_iter_delete_failed) {
+        // a key that on_delete() keeps makes the prefix delete unsafe
+        for (auto it = dead.begin(); it != dead.end(); ) {
+            if (on_delete(it->first, it->second)) {
+                ++it;
+            } else {
+                it = dead.erase(it);
+                shared = true;
+            }
+        }
+        prechecked = true;
+
+        if (!shared) {
+            ret = db.iter_delete(&iter_ctx);
+            if (ret == 0) {
+                logger->inc(l_kvsstore_reaper_iter_deletes);
+                logger->inc(l_kvsstore_reaper_deleted_keys, dead.size());
+                goto out;
+            }
+            derr << __func__ << " prefix delete is not supported by the device (ret = " << ret
+                 << "), falling back to individual deletes" << dendl;
+            reaper_iter_delete_failed = true;
+            ret = 0;
+        }
+    }
+
+    {
+        const uint64_t batch_size = cct->_conf->kvsstore_reaper_batch_size;
+        auto it = dead.begin();
+        while (it != dead.end()) {
+            std::list<std::pair<void *, int> > batch;
+            while (it != dead.end() && batch.size() < batch_size) {
+                if (prechecked || on_delete(it->first, it->second))
+                    batch.push_back(*it);
+                ++it;
+            }
+            if (batch.empty()) continue;
+            if (!_reaper_throttle(batch.size())) {
+                ret = -EINTR;
+                break;
+            }
+            ret = _reap_delete_keys(batch);
+            if (ret < 0) break;
+        }
+    }
+
+out:
+    for (const auto &p : buflist) {
+        free(p.first);
+    }
+    return ret;
+}
+
+int KvsStore::_reap_delete_keys(std::list<std::pair<void *, int> > &keys) {
+    std::vector<std::unique_ptr<KvsSyncWriteContext> > ctxs;
+    int r = 0;
+
+    ctxs.reserve(keys.size());
+    for (const auto &p : keys) {
+        KvsSyncWriteContext *ctx = new KvsSyncWriteContext(cct);
+        ctx->delete_key(p.first, p.second);
+        ctxs.emplace_back(ctx);
+        db.aio_submit(ctx);
+    }
+
+    for (auto &ctx : ctxs) {
+        kv_result ret = ctx->write_wait();
+        if (ret != 0 && ret != KV_ERR_KEY_NOT_EXIST) {
+            derr << __func__ << " failed to delete a key, ret = " << ret << dendl;
+            r = -EIO;
+        }
+    }
+
+    logger->inc(l_kvsstore_reaper_deleted_keys, keys.size());
+    return r;
+}
+
+// returns false if the reaper is asked to stop while waiting
+bool KvsStore::_reaper_throttle(uint64_t nkeys) {
+    std::unique_lock<std::mutex> l(reaper_lock);
+    bool throttled = false;
+
+    while (!reaper_stop) {
+        const uint64_t rate = cct->_conf->kvsstore_reaper_max_keys_per_sec;
+        const uint64_t max_pending = cct->_conf->kvsstore_reaper_max_pending_ios;
+        const utime_t now = ceph_clock_now();
+
+        if (now - reaper_window_start >= utime_t(1, 0)) {
+            reaper_window_start = now;
+            reaper_window_keys = 0;
+        }
+
+        // client writes go first
+        const bool busy = max_pending &&
+                          logger->get(l_kvsstore_pending_trx_ios) > max_pending;
+        const bool over = rate && reaper_window_keys > 0 &&
+                          reaper_window_keys + nkeys > rate;
+
+        if (!busy && !over) {
+            reaper_window_keys += nkeys;
+            return true;
+        }
+
+        if (!throttled) {
+            logger->inc(l_kvsstore_reaper_throttled);
+            throttled = true;
+        }
+
+        if (busy) {
+            reaper_cond.wait_for(l, std::chrono::milliseconds(10));
+        } else {
+            utime_t left = reaper_window_start + utime_t(1, 0) - now;
+            reaper_cond.wait_for(l, std::chrono::milliseconds(left.to_msec() + 1));
+        }
+    }
+    return false;
+}
+
+/// -------------------
+///  TRANSACTIONS
+/// -------------------
+
+int KvsStore::queue_transactions(
+        Sequencer *posr,
+        vector<Transaction> &tls,
+        TrackedOpRef op,
+        ThreadPool::TPHandle *handle) {
+    static std::mutex journal_index_lock;
+    static const uint32_t MAX_JOURNAL_INDEX = 5000;
+    static uint32_t journal_index;
+    static uint64_t journal_seq;
+    FTRACE;
+    Context *onreadable;
+    Context *ondisk;
+    Context *onreadable_sync;
+    ObjectStore::Transaction::collect_contexts(
+            tls, &onreadable, &ondisk, &onreadable_sync);
+
+    if (cct->_conf->objectstore_blackhole) {
+        delete ondisk;
+        delete onreadable;
+        delete onreadable_sync;
+        return 0;
+    }
+
+    // set up the sequencer
+    KvsOpSequencer *osr;
+    assert(posr);
+    if (posr->p) {
+        osr = static_cast<KvsOpSequencer *>(posr->p.get());
+        dout(10) << __func__ << " existing " << osr << " " << *osr << dendl;
+    } else {
+        osr = new KvsOpSequencer(cct, this);
+        osr->parent = posr;
+        posr->p = osr;
+        dout(10) << __func__ << " new " << osr << " " << *osr << dendl;
+    }
+
+    // prepare
+    KvsTransContext *txc = _txc_create(osr);
+    txc->onreadable = onreadable;
+    txc->onreadable_sync = onreadable_sync;
+    txc->oncommit = ondisk;
+
+    for (vector<Transaction>::iterator p = tls.begin(); p != tls.end(); ++p) {
+        (*p).set_osr(osr);
+        _txc_add_transaction(txc, &(*p));
+    }
+
+    _txc_write_nodes(txc);
+
+    // meta journaling
+
+    uint32_t cur_journal_index;
+    uint64_t cur_journal_seq;
+    {
+        std::lock_guard<std::mutex> lock(journal_index_lock);
+        cur_journal_index = journal_index++;
+        cur_journal_seq = journal_seq++;
+        if (journal_index == MAX_JOURNAL_INDEX) journal_index = 0;
+        _statfs_apply(txc, cur_journal_seq);
+    }
+
+    KVS_TRACE(cct, KVS_EV_TXC_JOURNAL, txc, nullptr, cur_journal_seq, txc->ioc.journal_entries.size());
+    _txc_journal_meta(txc, cur_journal_index);
+    _txc_absorb_writes(txc, cur_journal_seq);
+
+    // a journal slot is overwritten MAX_JOURNAL_INDEX transactions later;
+    // buffered updates must be on the device well before that. past the soft
+    // limits the mempool thread writes the buffer back; only when it falls
+    // behind does the submitter flush itself, as backpressure
+    const uint64_t max_bytes = cct->_conf->kvsstore_write_buffer_max_bytes;
+    const uint64_t bytes = wbuf.get_bytes();
+    const uint64_t oldest = wbuf.oldest_jseq();
+    const uint64_t soft_jseq = (cur_journal_seq > MAX_JOURNAL_INDEX / 2) ?
+                               cur_journal_seq - MAX_JOURNAL_INDEX / 2 : 0;
+    const uint64_t hard_jseq = (cur_journal_seq > MAX_JOURNAL_INDEX / 4 * 3) ?
+                               cur_journal_seq - MAX_JOURNAL_INDEX / 4 * 3 : 0;
+    if (oldest < hard_jseq) {
+        _wbuf_flush(soft_jseq, utime_t());
+    } else if (max_bytes && bytes > 2 * max_bytes) {
+        _wbuf_flush(UINT64_MAX, utime_t(UINT32_MAX, 0));
+    } else if ((max_bytes && bytes > max_bytes) || oldest < soft_jseq) {
+        mempool_thread.kick_wbuf();
+    }
+
+    // execute (start)
+    _txc_state_proc(txc);
+
+    return 0;
+}
+
+// Small omap updates are durable once _txc_journal_meta() returns, so they are
+// handed to the write buffer instead of the device. Deletes and large values
+// go to the device ("passthrough"); the buffered version of such a key is
+// dropped first, and the key is kept out of the buffer until the device write
+// completes so that a later buffered version cannot be flushed ahead of it.
+void KvsStore::_txc_absorb_writes(KvsTransContext *txc, uint64_t jseq) {
+    FTRACE
+    // the buffer may still hold keys if it was disabled at runtime
+    const bool enabled = cct->_conf->kvsstore_write_buffer_max_bytes != 0;
+    if (!enabled && wbuf.get_bytes() == 0)
+        return;
+
+    const uint64_t max_value = cct->_conf->kvsstore_write_buffer_max_value_size;
+    KvsIoContext &ioc = txc->ioc;
+    auto is_omap = [](const kv_key *k) {
+        return k->length >= offsetof(kvs_omap_key, name) &&
+               ((const kvs_omap_key *) k->key)->group == GROUP_PREFIX_OMAP;
+    };
+
+    std::set<std::string> passthru;
+    for (const auto &p : ioc.pending_aios) {
+        if (is_omap(p.first) && (!enabled || p.second == 0 || p.second->length > max_value))
+            passthru.insert(std::string((const char *) p.first->key, p.first->length));
+    }
+    for (const auto &k : passthru) {
+        wbuf.begin_passthru(k.data(), k.length());
+        txc->wbuf_passthru.push_back(k);
+    }
+
+    int absorbed = 0, coalesced = 0;
+    auto it = ioc.pending_aios.begin();
+    while (enabled && it != ioc.pending_aios.end()) {
+        std::string k((const char *) it->first->key, it->first->length);
+        if (!is_omap(it->first) || passthru.count(k)) {
+            ++it;
+            continue;
+        }
+        int r = wbuf.absorb(it->first, it->second, jseq);
+        if (r < 0) {
+            // an earlier passthrough of this key is still in flight
+            txc->wbuf_passthru.push_back(std::move(k));
+            ++it;
+            continue;
+        }
+        coalesced += r;
+        absorbed++;
+        it = ioc.pending_aios.erase(it);
+        ioc.num_pending--;
+    }
+
+    // the buffer may already have released some of these
+    ioc.journal_entries.clear();
+
+    if (absorbed && logger) {
+        logger->inc(l_kvsstore_wbuf_absorbed, absorbed);
+        logger->inc(l_kvsstore_wbuf_coalesced, coalesced);
+        logger->set(l_kvsstore_wbuf_bytes, wbuf.get_bytes());
+    }
+}
+
+void KvsStore::_wbuf_flush(uint64_t jseq, const utime_t &stamp) {
+    int flushed = wbuf.flush(jseq, stamp);
+    KVS_TRACE(cct, KVS_EV_WBUF_FLUSH, 0, nullptr, jseq, flushed);
+    if (flushed && logger) {
+        logger->inc(l_kvsstore_wbuf_flushed, flushed);
+        logger->set(l_kvsstore_wbuf_bytes, wbuf.get_bytes());
+    }
+}
+
+kv_result KvsStore::omap_sync_read(kv_key *key, bufferlist &bl, int valuesize) {
+    if (wbuf.lookup(key, bl) == 0)
+        return KV_SUCCESS;
+    return db.sync_read(key, bl, valuesize);
+}
+
+int KvsStore::_omap_populate_keylist(uint64_t lid, std::list<std::pair<void*, int>> &buflist, std::set<string> &keylist) {
+    populate_keylist(cct, lid, buflist, keylist, &db);
+    wbuf.merge_keylist(lid, keylist);
+    return keylist.empty() ? -1 : 0;
+}
+
+void KvsStore::_txc_journal_meta(KvsTransContext *txc, uint64_t index) {
+    KvsSyncWriteContext ctx(cct);
+    auto &entries = txc->ioc.journal_entries;
+    kv_key *statfs_key = 0;
+    kv_value *statfs_value = 0;
+    if (txc->statfs_snapshot.length()) {
+        // replayed into the usage counters, not written to the device
+        statfs_key = KvsMemPool::Alloc_key();
+        construct_statfs_key(statfs_key);
+        statfs_value = KvsMemPool::Alloc_value(txc->statfs_snapshot.length());
+        txc->statfs_snapshot.copy(0, txc->statfs_snapshot.length(), (char *) statfs_value->value);
+        entries.push_back(std::make_pair(statfs_key, statfs_value));
+    }
+    int r = ctx.write_journal(index, entries);
+    if (statfs_key) {
+        entries.pop_back();
+        KvsMemPool::Release_key(statfs_key);
+        KvsMemPool::Release_value(statfs_value);
+    }
+    if (r < 0)
+        return;
+    db.aio_submit(&ctx);
+    kv_result ret = ctx.write_wait();
+
+    if (ret != KV_SUCCESS) {
+        derr << "write failed, error = " << ret << dendl;
+        ceph_abort_msg(cct, "_txc_journal_meta - journal write failed");
+    }
+}
+
+
+void KvsStore::_txc_add_transaction(KvsTransContext *txc, Transaction *t) {
+    FTRACE
+
+    Transaction::iterator i = t->begin();
+
+    vector<CollectionRef> cvec(i.colls.size());
+
+    unsigned j = 0;
+    for (vector<coll_t>::iterator p = i.colls.begin(); p != i.colls.end();
+         ++p, ++j) {
+        cvec[j] = _get_collection(*p);
+    }
+
+
+    vector<OnodeRef> ovec(i.objects.size());
+
+    for (int pos = 0; i.have_op(); ++pos) {
+        Transaction::Op *op = i.decode_op();
+        int r = 0;
+
+        // no coll or obj
+        if (op->op == Transaction::OP_NOP)
+            continue;
+        
+         // collection operations
         CollectionRef &c = cvec[op->cid];
         switch (op->op) {
             case Transaction::OP_RMCOLL: {
@@ -2628,9 +3558,11 @@ release:
     return r;
 }
 
-int KvsStore::_update_write_buffer(OnodeRef &o, uint64_t offset, size_t length, bufferlist *towrite, bufferlist &out, bool truncate)
+int KvsStore::_update_write_buffer(KvsTransContext *txc, OnodeRef &o, uint64_t offset, size_t length, bufferlist *towrite, bufferlist &out, bool truncate)
 {
     _update_buffer(cct, out, offset, length, towrite, truncate);
+    _statfs_add(txc, o, o->exists ? 0 : 1,
+                (int64_t) out.length() - (int64_t) (o->exists ? o->onode.size : 0), 0);
     o->onode.size = out.length();
     o->exists = true;
     
@@ -2661,7 +3593,7 @@ int KvsStore::_write(KvsTransContext *txc,
     if (it != txc->tempbuffers.end()) {
         // previous written in this transaction
         
-        r = _update_write_buffer(o, offset, length, bl, it->second, truncate);
+        r = _update_write_buffer(txc, o, offset, length, bl, it->second, truncate);
     }
     else {
         bufferlist &data = txc->tempbuffers[o->oid];
@@ -2676,7 +3608,7 @@ int KvsStore::_write(KvsTransContext *txc,
         }
 
         if (length != 0 || data.length() == 0 || truncate) {
-            r = _update_write_buffer(o, offset, length, bl, data, truncate);
+            r = _update_write_buffer(txc, o, offset, length, bl, data, truncate);
         }
     }
     
@@ -2784,10 +3716,13 @@ int KvsStore::_do_remove(
     if (it != txc->tempbuffers.end()) {
         txc->tempbuffers.erase(it);
     }
+    _omap_charge(txc, o, -(int64_t) o->onode.omap_bytes);
+    _statfs_add(txc, o, -1, -(int64_t) o->onode.size, 0);
     o->exists = false;
     txc->ioc.rm_onode(o->oid);
     txc->ioc.rm_data(o->oid);
     txc->removed(o);
+    _pglog_reset(txc, o);
     o->onode = kvsstore_onode_t();
     
     /*{
@@ -2819,12 +3754,12 @@ int KvsStore::_setattr(KvsTransContext *txc,
     int r = 0;
 
     if (val.is_partial()) {
-        auto &b = o->onode.attrs[name.c_str()] = bufferptr(val.c_str(),
-                                                     val.length());
+        bufferptr b(val.c_str(), val.length());
         b.reassign_to_mempool(mempool::mempool_kvsstore_cache_other);
+        o->onode.set_attr(name.c_str(), b);
     } else {
-        auto &b = o->onode.attrs[name.c_str()] = val;
-        b.reassign_to_mempool(mempool::mempool_kvsstore_cache_other);
+        val.reassign_to_mempool(mempool::mempool_kvsstore_cache_other);
+        o->onode.set_attr(name.c_str(), val);
     }
     txc->write_onode(o);
     dout(10) << __func__ << " " << c->cid << " " << o->oid
@@ -2847,14 +3782,10 @@ int KvsStore::_setattrs(KvsTransContext *txc,
     for (map<string, bufferptr>::const_iterator p = aset.begin();
          p != aset.end(); ++p) {
 
-        if (p->second.is_partial()) {
-            auto &b = o->onode.attrs[p->first.c_str()] =
-                              bufferptr(p->second.c_str(), p->second.length());
-            b.reassign_to_mempool(mempool::mempool_kvsstore_cache_other);
-        } else {
-            auto &b = o->onode.attrs[p->first.c_str()] = p->second;
-            b.reassign_to_mempool(mempool::mempool_kvsstore_cache_other);
-        }
+        bufferptr b = p->second.is_partial() ?
+                      bufferptr(p->second.c_str(), p->second.length()) : p->second;
+        b.reassign_to_mempool(mempool::mempool_kvsstore_cache_other);
+        o->onode.set_attr(p->first.c_str(), b);
     }
     txc->write_onode(o);
     dout(10) << __func__ << " " << c->cid << " " << o->oid
@@ -2872,11 +3803,9 @@ int KvsStore::_rmattr(KvsTransContext *txc,
     dout(15) << __func__ << " " << c->cid << " " << o->oid
              << " " << name << dendl;
     int r = 0;
-    auto it = o->onode.attrs.find(name.c_str());
-    if (it == o->onode.attrs.end())
+    if (!o->onode.rm_attr(name.c_str()))
         goto out;
 
-    o->onode.attrs.erase(it);
     txc->write_onode(o);
 
 
@@ -2893,10 +3822,10 @@ int KvsStore::_rmattrs(KvsTransContext *txc,
     dout(15) << __func__ << " " << c->cid << " " << o->oid << dendl;
     int r = 0;
 
-    if (o->onode.attrs.empty())
+    if (!o->onode.has_attrs())
         goto out;
 
-    o->onode.attrs.clear();
+    o->onode.clear_attrs();
     txc->write_onode(o);
 
     out:
@@ -2904,40 +3833,817 @@ int KvsStore::_rmattrs(KvsTransContext *txc,
     return r;
 }
 
-void KvsStore::_do_omap_clear(KvsTransContext *txc, OnodeRef &o) {
-    FTRACE
+/// -------------------
+///  PG log segments
+/// -------------------
+//
+// The PG log of a pgmeta object is written as one omap key per log entry,
+// added as the log grows and removed as it is trimmed. On a KV-SSD each of
+// those is a separate command, so the entries are packed into segment
+// values of kvsstore_pglog_meta_t::seg_entries versions instead. What a
+// transaction adds to the segment that the log grows into (the head), and
+// the trim point, go into a delta record small enough for the write
+// buffer; the head itself is only rewritten every few deltas. A trim drops
+// the segments that fell behind it, and the log is read back a segment at
+// a time. The meta key is only rewritten when a head moves to another
+// segment.
+//
+// The state is loaded with the collection at mount, so that the
+// transaction path does not read. Only a rewind or a range removal that
+// reaches into an older segment reads that segment back.
+//
+// The trim point relies on PGLog removing single log keys only at the tail
+// of the log; ranges are removed entry by entry.
+
+// PGLog keys its entries with eversion_t::get_key_name(), "%010u.%020llu",
+// and its dups with "dup_" followed by the same. Returns the kind and sets
+// the version, or returns -1 for any other key.
+static int pglog_key_kind(const string &key, uint64_t *version)
+{
+    size_t off = 0;
+    int kind = KvsPGLogSegments::KIND_LOG;
+    if (key.length() == 35 && key.compare(0, 4, "dup_") == 0) {
+        off = 4;
+        kind = KvsPGLogSegments::KIND_DUP;
+    } else if (key.length() != 31) {
+        return -1;
+    }
+
+    const char *p = key.c_str() + off;
+    for (int i = 0; i < 31; i++) {
+        if (i == 10 ? p[i] != '.' : !isdigit(p[i]))
+            return -1;
+    }
+    *version = strtoull(p + 11, nullptr, 10);
+    return kind;
+}
+
+static const string pglog_min_key[KvsPGLogSegments::NUM_KINDS] = {
+    "0000000000.00000000000000000000",
+    "dup_0000000000.00000000000000000000"
+};
+static const string pglog_max_key[KvsPGLogSegments::NUM_KINDS] = {
+    "4294967295.18446744073709551615",
+    "dup_4294967295.18446744073709551615"
+};
+
+static string pglog_seg_name(int kind, uint64_t segno)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), KVS_PGLOG_SEG_PREFIX "%c.%016llx",
+             kind == KvsPGLogSegments::KIND_DUP ? 'd' : 'l', (unsigned long long)segno);
+    return string(buf);
+}
+
+static bool pglog_parse_seg_name(const string &name, int *kind, uint64_t *segno)
+{
+    const size_t plen = sizeof(KVS_PGLOG_SEG_PREFIX) - 1;
+    if (name.length() != plen + 18 ||
+        name.compare(0, plen, KVS_PGLOG_SEG_PREFIX) != 0 ||
+        name[plen + 1] != '.')
+        return false;
+
+    if (name[plen] == 'l')
+        *kind = KvsPGLogSegments::KIND_LOG;
+    else if (name[plen] == 'd')
+        *kind = KvsPGLogSegments::KIND_DUP;
+    else
+        return false;
+    *segno = strtoull(name.c_str() + plen + 2, nullptr, 16);
+    return true;
+}
+
+static string pglog_delta_name(uint32_t slot)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), KVS_PGLOG_DELTA_PREFIX "%02x", slot);
+    return string(buf);
+}
+
+static bool pglog_is_delta_name(const string &name)
+{
+    const size_t plen = sizeof(KVS_PGLOG_DELTA_PREFIX) - 1;
+    return name.length() == plen + 2 &&
+           name.compare(0, plen, KVS_PGLOG_DELTA_PREFIX) == 0;
+}
+
+static void pglog_encode_seg(const string &trimmed_to, const map<string, bufferlist> &entries,
+                             uint64_t seq, bufferlist &bl)
+{
+    ENCODE_START(2, 1, bl);
+    ::encode(trimmed_to, bl);
+    ::encode(entries, bl);
+    ::encode(seq, bl);
+    ENCODE_FINISH(bl);
+}
+
+static int pglog_decode_seg(bufferlist &bl, string *trimmed_to, map<string, bufferlist> *entries,
+                            uint64_t *seq)
+{
+    try {
+        bufferlist::iterator p = bl.begin();
+        DECODE_START(2, p);
+        ::decode(*trimmed_to, p);
+        ::decode(*entries, p);
+        uint64_t s = 0;
+        if (struct_v >= 2)
+            ::decode(s, p);
+        if (seq)
+            *seq = s;
+        DECODE_FINISH(p);
+    } catch (buffer::error &e) {
+        return -EIO;
+    }
+    return 0;
+}
+
+static void pglog_encode_delta(const KvsPGLogSegments::delta_t &d, bufferlist &bl)
+{
+    ENCODE_START(1, 1, bl);
+    ::encode(d.seq, bl);
+    for (int kind = 0; kind < KvsPGLogSegments::NUM_KINDS; kind++) {
+        ::encode(d.segno[kind], bl);
+        ::encode(d.trimmed_to[kind], bl);
+        ::encode(d.entries[kind], bl);
+    }
+    ENCODE_FINISH(bl);
+}
+
+static int pglog_decode_delta(bufferlist &bl, KvsPGLogSegments::delta_t *d)
+{
+    try {
+        bufferlist::iterator p = bl.begin();
+        DECODE_START(1, p);
+        ::decode(d->seq, p);
+        for (int kind = 0; kind < KvsPGLogSegments::NUM_KINDS; kind++) {
+            ::decode(d->segno[kind], p);
+            ::decode(d->trimmed_to[kind], p);
+            ::decode(d->entries[kind], p);
+        }
+        DECODE_FINISH(p);
+    } catch (buffer::error &e) {
+        return -EIO;
+    }
+    return 0;
+}
+
+// brings a head segment read with sequence seq up to date with the deltas,
+// which are sorted oldest first. Returns whether any applied.
+static bool pglog_apply_deltas(const std::vector<KvsPGLogSegments::delta_t> &deltas, int kind,
+                               int64_t segno, uint64_t seq, string *trimmed_to,
+                               map<string, bufferlist> *entries)
+{
+    bool applied = false;
+    for (const auto &d : deltas) {
+        if (d.segno[kind] != segno || d.seq <= seq)
+            continue;
+        for (const auto &e : d.entries[kind]) {
+            (*entries)[e.first] = e.second;
+        }
+        if (d.trimmed_to[kind] > *trimmed_to)
+            *trimmed_to = d.trimmed_to[kind];
+        applied = true;
+    }
+    return applied;
+}
+
+static int pglog_decode_meta(bufferlist &bl, kvsstore_pglog_meta_t *meta)
+{
+    try {
+        bufferlist::iterator p = bl.begin();
+        ::decode(*meta, p);
+    } catch (buffer::error &e) {
+        return -EIO;
+    }
+    return 0;
+}
+
+// segments of a kind that a key range [first, last) can touch. Versions
+// grow with the keys in a PG log, so a range of keys is a range of
+// segments; a bound that is not a key of this kind leaves that end open.
+static void pglog_range_segs(const KvsPGLogSegments *pl, int kind,
+                             const string &first, const string &last,
+                             uint64_t *lo, uint64_t *hi)
+{
+    uint64_t version;
+    *lo = 0;
+    *hi = std::numeric_limits<uint64_t>::max();
+    if (first > pglog_min_key[kind] && pglog_key_kind(first, &version) == kind)
+        *lo = pl->seg_of(version);
+    if (last < pglog_max_key[kind] && pglog_key_kind(last, &version) == kind)
+        *hi = pl->seg_of(version);
+}
+
+int KvsStore::_pglog_read_meta(uint64_t lid, kvsstore_pglog_meta_t *meta)
+{
+    kv_key *key = KvsMemPool::Alloc_key();
+    if (key == 0) { ceph_abort_msg(cct, "memory allocation failure"); }
+
+    bufferlist bl;
+    construct_omap_key(cct, lid, KVS_PGLOG_META_KEY, sizeof(KVS_PGLOG_META_KEY) - 1, key);
+    kv_result res = omap_sync_read(key, bl, 4096);
+    KvsMemPool::Release_key(key);
+
+    if (res != 0)
+        return -ENOENT;
+    return pglog_decode_meta(bl, meta);
+}
+
+// reads a segment with a buffer of the size recorded in the meta key
+int KvsStore::_pglog_read_seg(uint64_t lid, const kvsstore_pglog_meta_t &meta, int kind,
+                              uint64_t segno, string *trimmed_to, map<string, bufferlist> *entries,
+                              uint64_t *seq)
+{
+    kv_key *key = KvsMemPool::Alloc_key();
+    if (key == 0) { ceph_abort_msg(cct, "memory allocation failure"); }
+
+    bufferlist bl;
+    const string name = pglog_seg_name(kind, segno);
+    construct_omap_key(cct, lid, name.c_str(), name.length(), key);
+    kv_result res = omap_sync_read(key, bl, meta.seg_bytes[kind] ? meta.seg_bytes[kind] : KVS_OBJECT_MAX_SIZE);
+    KvsMemPool::Release_key(key);
+
+    if (logger)
+        logger->inc(l_kvsstore_pglog_seg_reads);
+    if (res != 0)
+        return -ENOENT;
+    return pglog_decode_seg(bl, trimmed_to, entries, seq);
+}
+
+// reads the delta records that exist, oldest first
+int KvsStore::_pglog_read_deltas(uint64_t lid, const kvsstore_pglog_meta_t &meta,
+                                 std::vector<KvsPGLogSegments::delta_t> *deltas)
+{
+    kv_key *key = KvsMemPool::Alloc_key();
+    if (key == 0) { ceph_abort_msg(cct, "memory allocation failure"); }
+
     int r = 0;
+    for (uint32_t slot = 0; slot < meta.delta_slots; slot++) {
+        bufferlist bl;
+        const string name = pglog_delta_name(slot);
+        construct_omap_key(cct, lid, name.c_str(), name.length(), key);
+        if (omap_sync_read(key, bl, KVS_PGLOG_DELTA_MAX_BYTES) != 0)
+            continue;
+        deltas->emplace_back();
+        if (pglog_decode_delta(bl, &deltas->back()) < 0) {
+            deltas->pop_back();
+            r = -EIO;
+        }
+    }
+    KvsMemPool::Release_key(key);
 
-    if(!o->onode.has_omap())
-        goto release;
-    o->flush();
-    {
-        uint64_t lid = o->onode.lid;
+    std::sort(deltas->begin(), deltas->end(),
+              [](const KvsPGLogSegments::delta_t &a, const KvsPGLogSegments::delta_t &b) {
+                  return a.seq < b.seq;
+              });
+    return r;
+}
 
-        kv_iter_context iter_ctx;
-        std::list<std::pair<void*, int>> buflist;
-        std::set<string> keylist;
+// reads the meta key and the heads of the pgmeta object o into pl. Nothing
+// may be writing its omap at the same time.
+void KvsStore::_pglog_load(OnodeRef &o, KvsPGLogSegments *pl)
+{
+    const uint64_t lid = o->onode.lid;
 
-        omap_iterator_init(cct, lid, &iter_ctx);
+    kv_iter_context iter_ctx;
+    std::list<std::pair<void *, int>> buflist;
+    std::set<string> keylist;
 
-        
+    omap_iterator_init(cct, lid, &iter_ctx);
+    if (db.iter_readall(&iter_ctx, buflist) == 0)
+        _omap_populate_keylist(lid, buflist, keylist);
+    for (const auto &p : buflist) {
+        free(p.first);
+    }
 
-        if (db.iter_readall(&iter_ctx, buflist) < 0) {
-            ceph_abort_msg(cct, "iterator read failed");
-        };
+    if (keylist.count(KVS_PGLOG_META_KEY) &&
+        _pglog_read_meta(lid, &pl->meta) < 0) {
+        derr << __func__ << " " << o->oid << " unable to read the pglog meta" << dendl;
+        ceph_abort_msg(cct, "corrupt pglog meta");
+    }
+    pl->seq = pl->meta.seq;
+
+    for (const auto &k : keylist) {
+        int kind;
+        uint64_t n;
+        if (pglog_parse_seg_name(k, &kind, &n))
+            pl->segs[kind][n].on_disk = true;
+        else if (pglog_key_kind(k, &n) >= 0)
+            pl->has_plain_keys = true;
+    }
 
-        r = populate_keylist(cct, lid, buflist, keylist, &db);
+    std::vector<KvsPGLogSegments::delta_t> deltas;
+    if (_pglog_read_deltas(lid, pl->meta, &deltas) < 0) {
+        derr << __func__ << " " << o->oid << " unable to read the pglog deltas" << dendl;
+        ceph_abort_msg(cct, "corrupt pglog delta");
+    }
+    if (!deltas.empty())
+        pl->seq = std::max(pl->seq, deltas.back().seq);
 
-        if (r == -1) return ;
+    // the heads carry the trim points, and the log grows into them
+    for (int kind = 0; kind < KvsPGLogSegments::NUM_KINDS; kind++) {
+        pl->trimmed_to[kind] = pl->meta.trimmed_to[kind];
+        if (pl->meta.head[kind] < 0)
+            continue;
+        auto p = pl->segs[kind].find(pl->meta.head[kind]);
+        if (p == pl->segs[kind].end())
+            continue;
+        KvsPGLogSegments::seg_t &s = p->second;
+        string trimmed_to;
+        if (_pglog_read_seg(lid, pl->meta, kind, p->first, &trimmed_to, &s.entries, &s.seq) < 0) {
+            derr << __func__ << " " << o->oid << " unable to read pglog segment "
+                 << kind << "." << p->first << dendl;
+            ceph_abort_msg(cct, "corrupt pglog segment");
+        }
+        s.loaded = true;
+        s.deltas = pglog_apply_deltas(deltas, kind, p->first, s.seq, &trimmed_to, &s.entries);
+        pl->seq = std::max(pl->seq, s.seq);
+        if (trimmed_to > pl->trimmed_to[kind])
+            pl->trimmed_to[kind] = trimmed_to;
+    }
+
+    dout(20) << __func__ << " " << o->oid << " seg_entries " << pl->meta.seg_entries
+             << " segments " << pl->segs[KvsPGLogSegments::KIND_LOG].size()
+             << "+" << pl->segs[KvsPGLogSegments::KIND_DUP].size()
+             << " deltas " << deltas.size() << " seq " << pl->seq
+             << (pl->has_plain_keys ? " has plain keys" : "") << dendl;
+}
+
+// called for each collection at mount
+void KvsStore::_pglog_preload(CollectionRef &c)
+{
+    spg_t pgid;
+    if (!c->cid.is_pg(&pgid))
+        return;
 
-        for (auto it = keylist.begin(); it != keylist.end(); ++it){
-                string user_key = *it;
+    RWLock::RLocker l(c->lock);
+    OnodeRef o = c->get_onode(pgid.make_pgmeta_oid(), false);
+    if (!o || !o->exists)
+        return;
+    c->pglog.reset(new KvsPGLogSegments);
+    c->pglog->lid = o->onode.lid;
+    if (o->onode.has_omap())
+        _pglog_load(o, c->pglog.get());
+}
 
-                txc->ioc.rm_omap(o->oid, o->onode.lid, user_key);
+// returns the segments of a pgmeta object, or nullptr if its log is kept
+// one entry per key
+KvsPGLogSegments *KvsStore::_pglog_open(KvsTransContext *txc, OnodeRef &o)
+{
+    if (!o->oid.is_pgmeta())
+        return nullptr;
+
+    std::unique_ptr<KvsPGLogSegments> &pl = o->c->pglog;
+    if (!pl || pl->lid != o->onode.lid) {
+        pl.reset(new KvsPGLogSegments);
+        pl->lid = o->onode.lid;
+        if (o->onode.has_omap()) {
+            // not loaded at mount; earlier transactions of this PG may
+            // still be writing the keys
+            dout(10) << __func__ << " " << o->oid << " loading on the transaction path" << dendl;
+            txc->osr->drain_preceding(txc);
+            _pglog_load(o, pl.get());
         }
     }
-release:
-        return ;
+
+    if (!pl->enabled() && cct->_conf->kvsstore_pglog_segment_entries > 0) {
+        pl->meta.seg_entries = cct->_conf->kvsstore_pglog_segment_entries;
+        pl->meta_dirty = true;
+        txc->pglog_onodes.insert(o);
+    }
+    if (pl->enabled() && pl->meta.delta_slots == 0) {
+        pl->meta.delta_slots = KVS_PGLOG_DELTA_SLOTS;
+        pl->meta_dirty = true;
+        txc->pglog_onodes.insert(o);
+    }
+
+    return pl->enabled() ? pl.get() : nullptr;
+}
+
+// only a rewind or a range removal asks for a segment other than a head,
+// and only then is one read on the transaction path
+KvsPGLogSegments::seg_t *KvsStore::_pglog_get_seg(KvsTransContext *txc, OnodeRef &o,
+                                                  int kind, uint64_t segno, bool create)
+{
+    KvsPGLogSegments *pl = o->c->pglog.get();
+    auto &segs = pl->segs[kind];
+    auto p = segs.find(segno);
+    if (p == segs.end()) {
+        if (!create)
+            return nullptr;
+        KvsPGLogSegments::seg_t &s = segs[segno];
+        s.loaded = true;
+        return &s;
+    }
+
+    KvsPGLogSegments::seg_t &s = p->second;
+    if (!s.loaded) {
+        if (s.on_disk) {
+            txc->osr->drain_preceding(txc);
+            string trimmed_to;
+            if (_pglog_read_seg(o->onode.lid, pl->meta, kind, segno, &trimmed_to, &s.entries, &s.seq) < 0) {
+                derr << __func__ << " " << o->oid << " unable to read pglog segment "
+                     << kind << "." << segno << dendl;
+                ceph_abort_msg(cct, "corrupt pglog segment");
+            }
+        }
+        s.loaded = true;
+    }
+    return &s;
+}
+
+void KvsStore::_pglog_set(KvsTransContext *txc, OnodeRef &o, int kind, uint64_t version,
+                          const string &key, bufferlist &value)
+{
+    KvsPGLogSegments *pl = o->c->pglog.get();
+    string &trimmed = pl->trimmed_to[kind];
+
+    if (key <= trimmed) {
+        // the log is rewritten from below its old tail (e.g. on a split):
+        // drop what the trim point hides so that it does not come back
+        for (auto &p : pl->segs[kind]) {
+            KvsPGLogSegments::seg_t *s = _pglog_get_seg(txc, o, kind, p.first, false);
+            s->entries.erase(s->entries.begin(), s->entries.upper_bound(trimmed));
+            s->dirty = true;
+            s->rewrite = true;
+        }
+        trimmed.clear();
+        pl->trim_dirty[kind] = true;
+        pl->meta_dirty = true;
+    }
+
+    KvsPGLogSegments::seg_t *s = _pglog_get_seg(txc, o, kind, pl->seg_of(version), true);
+    s->entries[key] = value;
+    s->added[key] = value;
+    s->dirty = true;
+    txc->pglog_onodes.insert(o);
+}
+
+void KvsStore::_pglog_trim(KvsTransContext *txc, OnodeRef &o, int kind, uint64_t version,
+                           const string &key)
+{
+    KvsPGLogSegments *pl = o->c->pglog.get();
+
+    if (pl->has_plain_keys) {
+        string k = key;
+        txc->ioc.rm_omap(o->oid, o->onode.lid, k);
+    }
+
+    string &trimmed = pl->trimmed_to[kind];
+    if (key <= trimmed)
+        return;
+    trimmed = key;
+    pl->trim_dirty[kind] = true;
+    txc->pglog_onodes.insert(o);
+
+    // everything before this segment is trimmed now. The segment itself
+    // goes as well if its newest entry is known to be trimmed.
+    const uint64_t segno = pl->seg_of(version);
+    for (auto &p : pl->segs[kind]) {
+        if (p.first > segno)
+            break;
+        KvsPGLogSegments::seg_t &s = p.second;
+        if (p.first == segno &&
+            !(s.loaded && (s.entries.empty() || s.entries.rbegin()->first <= key)))
+            continue;
+        s.entries.clear();
+        s.loaded = true;
+        s.dirty = true;
+        s.rewrite = true;
+    }
+}
+
+void KvsStore::_pglog_rm_range(KvsTransContext *txc, OnodeRef &o, const string &first, const string &last)
+{
+    KvsPGLogSegments *pl = o->c->pglog.get();
+
+    for (int kind = 0; kind < KvsPGLogSegments::NUM_KINDS; kind++) {
+        if (last <= pglog_min_key[kind] || first > pglog_max_key[kind])
+            continue;
+        const bool all = first <= pglog_min_key[kind] && last >= pglog_max_key[kind];
+
+        // only the segments the range overlaps are read
+        uint64_t lo, hi;
+        pglog_range_segs(pl, kind, first, last, &lo, &hi);
+        auto &segs = pl->segs[kind];
+        for (auto p = segs.lower_bound(lo); p != segs.end() && p->first <= hi; ++p) {
+            KvsPGLogSegments::seg_t &s = p->second;
+            if (all) {
+                s.entries.clear();
+                s.loaded = true;
+                s.dirty = true;
+                s.rewrite = true;
+                continue;
+            }
+            _pglog_get_seg(txc, o, kind, p->first, false);
+            auto b = s.entries.lower_bound(first);
+            auto e = s.entries.lower_bound(last);
+            if (b == e)
+                continue;
+            s.entries.erase(b, e);
+            s.dirty = true;
+            s.rewrite = true;
+        }
+    }
+    txc->pglog_onodes.insert(o);
+}
+
+// called once per transaction, after all of its ops
+void KvsStore::_pglog_write(KvsTransContext *txc, OnodeRef &o)
+{
+    KvsPGLogSegments *pl = o->c->pglog.get();
+    if (!pl || !o->exists || pl->lid != o->onode.lid)
+        return;
+    const uint64_t lid = o->onode.lid;
+    const uint64_t seq = pl->seq + 1;
+    const uint32_t slots = pl->meta.delta_slots;
+    bool written = false;
+
+    KvsPGLogSegments::delta_t delta;
+    delta.seq = seq;
+    size_t delta_bytes = 64;   // the fixed part, generously
+    bool has_delta = false;
+
+    for (int kind = 0; kind < KvsPGLogSegments::NUM_KINDS; kind++) {
+        auto &segs = pl->segs[kind];
+
+        // the newest segment that is left after this transaction
+        int64_t head = -1;
+        for (auto p = segs.rbegin(); p != segs.rend(); ++p) {
+            if (!p->second.loaded || !p->second.entries.empty()) {
+                head = p->first;
+                break;
+            }
+        }
+        if (head != pl->meta.head[kind]) {
+            pl->meta.head[kind] = head;
+            pl->meta_dirty = true;
+        }
+
+        // deltas only apply to the head, so a segment that stopped being
+        // the head takes in its deltas now
+        for (auto &p : segs) {
+            if (p.second.deltas && (int64_t)p.first != head) {
+                assert(p.second.loaded);
+                p.second.dirty = true;
+            }
+        }
+
+        // a moved trim point goes with the head, or with the meta key if
+        // there is no segment left
+        const bool trim_moved = pl->trim_dirty[kind];
+        pl->trim_dirty[kind] = false;
+        if (head >= 0) {
+            KvsPGLogSegments::seg_t *s = _pglog_get_seg(txc, o, kind, head, false);
+            // this sequence reuses the slot of a delta the head may need,
+            // whichever kind the delta is written for
+            const bool wrap = seq - s->seq >= slots;
+            if (s->dirty || trim_moved || (s->deltas && wrap)) {
+                size_t bytes = 16 + pl->trimmed_to[kind].length();
+                for (const auto &e : s->added) {
+                    bytes += 8 + e.first.length() + e.second.length();
+                }
+                // a delta cannot remove entries and has to fit its buffer
+                if (slots && s->on_disk && !s->rewrite && !wrap &&
+                    delta_bytes + bytes <= KVS_PGLOG_DELTA_MAX_BYTES) {
+                    delta.segno[kind] = head;
+                    delta.trimmed_to[kind] = pl->trimmed_to[kind];
+                    delta.entries[kind].swap(s->added);
+                    delta_bytes += bytes;
+                    has_delta = true;
+                    s->dirty = false;
+                    s->deltas = true;
+                } else {
+                    s->dirty = true;
+                }
+            }
+        } else if (trim_moved) {
+            pl->meta_dirty = true;
+        }
+
+        for (auto p = segs.begin(); p != segs.end(); ) {
+            KvsPGLogSegments::seg_t &s = p->second;
+            if (!s.dirty) {
+                ++p;
+                continue;
+            }
+
+            string name = pglog_seg_name(kind, p->first);
+            if (s.entries.empty()) {
+                if (s.on_disk)
+                    txc->ioc.rm_omap(o->oid, lid, name);
+                p = segs.erase(p);
+                continue;
+            }
+
+            bufferlist bl;
+            pglog_encode_seg(pl->trimmed_to[kind], s.entries, seq, bl);
+            if (bl.length() > KVS_OBJECT_MAX_SIZE) {
+                derr << __func__ << " " << o->oid << " pglog segment " << name.substr(1)
+                     << " is " << bl.length() << " bytes" << dendl;
+                ceph_abort_msg(cct, "pglog segment too large, lower kvsstore_pglog_segment_entries");
+            }
+            if (bl.length() > pl->meta.seg_bytes[kind]) {
+                // grows in powers of two, so the meta key is rarely rewritten
+                uint32_t bytes = 4096;
+                while (bytes < bl.length())
+                    bytes <<= 1;
+                pl->meta.seg_bytes[kind] = bytes;
+                pl->meta_dirty = true;
+            }
+            txc->ioc.add_omap(o->oid, lid, name, bl);
+            if (logger)
+                logger->inc(l_kvsstore_pglog_seg_writes);
+            written = true;
+            s.on_disk = true;
+            s.dirty = false;
+            s.rewrite = false;
+            s.deltas = false;
+            s.seq = seq;
+            s.added.clear();
+
+            // only the head keeps growing; older segments are read back if
+            // a rewind or a range removal ever touches them
+            if ((int64_t)p->first != head) {
+                s.entries.clear();
+                s.loaded = false;
+            }
+            ++p;
+        }
+    }
+
+    if (has_delta) {
+        bufferlist bl;
+        pglog_encode_delta(delta, bl);
+        assert(bl.length() <= KVS_PGLOG_DELTA_MAX_BYTES);
+        string name = pglog_delta_name(seq % slots);
+        txc->ioc.add_omap(o->oid, lid, name, bl);
+        if (logger)
+            logger->inc(l_kvsstore_pglog_delta_writes);
+        written = true;
+    }
+    if (written || pl->meta_dirty)
+        pl->seq = seq;
+
+    if (pl->meta_dirty) {
+        for (int kind = 0; kind < KvsPGLogSegments::NUM_KINDS; kind++) {
+            pl->meta.trimmed_to[kind] = pl->trimmed_to[kind];
+        }
+        pl->meta.seq = pl->seq;
+        bufferlist bl;
+        ::encode(pl->meta, bl);
+        string name = KVS_PGLOG_META_KEY;
+        txc->ioc.add_omap(o->oid, lid, name, bl);
+        if (logger)
+            logger->inc(l_kvsstore_pglog_meta_writes);
+        pl->meta_dirty = false;
+    }
+}
+
+// the omap of o is gone or moved to a new lid, which starts out empty
+void KvsStore::_pglog_reset(KvsTransContext *txc, OnodeRef &o)
+{
+    if (o->oid.is_pgmeta()) {
+        o->c->pglog.reset(new KvsPGLogSegments);
+        o->c->pglog->lid = o->onode.lid;
+    }
+    txc->pglog_onodes.erase(o);
+}
+
+// replaces the pglog meta, segment and delta keys of a pgmeta object in
+// keylist by the entries of the segments that are not trimmed, and
+// returns their values in *values
+void KvsStore::_pglog_expand(OnodeRef &o, std::set<string> &keylist, std::map<string, bufferlist> *values)
+{
+    if (!o->oid.is_pgmeta() || !keylist.count(KVS_PGLOG_META_KEY))
+        return;
+    const uint64_t lid = o->onode.lid;
+
+    kvsstore_pglog_meta_t meta;
+    if (_pglog_read_meta(lid, &meta) < 0) {
+        derr << __func__ << " " << o->oid << " unable to read the pglog meta" << dendl;
+    }
+    keylist.erase(KVS_PGLOG_META_KEY);
+
+    std::vector<KvsPGLogSegments::delta_t> deltas;
+    if (_pglog_read_deltas(lid, meta, &deltas) < 0) {
+        derr << __func__ << " " << o->oid << " unable to read the pglog deltas" << dendl;
+    }
+
+    // the trim point is only known once the heads are read
+    string trimmed_to[KvsPGLogSegments::NUM_KINDS] = { meta.trimmed_to[0], meta.trimmed_to[1] };
+    std::vector<map<string, bufferlist>> segs;
+    std::vector<int> kinds;
+
+    auto p = keylist.lower_bound(KVS_PGLOG_SEG_PREFIX);
+    while (p != keylist.end() &&
+           p->compare(0, sizeof(KVS_PGLOG_SEG_PREFIX) - 1, KVS_PGLOG_SEG_PREFIX) == 0) {
+        const string name = *p;
+        p = keylist.erase(p);
+
+        int kind;
+        uint64_t segno;
+        if (!pglog_parse_seg_name(name, &kind, &segno))
+            continue;
+
+        string seg_trimmed_to;
+        uint64_t seq;
+        segs.emplace_back();
+        if (_pglog_read_seg(lid, meta, kind, segno, &seg_trimmed_to, &segs.back(), &seq) < 0) {
+            derr << __func__ << " " << o->oid << " unable to read pglog segment "
+                 << name.substr(1) << dendl;
+            segs.pop_back();
+            continue;
+        }
+        kinds.push_back(kind);
+        if ((int64_t)segno == meta.head[kind]) {
+            pglog_apply_deltas(deltas, kind, segno, seq, &seg_trimmed_to, &segs.back());
+            if (seg_trimmed_to > trimmed_to[kind])
+                trimmed_to[kind] = seg_trimmed_to;
+        }
+    }
+
+    for (unsigned i = 0; i < segs.size(); i++) {
+        for (auto &e : segs[i]) {
+            if (e.first <= trimmed_to[kinds[i]])
+                continue;
+            keylist.insert(e.first);
+            if (values)
+                (*values)[e.first].claim(e.second);
+        }
+    }
+}
+
+// looks a single log or dup entry up in the segments of a pgmeta object
+bool KvsStore::_pglog_lookup(OnodeRef &o, const string &key, bufferlist *value)
+{
+    int kind;
+    uint64_t version;
+    if (!o->oid.is_pgmeta() || (kind = pglog_key_kind(key, &version)) < 0)
+        return false;
+    const uint64_t lid = o->onode.lid;
+
+    kvsstore_pglog_meta_t meta;
+    if (_pglog_read_meta(lid, &meta) < 0)
+        return false;
+    if (meta.seg_entries == 0 || meta.head[kind] < 0 || key <= meta.trimmed_to[kind])
+        return false;
+    const uint64_t segno = version / meta.seg_entries;
+    if (segno > (uint64_t)meta.head[kind])
+        return false;
+
+    // the head and its deltas hold the current trim point
+    std::vector<KvsPGLogSegments::delta_t> deltas;
+    string trimmed_to;
+    uint64_t seq;
+    map<string, bufferlist> head_entries;
+    if (_pglog_read_seg(lid, meta, kind, meta.head[kind], &trimmed_to, &head_entries, &seq) < 0)
+        return false;
+    _pglog_read_deltas(lid, meta, &deltas);
+    pglog_apply_deltas(deltas, kind, meta.head[kind], seq, &trimmed_to, &head_entries);
+    if (key <= trimmed_to)
+        return false;
+
+    map<string, bufferlist> entries;
+    if (segno == (uint64_t)meta.head[kind]) {
+        entries.swap(head_entries);
+    } else {
+        string seg_trimmed_to;
+        if (_pglog_read_seg(lid, meta, kind, segno, &seg_trimmed_to, &entries, nullptr) < 0)
+            return false;
+    }
+    auto p = entries.find(key);
+    if (p == entries.end())
+        return false;
+
+    if (value)
+        value->claim(p->second);
+    return true;
+}
+
+// the omap keys are not deleted here: the object moves to a fresh lid and
+// a reaper record for the old one is written along with the onode. The
+// keys are reclaimed by the reaper thread after the transaction commits.
+void KvsStore::_do_omap_clear(KvsTransContext *txc, OnodeRef &o) {
+    FTRACE
+    if (!o->onode.has_omap())
+        return;
+    o->flush();
+
+    kvsstore_reap_t r = _new_reap_record(kvsstore_reap_t::REAP_LID);
+    r.lid = o->onode.lid;
+    txc->ioc.add_reap(r);
+    txc->reaps.push_back(r);
+
+    _omap_changing(txc, o);
+    o->onode.lid = ++lid_last;
+    txc->write_onode(o);
+    _pglog_reset(txc, o);
+    _omap_charge(txc, o, -(int64_t) o->onode.omap_bytes);
+    o->omap_charges.clear();
+    o->omap_charges_complete = true;
+
+    dout(20) << __func__ << " " << o->oid << " " << r << " new lid " << o->onode.lid << dendl;
 }
 
 
@@ -2967,11 +4673,15 @@ int KvsStore::_omap_setkeys(KvsTransContext *txc,
     int r;
     bufferlist::iterator p = bl.begin();
     __u32 num;
+    KvsPGLogSegments *pl = _pglog_open(txc, o);
     if (!o->onode.has_omap()) {
         o->onode.set_omap_flag();
+        o->omap_charges.clear();
+        o->omap_charges_complete = true;
         txc->write_onode(o);
     }
 
+    int64_t charge = 0;
     ::decode(num, p);
     while (num--) {
         string key;
@@ -2979,8 +4689,16 @@ int KvsStore::_omap_setkeys(KvsTransContext *txc,
         ::decode(key, p);
         ::decode(value, p);
         dout(30) << __func__ << "  " << pretty_binary_string(key) << dendl;
+        uint64_t version;
+        int kind;
+        if (pl && (kind = pglog_key_kind(key, &version)) >= 0) {
+            _pglog_set(txc, o, kind, version, key, value);
+            continue;
+        }
+        charge += _omap_recharge(txc, o, key, key.length() + value.length());
         txc->ioc.add_omap(o->oid, o->onode.lid, key, value);
     }
+    _omap_charge(txc, o, charge);
     r = 0;
     dout(10) << __func__ << " " << c->cid << " " << o->oid << " = " << r << dendl;
     return r;
@@ -2995,10 +4713,13 @@ int KvsStore::_omap_setheader(KvsTransContext *txc,
     int r;
     if (!o->onode.has_omap()) {
         o->onode.set_omap_flag();
+        o->omap_charges.clear();
+        o->omap_charges_complete = true;
         txc->write_onode(o);
     }
 
     string key = "";
+    _omap_charge(txc, o, _omap_recharge(txc, o, key, bl.length()));
     txc->ioc.add_omap(o->oid, o->onode.lid, key, bl);
 
     r = 0;
@@ -3016,17 +4737,29 @@ int KvsStore::_omap_rmkeys(KvsTransContext *txc,
     bufferlist::iterator p = bl.begin();
     __u32 num;
 
+    KvsPGLogSegments *pl;
+    int64_t charge = 0;
+
     if (!o->onode.has_omap()) {
         goto out;
     }
 
+    pl = _pglog_open(txc, o);
     ::decode(num, p);
     while (num--) {
         string key;
         ::decode(key, p);
 
+        uint64_t version;
+        int kind;
+        if (pl && (kind = pglog_key_kind(key, &version)) >= 0) {
+            _pglog_trim(txc, o, kind, version, key);
+            continue;
+        }
+        charge += _omap_recharge(txc, o, key, 0);
         txc->ioc.rm_omap(o->oid, o->onode.lid, key);
     }
+    _omap_charge(txc, o, charge);
 
     out:
     dout(10) << __func__ << " " << c->cid << " " << o->oid << " = " << r << dendl;
@@ -3043,9 +4776,12 @@ int KvsStore::_omap_rmkey_range(KvsTransContext *txc,
     if (!o->onode.has_omap())
         goto release;
     o->flush();
+    if (_pglog_open(txc, o))
+        _pglog_rm_range(txc, o, first, last);
     {
         kv_result ret = 0;
         uint64_t lid = o->onode.lid;
+        int64_t charge = 0;
 
         kv_iter_context iter_ctx;
         std::list<std::pair<void *, int>> buflist;
@@ -3057,7 +4793,7 @@ int KvsStore::_omap_rmkey_range(KvsTransContext *txc,
         ret = db.iter_readall(&iter_ctx, buflist);
         if (ret != 0) return 0;
 
-        r = populate_keylist(cct, lid, buflist, keylist, &db);
+        r = _omap_populate_keylist(lid, buflist, keylist);
         if (r == -1) return 0;
 
         // End Iterator --
@@ -3067,9 +4803,14 @@ int KvsStore::_omap_rmkey_range(KvsTransContext *txc,
 
         for (auto it = startKey; it != lastKey; ++it) {
             string user_key = *it;
+            // the pglog segments are taken care of above
+            if (user_key.compare(0, sizeof(KVS_PGLOG_META_KEY) - 1, KVS_PGLOG_META_KEY) == 0 &&
+                o->oid.is_pgmeta())
+                continue;
+            charge += _omap_recharge(txc, o, user_key, 0);
             txc->ioc.rm_omap(o->oid, o->onode.lid, user_key);
         }
-
+        _omap_charge(txc, o, charge);
     }
     release:
     
@@ -3096,7 +4837,7 @@ int KvsStore::_clone(KvsTransContext *txc,CollectionRef& c, OnodeRef& oldo,Onode
     r = _write(txc, c, newo, 0, r, &oldbl, 0);
 
     // clone attrs
-    newo->onode.attrs = oldo->onode.attrs;
+    newo->onode.copy_attrs(oldo->onode);
 
     // clear newo's omap
     if (newo->onode.has_omap()) {
@@ -3110,8 +4851,11 @@ int KvsStore::_clone(KvsTransContext *txc,CollectionRef& c, OnodeRef& oldo,Onode
         dout(20) << __func__ << " copying omap data" << dendl;
         if (!newo->onode.has_omap()) {
             newo->onode.set_omap_flag();
+            newo->omap_charges.clear();
+            newo->omap_charges_complete = true;
         }
 
+        int64_t charge = 0;
         KvsOmapIterator *it  = _get_kvsomapiterator((KvsCollection*)c->get(), oldo);
 
         if (it) {
@@ -3119,6 +4863,7 @@ int KvsStore::_clone(KvsTransContext *txc,CollectionRef& c, OnodeRef& oldo,Onode
             while (it->valid()) {
                 std::string name = it->key();
                 bufferlist b = it->value();
+                charge += _omap_recharge(txc, newo, name, name.length() + b.length());
                 txc->ioc.add_omap(newo->oid, newo->onode.lid, name, b);
                 it->next();
             }
@@ -3126,12 +4871,14 @@ int KvsStore::_clone(KvsTransContext *txc,CollectionRef& c, OnodeRef& oldo,Onode
             bufferlist hdr;
             if (it->header(hdr)) {
                 std::string n = "";
+                charge += _omap_recharge(txc, newo, n, hdr.length());
                 txc->ioc.add_omap(newo->oid, newo->onode.lid, n, hdr);
             }
 
 
             delete it;
         }
+        _omap_charge(txc, newo, charge);
 
     } else {
         newo->onode.clear_omap_flag();
@@ -3271,6 +5018,24 @@ int KvsStore::_remove_collection(KvsTransContext *txc, const coll_t &cid,
                 }
             }
             if (!exists) {
+                // sweep keys that were left behind in the pg's hash range
+                // (e.g. data keys of objects that were not journaled)
+                spg_t pgid;
+                if (cid.is_pg(&pgid)) {
+                    struct iter_param temp;
+                    struct iter_param other;
+                    get_coll_key_range(cct, c->get(), temp, other);
+
+                    kvsstore_reap_t rr = _new_reap_record(kvsstore_reap_t::REAP_COLL);
+                    rr.cid = cid.to_str();
+                    rr.poolid = pgid.pool();
+                    rr.shardid = other.shardid;
+                    rr.starthash = other.starthash;
+                    rr.endhash = get_coll_end_hash(c->get(), other.starthash);
+                    txc->ioc.add_reap(rr);
+                    txc->reaps.push_back(rr);
+                }
+
                 coll_map.erase(cid);
                 txc->removed_collections.push_back(*c);
                 (*c)->exists = false;
@@ -3499,7 +5264,55 @@ int KvsStore::_write_sb() {
     db.aio_submit(&ctx);
 
     kv_result ret = ctx.write_wait();
+    if (ret == 0)
+        ret = _write_statfs();
+
+    return ret;
+}
+
+int KvsStore::_read_statfs(kvsstore_statfs_t *s) {
+    bufferlist v;
+    KvsReadContext ctx(cct);
+    ctx.read_statfs();
+    bool ispartial;
+    int ret = db.kv_retrieve_sync(ctx.key, ctx.value, 0, 0, v, ispartial);
+
+    *s = kvsstore_statfs_t();
+    if (ret != KV_SUCCESS || v.length() == 0) {
+        dout(1) << __func__ << " no usage record, starting from zero" << dendl;
+        return -ENOENT;
+    }
+    try {
+        bufferptr::iterator p = v.front().begin_deep();
+        s->decode(p);
+    } catch (buffer::error &e) {
+        derr << __func__ << " usage record is corrupt, starting from zero" << dendl;
+        *s = kvsstore_statfs_t();
+        return -EIO;
+    }
+    return 0;
+}
 
+int KvsStore::_write_statfs(bool only_dirty) {
+    bufferlist bl;
+    {
+        std::lock_guard<std::mutex> l(statfs_lock);
+        if (only_dirty && !statfs_dirty)
+            return 0;
+        ::encode(statfs_state, bl);
+        statfs_dirty = false;
+    }
+
+    KvsSyncWriteContext ctx(cct);
+    ctx.write_statfs(bl);
+    db.aio_submit(&ctx);
+
+    kv_result ret = ctx.write_wait();
+    if (ret != 0) {
+        derr << __func__ << " failed to write the usage record, ret = " << ret << dendl;
+        std::lock_guard<std::mutex> l(statfs_lock);
+        statfs_dirty = true;
+    }
     return ret;
 }
 
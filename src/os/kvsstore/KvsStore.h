@@ -54,6 +54,21 @@ enum {
     l_kvsstore_write_latency,
     l_kvsstore_delete_latency,
     l_kvsstore_pending_trx_ios,
+    l_kvsstore_reaper_pending,
+    l_kvsstore_reaper_reaped,
+    l_kvsstore_reaper_deleted_keys,
+    l_kvsstore_reaper_iter_deletes,
+    l_kvsstore_reaper_throttled,
+    l_kvsstore_wbuf_bytes,
+    l_kvsstore_wbuf_absorbed,
+    l_kvsstore_wbuf_coalesced,
+    l_kvsstore_wbuf_flushed,
+    l_kvsstore_pglog_seg_writes,
+    l_kvsstore_pglog_seg_reads,
+    l_kvsstore_pglog_meta_writes,
+    l_kvsstore_pglog_delta_writes,
+    l_kvsstore_omap_estimates,
+    l_kvsstore_omap_recounts,
     l_kvsstore_last
 };
 
@@ -66,7 +81,7 @@ class KvsStore : public ObjectStore {
 
 private:
     /// Types
-    ///     - Three background threads: callback, finalize, and mempool
+    ///     - Four background threads: callback, finalize, mempool and reaper
 
     struct KVCallbackThread : public Thread {
         KvsStore *store;
@@ -86,11 +101,21 @@ private:
         }
     };
 
+    struct KVReaperThread : public Thread {
+        KvsStore *store;
+        explicit KVReaperThread(KvsStore *s) : store(s) {}
+        void *entry() override {
+            store->_kv_reaper_thread();
+            return NULL;
+        }
+    };
+
     struct MempoolThread : public Thread {
         KvsStore *store;
         Cond cond;
         Mutex lock;
         bool stop = false;
+        std::atomic<bool> wbuf_kick = { false };  ///< write back the whole buffer
     public:
         explicit MempoolThread(KvsStore *s)
                 : store(s),
@@ -98,6 +123,16 @@ private:
 
         void *entry() override;
 
+        // called from the op path; never waits for the thread's lock. if the
+        // lock is taken the thread is awake and sees wbuf_kick before sleeping
+        void kick_wbuf() {
+            wbuf_kick = true;
+            if (lock.TryLock()) {
+                cond.Signal();
+                lock.Unlock();
+            }
+        }
+
         void init() {
             assert(stop == false);
             create("kvsmempool");
@@ -156,12 +191,35 @@ private:
 
     MempoolThread    mempool_thread;
 
+    KVReaperThread kv_reaper_thread;
+    std::mutex reaper_lock;           ///< protect reaper_queue
+    std::condition_variable reaper_cond;
+    bool reaper_stop = false;
+    bool reaper_iter_delete_failed = false;  ///< device rejected a prefix delete
+    std::deque<kvsstore_reap_t> reaper_queue;  ///< committed, not yet reclaimed
+    std::atomic<uint64_t> reaper_seq = {0};
+    utime_t reaper_window_start;
+    uint64_t reaper_window_keys = 0;
+
+    KvsWriteBuffer wbuf;              ///< journaled omap updates not yet on the device
+
     PerfCounters *logger = nullptr;
 
     std::mutex reap_lock;
     list<CollectionRef> removed_collections;
     kvsstore_sb_t kvsb;
 
+    std::mutex statfs_lock;           ///< protect statfs_state, statfs_sum and statfs_dirty
+    kvsstore_statfs_t statfs_state;   ///< per-pool usage
+    kvsstore_pool_stat_t statfs_sum;  ///< statfs_state over all pools
+    bool statfs_dirty = false;        ///< changed since the last checkpoint
+    std::atomic<uint64_t> dev_capacity = {0};  ///< cached device capacity
+    std::atomic<uint64_t> dev_used = {0};      ///< cached device utilization
+    utime_t dev_space_stamp;          ///< last device space query
+
+    std::mutex omap_recount_lock;     ///< protect omap_recount_q
+    std::list<OnodeRef> omap_recount_q;   ///< objects with estimated omap charges
+
 
 private:
 
@@ -179,6 +237,10 @@ private:
     void _flush_cache();
     int _read_sb();
     int _write_sb();
+    int _read_statfs(kvsstore_statfs_t *s);
+    int _write_statfs(bool only_dirty = false);
+    void _set_statfs(const kvsstore_statfs_t &s);
+    void _refresh_device_space();
 
     int get_predefinedID(const std::string& key);
 
@@ -240,6 +302,7 @@ public:
     /// Interface - continued
 
     int statfs(struct store_statfs_t *buf) override;
+    void get_db_statistics(Formatter *f) override;
 
     bool exists(const coll_t& cid, const ghobject_t& oid) override;
     bool exists(CollectionHandle &c_, const ghobject_t& oid) override;
@@ -377,9 +440,18 @@ private:
     void _reap_collections();
     void _txc_add_transaction(KvsTransContext *txc, Transaction *t);
     void _txc_journal_meta(KvsTransContext *txc, uint64_t index);
+    void _txc_absorb_writes(KvsTransContext *txc, uint64_t jseq);
+    void _wbuf_flush(uint64_t jseq, const utime_t &stamp);
     int _touch(KvsTransContext *txc,CollectionRef& c,OnodeRef &o);
     int _write(KvsTransContext *txc,CollectionRef& c,OnodeRef& o,uint64_t offset, size_t len,bufferlist* bl,uint32_t fadvise_flags, bool truncate = false);
-    int _update_write_buffer(OnodeRef &o, uint64_t offset, size_t length, bufferlist *towrite, bufferlist &out, bool truncate);
+    int _update_write_buffer(KvsTransContext *txc, OnodeRef &o, uint64_t offset, size_t length, bufferlist *towrite, bufferlist &out, bool truncate);
+    void _statfs_add(KvsTransContext *txc, const OnodeRef &o, int64_t objects, int64_t stored, int64_t omap);
+    void _omap_charge(KvsTransContext *txc, OnodeRef &o, int64_t bytes);
+    int64_t _omap_recharge(KvsTransContext *txc, OnodeRef &o, const string &key, uint32_t charge);
+    void _omap_changing(KvsTransContext *txc, OnodeRef &o);
+    int _omap_count(uint64_t lid, uint64_t *bytes);
+    void _omap_recount();
+    void _statfs_apply(KvsTransContext *txc, uint64_t jseq);
     int _do_write(KvsTransContext *txc, CollectionRef& c,OnodeRef o,uint64_t offset, uint64_t length,bufferlist& bl, uint32_t fadvise_flags);
     void _txc_write_onodes(KvsTransContext *txc);
 
@@ -441,8 +513,42 @@ private:
                             unsigned bits, CollectionRef *c);
 
     int _split_collection(KvsTransContext *txc, CollectionRef& c, CollectionRef& d, unsigned bits, int rem);
-    int _kvs_replay_journal(kvs_journal_key *j);
+    int _kvs_replay_journal(kvs_journal_key *j, kvsstore_statfs_t *statfs);
+
+    // background reaper
+    int _open_reaper();
+    void _start_reaper();
+    void _stop_reaper();
+    void _queue_reap(list<kvsstore_reap_t> &reaps);
+    kvsstore_reap_t _new_reap_record(uint8_t type);
+    int _reap_one(const kvsstore_reap_t &r);
+    int _reap_lid(uint64_t lid);
+    bool _reap_coll_is_live(const kvsstore_reap_t &r);
+    int _reap_coll(const std::vector<kvsstore_reap_t> &rs);
+    int _reap_prefix(uint32_t prefix, bool routed, std::function<bool(const void *, int)> is_dead,
+                     std::function<bool(const void *, int)> on_delete);
+    int _reap_delete_keys(std::list<std::pair<void *, int> > &keys);
+    bool _reaper_throttle(uint64_t nkeys);
     KvsOmapIterator* _get_kvsomapiterator(KvsCollection *c, OnodeRef &o);
+    int _omap_populate_keylist(uint64_t lid, std::list<std::pair<void*, int>> &buflist, std::set<string> &keylist);
+
+    // pglog segments of pgmeta objects
+    void _pglog_preload(CollectionRef &c);
+    void _pglog_load(OnodeRef &o, KvsPGLogSegments *pl);
+    KvsPGLogSegments *_pglog_open(KvsTransContext *txc, OnodeRef &o);
+    KvsPGLogSegments::seg_t *_pglog_get_seg(KvsTransContext *txc, OnodeRef &o, int kind, uint64_t segno, bool create);
+    void _pglog_set(KvsTransContext *txc, OnodeRef &o, int kind, uint64_t version, const string &key, bufferlist &value);
+    void _pglog_trim(KvsTransContext *txc, OnodeRef &o, int kind, uint64_t version, const string &key);
+    void _pglog_rm_range(KvsTransContext *txc, OnodeRef &o, const string &first, const string &last);
+    void _pglog_write(KvsTransContext *txc, OnodeRef &o);
+    void _pglog_reset(KvsTransContext *txc, OnodeRef &o);
+    int _pglog_read_meta(uint64_t lid, kvsstore_pglog_meta_t *meta);
+    int _pglog_read_seg(uint64_t lid, const kvsstore_pglog_meta_t &meta, int kind, uint64_t segno,
+                        string *trimmed_to, map<string, bufferlist> *entries, uint64_t *seq);
+    int _pglog_read_deltas(uint64_t lid, const kvsstore_pglog_meta_t &meta,
+                           std::vector<KvsPGLogSegments::delta_t> *deltas);
+    void _pglog_expand(OnodeRef &o, std::set<string> &keylist, std::map<string, bufferlist> *values);
+    bool _pglog_lookup(OnodeRef &o, const string &key, bufferlist *value);
 
 public:
     ///
@@ -450,6 +556,7 @@ public:
 
     void _kv_callback_thread();
     void _kv_finalize_thread();
+    void _kv_reaper_thread();
     void _mempool_thread();
 
 public:
@@ -461,6 +568,9 @@ public:
 
     void txc_aio_finish(kv_io_context *op, KvsTransContext *txc);   // called per each I/O completion
 
+    // reads an omap key from the write buffer or the device
+    kv_result omap_sync_read(kv_key *key, bufferlist &bl, int valuesize = ITER_BUFSIZE);
+
     int iterate_objects_in_device(uint64_t poolid, int8_t shardid, std::set<ghobject_t> &data);
     ///
     /// OSR SET
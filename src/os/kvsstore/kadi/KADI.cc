@@ -22,6 +22,7 @@
 #include <math.h>
 #include <time.h>
 #include <vector>
+#include "include/str_list.h"
 #include "../kvsstore_types.h"
 #include "../KvsStore.h"
 #include "KADI.h"
@@ -34,12 +35,6 @@
 
 #define EPOLL_DEV 1
 
-#ifdef EPOLL_DEV
-int EpollFD_dev;
-struct epoll_event watch_events;
-struct epoll_event list_of_events[1];
-#endif
-
 //std::mutex debuglk;
 //std::vector<std::string> debug;
 
@@ -111,32 +106,41 @@ void read_callback(kv_io_context &op, void* private_data) {
 void prefetch_callback(kv_io_context &op, void *private_data){
   KvsReadContext* txc = (KvsReadContext*)private_data;
   txc->retcode = op.retcode;
-  bufferlist bl;
-  bl.append((const char *)op.value->value, op.value->length);
+  // decode copies what it keeps, so the value buffer is not copied here
+  auto bl = bufferlist::static_from_mem((char*)op.value->value, op.value->length);
   KvsOnode *on = txc->onode;
   if(bl.length() != 0 && txc->retcode == 0) {
     std::unique_lock<std::mutex> plock (on->prefetch_lock);
     on->exists = true;
     bufferptr::iterator p = bl.front().begin_deep();
     on->onode.decode(p);
-    for (auto& i : on->onode.attrs){
-      i.second.reassign_to_mempool(mempool::mempool_kvsstore_cache_other);
-    }
     on->prefetch_cond.notify_all();
   }
   delete txc;
 }
 
 kv_result KADI::iter_readall(kv_iter_context *iter_ctx, std::list<std::pair<void*, int> > &buflist)
+{
+    if (iter_ctx->routed)
+        return iter_readall(route_prefix(iter_ctx->prefix), iter_ctx, buflist);
+
+    for (kv_device *dev : devs) {
+        kv_result r = iter_readall(dev, iter_ctx, buflist);
+        if (r != 0) return r;
+    }
+    return 0;
+}
+
+kv_result KADI::iter_readall(kv_device *dev, kv_iter_context *iter_ctx, std::list<std::pair<void*, int> > &buflist)
 {
     
-    kv_result r = iter_open(iter_ctx);
+    kv_result r = iter_open(dev, iter_ctx);
     
     if (r != 0) return r;
     while (!iter_ctx->end) {
         iter_ctx->byteswritten = 0;
         iter_ctx->buf = calloc(1, iter_ctx->buflen); //= malloc(iter_ctx->buflen);
-        int ret = iter_read(iter_ctx);
+        int ret = iter_read(dev, iter_ctx);
         if (ret) {
             if (ret == 0x311){
                 derr << "ERR: uncorrectable error : iter_read " << dendl;
@@ -160,112 +164,171 @@ kv_result KADI::iter_readall(kv_iter_context *iter_ctx, std::list<std::pair<void
 
     }
     
-    r = iter_close(iter_ctx);
+    r = iter_close(dev, iter_ctx);
     
     return r;
 }
 
+// keys of an object (onode and data) are spread by the object hash. any other
+// key is placed by its 4-byte prefix, so a prefix iterator over it needs a
+// single device; the store metadata stays on the first device.
+KADI::kv_device *KADI::route(const void *key, int length) {
+    if (devs.size() == 1) return devs[0];
+
+    const kvs_var_object_key *k = (const kvs_var_object_key *) key;
+    if ((k->group == GROUP_PREFIX_ONODE || k->group == GROUP_PREFIX_DATA) && length >= 18) {
+        return devs[ceph_str_hash_linux((const char *) &k->bitwisekey, sizeof(k->bitwisekey)) % devs.size()];
+    }
+    return route_prefix(k->grouphash);
+}
+
+KADI::kv_device *KADI::route_prefix(uint32_t prefix) {
+    switch (prefix) {
+        case GROUP_PREFIX_COLL:
+        case GROUP_PREFIX_SUPER:
+        case GROUP_PREFIX_JOURNAL:
+        case GROUP_PREFIX_REAPER:
+            return devs[0];
+    }
+    return devs[prefix % devs.size()];
+}
+
 int KADI::open(std::string &devpath, int csum_type_) {
     FTRACE
-    int ret = 0;
     this->csum_type = csum_type_;
 
-    fd = ::open(devpath.c_str(), O_RDWR);
-    if (fd < 0) {
-        derr <<  "can't open a device : " << devpath << dendl;
-        return fd;
+    std::vector<std::string> paths;
+    get_str_vec(devpath, ", ", paths);
+    if (paths.empty()) {
+        derr << "no KV device is given" << dendl;
+        return -1;
+    }
+
+#ifdef EPOLL_DEV
+    epoll_fd = epoll_create(1024);
+    if (epoll_fd < 0) {
+        derr << "Unable to create Epoll FD; error = " << epoll_fd << dendl;
+        return -1;
+    }
+#endif
+
+    for (const auto &path : paths) {
+        kv_device *dev = new kv_device;
+        dev->path = path;
+        devs.push_back(dev);
+
+        if (open_device(dev) != 0) {
+            close();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int KADI::open_device(kv_device *dev) {
+    dev->fd = ::open(dev->path.c_str(), O_RDWR);
+    if (dev->fd < 0) {
+        derr <<  "can't open a device : " << dev->path << dendl;
+        return dev->fd;
     }
 
-    nsid = ioctl(fd, NVME_IOCTL_ID);
-    if (nsid == (unsigned) -1) {
+    dev->nsid = ioctl(dev->fd, NVME_IOCTL_ID);
+    if (dev->nsid == (unsigned) -1) {
         derr <<  "can't get an ID" << dendl;
         return -1;
     }
 
-    space_id = 0;
+    dev->space_id = 0;
 
     for (int i =0  ; i < qdepth; i++) {
         aio_cmd_ctx *ctx = (aio_cmd_ctx *)calloc(1, sizeof(aio_cmd_ctx));
         ctx->index = i;
-        free_cmdctxs.push_back(ctx);
+        dev->free_cmdctxs.push_back(ctx);
     }
-#ifdef EPOLL_DEV
-	EpollFD_dev = epoll_create(1024);
-	if(EpollFD_dev<0){
-		derr << "Unable to create Epoll FD; error = " << EpollFD_dev << dendl;
-		return -1;
-	}
-#endif
 
     int efd = eventfd(0,0);
     if (efd < 0) {
         fprintf(stderr, "fail to create an event.\n");
-     	::close(EpollFD_dev);
         return -1;
     }
-    
+
+    dev->aioctx.ctxid   = 0;
+    dev->aioctx.eventfd = efd;
+
+    if (ioctl(dev->fd, NVME_IOCTL_SET_AIOCTX, &dev->aioctx) < 0) {
+        derr <<  "fail to set_aioctx" << dendl;
+        ::close(efd);
+        dev->aioctx.eventfd = -1;
+        return -1;
+    }
 
 #ifdef EPOLL_DEV
+    struct epoll_event watch_events;
     watch_events.events = EPOLLIN | EPOLLET;
-    watch_events.data.fd = efd;
+    watch_events.data.ptr = dev;
     int register_event;
-    register_event = epoll_ctl(EpollFD_dev, EPOLL_CTL_ADD, efd, &watch_events);
+    register_event = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, efd, &watch_events);
     if (register_event)
-	derr << " Failed to add FD = " << efd << ", to epoll FD = " << EpollFD_dev
+	derr << " Failed to add FD = " << efd << ", to epoll FD = " << epoll_fd
 		<< ", with error code  = " << register_event << dendl;
 #endif
 
-    aioctx.ctxid   = 0;
-    aioctx.eventfd = efd;
-
-    if (ioctl(fd, NVME_IOCTL_SET_AIOCTX, &aioctx) < 0) {
-        derr <<  "fail to set_aioctx" << dendl;
-        return -1;
-    }
-
-    derr << "KV device is opened: fd " << fd << ", efd " << efd << ", dev " << devpath.c_str() << dendl;
+    derr << "KV device is opened: fd " << dev->fd << ", efd " << efd << ", dev " << dev->path << dendl;
 
-    return ret;
+    return 0;
 }
 
 int KADI::close() {
-    if (fd > 0) {
+    for (kv_device *dev : devs) {
+        close_device(dev);
+        delete dev;
+    }
+    devs.clear();
 
-        ioctl(fd, NVME_IOCTL_DEL_AIOCTX, &aioctx);
-        ::close((int)aioctx.eventfd);
-        ::close(fd);
+#ifdef EPOLL_DEV
+    if (epoll_fd >= 0) {
+        ::close(epoll_fd);
+        epoll_fd = -1;
+    }
+#endif
+    return 0;
+}
 
-        for (aio_cmd_ctx *ctx: free_cmdctxs) {
-            free((void*)ctx);
-        }
-        free_cmdctxs.clear();
-        for (const auto &ctx: pending_cmdctxs) {
-            free((void*)ctx.second);
+void KADI::close_device(kv_device *dev) {
+    if (dev->fd > 0) {
+
+        if (dev->aioctx.eventfd > 0) {
+            ioctl(dev->fd, NVME_IOCTL_DEL_AIOCTX, &dev->aioctx);
+            ::close((int)dev->aioctx.eventfd);
         }
-        pending_cmdctxs.clear();
+        ::close(dev->fd);
 
-        derr << "KV device is closed: fd " << fd << dendl;
-        fd = -1;
+        derr << "KV device is closed: fd " << dev->fd << dendl;
+        dev->fd = -1;
+    }
 
-#ifdef EPOLL_DEV
-	::close(EpollFD_dev);
-#endif
+    for (aio_cmd_ctx *ctx: dev->free_cmdctxs) {
+        free((void*)ctx);
     }
-    return 0;
+    dev->free_cmdctxs.clear();
+    for (const auto &ctx: dev->pending_cmdctxs) {
+        free((void*)ctx.second);
+    }
+    dev->pending_cmdctxs.clear();
 }
 
 //std::atomic<uint64_t> pindex(0);
-KADI::aio_cmd_ctx* KADI::get_cmd_ctx(kv_cb& cb) {
-    std::unique_lock<std::mutex> lock (cmdctx_lock);
+KADI::aio_cmd_ctx* KADI::get_cmd_ctx(kv_device *dev, kv_cb& cb) {
+    std::unique_lock<std::mutex> lock (dev->cmdctx_lock);
 
-    while (free_cmdctxs.empty()) {
-        if (cmdctx_cond.wait_for(lock, std::chrono::seconds(5)) == std::cv_status::timeout) {
+    while (dev->free_cmdctxs.empty()) {
+        if (dev->cmdctx_cond.wait_for(lock, std::chrono::seconds(5)) == std::cv_status::timeout) {
             derr << "max queue depth has reached. wait..." << dendl;
         }
     }
 
-    aio_cmd_ctx *p = free_cmdctxs.back();
-    free_cmdctxs.pop_back();
+    aio_cmd_ctx *p = dev->free_cmdctxs.back();
+    dev->free_cmdctxs.pop_back();
     //p->index = ++pindex;
 
     p->post_fn   = cb.post_fn;
@@ -286,34 +349,34 @@ KADI::aio_cmd_ctx* KADI::get_cmd_ctx(kv_cb& cb) {
         }
         ceph_abort_msg(cct, "duplicated entry");
     }*/
-    pending_cmdctxs.insert(std::make_pair(p->index, p));
+    dev->pending_cmdctxs.insert(std::make_pair(p->index, p));
     return p;
 }
 
-void KADI::release_cmd_ctx(aio_cmd_ctx *p) {
-    std::lock_guard<std::mutex> lock (cmdctx_lock);
+void KADI::release_cmd_ctx(kv_device *dev, aio_cmd_ctx *p) {
+    std::lock_guard<std::mutex> lock (dev->cmdctx_lock);
     
-    free_cmdctxs.push_back(p);
-    cmdctx_cond.notify_one();
+    dev->free_cmdctxs.push_back(p);
+    dev->cmdctx_cond.notify_one();
 }
 
 
 
-kv_result KADI::iter_open(kv_iter_context *iter_handle)
+kv_result KADI::iter_open(kv_device *dev, kv_iter_context *iter_handle)
 {
     struct nvme_passthru_kv_cmd cmd;
     memset(&cmd, 0, sizeof(struct nvme_passthru_kv_cmd));
 
     cmd.opcode = nvme_cmd_kv_iter_req;
-    cmd.cdw3 = space_id;
-    cmd.nsid = nsid;
+    cmd.cdw3 = dev->space_id;
+    cmd.nsid = dev->nsid;
     cmd.cdw4 = (ITER_OPTION_OPEN | ITER_OPTION_KEY_ONLY);
     cmd.cdw12 = iter_handle->prefix;
     cmd.cdw13 = iter_handle->bitmask;
 #ifdef DUMP_ISSUE_CMD
     dump_cmd(&cmd);
 #endif
-    int ret = ioctl(fd, NVME_IOCTL_IO_KV_CMD, &cmd);
+    int ret = ioctl(dev->fd, NVME_IOCTL_IO_KV_CMD, &cmd);
     if (ret < 0) {
         return -1;
     }
@@ -325,32 +388,74 @@ kv_result KADI::iter_open(kv_iter_context *iter_handle)
     return cmd.status;
 }
 
-kv_result KADI::iter_close(kv_iter_context *iter_handle) {
+kv_result KADI::iter_close(kv_device *dev, kv_iter_context *iter_handle) {
     struct nvme_passthru_kv_cmd cmd;
     memset(&cmd, 0, sizeof(struct nvme_passthru_kv_cmd));
     cmd.opcode = nvme_cmd_kv_iter_req;
-    cmd.cdw3 = space_id;
-    cmd.nsid = nsid;
+    cmd.cdw3 = dev->space_id;
+    cmd.nsid = dev->nsid;
     cmd.cdw4 = ITER_OPTION_CLOSE;
     cmd.cdw5 = iter_handle->handle;
 #ifdef DUMP_ISSUE_CMD
     dump_cmd(&cmd);
 #endif
-    if (ioctl(fd, NVME_IOCTL_IO_KV_CMD, &cmd) < 0) {
+    if (ioctl(dev->fd, NVME_IOCTL_IO_KV_CMD, &cmd) < 0) {
         return -1;
     }
     return cmd.status;
 }
 
 
-kv_result KADI::iter_read(kv_iter_context *iter_handle) {
+// deletes every key/value pair matching prefix/bitmask inside the device(s).
+// the handle is closed once the device has finished the deletion.
+kv_result KADI::iter_delete(kv_iter_context *iter_handle)
+{
+    if (iter_handle->routed)
+        return iter_delete(route_prefix(iter_handle->prefix), iter_handle);
+
+    for (kv_device *dev : devs) {
+        kv_result r = iter_delete(dev, iter_handle);
+        if (r != 0) return r;
+    }
+    return 0;
+}
+
+kv_result KADI::iter_delete(kv_device *dev, kv_iter_context *iter_handle)
+{
+    struct nvme_passthru_kv_cmd cmd;
+    memset(&cmd, 0, sizeof(struct nvme_passthru_kv_cmd));
+
+    cmd.opcode = nvme_cmd_kv_iter_req;
+    cmd.cdw3 = dev->space_id;
+    cmd.nsid = dev->nsid;
+    cmd.cdw4 = (ITER_OPTION_OPEN | ITER_OPTION_DEL_KEY_VALUE);
+    cmd.cdw12 = iter_handle->prefix;
+    cmd.cdw13 = iter_handle->bitmask;
+#ifdef DUMP_ISSUE_CMD
+    dump_cmd(&cmd);
+#endif
+    int ret = ioctl(dev->fd, NVME_IOCTL_IO_KV_CMD, &cmd);
+    if (ret < 0) {
+        return -1;
+    }
+    if (cmd.status != 0) {
+        return cmd.status;
+    }
+
+    iter_handle->handle = cmd.result & 0xff;
+    iter_handle->end    = true;
+
+    return iter_close(dev, iter_handle);
+}
+
+kv_result KADI::iter_read(kv_device *dev, kv_iter_context *iter_handle) {
 
     struct nvme_passthru_kv_cmd cmd;
     memset(&cmd, 0, sizeof(struct nvme_passthru_kv_cmd));
 
     cmd.opcode = nvme_cmd_kv_iter_read;
-    cmd.nsid = nsid;
-    cmd.cdw3 = space_id;
+    cmd.nsid = dev->nsid;
+    cmd.cdw3 = dev->space_id;
     cmd.cdw5 = iter_handle->handle;
     cmd.data_addr = (__u64)iter_handle->buf;
     cmd.data_length = iter_handle->buflen;
@@ -360,7 +465,7 @@ kv_result KADI::iter_read(kv_iter_context *iter_handle) {
     
     
     
-    int ret = ioctl(fd, NVME_IOCTL_IO_KV_CMD, &cmd);
+    int ret = ioctl(dev->fd, NVME_IOCTL_IO_KV_CMD, &cmd);
 
     
 
@@ -423,7 +528,8 @@ redo:
 
 
 kv_result KADI::kv_store(kv_key *key, kv_value *value, kv_cb& cb) {
-    aio_cmd_ctx *ioctx = get_cmd_ctx(cb);
+    kv_device *dev = route(key);
+    aio_cmd_ctx *ioctx = get_cmd_ctx(dev, cb);
     memset((void*)&ioctx->cmd, 0, sizeof(struct nvme_passthru_kv_cmd));
 
     if ((key == 0 || key->key == 0 || value == 0 || (value->length != 0 && value->value == 0))) {
@@ -434,7 +540,7 @@ kv_result KADI::kv_store(kv_key *key, kv_value *value, kv_cb& cb) {
     ioctx->value = value;
 
     ioctx->cmd.opcode = nvme_cmd_kv_store;
-    ioctx->cmd.nsid = nsid;
+    ioctx->cmd.nsid = dev->nsid;
 
     if (key->length > KVCMD_INLINE_KEY_MAX) {
         ioctx->cmd.key_addr = (__u64)key->key;
@@ -447,7 +553,7 @@ kv_result KADI::kv_store(kv_key *key, kv_value *value, kv_cb& cb) {
     ioctx->cmd.data_addr = (__u64)value->value;
     ioctx->cmd.data_length = value->length;
     ioctx->cmd.cdw10 = (value->length >>  2);
-    ioctx->cmd.ctxid = aioctx.ctxid;
+    ioctx->cmd.ctxid = dev->aioctx.ctxid;
     ioctx->cmd.reqid = ioctx->index;
      //derr << "write " << ioctx->cmd.reqid << ", " << std::hex << ioctx << std::dec << dendl;
 #ifdef DUMP_ISSUE_CMD
@@ -456,8 +562,8 @@ derr << "Send write IO(kv_store): key = " << print_key((const char *)key->key, k
 #endif
 
     int ret;
-    if ((ret = ioctl(fd, NVME_IOCTL_AIO_CMD, &ioctx->cmd)) < 0) {
-        release_cmd_ctx(ioctx);
+    if ((ret = ioctl(dev->fd, NVME_IOCTL_AIO_CMD, &ioctx->cmd)) < 0) {
+        release_cmd_ctx(dev, ioctx);
         return -1;
     }
 
@@ -465,7 +571,8 @@ derr << "Send write IO(kv_store): key = " << print_key((const char *)key->key, k
 }
 
 kv_result KADI::kv_retrieve(kv_key *key, kv_value *value, kv_cb& cb){
-    aio_cmd_ctx *ioctx = get_cmd_ctx(cb);
+    kv_device *dev = route(key);
+    aio_cmd_ctx *ioctx = get_cmd_ctx(dev, cb);
     memset((void*)&ioctx->cmd, 0, sizeof(struct nvme_passthru_kv_cmd));
 
     if (key == 0 || key->key == 0 || value == 0 || value->value == 0) {
@@ -476,8 +583,8 @@ kv_result KADI::kv_retrieve(kv_key *key, kv_value *value, kv_cb& cb){
     ioctx->value = value;
 
     ioctx->cmd.opcode = nvme_cmd_kv_retrieve;
-    ioctx->cmd.nsid = nsid;
-    ioctx->cmd.cdw3 = space_id;
+    ioctx->cmd.nsid = dev->nsid;
+    ioctx->cmd.cdw3 = dev->space_id;
     ioctx->cmd.cdw4 = 0;
     ioctx->cmd.cdw5 = value->offset;
     ioctx->cmd.data_addr = (__u64)value->value;
@@ -489,15 +596,15 @@ kv_result KADI::kv_retrieve(kv_key *key, kv_value *value, kv_cb& cb){
     }
     ioctx->cmd.key_length = key->length;
     ioctx->cmd.reqid = ioctx->index;
-    ioctx->cmd.ctxid = aioctx.ctxid;
+    ioctx->cmd.ctxid = dev->aioctx.ctxid;
 
 #ifdef DUMP_ISSUE_CMD
     dump_retrieve_cmd(&ioctx->cmd);
     derr << "IO:kv_retrieve: key = " << print_key((const char *)key->key, key->length) << ", len = " << (int)key->length << dendl;
 #endif
-    int ret = ioctl(fd, NVME_IOCTL_AIO_CMD, &ioctx->cmd);
+    int ret = ioctl(dev->fd, NVME_IOCTL_AIO_CMD, &ioctx->cmd);
     if (ret < 0) {
-        release_cmd_ctx(ioctx);
+        release_cmd_ctx(dev, ioctx);
         return -1;
     }
     return 0;
@@ -525,6 +632,7 @@ kv_result KADI::kv_retrieve_sync(kv_key *key, kv_value *value, uint64_t offset,
     
 }
 kv_result KADI::kv_retrieve_sync(kv_key *key, kv_value *value){
+    kv_device *dev = route(key);
     struct nvme_passthru_kv_cmd cmd;
     memset((void*)&cmd, 0, sizeof(struct nvme_passthru_kv_cmd));
 
@@ -535,8 +643,8 @@ kv_result KADI::kv_retrieve_sync(kv_key *key, kv_value *value){
 
 
     cmd.opcode = nvme_cmd_kv_retrieve;
-    cmd.nsid = nsid;
-    cmd.cdw3 = space_id;
+    cmd.nsid = dev->nsid;
+    cmd.cdw3 = dev->space_id;
     cmd.cdw4 = 0;
     cmd.cdw5 = value->offset;
     cmd.data_addr = (__u64)value->value;
@@ -552,7 +660,7 @@ kv_result KADI::kv_retrieve_sync(kv_key *key, kv_value *value){
 
 
 retry:
-    int ret = ioctl(fd, NVME_IOCTL_IO_KV_CMD, &cmd);
+    int ret = ioctl(dev->fd, NVME_IOCTL_IO_KV_CMD, &cmd);
     if (ret == 0) {
         value->actual_value_size = cmd.result;
         value->length = std::min(cmd.result,  value->length);
@@ -578,6 +686,20 @@ retry:
 }
 
 int KADI::get_freespace(uint64_t &bytesused, uint64_t &capacity, double &utilization)
+{
+    bytesused = capacity = 0;
+    for (kv_device *dev : devs) {
+        uint64_t used, cap;
+        if (get_freespace(dev, used, cap) != 0)
+            return -1;
+        bytesused += used;
+        capacity += cap;
+    }
+    utilization = capacity ? (1.0 * bytesused) / capacity : 0;
+    return 0;
+}
+
+int KADI::get_freespace(kv_device *dev, uint64_t &bytesused, uint64_t &capacity)
 {
     void *data = 0;
     struct nvme_passthru_cmd cmd;
@@ -587,12 +709,12 @@ int KADI::get_freespace(uint64_t &bytesused, uint64_t &capacity, double &utiliza
     if (data == 0) throw new runtime_error("getfreespace: memory allocation failed ");
 
     cmd.opcode = 0x06;
-    cmd.nsid = nsid;
+    cmd.nsid = dev->nsid;
     cmd.addr = (__u64)data;
     cmd.data_len = 4096;
     cmd.cdw10 = 0;
 
-    if (ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd) < 0)
+    if (ioctl(dev->fd, NVME_IOCTL_ADMIN_CMD, &cmd) < 0)
     {
         return -1;
     }
@@ -601,7 +723,6 @@ int KADI::get_freespace(uint64_t &bytesused, uint64_t &capacity, double &utiliza
     const __u64 namespace_utilization = *((__u64 *)&((char*)data)[16]);
     capacity = namespace_size * 512;
     bytesused = namespace_utilization * 512;
-    utilization = (1.0 * namespace_utilization) / namespace_size;
 
     if (data)
                 free(data);
@@ -620,11 +741,12 @@ bool KADI::exist(void *key, int length)
     return (ret == 0);
 #else
     int ret = 0;
+    kv_device *dev = route(key, length);
     struct nvme_passthru_kv_cmd cmd;
     memset(&cmd, 0, sizeof (struct nvme_passthru_kv_cmd));
     cmd.opcode = nvme_cmd_kv_exist;
-    cmd.nsid = nsid;
-    cmd.cdw3 = space_id;
+    cmd.nsid = dev->nsid;
+    cmd.cdw3 = dev->space_id;
     cmd.key_length = length;
     if (length > KVCMD_INLINE_KEY_MAX) {
             cmd.key_addr = (__u64)key;
@@ -636,7 +758,7 @@ bool KADI::exist(void *key, int length)
     dump_cmd(&cmd);
 #endif
 
-    ret = ioctl(fd, NVME_IOCTL_IO_KV_CMD, &cmd);
+    ret = ioctl(dev->fd, NVME_IOCTL_IO_KV_CMD, &cmd);
 
     return (ret == 0)? true:false;
 #endif
@@ -648,7 +770,8 @@ bool KADI::exist(kv_key *key)
 }
 
 kv_result KADI::kv_delete(kv_key *key, kv_cb& cb, int check_exist) {
-    aio_cmd_ctx *ioctx = get_cmd_ctx(cb);
+    kv_device *dev = route(key);
+    aio_cmd_ctx *ioctx = get_cmd_ctx(dev, cb);
     memset((void*)&ioctx->cmd, 0, sizeof(struct nvme_passthru_kv_cmd));
 
     if (key == 0 || key->key == 0) {
@@ -658,8 +781,8 @@ kv_result KADI::kv_delete(kv_key *key, kv_cb& cb, int check_exist) {
     ioctx->value = 0;
 
     ioctx->cmd.opcode = nvme_cmd_kv_delete;
-    ioctx->cmd.nsid = nsid;
-    ioctx->cmd.cdw3 = space_id;
+    ioctx->cmd.nsid = dev->nsid;
+    ioctx->cmd.cdw3 = dev->space_id;
     ioctx->cmd.cdw4 = 1;
     if (key->length <= KVCMD_INLINE_KEY_MAX) {
         memcpy((void*)ioctx->cmd.key, (void*)key->key, key->length);
@@ -668,7 +791,7 @@ kv_result KADI::kv_delete(kv_key *key, kv_cb& cb, int check_exist) {
     }
     ioctx->cmd.key_length = key->length;
     ioctx->cmd.reqid = ioctx->index;
-    ioctx->cmd.ctxid = aioctx.ctxid;
+    ioctx->cmd.ctxid = dev->aioctx.ctxid;
     
     
 #ifdef DUMP_ISSUE_CMD
@@ -676,9 +799,9 @@ kv_result KADI::kv_delete(kv_key *key, kv_cb& cb, int check_exist) {
     derr << "IO:kv_delete: key = " << print_key((const char *)key->key, key->length) << ", len = " << (int)key->length << dendl;
 #endif
 
-    if (ioctl(fd, NVME_IOCTL_AIO_CMD, &ioctx->cmd) < 0) {
+    if (ioctl(dev->fd, NVME_IOCTL_AIO_CMD, &ioctx->cmd) < 0) {
         
-        release_cmd_ctx(ioctx);
+        release_cmd_ctx(dev, ioctx);
         
         return -1;
     }
@@ -688,26 +811,48 @@ kv_result KADI::kv_delete(kv_key *key, kv_cb& cb, int check_exist) {
 
 kv_result KADI::poll_completion(uint32_t &num_events, uint32_t timeout_us) {
 
-    FD_ZERO(&rfds);
-
 #ifdef EPOLL_DEV
+    static const int MAX_READY_DEVS = 16;
+    struct epoll_event list_of_events[MAX_READY_DEVS];
     int timeout = timeout_us/1000;
-    int nr_changed_fds = epoll_wait(EpollFD_dev, list_of_events, 1, timeout);
+    int nr_changed_fds = epoll_wait(epoll_fd, list_of_events, MAX_READY_DEVS, timeout);
     if( nr_changed_fds == 0 || nr_changed_fds < 0){ num_events = 0; return 0;}
+
+    for (int i = 0; i < nr_changed_fds; i++) {
+        kv_result r = reap_completions((kv_device *)list_of_events[i].data.ptr);
+        if (r != 0) return r;
+    }
 #else
-    FD_SET(aioctx.eventfd, &rfds);
+    fd_set rfds;
+    struct timeval timeout;
+    int maxfd = -1;
+
+    FD_ZERO(&rfds);
+    for (kv_device *dev : devs) {
+        FD_SET(dev->aioctx.eventfd, &rfds);
+        maxfd = std::max(maxfd, (int)dev->aioctx.eventfd);
+    }
 
     memset(&timeout, 0, sizeof(timeout));
     timeout.tv_usec = timeout_us;
     
-    int nr_changed_fds = select(aioctx.eventfd+1, &rfds, NULL, NULL, &timeout);
+    int nr_changed_fds = select(maxfd+1, &rfds, NULL, NULL, &timeout);
     
     if ( nr_changed_fds == 0 || nr_changed_fds < 0) { num_events = 0; return 0; }
-    
+
+    for (kv_device *dev : devs) {
+        if (!FD_ISSET(dev->aioctx.eventfd, &rfds)) continue;
+        kv_result r = reap_completions(dev);
+        if (r != 0) return r;
+    }
 #endif
 
+    return 0;
+}
+
+kv_result KADI::reap_completions(kv_device *dev) {
     unsigned long long eftd_ctx = 0;
-    int read_s = read(aioctx.eventfd, &eftd_ctx, sizeof(unsigned long long));
+    int read_s = read(dev->aioctx.eventfd, &eftd_ctx, sizeof(unsigned long long));
 
     if (read_s != sizeof(unsigned long long)) {
         fprintf(stderr, "failt to read from eventfd ..\n");
@@ -731,10 +876,10 @@ kv_result KADI::poll_completion(uint32_t &num_events, uint32_t timeout_us) {
         }
 
         aioevents.nr = check_nr;
-        aioevents.ctxid = aioctx.ctxid;
+        aioevents.ctxid = dev->aioctx.ctxid;
         
         
-        if (ioctl(fd, NVME_IOCTL_GET_AIOEVENT, &aioevents) < 0) {
+        if (ioctl(dev->fd, NVME_IOCTL_GET_AIOEVENT, &aioevents) < 0) {
             fprintf(stderr, "fail to read IOEVETS \n");
             return -1;
         }
@@ -749,14 +894,14 @@ kv_result KADI::poll_completion(uint32_t &num_events, uint32_t timeout_us) {
             derr << "reqid  = " << event.reqid << ", ret " << (int)event.status << "," << (int) aioevents.events[i].status << dendl;
 #endif
             
-            aio_cmd_ctx *ioctx = get_cmdctx(event.reqid);
+            aio_cmd_ctx *ioctx = get_cmdctx(dev, event.reqid);
 
             //derr  << "-0 i = " << i << ", nr = " << aioevents.nr << ", reqid = " << event.reqid << ", ioctx = " << std::hex << ioctx << std::dec << dendl;
             
             if (ioctx != 0) {
                 fill_ioresult(*ioctx, event, ioresult);
                 ioctx->call_post_fn(ioresult);
-                release_cmd_ctx(ioctx);
+                release_cmd_ctx(dev, ioctx);
             } else {
                 derr << "not found " << event.reqid << dendl; 
                 sleep(1);
@@ -903,6 +1048,27 @@ kv_result KADI::sync_read(kv_key *key, bufferlist &bl, int valuesize) {
     return txc.read_wait(bl);
 }
 
+// the device reports the length of the whole value, however small the
+// buffer it is read into
+kv_result KADI::sync_value_size(kv_key *key, uint32_t *size) {
+
+    KvsReadContext txc(cct);
+    txc.value = KvsMemPool::Alloc_value(4096);
+
+    txc.num_running = 1;
+    txc.start = ceph_clock_now();
+
+    kv_cb f = { read_callback, &txc };
+    queuedepth++;
+    kv_result ret = kv_retrieve(key, txc.value, f);
+    if (ret != 0) return ret;
+
+    ret = txc.read_wait();
+    if (ret == KV_SUCCESS)
+        *size = txc.value->actual_value_size;
+    return ret;
+}
+
 
 
 kv_result KADI::submit_batch(aio_iter begin, aio_iter end, void *priv, bool write )
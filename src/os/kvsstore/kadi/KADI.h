@@ -10,6 +10,7 @@
 #include <vector>
 #include <mutex>
 #include <list>
+#include <string>
 #include <stdbool.h>
 #include <condition_variable>
 #include <sys/eventfd.h>
@@ -128,6 +129,7 @@ typedef struct
     int byteswritten;
     int bufoffset;
     bool end;
+    bool routed = false;   ///< every key under prefix lives on one device
 } kv_iter_context;
 
 class iterbuf_reader {
@@ -170,51 +172,74 @@ public:
         }
     } aio_cmd_ctx;
 
+    /// a KV namespace with its own command queue and completion context
+    struct kv_device {
+        std::string path;
+        int fd = -1;
+        unsigned nsid;
+        int space_id = 0;
+
+        std::mutex cmdctx_lock;
+        std::condition_variable cmdctx_cond;
+        std::vector<aio_cmd_ctx *>   free_cmdctxs;
+        std::map<int, aio_cmd_ctx *> pending_cmdctxs;
+
+        struct nvme_aioctx aioctx;
+    };
+
     KADI(CephContext *c): cct(c) { }
     ~KADI() { close(); }
 
 private:
 
-    int fd = -1;
     int csum_type = 0;
-    unsigned nsid;
-    int space_id;
 
-    fd_set rfds;
-    struct timeval timeout;
     CephContext *cct;
-    std::mutex cmdctx_lock;
     std::mutex aioevent_lock;
-    std::condition_variable cmdctx_cond;
 
-    std::vector<aio_cmd_ctx *>   free_cmdctxs;
-    std::map<int, aio_cmd_ctx *> pending_cmdctxs;
+    std::vector<kv_device *> devs;   ///< devs[0] holds the store metadata
+    int epoll_fd = -1;                ///< watches the eventfd of every device
 
     const int qdepth = 256;
-    struct nvme_aioctx aioctx;
 
-    aio_cmd_ctx* get_cmd_ctx(kv_cb& cb);
+    int open_device(kv_device *dev);
+    void close_device(kv_device *dev);
 
-    inline aio_cmd_ctx* get_cmdctx(int reqid) {
-        std::unique_lock<std::mutex> lock (cmdctx_lock);
-        auto p = pending_cmdctxs.find(reqid);
-        if (p == pending_cmdctxs.end()) {
+    // key placement
+    kv_device *route(const void *key, int length);
+    kv_device *route(const kv_key *key) { return route(key->key, key->length); }
+    kv_device *route_prefix(uint32_t prefix);
+
+    aio_cmd_ctx* get_cmd_ctx(kv_device *dev, kv_cb& cb);
+
+    inline aio_cmd_ctx* get_cmdctx(kv_device *dev, int reqid) {
+        std::unique_lock<std::mutex> lock (dev->cmdctx_lock);
+        auto p = dev->pending_cmdctxs.find(reqid);
+        if (p == dev->pending_cmdctxs.end()) {
             
             
             return 0;
         }
         else {
             aio_cmd_ctx *ctx = p->second;
-            pending_cmdctxs.erase(p);
+            dev->pending_cmdctxs.erase(p);
             return ctx;
         }
         
     }
 
-    void release_cmd_ctx(aio_cmd_ctx *p);
+    void release_cmd_ctx(kv_device *dev, aio_cmd_ctx *p);
+    kv_result reap_completions(kv_device *dev);
     void dump_delete_cmd(struct nvme_passthru_kv_cmd *cmd);
     void dump_retrieve_cmd(struct nvme_passthru_kv_cmd *cmd);
 
+    kv_result iter_open(kv_device *dev, kv_iter_context *iter_handle);
+    kv_result iter_close(kv_device *dev, kv_iter_context *iter_handle);
+    kv_result iter_read(kv_device *dev, kv_iter_context *iter_handle);
+    kv_result iter_readall(kv_device *dev, kv_iter_context *iter_ctx, std::list<std::pair<void*, int> > &buflist);
+    kv_result iter_delete(kv_device *dev, kv_iter_context *iter_handle);
+    int get_freespace(kv_device *dev, uint64_t &bytesused, uint64_t &capacity);
+
 public:
 
     kv_result kv_store(kv_key *key, kv_value *value, kv_cb& cb);
@@ -222,13 +247,13 @@ public:
     kv_result kv_retrieve_sync(kv_key *key, kv_value *value);
     kv_result kv_retrieve_sync(kv_key *key, kv_value *value, uint64_t offset, size_t length, bufferlist &bl, bool &ispartial);
     kv_result kv_delete(kv_key *key, kv_cb& cb, int check_exist = 0);
-    kv_result iter_open(kv_iter_context *iter_handle);
-    kv_result iter_close(kv_iter_context *iter_handle);
-    kv_result iter_read(kv_iter_context *iter_handle);
+    // iterators run on every device unless iter_ctx->routed is set
     kv_result iter_readall(kv_iter_context *iter_ctx, std::list<std::pair<void*, int> > &buflist);
+    kv_result iter_delete(kv_iter_context *iter_handle);
     kv_result poll_completion(uint32_t &num_events, uint32_t timeout_us);
     bool exist(kv_key *key);
     bool exist(void *key, int length);
+    // devpath is a comma or space separated list of KV namespaces
     int open(std::string &devpath, int csum_type);
     int close();
     int fill_ioresult(const aio_cmd_ctx &ioctx, const struct nvme_aioevent &event, kv_io_context &result);
@@ -239,13 +264,16 @@ public:
     kv_result sync_submit(KvsReadContext *txc);
     kv_result aio_submit_prefetch(KvsReadContext *txc);
     kv_result sync_read(kv_key *key, bufferlist &bl, int valuesize = 4096);
+    kv_result sync_value_size(kv_key *key, uint32_t *size);
+    // summed over all devices
     kv_result get_freespace(uint64_t &bytesused, uint64_t &capacity, double &utilization);
 
     std::string errstr(int res) {
         if (res == KV_SUCCESS) return "SUCCESS";
         return "ERROR";
     }
-    bool is_opened() { return (fd != -1); }
+    bool is_opened() { return !devs.empty(); }
+    unsigned num_devices() { return devs.size(); }
     void dump_cmd(struct nvme_passthru_kv_cmd *cmd);
 
 };
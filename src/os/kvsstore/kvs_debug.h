@@ -6,6 +6,7 @@
 #define CEPH_KVS_DEBUG_H
 
 #include "os/ObjectStore.h"
+#include "common/kvsdbg.h"
 #include <sstream>
 #include <pthread.h>
 
@@ -16,36 +17,16 @@
 #undef dout_prefix
 #define dout_prefix *_dout << "[kvs] "
 
-#define FTRACE
-#define FTRACE2
+// function enter/exit records in the kvsdbg trace rings (kvsdbg_trace)
+#define FTRACE KVS_FTRACE_SCOPE(cct);
+#define FTRACE2 KVS_FTRACE_SCOPE(store->cct);
 //#define PRINTRKEY(k) 
 #define PRINTRKEY_CCT(ct, k)
 
-#ifndef FTRACE
-#define FTRACE FtraceObject fobj(__FUNCTION__, cct);
-#endif
-
-#ifndef FTRACE2
-#define FTRACE2 //FtraceObject obj(__FUNCTION__, store->cct);
-#endif
-
 #define PRINTWKEY(k) derr << __func__ << ": write key = " << print_key((const char*)(k)->key, (k)->length) << dendl;
 #define PRINTRKEY(k) derr << __func__ << ": read key = " << print_key((const char*)(k)->key, (k)->length) << dendl;
 //#define PRINTRKEY_CCT(ct, k) lderr(ct) << __func__ << ": read key = " << print_key((const char*)(k)->key, (k)->length) << dendl;
 
-struct FtraceObject {
-    std::string func;
-    CephContext *cct;
-    FtraceObject(const char *f, CephContext *c) : func(f), cct(c) {
-      derr << "ENTER: " << func << dendl;
-    }
-
-    ~FtraceObject() {
-      derr << "EXIT : " << func << dendl;
-    }
-
-};
-
 
 static const std::map<int, std::string> opstr_map = {
         {ObjectStore::Transaction::OP_NOP              ,"OP_NOP               "},
@@ -33,29 +33,111 @@ const uint8_t GROUP_PREFIX_DATA  = 2;
 const uint8_t GROUP_PREFIX_COLL  = 3;
 const uint8_t GROUP_PREFIX_SUPER = 4;
 const uint8_t GROUP_PREFIX_JOURNAL = 5;
+const uint8_t GROUP_PREFIX_REAPER  = 6;
+const uint8_t GROUP_PREFIX_KVDB    = 7;   ///< KADIStore (KeyValueDB) keys
 
 /// superblock
 struct kvsstore_sb_t {
     uint64_t lid_last;
     uint64_t is_uptodate;
+    uint64_t num_devices = 1;   ///< length of kvsstore_dev_path at mkfs
 
     explicit kvsstore_sb_t() {}
 
     DENC(kvsstore_sb_t, v, p) {
-        DENC_START(1, 1, p);
+        DENC_START(2, 1, p);
             denc(v.lid_last, p);
             denc(v.is_uptodate, p);
+            if (struct_v >= 2)
+                denc(v.num_devices, p);
         DENC_FINISH(p);
     }
     void dump(Formatter *f) const{
         f->dump_unsigned("lid_last", lid_last);
         f->dump_unsigned("is_uptodate", is_uptodate);
+        f->dump_unsigned("num_devices", num_devices);
     }
     static void generate_test_instances(list<kvsstore_sb_t*>& o){}
 
 };
 WRITE_CLASS_DENC(kvsstore_sb_t)
 
+/// usage of one pool
+struct kvsstore_pool_stat_t {
+    int64_t objects = 0;
+    int64_t stored = 0;    ///< object data bytes
+    int64_t omap = 0;      ///< omap key, value and header bytes
+
+    bool is_zero() const {
+        return objects == 0 && stored == 0 && omap == 0;
+    }
+    kvsstore_pool_stat_t& operator+=(const kvsstore_pool_stat_t& o) {
+        objects += o.objects;
+        stored += o.stored;
+        omap += o.omap;
+        return *this;
+    }
+
+    DENC(kvsstore_pool_stat_t, v, p) {
+        DENC_START(1, 1, p);
+            denc_signed_varint(v.objects, p);
+            denc_signed_varint(v.stored, p);
+            denc_signed_varint(v.omap, p);
+        DENC_FINISH(p);
+    }
+    void dump(Formatter *f) const {
+        f->dump_int("objects", objects);
+        f->dump_int("stored", stored);
+        f->dump_int("omap", omap);
+    }
+    static void generate_test_instances(list<kvsstore_pool_stat_t*>& o) {
+        o.push_back(new kvsstore_pool_stat_t);
+        o.push_back(new kvsstore_pool_stat_t);
+        o.back()->objects = 3;
+        o.back()->stored = 12288;
+        o.back()->omap = 100;
+    }
+};
+WRITE_CLASS_DENC(kvsstore_pool_stat_t)
+
+/// per-pool usage
+///
+/// Kept up to date by the transaction path. A copy is written next to the
+/// superblock at mount, umount and periodically in between, and each
+/// journaled transaction carries one as well, so that replay can restore
+/// the counters as of the newest journal entry.
+struct kvsstore_statfs_t {
+    uint64_t jseq = 0;   ///< journal sequence the counters are current as of
+    std::map<int64_t, kvsstore_pool_stat_t> pools;
+
+    DENC(kvsstore_statfs_t, v, p) {
+        DENC_START(1, 1, p);
+            denc_varint(v.jseq, p);
+            denc(v.pools, p);
+        DENC_FINISH(p);
+    }
+    void dump(Formatter *f) const {
+        f->dump_unsigned("jseq", jseq);
+        f->open_array_section("pools");
+        for (auto &i : pools) {
+            f->open_object_section("pool");
+            f->dump_int("pool", i.first);
+            i.second.dump(f);
+            f->close_section();
+        }
+        f->close_section();
+    }
+    static void generate_test_instances(list<kvsstore_statfs_t*>& o) {
+        o.push_back(new kvsstore_statfs_t);
+        o.push_back(new kvsstore_statfs_t);
+        o.back()->jseq = 42;
+        o.back()->pools[1].objects = 2;
+        o.back()->pools[1].stored = 8192;
+        o.back()->pools[3].omap = 512;
+    }
+};
+WRITE_CLASS_DENC(kvsstore_statfs_t)
+
 /// collection metadata
 struct kvsstore_cnode_t {
     uint32_t bits;   ///< how many bits of coll pgid are significant
@@ -74,13 +156,218 @@ struct kvsstore_cnode_t {
 WRITE_CLASS_DENC(kvsstore_cnode_t)
 
 
+/// reaper record: keys that are logically dead and reclaimed in the background
+struct kvsstore_reap_t {
+    enum {
+        REAP_LID  = 1,   ///< all omap keys of a lid
+        REAP_COLL = 2,   ///< leftover onode/data keys in a removed collection
+    };
+
+    uint64_t seq = 0;        ///< record id, also used as the key index
+    uint8_t type = 0;
+    uint64_t lid = 0;        ///< REAP_LID
+    std::string cid;         ///< REAP_COLL, coll_t::to_str()
+    uint64_t poolid = 0;
+    int8_t shardid = 0;
+    uint32_t starthash = 0;
+    uint64_t endhash = 0;    ///< exclusive, up to 1 << 32
+
+    DENC(kvsstore_reap_t, v, p) {
+        DENC_START(1, 1, p);
+            denc(v.seq, p);
+            denc(v.type, p);
+            denc_varint(v.lid, p);
+            denc(v.cid, p);
+            denc(v.poolid, p);
+            denc(v.shardid, p);
+            denc(v.starthash, p);
+            denc(v.endhash, p);
+        DENC_FINISH(p);
+    }
+    void dump(Formatter *f) const {
+        f->dump_unsigned("seq", seq);
+        f->dump_unsigned("type", type);
+        f->dump_unsigned("lid", lid);
+        f->dump_string("cid", cid);
+        f->dump_unsigned("poolid", poolid);
+        f->dump_int("shardid", shardid);
+        f->dump_unsigned("starthash", starthash);
+        f->dump_unsigned("endhash", endhash);
+    }
+    static void generate_test_instances(list<kvsstore_reap_t*>& o) {}
+};
+WRITE_CLASS_DENC(kvsstore_reap_t)
+
+inline ostream& operator<<(ostream& out, const kvsstore_reap_t& r) {
+    out << "reap(" << r.seq;
+    if (r.type == kvsstore_reap_t::REAP_LID)
+        out << " lid " << r.lid;
+    else
+        out << " coll " << r.cid << " pool " << r.poolid << " shard " << (int)r.shardid
+            << " hash " << std::hex << r.starthash << "~" << r.endhash << std::dec;
+    return out << ")";
+}
+
+/// pglog segment layout of a pgmeta object
+///
+/// PG log and dup entries are kept in segment values that each hold
+/// seg_entries consecutive versions, rather than one omap key per entry.
+/// Entries up to the trim point are logically gone; the segments they
+/// live in are dropped as a whole once the trim moves past them.
+///
+/// A transaction does not rewrite the newest segment of a kind (the
+/// head). What it adds to the heads, and the trim point, which moves with
+/// nearly every transaction, go into a small delta record in one of
+/// delta_slots keys, used round robin. The head is rewritten in full, and
+/// the deltas before it dropped, before the slots wrap or once it stops
+/// being the head. Segment values and deltas carry the sequence number of
+/// the transaction that wrote them; a head is read back as its value plus
+/// the deltas for it with a higher sequence.
+///
+/// This record is only rewritten when a head changes or a segment
+/// outgrows seg_bytes. The trim point is the largest of trimmed_to, the
+/// one in the head value and those in its deltas.
+struct kvsstore_pglog_meta_t {
+    uint32_t seg_entries = 0;      ///< versions per segment, 0 if not used
+    std::string trimmed_to[2];     ///< trim point when this was written, per entry kind
+    int64_t head[2] = {-1, -1};    ///< newest segment, -1 if there is none
+    uint32_t seg_bytes[2] = {0, 0};   ///< no segment value is larger than this
+    uint32_t delta_slots = 0;      ///< delta record keys, 0 if heads are always rewritten
+    uint64_t seq = 0;              ///< last sequence number used when this was written
+
+    DENC(kvsstore_pglog_meta_t, v, p) {
+        DENC_START(2, 1, p);
+            denc(v.seg_entries, p);
+            denc(v.trimmed_to[0], p);
+            denc(v.trimmed_to[1], p);
+            denc(v.head[0], p);
+            denc(v.head[1], p);
+            denc(v.seg_bytes[0], p);
+            denc(v.seg_bytes[1], p);
+            if (struct_v >= 2) {
+                denc(v.delta_slots, p);
+                denc(v.seq, p);
+            }
+        DENC_FINISH(p);
+    }
+    void dump(Formatter *f) const {
+        f->dump_unsigned("seg_entries", seg_entries);
+        f->dump_string("log_trimmed_to", trimmed_to[0]);
+        f->dump_string("dup_trimmed_to", trimmed_to[1]);
+        f->dump_int("log_head", head[0]);
+        f->dump_int("dup_head", head[1]);
+        f->dump_unsigned("log_seg_bytes", seg_bytes[0]);
+        f->dump_unsigned("dup_seg_bytes", seg_bytes[1]);
+        f->dump_unsigned("delta_slots", delta_slots);
+        f->dump_unsigned("seq", seq);
+    }
+    static void generate_test_instances(list<kvsstore_pglog_meta_t*>& o) {
+        o.push_back(new kvsstore_pglog_meta_t);
+        o.push_back(new kvsstore_pglog_meta_t);
+        o.back()->seg_entries = 32;
+        o.back()->trimmed_to[0] = "0000000012.00000000000000000042";
+        o.back()->head[0] = 3;
+        o.back()->seg_bytes[0] = 8192;
+        o.back()->delta_slots = 8;
+        o.back()->seq = 1234;
+    }
+};
+WRITE_CLASS_DENC(kvsstore_pglog_meta_t)
+
 /// onode: per-object metadata
+///
+/// v2 layout (fixed-size header followed by a flat attribute table):
+///   le64 lid | le64 size | u8 flags | le32 attr table length | attr records
+///   attr record: le16 name_len | le32 value_len | name | value
+/// v3 appends le64 omap_bytes.
+///
+/// The attr table is kept in its encoded form (attr_blob) after a load and
+/// is only scanned when an attr is looked up. Attrs changed since the load
+/// are tracked in attr_set/attr_rm, and unchanged records are copied
+/// verbatim from attr_blob when the onode is re-encoded.
 struct kvsstore_onode_t {
+    typedef mempool::kvsstore_cache_other::string attr_name_t;
+    typedef map<attr_name_t, bufferptr> attr_map_t;
+
     uint64_t lid = 0;
     uint64_t size = 0;                   ///< object size
-    map<mempool::kvsstore_cache_other::string,  bufferptr> attrs;        ///< attrs
     uint8_t flags = 0;
+    uint64_t omap_bytes = 0;             ///< omap bytes charged to the pool
+
+private:
+    bufferptr attr_blob;                 ///< encoded attr table as loaded
+    attr_map_t attr_set;                 ///< attrs set since the load
+    mempool::kvsstore_cache_other::set<attr_name_t> attr_rm;  ///< attr_blob records removed since the load
+
+    static const size_t ATTR_RECORD_HEADER = 2 + 4;
+
+    // calls f(name, name_len, record offset, record length) for each record in attr_blob
+    template<typename F>
+    void _for_each_blob_record(F &&f) const {
+        const char *start = attr_blob.c_str();
+        size_t off = 0;
+        const size_t len = attr_blob.length();
+        while (off + ATTR_RECORD_HEADER <= len) {
+            const uint16_t name_len = *(const ceph_le16 *)(start + off);
+            const uint32_t value_len = *(const ceph_le32 *)(start + off + 2);
+            const size_t rlen = ATTR_RECORD_HEADER + name_len + value_len;
+            if (off + rlen > len)
+                throw buffer::malformed_input("kvsstore_onode_t: truncated attr table");
+            if (!f(start + off + ATTR_RECORD_HEADER, name_len, off, rlen))
+                return;
+            off += rlen;
+        }
+    }
 
+    bool _blob_attr_is_live(const char *name, size_t name_len) const {
+        if (attr_set.empty() && attr_rm.empty())
+            return true;
+        attr_name_t n(name, name_len);
+        return attr_set.count(n) == 0 && attr_rm.count(n) == 0;
+    }
+
+    bool _blob_find(const char *name, size_t name_len, bufferptr *value) const {
+        bool found = false;
+        _for_each_blob_record([&](const char *n, uint16_t nlen, size_t off, size_t rlen) {
+            if (nlen != name_len || memcmp(n, name, nlen) != 0)
+                return true;
+            found = true;
+            if (value) {
+                const size_t voff = off + ATTR_RECORD_HEADER + nlen;
+                *value = bufferptr(attr_blob, voff, rlen - ATTR_RECORD_HEADER - nlen);
+            }
+            return false;
+        });
+        return found;
+    }
+
+    static void _encode_attr_record(const attr_name_t &name, const bufferptr &value,
+                                    bufferlist::contiguous_appender& p) {
+        ceph_le16 name_len;
+        name_len = name.length();
+        ceph_le32 value_len;
+        value_len = value.length();
+        denc(name_len, p);
+        denc(value_len, p);
+        p.append(name.data(), name.length());
+        p.append(value.c_str(), value.length());
+    }
+
+    size_t _attr_table_length() const {
+        size_t len = 0;
+        if (attr_blob.length()) {
+            _for_each_blob_record([&](const char *n, uint16_t nlen, size_t off, size_t rlen) {
+                if (_blob_attr_is_live(n, nlen))
+                    len += rlen;
+                return true;
+            });
+        }
+        for (auto &i : attr_set)
+            len += ATTR_RECORD_HEADER + i.first.length() + i.second.length();
+        return len;
+    }
+
+public:
     enum {
         FLAG_OMAP = 1,
     };
@@ -117,19 +404,182 @@ struct kvsstore_onode_t {
         clear_flag(FLAG_OMAP);
     }
 
+    /// attrs
 
+    bool get_attr(const char *name, bufferptr *value) const {
+        const size_t name_len = strlen(name);
+        attr_name_t n(name, name_len);
+        auto it = attr_set.find(n);
+        if (it != attr_set.end()) {
+            if (value) *value = it->second;
+            return true;
+        }
+        if (attr_rm.count(n))
+            return false;
+        return _blob_find(name, name_len, value);
+    }
 
-    DENC(kvsstore_onode_t, v, p) {
-        DENC_START(1, 1, p);
-            denc_varint(v.lid, p);
-            denc_varint(v.size, p);
-            denc(v.attrs, p);
-            denc(v.flags, p);
+    void get_attrs(map<string, bufferptr> &out) const {
+        if (attr_blob.length()) {
+            _for_each_blob_record([&](const char *n, uint16_t nlen, size_t off, size_t rlen) {
+                if (_blob_attr_is_live(n, nlen)) {
+                    const size_t voff = off + ATTR_RECORD_HEADER + nlen;
+                    out[string(n, nlen)] = bufferptr(attr_blob, voff, rlen - ATTR_RECORD_HEADER - nlen);
+                }
+                return true;
+            });
+        }
+        for (auto &i : attr_set)
+            out[string(i.first.data(), i.first.length())] = i.second;
+    }
+
+    bool has_attrs() const {
+        if (!attr_set.empty())
+            return true;
+        bool found = false;
+        if (attr_blob.length()) {
+            _for_each_blob_record([&](const char *n, uint16_t nlen, size_t off, size_t rlen) {
+                found = _blob_attr_is_live(n, nlen);
+                return !found;
+            });
+        }
+        return found;
+    }
+
+    /// value must already be accounted to mempool_kvsstore_cache_other
+    void set_attr(const char *name, const bufferptr &value) {
+        attr_name_t n(name);
+        attr_rm.erase(n);
+        attr_set[n] = value;
+    }
+
+    /// returns false if the attr does not exist
+    bool rm_attr(const char *name) {
+        const size_t name_len = strlen(name);
+        attr_name_t n(name, name_len);
+        bool existed = attr_set.erase(n) > 0;
+        if (!attr_rm.count(n) && _blob_find(name, name_len, nullptr)) {
+            attr_rm.insert(n);
+            existed = true;
+        }
+        return existed;
+    }
+
+    void clear_attrs() {
+        attr_blob = bufferptr();
+        attr_set.clear();
+        attr_rm.clear();
+    }
+
+    /// the encoded table is immutable, so it is shared rather than copied
+    void copy_attrs(const kvsstore_onode_t &o) {
+        attr_blob = o.attr_blob;
+        attr_set = o.attr_set;
+        attr_rm = o.attr_rm;
+    }
+
+    /// encoding
+
+    DENC_HELPERS
+
+    void bound_encode(size_t& p) const {
+        DENC_START(3, 2, p);
+            p += sizeof(ceph_le64) * 3 + sizeof(flags) + sizeof(ceph_le32);
+            p += _attr_table_length();
         DENC_FINISH(p);
     }
 
-    void dump(Formatter *f) const {}
-    static void generate_test_instances(list<kvsstore_onode_t*>& o) {}
+    void encode(bufferlist::contiguous_appender& p) const {
+        DENC_START(3, 2, p);
+            ceph_le64 v;
+            v = lid;
+            denc(v, p);
+            v = size;
+            denc(v, p);
+            denc(flags, p);
+            ceph_le32 attr_len;
+            attr_len = _attr_table_length();
+            denc(attr_len, p);
+            if (attr_blob.length()) {
+                if (attr_set.empty() && attr_rm.empty()) {
+                    p.append(attr_blob.c_str(), attr_blob.length());
+                } else {
+                    // unchanged records are copied as they are
+                    _for_each_blob_record([&](const char *n, uint16_t nlen, size_t off, size_t rlen) {
+                        if (_blob_attr_is_live(n, nlen))
+                            p.append(attr_blob.c_str() + off, rlen);
+                        return true;
+                    });
+                }
+            }
+            for (auto &i : attr_set)
+                _encode_attr_record(i.first, i.second, p);
+            v = omap_bytes;
+            denc(v, p);
+        DENC_FINISH(p);
+    }
+
+    void decode(buffer::ptr::iterator& p) {
+        clear_attrs();
+        omap_bytes = 0;
+        DENC_START(3, 1, p);
+            if (struct_v < 2) {
+                attr_map_t attrs;
+                denc_varint(lid, p);
+                denc_varint(size, p);
+                denc(attrs, p);
+                denc(flags, p);
+                for (auto &i : attrs) {
+                    i.second.reassign_to_mempool(mempool::mempool_kvsstore_cache_other);
+                }
+                attr_set.swap(attrs);
+            } else {
+                ceph_le64 v;
+                denc(v, p);
+                lid = v;
+                denc(v, p);
+                size = v;
+                denc(flags, p);
+                ceph_le32 attr_len;
+                denc(attr_len, p);
+                if (attr_len) {
+                    attr_blob = p.get_ptr(attr_len);
+                    attr_blob.reassign_to_mempool(mempool::mempool_kvsstore_cache_other);
+                }
+                if (struct_v >= 3) {
+                    denc(v, p);
+                    omap_bytes = v;
+                }
+            }
+        DENC_FINISH(p);
+    }
+
+    void dump(Formatter *f) const {
+        f->dump_unsigned("lid", lid);
+        f->dump_unsigned("size", size);
+        f->dump_string("flags", get_flags_string());
+        f->dump_unsigned("omap_bytes", omap_bytes);
+        map<string, bufferptr> attrs;
+        get_attrs(attrs);
+        f->open_array_section("attrs");
+        for (auto &i : attrs) {
+            f->open_object_section("attr");
+            f->dump_string("name", i.first);
+            f->dump_unsigned("len", i.second.length());
+            f->close_section();
+        }
+        f->close_section();
+    }
+    static void generate_test_instances(list<kvsstore_onode_t*>& o) {
+        o.push_back(new kvsstore_onode_t);
+        o.push_back(new kvsstore_onode_t);
+        o.back()->lid = 42;
+        o.back()->size = 4096;
+        o.back()->set_omap_flag();
+        o.back()->omap_bytes = 300;
+        o.back()->set_attr("_", bufferptr("object info", 11));
+        o.back()->set_attr("snapset", bufferptr("snapset", 7));
+    }
 };
 WRITE_CLASS_DENC(kvsstore_onode_t)
 
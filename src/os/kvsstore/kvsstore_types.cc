@@ -493,6 +493,7 @@ void omap_iterator_init(CephContext *cct, uint64_t lid, kv_iter_context *iter_ct
     iter_ctx->prefix =  ceph_str_hash_linux((char*)&hdr, sizeof(struct kvs_omap_key_header));
     iter_ctx->bitmask = 0xFFFFFFFF;
     iter_ctx->buflen = ITER_BUFSIZE;
+    iter_ctx->routed = true;
 }
 
 void print_iterKeys(CephContext *cct, std::map<string, int> &keylist){
@@ -575,7 +576,7 @@ int KvsOmapIterator::seek_to_first()
 
     construct_omap_key(c->store->cct, o->onode.lid, "", 0, key);
 
-    kv_result res = c->store->db.sync_read(key, hdr, ITER_BUFSIZE);
+    kv_result res = c->store->omap_sync_read(key, hdr);
 
     if (key){ KvsMemPool::Release_key(key); }
 
@@ -638,13 +639,18 @@ bufferlist KvsOmapIterator::value()
         return output;
     }
 
+    auto v = values.find(*it);
+    if (v != values.end()) {
+        return v->second;
+    }
+
     kv_key *key = KvsMemPool::Alloc_key();
     if (key == 0){	lderr(c->store->cct) << __func__ << "key = " << key << dendl; exit(1); }
 
     const string user_key = *it;
 	construct_omap_key(c->store->cct, o->onode.lid, user_key.c_str(), user_key.length(), key);
 
-	kv_result res = c->store->db.sync_read(key, output, ITER_BUFSIZE);
+	kv_result res = c->store->omap_sync_read(key, output);
 	if (res != 0) {
         lderr(c->store->cct) << __func__ << ": sync_read failed res = " << res << ", bufferlist length = " << output.length()  << dendl;
         goto release;
@@ -984,6 +990,17 @@ inline int construct_journalkey(kv_key *kvkey, uint64_t index) {
     return 0;
 }
 
+void construct_reaper_key(kv_key *kvkey, uint64_t seq) {
+    struct kvs_reaper_key *rkey = (struct kvs_reaper_key *)kvkey->key;
+    rkey->hash  = GROUP_PREFIX_REAPER;
+    rkey->group = GROUP_PREFIX_REAPER;
+    rkey->seq   = seq;
+    rkey->reserved1= 0;
+    rkey->reserved2= 0;
+    rkey->reserved3= 0;
+    kvkey->length = 16;
+}
+
 void construct_omap_key(CephContext* cct, uint64_t lid, const char *name, const int name_len, kv_key *key){
     if (name_len > KVSSD_VAR_OMAP_KEY_MAX_SIZE){
         lderr(cct) << "ERR: onode name '" << name <<"' is too long (" << name_len  << "> 218B (max))" << dendl;
@@ -1032,6 +1049,21 @@ inline void construct_sb_key(kv_key *key) {
     key->length = 16;
 }
 
+void construct_statfs_key(kv_key *key) {
+    memset((void*)key->key, 0, 16);
+    struct kvs_sb_key* kvskey = (struct kvs_sb_key*)key->key;
+    kvskey->prefix = GROUP_PREFIX_SUPER;
+    kvskey->group  = GROUP_PREFIX_SUPER;
+    sprintf(kvskey->name, "%s", "statfs");
+    key->length = 16;
+}
+
+bool is_statfs_key(const kv_key *key) {
+    const struct kvs_sb_key* kvskey = (const struct kvs_sb_key*)key->key;
+    return key->length == 16 && kvskey->group == GROUP_PREFIX_SUPER &&
+           strncmp(kvskey->name, "statfs", sizeof(kvskey->name)) == 0;
+}
+
 
 ///
 /// Write operations
@@ -1203,6 +1235,26 @@ void KvsIoContext::rm_omap (const ghobject_t& oid, uint64_t index, std::string &
     this->del(key, true);
 }
 
+void KvsIoContext::add_reap(const kvsstore_reap_t &r)
+{
+    FTRACE
+    kv_key *key;
+    kv_value *value;
+    bufferlist bl;
+
+    encode(r, bl);
+
+    key = KvsMemPool::Alloc_key();
+    construct_reaper_key(key, r.seq);
+
+    value = to_kv_value(bl);
+
+#ifdef DUMP_IOWORKLOAD
+    derr << "IO: add_reap: key = " << print_key((const char*)key->key, (int)key->length ) << ", " << r << dendl;
+#endif
+    this->add(key, value, true);
+}
+
 void KvsIoContext::add_userdata(const ghobject_t& oid, char *data, int length)
 {
     FTRACE
@@ -1283,6 +1335,14 @@ void KvsReadContext::read_sb()
 }
 
 
+void KvsReadContext::read_statfs()
+{
+    FTRACE
+    this->key = KvsMemPool::Alloc_key();
+    this->value = KvsMemPool::Alloc_value(DEFAULT_READBUF_SIZE);
+    construct_statfs_key(key);
+}
+
 void KvsReadContext::read_journal(kvs_journal_key *jkey) {
     this->key = KvsMemPool::Alloc_key();
     this->value = KvsMemPool::Alloc_value(DEFAULT_READBUF_SIZE);
@@ -1437,6 +1497,15 @@ void KvsSyncWriteContext::write_sb(bufferlist &bl)
     construct_sb_key(key);
 }
 
+void KvsSyncWriteContext::write_statfs(bufferlist &bl)
+{
+    FTRACE
+    this->key = KvsMemPool::Alloc_key();
+    this->value = to_kv_value(bl);
+
+    construct_statfs_key(key);
+}
+
 void KvsSyncWriteContext::delete_journal_key(struct kvs_journal_key* k) {
     this->key = KvsMemPool::Alloc_key(sizeof(kvs_journal_key));
     this->value = 0;
@@ -1447,6 +1516,18 @@ void KvsSyncWriteContext::delete_journal_key(struct kvs_journal_key* k) {
     memcpy((void*)key->key, (char*) k, this->key->length);
 }
 
+void KvsSyncWriteContext::delete_key(const void *k, int length) {
+    this->key = KvsMemPool::Alloc_key(length);
+    this->value = 0;
+    memcpy((void*)key->key, k, length);
+}
+
+void KvsSyncWriteContext::delete_reap(uint64_t seq) {
+    this->key = KvsMemPool::Alloc_key(sizeof(kvs_reaper_key));
+    this->value = 0;
+    construct_reaper_key(key, seq);
+}
+
 char *KvsSyncWriteContext::write_journal_entry(char *entry, uint64_t &lid) {
     char *curpos = entry;
 
@@ -1560,3 +1641,215 @@ KvsSyncWriteContext::~KvsSyncWriteContext() {
 
 
 
+
+///
+/// KvsWriteBuffer
+///
+
+#undef dout_prefix
+#define dout_prefix *_dout << "kvsstore.writebuffer(" << this << ") "
+
+// hash, group and lid are shared by all omap keys of an object
+static std::string omap_key_prefix(uint64_t lid)
+{
+    kvs_omap_key_header hdr = { GROUP_PREFIX_OMAP, lid};
+    kvs_omap_key k;
+    k.hash  = ceph_str_hash_linux((char*)&hdr, sizeof(struct kvs_omap_key_header));
+    k.group = GROUP_PREFIX_OMAP;
+    k.lid   = lid;
+    return std::string((const char *)&k, 13);
+}
+
+KvsWriteBuffer::~KvsWriteBuffer()
+{
+    // anything left here is still in the journal and will be replayed
+    for (auto &p : entries) {
+        _release(p.second);
+    }
+    entries.clear();
+}
+
+void KvsWriteBuffer::_release(entry_t &e)
+{
+    bytes -= e.key->length + e.value->length;
+    KvsMemPool::Release_key(e.key);
+    KvsMemPool::Release_value(e.value);
+    e.key = 0;
+    e.value = 0;
+}
+
+void KvsWriteBuffer::_unpin(uint64_t jseq)
+{
+    auto it = jseqs.find(jseq);
+    assert(it != jseqs.end());
+    if (--it->second == 0)
+        jseqs.erase(it);
+}
+
+int KvsWriteBuffer::absorb(kv_key *key, kv_value *value, uint64_t jseq)
+{
+    std::string k((const char *)key->key, key->length);
+    int coalesced = 0;
+
+    std::lock_guard<std::mutex> l(lock);
+    auto pt = passthru.find(k);
+    if (pt != passthru.end()) {
+        pt->second++;
+        return -EBUSY;
+    }
+    auto it = entries.find(k);
+    if (it != entries.end()) {
+        entry_t &e = it->second;
+        _unpin(e.jseq);
+        _release(e);
+        e.key   = key;
+        e.value = value;
+        e.jseq  = jseq;
+        coalesced = 1;
+    } else {
+        entries.emplace(std::move(k), entry_t{ key, value, jseq, ceph_clock_now() });
+    }
+    jseqs[jseq]++;
+    bytes += key->length + value->length;
+    return coalesced;
+}
+
+void KvsWriteBuffer::begin_passthru(const void *key, int length)
+{
+    std::string k((const char *)key, length);
+
+    // wait for an in-flight write of this key to land first
+    std::lock_guard<std::mutex> fl(flush_lock);
+    std::lock_guard<std::mutex> l(lock);
+    passthru[k]++;
+    auto it = entries.find(k);
+    if (it == entries.end()) return;
+    _unpin(it->second.jseq);
+    _release(it->second);
+    entries.erase(it);
+}
+
+void KvsWriteBuffer::end_passthru(const std::string &key)
+{
+    std::lock_guard<std::mutex> l(lock);
+    auto it = passthru.find(key);
+    assert(it != passthru.end());
+    if (--it->second == 0)
+        passthru.erase(it);
+}
+
+void KvsWriteBuffer::discard_lid(uint64_t lid)
+{
+    const std::string prefix = omap_key_prefix(lid);
+
+    std::lock_guard<std::mutex> fl(flush_lock);
+    std::lock_guard<std::mutex> l(lock);
+    auto it = entries.lower_bound(prefix);
+    while (it != entries.end() && it->first.compare(0, prefix.length(), prefix) == 0) {
+        _unpin(it->second.jseq);
+        _release(it->second);
+        it = entries.erase(it);
+    }
+}
+
+int KvsWriteBuffer::lookup(const kv_key *key, bufferlist &bl)
+{
+    std::string k((const char *)key->key, key->length);
+
+    std::lock_guard<std::mutex> l(lock);
+    auto it = entries.find(k);
+    if (it == entries.end()) {
+        it = flushing.find(k);
+        if (it == flushing.end())
+            return -ENOENT;
+    }
+    bl.append((const char *)it->second.value->value, it->second.value->length);
+    return 0;
+}
+
+int KvsWriteBuffer::lookup_size(const kv_key *key, uint32_t *length)
+{
+    std::string k((const char *)key->key, key->length);
+
+    std::lock_guard<std::mutex> l(lock);
+    auto it = entries.find(k);
+    if (it == entries.end()) {
+        it = flushing.find(k);
+        if (it == flushing.end())
+            return -ENOENT;
+    }
+    *length = it->second.value->length;
+    return 0;
+}
+
+int KvsWriteBuffer::merge_keylist(uint64_t lid, std::set<string> &keylist)
+{
+    const std::string prefix = omap_key_prefix(lid);
+    int added = 0;
+
+    std::lock_guard<std::mutex> l(lock);
+    for (auto *m : { &entries, &flushing }) {
+        auto it = m->lower_bound(prefix);
+        for (; it != m->end() && it->first.compare(0, prefix.length(), prefix) == 0; ++it) {
+            // 14B = prefix + isheader, see construct_omap_key()
+            if (keylist.insert(it->first.substr(14)).second)
+                added++;
+        }
+    }
+    return added;
+}
+
+int KvsWriteBuffer::flush(uint64_t jseq, const utime_t &stamp)
+{
+    static const unsigned MAX_INFLIGHT = 128;
+    int flushed = 0;
+
+    std::lock_guard<std::mutex> fl(flush_lock);
+    {
+        std::lock_guard<std::mutex> l(lock);
+        auto it = entries.begin();
+        while (it != entries.end()) {
+            if (it->second.jseq < jseq || it->second.stamp < stamp) {
+                flushing.insert(*it);
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    auto it = flushing.begin();
+    while (it != flushing.end()) {
+        std::list<KvsSyncWriteContext> ctxs;
+        auto first = it;
+        for (; it != flushing.end() && ctxs.size() < MAX_INFLIGHT; ++it) {
+            ctxs.emplace_back(cct);
+            KvsSyncWriteContext &ctx = ctxs.back();
+            ctx.key   = it->second.key;
+            ctx.value = it->second.value;
+            db->aio_submit(&ctx);
+        }
+
+        for (auto &ctx : ctxs) {
+            kv_result ret = ctx.write_wait();
+            if (ret != KV_SUCCESS) {
+                derr << __func__ << " write failed, error = " << ret << dendl;
+                ceph_abort_msg(cct, "KvsWriteBuffer::flush - write failed");
+            }
+            // the buffer owns the key and the value
+            ctx.key = 0;
+            ctx.value = 0;
+        }
+
+        std::lock_guard<std::mutex> l(lock);
+        while (first != it) {
+            _unpin(first->second.jseq);
+            _release(first->second);
+            first = flushing.erase(first);
+            flushed++;
+        }
+    }
+
+    dout(20) << __func__ << " flushed " << flushed << " keys" << dendl;
+    return flushed;
+}
@@ -34,6 +34,8 @@
 
 #define KVS_OBJECT_MAX_SIZE 2*1024*1024
 #define KVSSD_VAR_OMAP_KEY_MAX_SIZE 242
+#define KVS_OMAP_CHARGE_CACHE_MAX 4096
+#define KVS_OMAP_RECOUNT_MAX 1024   // objects waiting for an omap recount
 
 class KvsStore;
 struct KvsOnodeSpace;
@@ -62,6 +64,11 @@ bool belongs_toOmap(void *key, uint64_t lid);
 void omap_iterator_init(CephContext *cct, uint64_t lid, kv_iter_context *iter_ctx);
 void print_iterKeys(CephContext *cct, std::map<string, int> &keylist);
 int populate_keylist(CephContext *cct, uint64_t lid, std::list<std::pair<void*, int>> &buflist, std::set<string> &keylist, KADI *db);
+// Reaper helpers
+void construct_reaper_key(kv_key *kvkey, uint64_t seq);
+// statfs helpers
+void construct_statfs_key(kv_key *key);
+bool is_statfs_key(const kv_key *key);
 //
 
 
@@ -101,6 +108,16 @@ struct __attribute__((__packed__)) kvs_journal_key
     uint8_t          reserved3;
 };
 
+struct __attribute__((__packed__)) kvs_reaper_key
+{
+    uint32_t         hash;
+    uint8_t          group;
+    uint64_t         seq;                          // 8B
+    uint8_t          reserved1;
+    uint8_t          reserved2;
+    uint8_t          reserved3;
+};
+
 struct __attribute__((__packed__)) kvs_coll_key
 {
     uint32_t         hash;
@@ -149,6 +166,64 @@ struct __attribute__((__packed__)) journal_header {
     uint16_t keylength;
     uint32_t vallength;
 };
+
+// omap names of the pglog segments of a pgmeta object, see kvsstore_pglog_meta_t.
+// PGLog's own keys are printable, so these cannot collide with them.
+#define KVS_PGLOG_META_KEY     "\001pglog"
+#define KVS_PGLOG_SEG_PREFIX   "\001pglog_"
+#define KVS_PGLOG_DELTA_PREFIX "\001pglog_+"
+
+#define KVS_PGLOG_DELTA_SLOTS     8      // delta record keys of a new PG
+#define KVS_PGLOG_DELTA_MAX_BYTES 4096   // larger changes rewrite the head
+
+/// in-memory state of the pglog segments of a pgmeta object
+///     - loaded with the collection at mount, or built on the first log
+///       update of a new object
+///     - kept in the collection, so it outlives the onode in the cache
+///     - only used by the transaction path, under the collection lock
+struct KvsPGLogSegments {
+    enum {
+        KIND_LOG = 0,   ///< pg_log_entry_t, keyed by eversion_t::get_key_name()
+        KIND_DUP = 1,   ///< pg_log_dup_t, keyed by "dup_" + the same
+        NUM_KINDS
+    };
+
+    struct seg_t {
+        bool loaded = false;    ///< entries hold the segment
+        bool on_disk = false;   ///< the segment key exists
+        bool dirty = false;     ///< written (or removed if empty) with the txc
+        bool rewrite = false;   ///< entries were removed, a delta cannot say so
+        bool deltas = false;    ///< the key lacks entries that are in deltas
+        uint64_t seq = 0;       ///< sequence the key was written with, if loaded
+        std::map<std::string, bufferlist> entries;
+        std::map<std::string, bufferlist> added;   ///< set since the last write
+    };
+
+    /// what one transaction added to the heads, see kvsstore_pglog_meta_t
+    struct delta_t {
+        uint64_t seq = 0;
+        int64_t segno[NUM_KINDS] = {-1, -1};   ///< head it applies to, -1 if none
+        std::string trimmed_to[NUM_KINDS];
+        std::map<std::string, bufferlist> entries[NUM_KINDS];
+    };
+
+    uint64_t lid = 0;   ///< omap this describes
+    uint64_t seq = 0;   ///< last sequence used for a segment or delta write
+    kvsstore_pglog_meta_t meta;
+    bool meta_dirty = false;
+    std::string trimmed_to[NUM_KINDS];   ///< current trim point, see kvsstore_pglog_meta_t
+    bool trim_dirty[NUM_KINDS] = {false, false};
+    bool has_plain_keys = false;   ///< log keys stored one per key before segments were used
+    std::map<uint64_t, seg_t> segs[NUM_KINDS];   ///< by segment number
+
+    bool enabled() const {
+        return meta.seg_entries > 0;
+    }
+    uint64_t seg_of(uint64_t version) const {
+        return version / meta.seg_entries;
+    }
+};
+
 /// an in-memory object
 struct KvsOnode {
     MEMPOOL_CLASS_HELPERS();
@@ -171,6 +246,19 @@ struct KvsOnode {
     std::mutex prefetch_lock;  ///< protect flush_txns
     std::condition_variable prefetch_cond;   ///< wait here for uncommitted txns
 
+    /// statfs charge (name + value length, 0 if absent) of the omap keys
+    /// written since the onode was loaded; only used by the transaction path
+    mempool::kvsstore_cache_other::unordered_map<std::string, uint32_t> omap_charges;
+    bool omap_charges_complete = false;   ///< omap_charges has every key
+
+    /// a key missing from omap_charges is charged an estimate, and the omap
+    /// recounted in the background; see KvsStore::_omap_recount()
+    std::atomic<uint64_t> omap_gen = {0};        ///< bumped by every omap change prepared
+    std::atomic<int> omap_inflight = {0};        ///< transactions with omap changes not finished
+    std::atomic<uint64_t> omap_count_gen = {UINT64_MAX};   ///< omap_gen omap_count_bytes is for
+    std::atomic<uint64_t> omap_count_bytes = {0};
+    bool omap_recount_queued = false;            ///< under KvsStore::omap_recount_lock
+
     KvsOnode(KvsCollection *c, const ghobject_t& o)
             : nref(0),
               c(c),
@@ -732,6 +820,8 @@ struct KvsCollection : public ObjectStore::CollectionImpl {
     // contention.
     KvsOnodeSpace onode_map;
     std::unordered_map<ghobject_t, KvsOnode *> onode_prefetch_map;
+
+    std::unique_ptr<KvsPGLogSegments> pglog;   ///< of the pgmeta object
     
 
     KvsOnode *lookup_prefetch_map(const ghobject_t &oid, bool erase) {
@@ -782,6 +872,7 @@ class KvsOmapIterator : public ObjectMap::ObjectMapIteratorImpl {
 public:
     std::set<string> keylist;
     std::list<std::pair<void *, int>> buflist;
+    std::map<string, bufferlist> values;   ///< entries read from pglog segments
 
     KvsOmapIterator(CollectionRef c, OnodeRef o, KvsStore *store);
     virtual ~KvsOmapIterator() {
@@ -869,6 +960,9 @@ public:
     void rm_omap (const ghobject_t& oid, uint64_t index, std::string &strkey);
     void add_omapheader(const ghobject_t& oid, uint64_t index, bufferlist &bl);
 
+    // reaper records are journaled together with the onode that dropped the keys
+    void add_reap(const kvsstore_reap_t &r);
+
     // userdata will be deleted by rm_onode
 
 
@@ -928,6 +1022,7 @@ public:
     utime_t get_prefetch_time() {return prefetch_onode_begin_time;}
     
     void read_sb();
+    void read_statfs();
     void read_onode(const ghobject_t &oid);
     void read_data(const ghobject_t &oid);
     void read_coll(const char *name, const int namelen);
@@ -961,10 +1056,13 @@ public:
     ~KvsSyncWriteContext();
 
     void write_sb(bufferlist &bl);
+    void write_statfs(bufferlist &bl);
 
     int write_journal(uint64_t index, std::list<std::pair<kv_key *, kv_value *> > &list);
     char *write_journal_entry(char *entry, uint64_t &lid);
     void delete_journal_key(struct kvs_journal_key* k);
+    void delete_key(const void *k, int length);
+    void delete_reap(uint64_t seq);
     void try_write_wake();
     kv_result write_wait();
 };
@@ -999,13 +1097,19 @@ struct KvsTransContext  {
     uint64_t bytes = 0, cost = 0;
 
     set<OnodeRef> onodes;     ///< these need to be updated/written
+    set<OnodeRef> pglog_onodes;   ///< pgmeta objects with pglog segments to write
+    set<OnodeRef> omap_onodes;    ///< objects whose omap_inflight we hold
 
     Context *oncommit = nullptr;         ///< signal on commit
     Context *onreadable = nullptr;       ///< signal on readable
     Context *onreadable_sync = nullptr;  ///< signal on readable
     list<Context*> oncommits;  ///< more commit completions
     list<CollectionRef> removed_collections; ///< colls we removed
+    list<kvsstore_reap_t> reaps;             ///< keys to reclaim once we commit
     map<const ghobject_t, bufferlist> tempbuffers;
+    map<int64_t, kvsstore_pool_stat_t> statfs_delta;  ///< usage change per pool
+    bufferlist statfs_snapshot;  ///< usage after this txc, journaled with it
+    std::vector<std::string> wbuf_passthru;  ///< omap keys written around the write buffer
     KvsIoContext ioc;
 
     bool had_ios = false;  ///< true if we submitted IOs before our kv txn
@@ -1136,7 +1240,76 @@ public:
 
 };
 
+///
+/// KvsWriteBuffer
+///     - holds small omap updates that are already protected by the journal
+///       so that rewrites of a hot key reach the device only once
+
+class KvsWriteBuffer {
+public:
+    struct entry_t {
+        kv_key   *key;
+        kv_value *value;
+        uint64_t  jseq;     ///< journal sequence protecting this version
+        utime_t   stamp;    ///< when the key was first absorbed
+    };
+
+private:
+    CephContext *cct;
+    KADI *db;
+
+    std::mutex lock;         ///< protects entries, flushing, jseqs and bytes
+    std::mutex flush_lock;   ///< serializes flushes and discards
+    std::map<std::string, entry_t> entries;    ///< raw key -> latest version
+    std::map<std::string, entry_t> flushing;   ///< being written to the device
+    std::map<uint64_t, int> jseqs;             ///< journal seq -> # of unflushed versions
+    std::map<std::string, int> passthru;       ///< raw key -> # of device writes in flight
+    uint64_t bytes = 0;
+
+    void _unpin(uint64_t jseq);
+    void _release(entry_t &e);
 
+public:
+    KvsWriteBuffer(CephContext *_cct, KADI *_db) : cct(_cct), db(_db) {}
+    ~KvsWriteBuffer();
+
+    // takes ownership of key and value. returns 1 if an older version was
+    // dropped, 0 if not. returns -EBUSY without taking ownership if the key
+    // has a device write in flight the buffered version could overtake; the
+    // write then counts as one more passthrough, see end_passthru()
+    int absorb(kv_key *key, kv_value *value, uint64_t jseq);
+
+    // a device write or delete of key is about to be issued: waits for an
+    // in-flight flush of the key, drops the buffered version and keeps the
+    // key out of the buffer until end_passthru()
+    void begin_passthru(const void *key, int length);
+    void end_passthru(const std::string &key);
+    void discard_lid(uint64_t lid);
+
+    // 0 if buffered, -ENOENT otherwise
+    int lookup(const kv_key *key, bufferlist &bl);
+    int lookup_size(const kv_key *key, uint32_t *length);
+    int merge_keylist(uint64_t lid, std::set<string> &keylist);
+
+    // writes back every version protected by a journal seq < jseq or absorbed
+    // before stamp. returns the number of keys written.
+    int flush(uint64_t jseq, const utime_t &stamp);
+    int flush_all() { return flush(UINT64_MAX, utime_t(UINT32_MAX, 0)); }
+
+    uint64_t get_bytes() {
+        std::lock_guard<std::mutex> l(lock);
+        return bytes;
+    }
+    size_t size() {
+        std::lock_guard<std::mutex> l(lock);
+        return entries.size();
+    }
+    // the oldest journal seq the buffer still depends on, or UINT64_MAX
+    uint64_t oldest_jseq() {
+        std::lock_guard<std::mutex> l(lock);
+        return jseqs.empty() ? UINT64_MAX : jseqs.begin()->first;
+    }
+};
 
 
 #endif //CEPH_KVSSTORE_TYPES_H
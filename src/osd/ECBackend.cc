@@ -151,10 +151,12 @@ ostream &operator<<(ostream &lhs, const ECBackend::Op &rhs)
       << " pending_read=" << rhs.pending_read
       << " remote_read=" << rhs.remote_read
       << " remote_read_result=" << rhs.remote_read_result
+      << " delta_reads_pending=" << rhs.delta_reads_pending
       << " pending_apply=" << rhs.pending_apply
       << " pending_commit=" << rhs.pending_commit
       << " plan.to_read=" << rhs.plan.to_read
       << " plan.will_write=" << rhs.plan.will_write
+      << " plan.delta_read=" << rhs.plan.delta_read
       << ")";
   return lhs;
 }
@@ -1773,12 +1775,130 @@ void ECBackend::start_rmw(Op *op, PGTransactionUPtr &&t)
     },
     get_parent()->get_dpp());
 
+  int parity_delta = 0;
+  if (!op->plan.to_read.empty() &&
+      get_parent()->get_pool().opts.get(
+	pool_opts_t::EC_PARITY_DELTA, &parity_delta) &&
+      parity_delta) {
+    ECTransaction::plan_parity_delta(
+      sinfo,
+      ec_impl->get_chunk_mapping(),
+      ec_impl->get_coding_chunk_count(),
+      op->plan,
+      [this, op](const hobject_t &hoid, const set<int> &want) {
+	if (has_write_in_flight(hoid, op))
+	  return false;
+	set<pg_shard_t> shards;
+	if (get_min_avail_to_read_shards(hoid, want, false, false, &shards))
+	  return false;
+	set<int> have;
+	for (auto &&i: shards)
+	  have.insert(i.shard);
+	return have == want;
+      },
+      get_parent()->get_dpp());
+  }
+
   dout(10) << __func__ << ": " << *op << dendl;
 
   waiting_state.push_back(*op);
   check_ops();
 }
 
+bool ECBackend::has_write_in_flight(const hobject_t &hoid, const Op *skip) const
+{
+  for (auto &&i: tid_to_op_map) {
+    if (&i.second == skip)
+      continue;
+    auto iter = i.second.plan.will_write.find(hoid);
+    if (iter != i.second.plan.will_write.end() && !iter->second.empty())
+      return true;
+  }
+  return false;
+}
+
+void ECBackend::start_delta_read(Op *op)
+{
+  map<hobject_t, read_request_t> for_read_op;
+  uint64_t bytes = 0;
+  for (auto &&hpair: op->plan.delta_read) {
+    const hobject_t &hoid = hpair.first;
+    set<pg_shard_t> shards;
+    int r = get_min_avail_to_read_shards(
+      hoid,
+      op->plan.delta_shards.at(hoid),
+      false,
+      false,
+      &shards);
+    // the shards were readable at submit and only an interval change,
+    // which drops this op, can take them away
+    assert(r == 0);
+    assert(shards.size() == op->plan.delta_shards.at(hoid).size());
+
+    list<boost::tuple<uint64_t, uint64_t, uint32_t> > to_read;
+    for (auto extent = hpair.second.begin();
+	 extent != hpair.second.end();
+	 ++extent) {
+      to_read.push_back(
+	boost::make_tuple(extent.get_start(), extent.get_len(), 0));
+      bytes += sinfo.aligned_logical_offset_to_chunk_offset(extent.get_len()) *
+	shards.size();
+    }
+    ceph_tid_t tid = op->tid;
+    for_read_op.insert(
+      make_pair(
+	hoid,
+	read_request_t(
+	  to_read,
+	  shards,
+	  false,
+	  make_gen_lambda_context<
+	    pair<RecoveryMessages *, read_result_t &> &>(
+	      [this, tid, hoid](pair<RecoveryMessages *, read_result_t &> &in) {
+		handle_delta_read(tid, hoid, in.second);
+	      }).release())));
+  }
+  op->delta_reads_pending = for_read_op.size();
+  get_parent()->get_logger()->inc(l_osd_ec_delta);
+  get_parent()->get_logger()->inc(l_osd_ec_delta_inb, bytes);
+  get_parent()->get_logger()->inc(
+    l_osd_ec_delta_rmw_inb, op->plan.delta_rmw_bytes);
+  start_read_op(
+    CEPH_MSG_PRIO_DEFAULT,
+    for_read_op,
+    op->client_op,
+    false,
+    false);
+}
+
+void ECBackend::handle_delta_read(
+  ceph_tid_t tid, const hobject_t &hoid, read_result_t &res)
+{
+  auto iter = tid_to_op_map.find(tid);
+  assert(iter != tid_to_op_map.end());
+  Op *op = &(iter->second);
+  if (res.r != 0) {
+    // the rmw path cannot recover from a failed read either
+    derr << __func__ << ": " << hoid << " parity delta read failed: "
+	 << res.r << " errors " << res.errors << dendl;
+    ceph_abort_msg(cct, "parity delta read failed");
+  }
+  auto &result = op->delta_read_result[hoid];
+  for (auto &&i: res.returned) {
+    pair<uint64_t, uint64_t> chunk_off_len =
+      sinfo.aligned_offset_len_to_chunk(
+	make_pair(i.get<0>(), i.get<1>()));
+    for (auto &&j: i.get<2>()) {
+      assert(j.second.length() == chunk_off_len.second);
+      result[j.first.shard].insert(
+	chunk_off_len.first, chunk_off_len.second, j.second);
+    }
+  }
+  assert(op->delta_reads_pending);
+  if (--op->delta_reads_pending == 0)
+    check_ops();
+}
+
 bool ECBackend::try_state_to_reads()
 {
   if (waiting_state.empty())
@@ -1839,8 +1959,18 @@ bool ECBackend::try_state_to_reads()
 
   dout(10) << __func__ << ": " << *op << dendl;
 
+  if (!op->plan.delta_read.empty()) {
+    assert(get_parent()->get_pool().allows_ecoverwrites());
+    start_delta_read(op);
+  }
+
   if (!op->remote_read.empty()) {
     assert(get_parent()->get_pool().allows_ecoverwrites());
+    uint64_t bytes = 0;
+    for (auto &&hpair: op->remote_read)
+      bytes += hpair.second.size();
+    get_parent()->get_logger()->inc(l_osd_ec_rmw);
+    get_parent()->get_logger()->inc(l_osd_ec_rmw_inb, bytes);
     objects_read_async_no_cache(
       op->remote_read,
       [this, op](map<hobject_t,pair<int, extent_map> > &&results) {
@@ -1903,6 +2033,7 @@ bool ECBackend::try_reads_to_commit()
       (get_osdmap()->require_osd_release < CEPH_RELEASE_KRAKEN),
       sinfo,
       op->remote_read_result,
+      op->delta_read_result,
       op->log_entries,
       &written,
       &trans,
@@ -1930,7 +2061,12 @@ bool ECBackend::try_reads_to_commit()
     written_set[i.first] = i.second.get_interval_set();
   }
   dout(20) << __func__ << ": written_set: " << written_set << dendl;
-  assert(written_set == op->plan.will_write);
+  map<hobject_t,extent_set> will_write = op->plan.will_write;
+  for (auto &&i: op->plan.delta_read) {
+    // parity delta writes bypass the cache, see plan_parity_delta()
+    will_write.erase(i.first);
+  }
+  assert(written_set == will_write);
 
   if (op->using_cache) {
     for (auto &&hpair: written) {
@@ -1940,6 +2076,7 @@ bool ECBackend::try_reads_to_commit()
   }
   op->remote_read.clear();
   op->remote_read_result.clear();
+  op->delta_read_result.clear();
 
   dout(10) << "onreadable_sync: " << op->on_local_applied_sync << dendl;
   ObjectStore::Transaction empty;
@@ -473,7 +473,9 @@ public:
     set<hobject_t> temp_cleared;
 
     ECTransaction::WritePlan plan;
-    bool requires_rmw() const { return !plan.to_read.empty(); }
+    bool requires_rmw() const {
+      return !plan.to_read.empty() || !plan.delta_read.empty();
+    }
     bool invalidates_cache() const { return plan.invalidates_cache; }
 
     // must be true if requires_rmw(), must be false if invalidates_cache()
@@ -483,8 +485,11 @@ public:
     map<hobject_t,extent_set> pending_read; // subset already being read
     map<hobject_t,extent_set> remote_read;  // subset we must read
     map<hobject_t,extent_map> remote_read_result;
+    map<hobject_t,map<int,extent_map> > delta_read_result; // shard chunks
+    unsigned delta_reads_pending = 0;
     bool read_in_progress() const {
-      return !remote_read.empty() && remote_read_result.empty();
+      return (!remote_read.empty() && remote_read_result.empty()) ||
+	delta_reads_pending > 0;
     }
 
     /// In progress write state
@@ -564,6 +569,10 @@ public:
   eversion_t completed_to;
   eversion_t committed_to;
   void start_rmw(Op *op, PGTransactionUPtr &&t);
+  bool has_write_in_flight(const hobject_t &hoid, const Op *skip) const;
+  void start_delta_read(Op *op);
+  void handle_delta_read(
+    ceph_tid_t tid, const hobject_t &hoid, read_result_t &res);
   bool try_state_to_reads();
   bool try_reads_to_commit();
   bool try_finish_rmw();
@@ -82,6 +82,146 @@ void encode_and_write(
   }
 }
 
+static int chunk_to_shard(const vector<int> &chunk_mapping, unsigned i)
+{
+  return chunk_mapping.size() > i ? chunk_mapping[i] : i;
+}
+
+static void xor_region(char *dst, const char *a, const char *b, uint64_t len)
+{
+  for (uint64_t i = 0; i < len; ++i)
+    dst[i] = a[i] ^ b[i];
+}
+
+/* The code is linear, so the parity of the stripe holding only the data
+ * delta (old ^ new in the written chunks, zero elsewhere) is the change
+ * to apply to the old parity. */
+void ECTransaction::delta_and_write(
+  pg_t pgid,
+  const hobject_t &oid,
+  const ECUtil::stripe_info_t &sinfo,
+  ErasureCodeInterfaceRef &ecimpl,
+  const set<int> &shards,
+  const extent_set &stripes,
+  const PGTransaction::ObjectOperation &op,
+  const map<int, extent_map> &old,
+  map<shard_id_t, ObjectStore::Transaction> *transactions,
+  DoutPrefixProvider *dpp) {
+  const uint64_t stripe_width = sinfo.get_stripe_width();
+  const uint64_t chunk_size = sinfo.get_chunk_size();
+  const vector<int> &chunk_mapping = ecimpl->get_chunk_mapping();
+  const unsigned data_chunks = ecimpl->get_data_chunk_count();
+
+  extent_map to_write;
+  uint32_t fadvise_flags = 0;
+  for (auto &&extent: op.buffer_updates) {
+    using BufferUpdate = PGTransaction::ObjectOperation::BufferUpdate;
+    bufferlist bl;
+    match(
+      extent.get_val(),
+      [&](const BufferUpdate::Write &op) {
+	bl = op.buffer;
+	fadvise_flags |= op.fadvise_flags;
+      },
+      [&](const BufferUpdate::Zero &) {
+	bl.append_zero(extent.get_len());
+      },
+      [&](const BufferUpdate::CloneRange &) {
+	assert(
+	  0 ==
+	  "CloneRange is not allowed, do_op should have returned ENOTSUPP");
+      });
+    to_write.insert(extent.get_off(), extent.get_len(), bl);
+  }
+
+  for (auto stripe: stripes) {
+    const uint64_t off = stripe.first;
+    const uint64_t len = stripe.second;
+    const uint64_t chunk_off = sinfo.aligned_logical_offset_to_chunk_offset(off);
+    const uint64_t chunk_len = sinfo.aligned_logical_offset_to_chunk_offset(len);
+
+    map<int, bufferlist> old_chunks;
+    for (auto shard: shards) {
+      auto em = old.at(shard).intersect(chunk_off, chunk_len);
+      assert(!em.empty());
+      bufferlist &bl = old_chunks[shard];
+      bl = em.begin().get_val();
+      assert(bl.length() == chunk_len);
+      bl.rebuild();
+    }
+
+    bufferptr delta(len);
+    delta.zero();
+    set<pair<int, uint64_t> > touched; // shard, chunk offset
+    for (auto &&extent: to_write.intersect(off, len)) {
+      bufferlist bl = extent.get_val();
+      const char *src = bl.c_str();
+      uint64_t pos = extent.get_off();
+      const uint64_t end = pos + extent.get_len();
+      while (pos < end) {
+	const uint64_t in_chunk = pos % chunk_size;
+	const uint64_t n = MIN(chunk_size - in_chunk, end - pos);
+	const int shard = chunk_to_shard(
+	  chunk_mapping, (pos % stripe_width) / chunk_size);
+	const uint64_t coff = sinfo.logical_to_prev_chunk_offset(pos) + in_chunk;
+	xor_region(
+	  delta.c_str() + (pos - off),
+	  old_chunks[shard].c_str() + (coff - chunk_off),
+	  src + (pos - extent.get_off()),
+	  n);
+	touched.insert(make_pair(shard, coff - in_chunk));
+	pos += n;
+      }
+    }
+
+    bufferlist delta_bl;
+    delta_bl.append(delta);
+    map<int, bufferlist> encoded;
+    int r = ECUtil::encode(sinfo, ecimpl, delta_bl, shards, &encoded);
+    assert(r == 0);
+
+    ldpp_dout(dpp, 20) << __func__ << ": " << oid
+		       << " stripes " << off << "~" << len
+		       << " touched chunks " << touched
+		       << dendl;
+
+    for (auto shard: shards) {
+      bufferlist &enc = encoded[shard];
+      assert(enc.length() == chunk_len);
+      bufferptr ptr(chunk_len);
+      xor_region(ptr.c_str(), old_chunks[shard].c_str(), enc.c_str(), chunk_len);
+      bufferlist bl;
+      bl.append(ptr);
+
+      auto t = transactions->find(shard_id_t(shard));
+      assert(t != transactions->end());
+      coll_t coll(spg_t(pgid, t->first));
+      ghobject_t goid(oid, ghobject_t::NO_GEN, t->first);
+
+      bool parity = true;
+      for (unsigned i = 0; i < data_chunks; ++i) {
+	if (chunk_to_shard(chunk_mapping, i) == shard) {
+	  parity = false;
+	  break;
+	}
+      }
+      if (parity) {
+	t->second.write(coll, goid, chunk_off, chunk_len, bl, fadvise_flags);
+	continue;
+      }
+      // data shards rewrite only the chunks that changed
+      for (auto p = touched.lower_bound(make_pair(shard, 0));
+	   p != touched.end() && p->first == shard;
+	   ++p) {
+	bufferlist chunk;
+	chunk.substr_of(bl, p->second - chunk_off, chunk_size);
+	t->second.write(coll, goid, p->second, chunk_size, chunk,
+			fadvise_flags);
+      }
+    }
+  }
+}
+
 bool ECTransaction::requires_overwrite(
   uint64_t prev_size,
   const PGTransaction::ObjectOperation &op) {
@@ -95,6 +235,89 @@ bool ECTransaction::requires_overwrite(
       (op.truncate->first < prev_size)));
 }
 
+void ECTransaction::plan_parity_delta(
+  const ECUtil::stripe_info_t &sinfo,
+  const vector<int> &chunk_mapping,
+  unsigned coding_chunks,
+  WritePlan &plan,
+  std::function<bool(const hobject_t &, const set<int> &)> &&can_read_shards,
+  DoutPrefixProvider *dpp)
+{
+  assert(plan.t);
+  const uint64_t stripe_width = sinfo.get_stripe_width();
+  const uint64_t chunk_size = sinfo.get_chunk_size();
+  const unsigned data_chunks = stripe_width / chunk_size;
+
+  for (auto i = plan.to_read.begin(); i != plan.to_read.end(); ) {
+    const hobject_t &oid = i->first;
+    auto opiter = plan.t->op_map.find(oid);
+    assert(opiter != plan.t->op_map.end());
+    const auto &op = opiter->second;
+    ECUtil::HashInfoRef hinfo = plan.hash_infos.at(oid);
+
+    // only overwrites inside the committed size, with nothing in flight
+    // that changes it
+    const uint64_t size = hinfo->get_total_logical_size(sinfo);
+    if (!op.is_none() || op.truncate || op.buffer_updates.empty() ||
+	hinfo->get_projected_total_logical_size(sinfo) != size) {
+      ++i;
+      continue;
+    }
+    extent_set raw_write_set;
+    for (auto &&extent: op.buffer_updates) {
+      raw_write_set.insert(extent.get_off(), extent.get_len());
+    }
+    if (raw_write_set.range_end() > size) {
+      ++i;
+      continue;
+    }
+
+    extent_set stripes;
+    set<int> shards;
+    for (auto extent = raw_write_set.begin();
+	 extent != raw_write_set.end();
+	 ++extent) {
+      uint64_t start = sinfo.logical_to_prev_stripe_offset(extent.get_start());
+      uint64_t end = extent.get_start() + extent.get_len();
+      stripes.union_insert(
+	start, sinfo.logical_to_next_stripe_offset(end) - start);
+      for (uint64_t c = extent.get_start() - extent.get_start() % chunk_size;
+	   c < end && shards.size() < data_chunks;
+	   c += chunk_size) {
+	shards.insert(
+	  chunk_to_shard(chunk_mapping, (c % stripe_width) / chunk_size));
+      }
+    }
+    for (unsigned c = data_chunks; c < data_chunks + coding_chunks; ++c) {
+      shards.insert(chunk_to_shard(chunk_mapping, c));
+    }
+
+    uint64_t delta_bytes =
+      sinfo.aligned_logical_offset_to_chunk_offset(stripes.size()) *
+      shards.size();
+    uint64_t rmw_bytes = i->second.size();
+    if (delta_bytes >= rmw_bytes || !can_read_shards(oid, shards)) {
+      ldpp_dout(dpp, 20) << __func__ << ": " << oid << " keeping rmw, reads "
+			 << rmw_bytes << " vs " << delta_bytes << dendl;
+      ++i;
+      continue;
+    }
+
+    ldpp_dout(dpp, 20) << __func__ << ": " << oid << " parity delta on "
+		       << stripes << " shards " << shards
+		       << ", reads " << delta_bytes << " vs " << rmw_bytes
+		       << dendl;
+    // only the touched data chunks of the stripes are read, so the
+    // extent cache cannot be given their new contents
+    plan.will_write[oid] = stripes;
+    plan.invalidates_cache = true;
+    plan.delta_read[oid] = std::move(stripes);
+    plan.delta_shards[oid] = std::move(shards);
+    plan.delta_rmw_bytes += rmw_bytes;
+    i = plan.to_read.erase(i);
+  }
+}
+
 void ECTransaction::generate_transactions(
   WritePlan &plan,
   ErasureCodeInterfaceRef &ecimpl,
@@ -102,6 +325,7 @@ void ECTransaction::generate_transactions(
   bool legacy_log_entries,
   const ECUtil::stripe_info_t &sinfo,
   const map<hobject_t,extent_map> &partial_extents,
+  const map<hobject_t,map<int,extent_map> > &delta_extents,
   vector<pg_log_entry_t> &entries,
   map<hobject_t,extent_map> *written_map,
   map<shard_id_t, ObjectStore::Transaction> *transactions,
@@ -390,6 +614,71 @@ void ECTransaction::generate_transactions(
 	}
       }
 
+      auto diter = plan.delta_read.find(oid);
+      if (diter != plan.delta_read.end()) {
+	assert(op.is_none() && !op.truncate);
+	auto eiter = delta_extents.find(oid);
+	assert(eiter != delta_extents.end());
+
+	vector<pair<uint64_t, uint64_t> > rollback_extents;
+	if (entry) {
+	  for (auto &&st : *transactions) {
+	    st.second.touch(
+	      coll_t(spg_t(pgid, st.first)),
+	      ghobject_t(oid, entry->version.version, st.first));
+	  }
+	  // every shard keeps its extents so the rollback stays uniform
+	  for (auto extent = diter->second.begin();
+	       extent != diter->second.end();
+	       ++extent) {
+	    uint64_t restore_from = sinfo.aligned_logical_offset_to_chunk_offset(
+	      extent.get_start());
+	    uint64_t restore_len = sinfo.aligned_logical_offset_to_chunk_offset(
+	      extent.get_len());
+	    rollback_extents.emplace_back(make_pair(restore_from, restore_len));
+	    for (auto &&st : *transactions) {
+	      st.second.clone_range(
+		coll_t(spg_t(pgid, st.first)),
+		ghobject_t(oid, ghobject_t::NO_GEN, st.first),
+		ghobject_t(oid, entry->version.version, st.first),
+		restore_from,
+		restore_len,
+		restore_from);
+	    }
+	  }
+	  ldpp_dout(dpp, 20) << __func__ << ": " << oid
+			     << " marking rollback extents "
+			     << rollback_extents
+			     << dendl;
+	  entry->mod_desc.rollback_extents(
+	    entry->version.version, rollback_extents);
+	}
+
+	delta_and_write(
+	  pgid,
+	  oid,
+	  sinfo,
+	  ecimpl,
+	  plan.delta_shards.at(oid),
+	  diter->second,
+	  op,
+	  eiter->second,
+	  transactions,
+	  dpp);
+
+	hinfo->set_total_chunk_size_clear_hash(hinfo->get_total_chunk_size());
+	bufferlist hbuf;
+	::encode(*hinfo, hbuf);
+	for (auto &&i : *transactions) {
+	  i.second.setattr(
+	    coll_t(spg_t(pgid, i.first)),
+	    ghobject_t(oid, ghobject_t::NO_GEN, i.first),
+	    ECUtil::get_hinfo_key(),
+	    hbuf);
+	}
+	return;
+      }
+
       extent_map to_write;
       auto pextiter = partial_extents.find(oid);
       if (pextiter != partial_extents.end()) {
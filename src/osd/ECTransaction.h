@@ -29,6 +29,15 @@ namespace ECTransaction {
     map<hobject_t,extent_set> to_read;
     map<hobject_t,extent_set> will_write; // superset of to_read
 
+    /* Partial-stripe overwrites done by parity delta instead of rmw:
+     * the stripes to read and the shards (touched data and parity) to
+     * read and rewrite.  will_write holds the same stripes, and the
+     * plan invalidates the extent cache since only some of their
+     * chunks are known. */
+    map<hobject_t,extent_set> delta_read;
+    map<hobject_t,set<int> > delta_shards;
+    uint64_t delta_rmw_bytes = 0; // what rmw would have read instead
+
     map<hobject_t,ECUtil::HashInfoRef> hash_infos;
   };
 
@@ -182,6 +191,37 @@ namespace ECTransaction {
     return plan;
   }
 
+  /**
+   * Move the partial-stripe overwrites in plan which read fewer bytes
+   * by parity delta than by a full-stripe rmw onto the delta path.
+   * can_read_shards says whether the listed shards of the object can
+   * be read and hold its committed contents.  Requires a linear code.
+   */
+  void plan_parity_delta(
+    const ECUtil::stripe_info_t &sinfo,
+    const vector<int> &chunk_mapping,
+    unsigned coding_chunks,
+    WritePlan &plan,
+    std::function<bool(const hobject_t &, const set<int> &)> &&can_read_shards,
+    DoutPrefixProvider *dpp);
+
+  /**
+   * Overwrite part of stripes in place on the shards in shards, given
+   * the stripes' old chunks of those shards in old.  Data shards get
+   * only the chunks op touches, parity shards the whole stripes.
+   */
+  void delta_and_write(
+    pg_t pgid,
+    const hobject_t &oid,
+    const ECUtil::stripe_info_t &sinfo,
+    ErasureCodeInterfaceRef &ecimpl,
+    const set<int> &shards,
+    const extent_set &stripes,
+    const PGTransaction::ObjectOperation &op,
+    const map<int, extent_map> &old,
+    map<shard_id_t, ObjectStore::Transaction> *transactions,
+    DoutPrefixProvider *dpp);
+
   void generate_transactions(
     WritePlan &plan,
     ErasureCodeInterfaceRef &ecimpl,
@@ -189,6 +229,7 @@ namespace ECTransaction {
     bool legacy_log_entries,
     const ECUtil::stripe_info_t &sinfo,
     const map<hobject_t,extent_map> &partial_extents,
+    const map<hobject_t,map<int,extent_map> > &delta_extents,
     vector<pg_log_entry_t> &entries,
     map<hobject_t,extent_map> *written,
     map<shard_id_t, ObjectStore::Transaction> *transactions,
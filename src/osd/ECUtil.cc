@@ -27,19 +27,27 @@ int ECUtil::decode(
   if (total_data_size == 0)
     return 0;
 
+  const vector<int> &chunk_mapping = ec_impl->get_chunk_mapping();
+  unsigned int k = ec_impl->get_data_chunk_count();
+  set<int> want;
+  for (unsigned int i = 0; i < k; i++)
+    want.insert(chunk_mapping.size() > i ? chunk_mapping[i] : i);
+
+  // decode all the stripes at once, then interleave the data chunks
+  map<int, bufferlist> decoded;
+  int r = ec_impl->decode_stripes(
+    want, sinfo.get_chunk_size(), to_decode, &decoded);
+  assert(r == 0);
   for (uint64_t i = 0; i < total_data_size; i += sinfo.get_chunk_size()) {
-    map<int, bufferlist> chunks;
-    for (map<int, bufferlist>::iterator j = to_decode.begin();
-	 j != to_decode.end();
-	 ++j) {
-      chunks[j->first].substr_of(j->second, i, sinfo.get_chunk_size());
+    for (unsigned int j = 0; j < k; j++) {
+      int chunk = chunk_mapping.size() > j ? chunk_mapping[j] : j;
+      assert(decoded[chunk].length() == total_data_size);
+      bufferlist bl;
+      bl.substr_of(decoded[chunk], i, sinfo.get_chunk_size());
+      out->claim_append(bl);
     }
-    bufferlist bl;
-    int r = ec_impl->decode_concat(chunks, &bl);
-    assert(bl.length() == sinfo.get_stripe_width());
-    assert(r == 0);
-    out->claim_append(bl);
   }
+  assert(out->length() == total_data_size * k);
   return 0;
 }
 
@@ -71,23 +79,15 @@ int ECUtil::decode(
     need.insert(i->first);
   }
 
-  for (uint64_t i = 0; i < total_data_size; i += sinfo.get_chunk_size()) {
-    map<int, bufferlist> chunks;
-    for (map<int, bufferlist>::iterator j = to_decode.begin();
-	 j != to_decode.end();
-	 ++j) {
-      chunks[j->first].substr_of(j->second, i, sinfo.get_chunk_size());
-    }
-    map<int, bufferlist> out_bls;
-    int r = ec_impl->decode(need, chunks, &out_bls);
-    assert(r == 0);
-    for (map<int, bufferlist*>::iterator j = out.begin();
-	 j != out.end();
-	 ++j) {
-      assert(out_bls.count(j->first));
-      assert(out_bls[j->first].length() == sinfo.get_chunk_size());
-      j->second->claim_append(out_bls[j->first]);
-    }
+  map<int, bufferlist> out_bls;
+  int r = ec_impl->decode_stripes(
+    need, sinfo.get_chunk_size(), to_decode, &out_bls);
+  assert(r == 0);
+  for (map<int, bufferlist*>::iterator j = out.begin();
+       j != out.end();
+       ++j) {
+    assert(out_bls.count(j->first));
+    j->second->claim_append(out_bls[j->first]);
   }
   for (map<int, bufferlist*>::iterator i = out.begin();
        i != out.end();
@@ -113,19 +113,20 @@ int ECUtil::encode(
   if (logical_size == 0)
     return 0;
 
+  // lay each data chunk of every stripe out back to back and encode
+  // all the stripes at once
+  const vector<int> &chunk_mapping = ec_impl->get_chunk_mapping();
+  unsigned int k = ec_impl->get_data_chunk_count();
   for (uint64_t i = 0; i < logical_size; i += sinfo.get_stripe_width()) {
-    map<int, bufferlist> encoded;
-    bufferlist buf;
-    buf.substr_of(in, i, sinfo.get_stripe_width());
-    int r = ec_impl->encode(want, buf, &encoded);
-    assert(r == 0);
-    for (map<int, bufferlist>::iterator i = encoded.begin();
-	 i != encoded.end();
-	 ++i) {
-      assert(i->second.length() == sinfo.get_chunk_size());
-      (*out)[i->first].claim_append(i->second);
+    for (unsigned int j = 0; j < k; j++) {
+      int chunk = chunk_mapping.size() > j ? chunk_mapping[j] : j;
+      bufferlist bl;
+      bl.substr_of(in, i + j * sinfo.get_chunk_size(), sinfo.get_chunk_size());
+      (*out)[chunk].claim_append(bl);
     }
   }
+  int r = ec_impl->encode_stripes(want, sinfo.get_chunk_size(), out);
+  assert(r == 0);
 
   for (map<int, bufferlist>::iterator i = out->begin();
        i != out->end();
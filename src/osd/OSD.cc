@@ -3551,6 +3551,28 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(
       l_osd_pg_biginfo, "osd_pg_biginfo", "PG updated its biginfo attr");
 
+  osd_plb.add_u64_counter(
+      l_osd_ec_rmw, "ec_rmw",
+      "EC partial-stripe overwrites by read-modify-write");
+  osd_plb.add_u64_counter(
+      l_osd_ec_rmw_inb, "ec_rmw_in_bytes",
+      "EC read-modify-write bytes read");
+  osd_plb.add_u64_counter(
+      l_osd_ec_delta, "ec_delta",
+      "EC partial-stripe overwrites by parity delta");
+  osd_plb.add_u64_counter(
+      l_osd_ec_delta_inb, "ec_delta_in_bytes",
+      "EC parity delta bytes read");
+  osd_plb.add_u64_counter(
+      l_osd_ec_delta_rmw_inb, "ec_delta_rmw_in_bytes",
+      "Bytes a read-modify-write would have read for parity delta overwrites");
+
+  // bumped by every op worker for every client op
+  for (int idx : { l_osd_op, l_osd_op_inb, l_osd_op_outb, l_osd_op_lat,
+		   l_osd_op_process_lat, l_osd_op_r, l_osd_op_w, l_osd_op_rw }) {
+    osd_plb.set_sharded(idx);
+  }
+
   logger = osd_plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -224,6 +224,12 @@ enum {
   l_osd_pg_fastinfo,
   l_osd_pg_biginfo,
 
+  l_osd_ec_rmw,
+  l_osd_ec_rmw_inb,
+  l_osd_ec_delta,
+  l_osd_ec_delta_inb,
+  l_osd_ec_delta_rmw_inb,
+
   l_osd_last,
 };
 
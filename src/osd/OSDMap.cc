@@ -189,6 +189,20 @@ int OSDMap::Incremental::get_net_marked_down(const OSDMap *previous) const
   return n;
 }
 
+void OSDMap::Incremental::get_remapping_osds(set<int> *osds) const
+{
+  for (auto& i : new_state) {
+    if (i.second)
+      osds->insert(i.first);
+  }
+  for (auto& i : new_up_client)
+    osds->insert(i.first);
+  for (auto& i : new_weight)
+    osds->insert(i.first);
+  for (auto& i : new_primary_affinity)
+    osds->insert(i.first);
+}
+
 int OSDMap::Incremental::identify_osd(uuid_d u) const
 {
   for (auto &uuid : new_uuid)
@@ -2161,17 +2175,9 @@ void OSDMap::_pg_to_up_acting_osds(
   _get_temp_osds(*pool, pg, &_acting, &_acting_primary);
   if (_acting.empty() || up || up_primary) {
     _pg_to_raw_osds(*pool, pg, &raw, &pps);
-    _apply_upmap(*pool, pg, &raw);
-    _raw_to_up_osds(*pool, raw, &_up);
-    _up_primary = _pick_primary(_up);
-    _apply_primary_affinity(pps, *pool, &_up, &_up_primary);
-    if (_acting.empty()) {
-      _acting = _up;
-      if (_acting_primary == -1) {
-        _acting_primary = _up_primary;
-      }
-    }
-  
+    _raw_to_up_acting_osds(*pool, pg, pps, &raw, &_up, &_up_primary,
+			   &_acting, &_acting_primary);
+
     if (up)
       up->swap(_up);
     if (up_primary)
@@ -2184,6 +2190,103 @@ void OSDMap::_pg_to_up_acting_osds(
     *acting_primary = _acting_primary;
 }
 
+void OSDMap::_raw_to_up_acting_osds(
+  const pg_pool_t& pool, pg_t pg, ps_t pps,
+  vector<int> *raw,
+  vector<int> *up, int *up_primary,
+  vector<int> *acting, int *acting_primary) const
+{
+  _apply_upmap(pool, pg, raw);
+  _raw_to_up_osds(pool, *raw, up);
+  *up_primary = _pick_primary(*up);
+  _apply_primary_affinity(pps, pool, up, up_primary);
+  if (acting->empty()) {
+    *acting = *up;
+    if (*acting_primary == -1) {
+      *acting_primary = *up_primary;
+    }
+  }
+}
+
+void OSDMap::get_pgs_with_overrides_on(const set<int>& osds,
+					set<pg_t> *pgs) const
+{
+  if (osds.empty())
+    return;
+  for (const auto& p : *pg_temp) {
+    for (auto osd : p.second) {
+      if (osds.count(osd)) {
+	pgs->insert(p.first);
+	break;
+      }
+    }
+  }
+  for (auto& p : *primary_temp) {
+    if (osds.count(p.second))
+      pgs->insert(p.first);
+  }
+  for (auto& p : pg_upmap) {
+    for (auto osd : p.second) {
+      if (osds.count(osd)) {
+	pgs->insert(p.first);
+	break;
+      }
+    }
+  }
+  for (auto& p : pg_upmap_items) {
+    for (auto& q : p.second) {
+      if (osds.count(q.first) || osds.count(q.second)) {
+	pgs->insert(p.first);
+	break;
+      }
+    }
+  }
+}
+
+void OSDMap::pg_range_to_up_acting_osds(
+  int64_t pool, unsigned ps_begin, unsigned ps_end,
+  const std::function<void(unsigned ps,
+			   vector<int>&& up, int up_primary,
+			   vector<int>&& acting, int acting_primary)>& f) const
+{
+  const pg_pool_t *pi = get_pg_pool(pool);
+  if (!pi) {
+    for (unsigned ps = ps_begin; ps < ps_end; ++ps) {
+      f(ps, {}, -1, {}, -1);
+    }
+    return;
+  }
+  if (ps_begin >= ps_end)
+    return;
+
+  unsigned size = pi->get_size();
+  vector<int> pps(ps_end - ps_begin);
+  for (unsigned ps = ps_begin; ps < ps_end; ++ps) {
+    pps[ps - ps_begin] = pi->raw_pg_to_pps(pg_t(ps, pool));
+  }
+  vector<int> raw_all, raw_len;
+  int ruleno = crush->find_rule(pi->get_crush_rule(), pi->get_type(), size);
+  if (ruleno < 0 ||
+      crush->do_rule_batch(ruleno, pps, size, osd_weight, pool,
+			   &raw_all, &raw_len) < 0) {
+    raw_len.assign(pps.size(), 0);
+  }
+
+  for (unsigned ps = ps_begin; ps < ps_end; ++ps) {
+    unsigned k = ps - ps_begin;
+    pg_t pg(ps, pool);
+    auto begin = raw_all.begin() + k * size;
+    vector<int> raw(begin, begin + raw_len[k]);
+    vector<int> up, acting;
+    int up_primary, acting_primary;
+    _remove_nonexistent_osds(*pi, raw);
+    _get_temp_osds(*pi, pg, &acting, &acting_primary);
+    _raw_to_up_acting_osds(*pi, pg, pps[k], &raw, &up, &up_primary,
+			   &acting, &acting_primary);
+    f(ps, std::move(up), up_primary, std::move(acting), acting_primary);
+  }
+}
+
 int OSDMap::calc_pg_rank(int osd, const vector<int>& acting, int nrep)
 {
   if (!nrep)
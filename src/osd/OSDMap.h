@@ -35,6 +35,7 @@
 #include <list>
 #include <set>
 #include <map>
+#include <functional>
 #include "include/memory.h"
 using namespace std;
 
@@ -419,6 +420,9 @@ public:
     int get_net_marked_out(const OSDMap *previous) const;
     int get_net_marked_down(const OSDMap *previous) const;
     int identify_osd(uuid_d u) const;
+    /// osds whose existence, up/down state, weight or primary affinity
+    /// this incremental changes
+    void get_remapping_osds(set<int> *osds) const;
 
     void encode_client_old(bufferlist& bl) const;
     void encode_classic(bufferlist& bl, uint64_t features) const;
@@ -1088,6 +1092,16 @@ private:
   void _get_temp_osds(const pg_pool_t& pool, pg_t pg,
                       vector<int> *temp_pg, int *temp_primary) const;
 
+  /**
+   * finish a mapping from the raw CRUSH output: apply upmaps, build the
+   * up set and its primary, and fall back to up for an empty acting set.
+   * acting and acting_primary come in as filled by _get_temp_osds().
+   */
+  void _raw_to_up_acting_osds(const pg_pool_t& pool, pg_t pg, ps_t pps,
+			      vector<int> *raw,
+			      vector<int> *up, int *up_primary,
+			      vector<int> *acting, int *acting_primary) const;
+
   /**
    *  map to up and acting. Fills in whatever fields are non-NULL.
    */
@@ -1131,6 +1145,19 @@ public:
     int up_primary, acting_primary;
     pg_to_up_acting_osds(pg, &up, &up_primary, &acting, &acting_primary);
   }
+  /// pgs whose pg_temp, primary_temp or pg_upmap[_items] names one of osds
+  void get_pgs_with_overrides_on(const set<int>& osds, set<pg_t> *pgs) const;
+
+  /**
+   * map pgs [ps_begin, ps_end) of a pool to their up and acting sets,
+   * as pg_to_up_acting_osds() would, with one batched CRUSH call for
+   * the whole range.  f is called once per pg, in order.
+   */
+  void pg_range_to_up_acting_osds(
+    int64_t pool, unsigned ps_begin, unsigned ps_end,
+    const std::function<void(unsigned ps,
+			     vector<int>&& up, int up_primary,
+			     vector<int>&& acting, int acting_primary)>& f) const;
   bool pg_is_ec(pg_t pg) const {
     auto i = pools.find(pg.pool());
     assert(i != pools.end());
@@ -3,6 +3,7 @@
 
 #include "OSDMapMapping.h"
 #include "OSDMap.h"
+#include "include/crc32c.h"
 
 #define dout_subsys ceph_subsys_mon
 
@@ -13,7 +14,8 @@ MEMPOOL_DEFINE_OBJECT_FACTORY(OSDMapMapping, osdmapmapping,
 
 // ensure that we have a PoolMappings for each pool and that
 // the dimensions (pg_num and size) match up.
-void OSDMapMapping::_init_mappings(const OSDMap& osdmap)
+void OSDMapMapping::_init_mappings(const OSDMap& osdmap,
+				   std::set<int64_t> *fresh)
 {
   num_pgs = 0;
   auto q = pools.begin();
@@ -36,6 +38,8 @@ void OSDMapMapping::_init_mappings(const OSDMap& osdmap)
     }
     pools.emplace(p.first, PoolMapping(p.second.get_size(),
 				       p.second.get_pg_num()));
+    if (fresh)
+      fresh->insert(p.first);
   }
   pools.erase(q, pools.end());
   assert(pools.size() == osdmap.get_pools().size());
@@ -56,6 +60,169 @@ void OSDMapMapping::update(const OSDMap& osdmap, pg_t pgid)
   _update_range(osdmap, pgid.pool(), pgid.ps(), pgid.ps() + 1);
 }
 
+void OSDMapMapping::update(const OSDMap& osdmap,
+			   const OSDMap::Incremental& inc)
+{
+  std::set<int64_t> dirty_pools;
+  std::set<pg_t> dirty_pgs;
+  if (!_prepare_incremental(osdmap, inc, &dirty_pools, &dirty_pgs)) {
+    update(osdmap);
+    return;
+  }
+  for (auto pool : dirty_pools) {
+    _update_range(osdmap, pool, 0, pools.find(pool)->second.pg_num);
+  }
+  for (auto pgid : dirty_pgs) {
+    _update_range(osdmap, pgid.pool(), pgid.ps(), pgid.ps() + 1);
+  }
+  _finish(osdmap);
+}
+
+std::unique_ptr<OSDMapMapping::MappingJob> OSDMapMapping::start_update(
+  const OSDMap& osdmap,
+  const OSDMap::Incremental& inc,
+  ParallelPGMapper& mapper,
+  unsigned pgs_per_item)
+{
+  std::set<int64_t> dirty_pools;
+  std::set<pg_t> dirty_pgs;
+  if (!_prepare_incremental(osdmap, inc, &dirty_pools, &dirty_pgs)) {
+    return start_update(osdmap, mapper, pgs_per_item);
+  }
+  // a handful at most; not worth a trip through the work queue
+  for (auto pgid : dirty_pgs) {
+    _update_range(osdmap, pgid.pool(), pgid.ps(), pgid.ps() + 1);
+  }
+  std::unique_ptr<MappingJob> job(new MappingJob(&osdmap, this));
+  mapper.queue(job.get(), pgs_per_item, &dirty_pools);
+  return job;
+}
+
+bool OSDMapMapping::_prepare_incremental(
+  const OSDMap& osdmap,
+  const OSDMap::Incremental& inc,
+  std::set<int64_t> *dirty_pools,
+  std::set<pg_t> *dirty_pgs)
+{
+  if (epoch == 0 ||
+      inc.epoch != epoch + 1 ||
+      osdmap.get_epoch() != inc.epoch ||
+      inc.fullmap.length() ||
+      inc.new_max_osd >= 0) {
+    return false;
+  }
+  // new pools, and pools whose pg_num or size changed
+  epoch = 0;
+  _init_mappings(osdmap, dirty_pools);
+
+  // pools whose rule or placement parameters changed, or whose rule
+  // reaches a changed osd
+  std::set<int> osds;
+  inc.get_remapping_osds(&osds);
+  rule_cache_t rules;
+  for (auto& p : pools) {
+    if (dirty_pools->count(p.first))
+      continue;
+    if (!inc.crush.length() && osds.empty() && !inc.new_pools.count(p.first))
+      continue;
+    const std::set<int> *leaves;
+    if (_get_pool_digest(osdmap, p.first, &rules, &leaves) !=
+	p.second.crush_digest) {
+      dirty_pools->insert(p.first);
+      continue;
+    }
+    for (auto osd : osds) {
+      if (leaves->count(osd)) {
+	dirty_pools->insert(p.first);
+	break;
+      }
+    }
+  }
+
+  // single pgs: changed overrides, and overrides naming a changed osd
+  std::set<pg_t> pgs;
+  for (auto& p : inc.new_pg_temp)
+    pgs.insert(p.first);
+  for (auto& p : inc.new_primary_temp)
+    pgs.insert(p.first);
+  for (auto& p : inc.new_pg_upmap)
+    pgs.insert(p.first);
+  for (auto& p : inc.new_pg_upmap_items)
+    pgs.insert(p.first);
+  pgs.insert(inc.old_pg_upmap.begin(), inc.old_pg_upmap.end());
+  pgs.insert(inc.old_pg_upmap_items.begin(), inc.old_pg_upmap_items.end());
+  osdmap.get_pgs_with_overrides_on(osds, &pgs);
+  for (auto pgid : pgs) {
+    auto p = pools.find(pgid.pool());
+    if (p == pools.end() ||
+	dirty_pools->count(pgid.pool()) ||
+	pgid.ps() >= p->second.pg_num)
+      continue;
+    dirty_pgs->insert(pgid);
+  }
+  return true;
+}
+
+uint32_t OSDMapMapping::_get_pool_digest(
+  const OSDMap& osdmap,
+  int64_t pool,
+  rule_cache_t *rules,
+  const std::set<int> **leaves)
+{
+  const pg_pool_t *pi = osdmap.get_pg_pool(pool);
+  int ruleno = osdmap.crush->find_rule(pi->get_crush_rule(),
+				       pi->get_type(), pi->get_size());
+  int64_t args = osdmap.crush->choose_args.count(pool) ?
+    pool : CrushWrapper::DEFAULT_CHOOSE_ARGS;
+  auto r = rules->find(std::make_pair(ruleno, args));
+  if (r == rules->end()) {
+    r = rules->emplace(std::make_pair(ruleno, args),
+		       std::make_pair(0, std::set<int>())).first;
+    r->second.first = osdmap.crush->get_rule_digest(
+      ruleno, args, &r->second.second);
+  }
+  if (leaves)
+    *leaves = &r->second.second;
+  // what raw_pg_to_pps() and the up/acting rules look at
+  uint32_t v[] = {
+    pi->get_type(),
+    pi->get_pgp_num(),
+    pi->has_flag(pg_pool_t::FLAG_HASHPSPOOL)
+  };
+  return ceph_crc32c(r->second.first, (const unsigned char *)v, sizeof(v));
+}
+
+void OSDMapMapping::_update_digests(const OSDMap& osdmap)
+{
+  rule_cache_t rules;
+  for (auto& p : pools) {
+    p.second.crush_digest = _get_pool_digest(osdmap, p.first, &rules,
+					     nullptr);
+  }
+}
+
+bool OSDMapMapping::same_as(const OSDMapMapping& other) const
+{
+  if (epoch != other.epoch ||
+      num_pgs != other.num_pgs ||
+      pools.size() != other.pools.size() ||
+      acting_rmap != other.acting_rmap) {
+    return false;
+  }
+  for (auto p = pools.begin(), q = other.pools.begin();
+       p != pools.end();
+       ++p, ++q) {
+    if (p->first != q->first ||
+	p->second.size != q->second.size ||
+	p->second.pg_num != q->second.pg_num ||
+	p->second.crush_digest != q->second.crush_digest ||
+	p->second.table != q->second.table) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void OSDMapMapping::_build_rmap(const OSDMap& osdmap)
 {
   acting_rmap.resize(osdmap.get_max_osd());
@@ -86,6 +253,7 @@ void OSDMapMapping::_build_rmap(const OSDMap& osdmap)
 void OSDMapMapping::_finish(const OSDMap& osdmap)
 {
   _build_rmap(osdmap);
+  _update_digests(osdmap);
   epoch = osdmap.get_epoch();
 }
 
@@ -111,15 +279,13 @@ void OSDMapMapping::_update_range(
   assert(i != pools.end());
   assert(pg_begin <= pg_end);
   assert(pg_end <= i->second.pg_num);
-  for (unsigned ps = pg_begin; ps < pg_end; ++ps) {
-    vector<int> up, acting;
-    int up_primary, acting_primary;
-    osdmap.pg_to_up_acting_osds(
-      pg_t(ps, pool),
-      &up, &up_primary, &acting, &acting_primary);
-    i->second.set(ps, std::move(up), up_primary,
-		  std::move(acting), acting_primary);
-  }
+  osdmap.pg_range_to_up_acting_osds(
+    pool, pg_begin, pg_end,
+    [&](unsigned ps, vector<int>&& up, int up_primary,
+	vector<int>&& acting, int acting_primary) {
+      i->second.set(ps, std::move(up), up_primary,
+		    std::move(acting), acting_primary);
+    });
 }
 
 // ---------------------------
@@ -155,10 +321,13 @@ void ParallelPGMapper::WQ::_process(Item *i, ThreadPool::TPHandle &h)
 
 void ParallelPGMapper::queue(
   Job *job,
-  unsigned pgs_per_item)
+  unsigned pgs_per_item,
+  const std::set<int64_t> *pools)
 {
   bool any = false;
   for (auto& p : job->osdmap->get_pools()) {
+    if (pools && !pools->count(p.first))
+      continue;
     for (unsigned ps = 0; ps < p.second.get_pg_num(); ps += pgs_per_item) {
       unsigned ps_end = MIN(ps + pgs_per_item, p.second.get_pg_num());
       job->start_one();
@@ -168,5 +337,10 @@ void ParallelPGMapper::queue(
       any = true;
     }
   }
-  assert(any);
+  if (!any) {
+    // nothing to remap; complete right away
+    assert(pools);
+    job->start_one();
+    job->finish_one();
+  }
 }
@@ -9,10 +9,9 @@
 #include <map>
 
 #include "osd/osd_types.h"
+#include "osd/OSDMap.h"
 #include "common/WorkQueue.h"
 
-class OSDMap;
-
 /// work queue to perform work on batches of pgids on multiple CPUs
 class ParallelPGMapper {
 public:
@@ -155,9 +154,11 @@ public:
     : cct(cct),
       wq(this, tp) {}
 
+  /// queue every pg of the job's map, or only those in pools if given
   void queue(
     Job *job,
-    unsigned pgs_per_item);
+    unsigned pgs_per_item,
+    const std::set<int64_t> *pools = nullptr);
 
   void drain() {
     wq.drain();
@@ -176,6 +177,7 @@ private:
 
     unsigned size = 0;
     unsigned pg_num = 0;
+    uint32_t crush_digest = 0;  ///< see _get_pool_digest()
     mempool::osdmap_mapping::vector<int32_t> table;
 
     size_t row_size() const {
@@ -246,7 +248,8 @@ private:
   epoch_t epoch = 0;
   uint64_t num_pgs = 0;
 
-  void _init_mappings(const OSDMap& osdmap);
+  void _init_mappings(const OSDMap& osdmap,
+		      std::set<int64_t> *fresh = nullptr);
   void _update_range(
     const OSDMap& map,
     int64_t pool,
@@ -254,7 +257,31 @@ private:
 
   void _build_rmap(const OSDMap& osdmap);
 
+  /// (rule, choose_args) -> (CrushWrapper::get_rule_digest(), leaves)
+  typedef std::map<std::pair<int,int64_t>,
+		   std::pair<uint32_t,std::set<int>>> rule_cache_t;
+  /// fingerprint of everything but osd state a pool's mapping depends on
+  uint32_t _get_pool_digest(const OSDMap& osdmap, int64_t pool,
+			    rule_cache_t *rules,
+			    const std::set<int> **leaves);
+  void _update_digests(const OSDMap& osdmap);
+
+  /**
+   * work out what inc may have remapped
+   *
+   * @param pools [out] pools to remap in full
+   * @param pgs [out] single pgs to remap, outside of pools
+   * @return false if this mapping is not for the epoch before inc, or
+   *         inc is too broad to narrow down; everything must be remapped
+   */
+  bool _prepare_incremental(const OSDMap& osdmap,
+			    const OSDMap::Incremental& inc,
+			    std::set<int64_t> *pools,
+			    std::set<pg_t> *pgs);
+
   void _start(const OSDMap& osdmap) {
+    // the table is in flux until _finish()
+    epoch = 0;
     _init_mappings(osdmap);
   }
   void _finish(const OSDMap& osdmap);
@@ -302,6 +329,12 @@ public:
 
   void update(const OSDMap& map);
   void update(const OSDMap& map, pg_t pgid);
+  /**
+   * update for map, which is the map this mapping was built for with inc
+   * applied, remapping only the pools and pgs inc can affect.  falls back
+   * to a full update if this mapping is not for the epoch before inc.
+   */
+  void update(const OSDMap& map, const OSDMap::Incremental& inc);
 
   std::unique_ptr<MappingJob> start_update(
     const OSDMap& map,
@@ -312,6 +345,16 @@ public:
     return job;
   }
 
+  /// start_update() that only remaps what inc can affect
+  std::unique_ptr<MappingJob> start_update(
+    const OSDMap& map,
+    const OSDMap::Incremental& inc,
+    ParallelPGMapper& mapper,
+    unsigned pgs_per_item);
+
+  /// true if both mappings are for the same epoch and hold the same table
+  bool same_as(const OSDMapMapping& other) const;
+
   epoch_t get_epoch() const {
     return epoch;
   }
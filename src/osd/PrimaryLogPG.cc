@@ -3424,15 +3424,15 @@ void PrimaryLogPG::log_op_stats(OpContext *ctx)
   uint64_t inb = ctx->bytes_written;
   uint64_t outb = ctx->bytes_read;
 
-  osd->logger->inc(l_osd_op);
+  osd->logger->inc_sharded(l_osd_op);
 
-  osd->logger->inc(l_osd_op_outb, outb);
-  osd->logger->inc(l_osd_op_inb, inb);
-  osd->logger->tinc(l_osd_op_lat, latency);
-  osd->logger->tinc(l_osd_op_process_lat, process_latency);
+  osd->logger->inc_sharded(l_osd_op_outb, outb);
+  osd->logger->inc_sharded(l_osd_op_inb, inb);
+  osd->logger->tinc_sharded(l_osd_op_lat, latency);
+  osd->logger->tinc_sharded(l_osd_op_process_lat, process_latency);
 
   if (op->may_read() && op->may_write()) {
-    osd->logger->inc(l_osd_op_rw);
+    osd->logger->inc_sharded(l_osd_op_rw);
     osd->logger->inc(l_osd_op_rw_inb, inb);
     osd->logger->inc(l_osd_op_rw_outb, outb);
     osd->logger->tinc(l_osd_op_rw_lat, latency);
@@ -3443,7 +3443,7 @@ void PrimaryLogPG::log_op_stats(OpContext *ctx)
     // read-modify-write
     // osd->logger->tinc(l_osd_pg_lock_latency_rw, pglock_time);
   } else if (op->may_read()) {
-    osd->logger->inc(l_osd_op_r);
+    osd->logger->inc_sharded(l_osd_op_r);
     osd->logger->inc(l_osd_op_r_outb, outb);
     osd->logger->tinc(l_osd_op_r_lat, latency);
     osd->logger->hinc(l_osd_op_r_lat_outb_hist, latency.to_nsec(), outb);
@@ -3452,7 +3452,7 @@ void PrimaryLogPG::log_op_stats(OpContext *ctx)
     // read pglock time
     // osd->logger->tinc(l_osd_pg_lock_latency_r, pglock_time);
   } else if (op->may_write() || op->may_cache()) {
-    osd->logger->inc(l_osd_op_w);
+    osd->logger->inc_sharded(l_osd_op_w);
     osd->logger->inc(l_osd_op_w_inb, inb);
     osd->logger->tinc(l_osd_op_w_lat, latency);
     osd->logger->hinc(l_osd_op_w_lat_inb_hist, latency.to_nsec(), inb);
@@ -1052,6 +1052,7 @@ public:
     CSUM_TYPE,
     CSUM_MAX_BLOCK,
     CSUM_MIN_BLOCK,
+    EC_PARITY_DELTA,
   };
 
   enum type_t {
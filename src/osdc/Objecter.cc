@@ -400,6 +400,7 @@ void Objecter::start(const OSDMap* o)
   start_tick();
   if (o) {
     osdmap->deepish_copy_from(*o);
+    _publish_osdmap();
   } else if (osdmap->get_epoch() == 0) {
     _maybe_request_map();
   }
@@ -473,15 +474,17 @@ void Objecter::shutdown()
     lop->put();
   }
 
-  while(!homeless_session->ops.empty()) {
-    std::map<ceph_tid_t, Op*>::iterator i = homeless_session->ops.begin();
-    ldout(cct, 10) << " op " << i->first << dendl;
-    Op *op = i->second;
-    {
-      OSDSession::unique_lock swl(homeless_session->lock);
-      _session_op_remove(homeless_session, op);
+  for (auto& shard : homeless_session->op_shards) {
+    while(!shard.ops.empty()) {
+      std::map<ceph_tid_t, Op*>::iterator i = shard.ops.begin();
+      ldout(cct, 10) << " op " << i->first << dendl;
+      Op *op = i->second;
+      {
+	OSDSession::unique_lock swl(homeless_session->lock);
+	_session_op_remove(homeless_session, op);
+      }
+      op->put();
     }
-    op->put();
   }
 
   while(!homeless_session->command_ops.empty()) {
@@ -570,8 +573,8 @@ void Objecter::_send_linger(LingerOp *info,
   if (info->register_tid) {
     // repeat send.  cancel old registeration op, if any.
     OSDSession::unique_lock sl(info->session->lock);
-    if (info->session->ops.count(info->register_tid)) {
-      Op *o = info->session->ops[info->register_tid];
+    Op *o = info->session->get_op(info->register_tid);
+    if (o) {
       _op_cancel_map_check(o);
       _cancel_linger_op(o);
     }
@@ -1060,32 +1063,34 @@ void Objecter::_scan_requests(OSDSession *s,
   }
 
   // check for changed request mappings
-  map<ceph_tid_t,Op*>::iterator p = s->ops.begin();
-  while (p != s->ops.end()) {
-    Op *op = p->second;
-    ++p;   // check_op_pool_dne() may touch ops; prevent iterator invalidation
-    ldout(cct, 10) << " checking op " << op->tid << dendl;
-    bool force_resend_writes = cluster_full;
-    if (pool_full_map)
-      force_resend_writes = force_resend_writes ||
-	(*pool_full_map)[op->target.base_oloc.pool];
-    int r = _calc_target(&op->target,
-			 op->session ? op->session->con.get() : nullptr);
-    switch (r) {
-    case RECALC_OP_TARGET_NO_ACTION:
-      if (!force_resend && !(force_resend_writes && op->respects_full()))
+  for (auto& shard : s->op_shards) {
+    map<ceph_tid_t,Op*>::iterator p = shard.ops.begin();
+    while (p != shard.ops.end()) {
+      Op *op = p->second;
+      ++p;   // check_op_pool_dne() may touch ops; prevent iterator invalidation
+      ldout(cct, 10) << " checking op " << op->tid << dendl;
+      bool force_resend_writes = cluster_full;
+      if (pool_full_map)
+	force_resend_writes = force_resend_writes ||
+	  (*pool_full_map)[op->target.base_oloc.pool];
+      int r = _calc_target(&op->target,
+			   op->session ? op->session->con.get() : nullptr);
+      switch (r) {
+      case RECALC_OP_TARGET_NO_ACTION:
+	if (!force_resend && !(force_resend_writes && op->respects_full()))
+	  break;
+	// -- fall-thru --
+      case RECALC_OP_TARGET_NEED_RESEND:
+	if (op->session) {
+	  _session_op_remove(op->session, op);
+	}
+	need_resend[op->tid] = op;
+	_op_cancel_map_check(op);
+	break;
+      case RECALC_OP_TARGET_POOL_DNE:
+	_check_op_pool_dne(op, &sl);
 	break;
-      // -- fall-thru --
-    case RECALC_OP_TARGET_NEED_RESEND:
-      if (op->session) {
-	_session_op_remove(op->session, op);
       }
-      need_resend[op->tid] = op;
-      _op_cancel_map_check(op);
-      break;
-    case RECALC_OP_TARGET_POOL_DNE:
-      _check_op_pool_dne(op, &sl);
-      break;
     }
   }
 
@@ -1264,6 +1269,9 @@ void Objecter::handle_osd_map(MOSDMap *m)
     }
   }
 
+  if (osdmap->get_epoch() != published_osdmap->get_epoch())
+    _publish_osdmap();
+
   // make sure need_resend targets reflect latest map
   for (auto p = need_resend.begin(); p != need_resend.end(); ) {
     Op *op = p->second;
@@ -1370,6 +1378,18 @@ void Objecter::handle_osd_map(MOSDMap *m)
   }
 }
 
+void Objecter::_publish_osdmap()
+{
+  OSDMap *m = new OSDMap;
+  m->deepish_copy_from(*osdmap);
+  std::unique_ptr<const OSDMap> old(m);
+  {
+    std::lock_guard<decltype(published_lock)> l(published_lock);
+    published_osdmap.swap(old);
+  }
+  ldout(cct, 20) << __func__ << " e" << m->get_epoch() << dendl;
+}
+
 void Objecter::enable_blacklist_events()
 {
   unique_lock wl(rwlock);
@@ -1515,7 +1535,7 @@ int Objecter::pool_snap_list(int64_t poolid, vector<uint64_t> *snaps)
 }
 
 // sl may be unlocked.
-void Objecter::_check_op_pool_dne(Op *op, unique_lock *sl)
+void Objecter::_check_op_pool_dne(Op *op, OSDSession::unique_lock *sl)
 {
   // rwlock is locked unique
 
@@ -1848,11 +1868,13 @@ void Objecter::close_session(OSDSession *s)
     _session_linger_op_remove(s, i->second);
   }
 
-  while (!s->ops.empty()) {
-    std::map<ceph_tid_t, Op*>::iterator i = s->ops.begin();
-    ldout(cct, 10) << " op " << i->first << dendl;
-    homeless_ops.push_back(i->second);
-    _session_op_remove(s, i->second);
+  for (auto& shard : s->op_shards) {
+    while (!shard.ops.empty()) {
+      std::map<ceph_tid_t, Op*>::iterator i = shard.ops.begin();
+      ldout(cct, 10) << " op " << i->first << dendl;
+      homeless_ops.push_back(i->second);
+      _session_op_remove(s, i->second);
+    }
   }
 
   while (!s->command_ops.empty()) {
@@ -2042,17 +2064,19 @@ void Objecter::_kick_requests(OSDSession *session,
 
   // resend ops
   map<ceph_tid_t,Op*> resend;  // resend in tid order
-  for (map<ceph_tid_t, Op*>::iterator p = session->ops.begin();
-       p != session->ops.end();) {
-    Op *op = p->second;
-    ++p;
-    logger->inc(l_osdc_op_resend);
-    if (op->should_resend) {
-      if (!op->target.paused)
-	resend[op->tid] = op;
-    } else {
-      _op_cancel_map_check(op);
-      _cancel_linger_op(op);
+  for (auto& shard : session->op_shards) {
+    for (map<ceph_tid_t, Op*>::iterator p = shard.ops.begin();
+	 p != shard.ops.end();) {
+      Op *op = p->second;
+      ++p;
+      logger->inc(l_osdc_op_resend);
+      if (op->should_resend) {
+	if (!op->target.paused)
+	  resend[op->tid] = op;
+      } else {
+	_op_cancel_map_check(op);
+	_cancel_linger_op(op);
+      }
     }
   }
 
@@ -2137,16 +2161,18 @@ void Objecter::tick()
     OSDSession *s = siter->second;
     OSDSession::lock_guard l(s->lock);
     bool found = false;
-    for (map<ceph_tid_t,Op*>::iterator p = s->ops.begin();
-	p != s->ops.end();
-	++p) {
-      Op *op = p->second;
-      assert(op->session);
-      if (op->stamp < cutoff) {
-	ldout(cct, 2) << " tid " << p->first << " on osd." << op->session->osd
-		      << " is laggy" << dendl;
-	found = true;
-	++laggy_ops;
+    for (auto& shard : s->op_shards) {
+      for (map<ceph_tid_t,Op*>::iterator p = shard.ops.begin();
+	   p != shard.ops.end();
+	   ++p) {
+	Op *op = p->second;
+	assert(op->session);
+	if (op->stamp < cutoff) {
+	  ldout(cct, 2) << " tid " << p->first << " on osd." << op->session->osd
+			<< " is laggy" << dendl;
+	  found = true;
+	  ++laggy_ops;
+	}
       }
     }
     for (map<uint64_t,LingerOp*>::iterator p = s->linger_ops.begin();
@@ -2456,9 +2482,10 @@ void Objecter::_op_submit(Op *op, shunique_lock& sul, ceph_tid_t *ptid)
     m = _prepare_osd_op(op);
   }
 
-  OSDSession::unique_lock sl(s->lock);
+  OSDSession::shared_lock sl(s->lock);
   if (op->tid == 0)
     op->tid = ++last_tid;
+  OSDSession::unique_op_lock ol(s->op_shard(op->tid).lock);
 
   ldout(cct, 10) << "_op_submit oid " << op->target.base_oid
 		 << " '" << op->target.base_oloc << "' '"
@@ -2472,7 +2499,7 @@ void Objecter::_op_submit(Op *op, shunique_lock& sul, ceph_tid_t *ptid)
     _send_op(op, m);
   }
 
-  // Last chance to touch Op here, after giving up session lock it can
+  // Last chance to touch Op here, after giving up the shard lock it can
   // be freed at any time by response handler.
   ceph_tid_t tid = op->tid;
   if (check_for_latest_map) {
@@ -2482,6 +2509,7 @@ void Objecter::_op_submit(Op *op, shunique_lock& sul, ceph_tid_t *ptid)
     *ptid = tid;
   op = NULL;
 
+  ol.unlock();
   sl.unlock();
   put_session(s);
 
@@ -2494,8 +2522,8 @@ int Objecter::op_cancel(OSDSession *s, ceph_tid_t tid, int r)
 
   OSDSession::unique_lock sl(s->lock);
 
-  map<ceph_tid_t, Op*>::iterator p = s->ops.find(tid);
-  if (p == s->ops.end()) {
+  Op *op = s->get_op(tid);
+  if (!op) {
     ldout(cct, 10) << __func__ << " tid " << tid << " dne in session "
 		   << s->osd << dendl;
     return -ENOENT;
@@ -2509,7 +2537,6 @@ int Objecter::op_cancel(OSDSession *s, ceph_tid_t tid, int r)
 
   ldout(cct, 10) << __func__ << " tid " << tid << " in session " << s->osd
 		 << dendl;
-  Op *op = p->second;
   if (op->onfinish) {
     num_in_flight--;
     op->onfinish->complete(r);
@@ -2545,7 +2572,9 @@ start:
        siter != osd_sessions.end(); ++siter) {
     OSDSession *s = siter->second;
     OSDSession::shared_lock sl(s->lock);
-    if (s->ops.find(tid) != s->ops.end()) {
+    OSDSession::unique_op_lock ol(s->op_shard(tid).lock);
+    if (s->get_op(tid)) {
+      ol.unlock();
       sl.unlock();
       ret = op_cancel(s, tid, r);
       if (ret == -ENOENT) {
@@ -2561,7 +2590,9 @@ start:
 
   // Handle case where the op is in homeless session
   OSDSession::shared_lock sl(homeless_session->lock);
-  if (homeless_session->ops.find(tid) != homeless_session->ops.end()) {
+  OSDSession::unique_op_lock ol(homeless_session->op_shard(tid).lock);
+  if (homeless_session->get_op(tid)) {
+    ol.unlock();
     sl.unlock();
     ret = op_cancel(homeless_session, tid, r);
     if (ret == -ENOENT) {
@@ -2571,6 +2602,7 @@ start:
       return ret;
     }
   } else {
+    ol.unlock();
     sl.unlock();
   }
 
@@ -2592,11 +2624,14 @@ epoch_t Objecter::op_cancel_writes(int r, int64_t pool)
        siter != osd_sessions.end(); ++siter) {
     OSDSession *s = siter->second;
     OSDSession::shared_lock sl(s->lock);
-    for (map<ceph_tid_t, Op*>::iterator op_i = s->ops.begin();
-	 op_i != s->ops.end(); ++op_i) {
-      if (op_i->second->target.flags & CEPH_OSD_FLAG_WRITE
-	  && (pool == -1 || op_i->second->target.target_oloc.pool == pool)) {
-	to_cancel.push_back(op_i->first);
+    for (auto& shard : s->op_shards) {
+      OSDSession::unique_op_lock ol(shard.lock);
+      for (map<ceph_tid_t, Op*>::iterator op_i = shard.ops.begin();
+	   op_i != shard.ops.end(); ++op_i) {
+	if (op_i->second->target.flags & CEPH_OSD_FLAG_WRITE
+	    && (pool == -1 || op_i->second->target.target_oloc.pool == pool)) {
+	  to_cancel.push_back(op_i->first);
+	}
       }
     }
     sl.unlock();
@@ -2943,13 +2978,13 @@ int Objecter::_map_session(op_target_t *target, OSDSession **s,
 
 void Objecter::_session_op_assign(OSDSession *to, Op *op)
 {
-  // to->lock is locked
+  // to->lock is locked unique, or shared with the op's shard locked
   assert(op->session == NULL);
   assert(op->tid);
 
   get_session(to);
   op->session = to;
-  to->ops[op->tid] = op;
+  to->op_shard(op->tid).ops[op->tid] = op;
 
   if (to->is_homeless()) {
     num_homeless_ops++;
@@ -2961,13 +2996,13 @@ void Objecter::_session_op_assign(OSDSession *to, Op *op)
 void Objecter::_session_op_remove(OSDSession *from, Op *op)
 {
   assert(op->session == from);
-  // from->lock is locked
+  // from->lock is locked unique, or shared with the op's shard locked
 
   if (from->is_homeless()) {
     num_homeless_ops--;
   }
 
-  from->ops.erase(op->tid);
+  from->op_shard(op->tid).ops.erase(op->tid);
   put_session(from);
   op->session = NULL;
 
@@ -3089,7 +3124,8 @@ void Objecter::_finish_op(Op *op, int r)
 {
   ldout(cct, 15) << "finish_op " << op->tid << dendl;
 
-  // op->session->lock is locked unique or op->session is null
+  // op->session->lock is locked unique, or shared with the op's shard
+  // locked, or op->session is null
 
   if (!op->ctx_budgeted && op->budgeted)
     put_op_budget(op);
@@ -3117,12 +3153,10 @@ void Objecter::finish_op(OSDSession *session, ceph_tid_t tid)
 
   OSDSession::unique_lock wl(session->lock);
 
-  map<ceph_tid_t, Op *>::iterator iter = session->ops.find(tid);
-  if (iter == session->ops.end())
+  Op *op = session->get_op(tid);
+  if (!op)
     return;
 
-  Op *op = iter->second;
-
   _finish_op(op, 0);
 }
 
@@ -3179,7 +3213,7 @@ MOSDOp *Objecter::_prepare_osd_op(Op *op)
 void Objecter::_send_op(Op *op, MOSDOp *m)
 {
   // rwlock is locked
-  // op->session->lock is locked
+  // op->session->lock is locked unique, or shared with the op's shard locked
 
   // backoff?
   hobject_t hoid = op->target.get_hobj();
@@ -3300,7 +3334,7 @@ void Objecter::_throttle_op(Op *op,
 void Objecter::unregister_op(Op *op)
 {
   OSDSession::unique_lock sl(op->session->lock);
-  op->session->ops.erase(op->tid);
+  op->session->op_shard(op->tid).ops.erase(op->tid);
   sl.unlock();
   put_session(op->session);
   op->session = NULL;
@@ -3333,14 +3367,16 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
     return;
   }
 
-  OSDSession::unique_lock sl(s->lock);
+  OSDSession::shared_lock sl(s->lock);
+  OSDSession::unique_op_lock ol(s->op_shard(tid).lock);
 
-  map<ceph_tid_t, Op *>::iterator iter = s->ops.find(tid);
-  if (iter == s->ops.end()) {
+  Op *op = s->get_op(tid);
+  if (!op) {
     ldout(cct, 7) << "handle_osd_op_reply " << tid
 		  << (m->is_ondisk() ? " ondisk" : (m->is_onnvram() ?
 						    " onnvram" : " ack"))
 		  << " ... stray" << dendl;
+    ol.unlock();
     sl.unlock();
     put_session(s);
     m->put();
@@ -3354,7 +3390,6 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 		<< " in " << m->get_pg()
 		<< " attempt " << m->get_retry_attempt()
 		<< dendl;
-  Op *op = iter->second;
   op->trace.event("osd op reply");
 
   if (retry_writes_after_first_reply && op->attempts == 1 &&
@@ -3364,6 +3399,7 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
       num_in_flight--;
     }
     _session_op_remove(s, op);
+    ol.unlock();
     sl.unlock();
     put_session(s);
 
@@ -3380,6 +3416,7 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 		    << "; last attempt " << (op->attempts - 1) << " sent to "
 		    << op->session->con->get_peer_addr() << dendl;
       m->put();
+      ol.unlock();
       sl.unlock();
       put_session(s);
       return;
@@ -3399,6 +3436,7 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
     if (op->onfinish)
       num_in_flight--;
     _session_op_remove(s, op);
+    ol.unlock();
     sl.unlock();
     put_session(s);
 
@@ -3418,6 +3456,7 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
     if (op->onfinish)
       num_in_flight--;
     _session_op_remove(s, op);
+    ol.unlock();
     sl.unlock();
     put_session(s);
 
@@ -3502,6 +3541,7 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
   if (completion_lock.mutex()) {
     completion_lock.lock();
   }
+  ol.unlock();
   sl.unlock();
 
   // do callbacks
@@ -3589,16 +3629,22 @@ void Objecter::handle_osd_backoff(MOSDBackoff *m)
 	s->backoffs_by_id.erase(p);
 
 	// check for any ops to resend
-	for (auto& q : s->ops) {
-	  if (q.second->target.actual_pgid == m->pgid) {
-	    int r = q.second->target.contained_by(m->begin, m->end);
-	    ldout(cct, 20) << __func__ <<  " contained_by " << r << " on "
-			   << q.second->target.get_hobj() << dendl;
-	    if (r) {
-	      _send_op(q.second);
+	map<ceph_tid_t,Op*> resend;  // resend in tid order
+	for (auto& shard : s->op_shards) {
+	  for (auto& q : shard.ops) {
+	    if (q.second->target.actual_pgid == m->pgid) {
+	      int r = q.second->target.contained_by(m->begin, m->end);
+	      ldout(cct, 20) << __func__ <<  " contained_by " << r << " on "
+			     << q.second->target.get_hobj() << dendl;
+	      if (r) {
+		resend[q.first] = q.second;
+	      }
 	    }
 	  }
 	}
+	for (auto& q : resend) {
+	  _send_op(q.second);
+	}
       } else {
 	lderr(cct) << __func__ << " " << m->pgid << " id " << m->id
 		   << " unblock on ["
@@ -4455,14 +4501,17 @@ void Objecter::op_target_t::dump(Formatter *f) const
 
 void Objecter::_dump_active(OSDSession *s)
 {
-  for (map<ceph_tid_t,Op*>::iterator p = s->ops.begin();
-       p != s->ops.end();
-       ++p) {
-    Op *op = p->second;
-    ldout(cct, 20) << op->tid << "\t" << op->target.pgid
-		   << "\tosd." << (op->session ? op->session->osd : -1)
-		   << "\t" << op->target.base_oid
-		   << "\t" << op->ops << dendl;
+  for (auto& shard : s->op_shards) {
+    OSDSession::unique_op_lock ol(shard.lock);
+    for (map<ceph_tid_t,Op*>::iterator p = shard.ops.begin();
+	 p != shard.ops.end();
+	 ++p) {
+      Op *op = p->second;
+      ldout(cct, 20) << op->tid << "\t" << op->target.pgid
+		     << "\tosd." << (op->session ? op->session->osd : -1)
+		     << "\t" << op->target.base_oid
+		     << "\t" << op->ops << dendl;
+    }
   }
 }
 
@@ -4502,28 +4551,31 @@ void Objecter::dump_requests(Formatter *fmt)
 
 void Objecter::_dump_ops(const OSDSession *s, Formatter *fmt)
 {
-  for (map<ceph_tid_t,Op*>::const_iterator p = s->ops.begin();
-       p != s->ops.end();
-       ++p) {
-    Op *op = p->second;
-    fmt->open_object_section("op");
-    fmt->dump_unsigned("tid", op->tid);
-    op->target.dump(fmt);
-    fmt->dump_stream("last_sent") << op->stamp;
-    fmt->dump_int("attempts", op->attempts);
-    fmt->dump_stream("snapid") << op->snapid;
-    fmt->dump_stream("snap_context") << op->snapc;
-    fmt->dump_stream("mtime") << op->mtime;
+  for (auto& shard : s->op_shards) {
+    OSDSession::unique_op_lock ol(shard.lock);
+    for (map<ceph_tid_t,Op*>::const_iterator p = shard.ops.begin();
+	 p != shard.ops.end();
+	 ++p) {
+      Op *op = p->second;
+      fmt->open_object_section("op");
+      fmt->dump_unsigned("tid", op->tid);
+      op->target.dump(fmt);
+      fmt->dump_stream("last_sent") << op->stamp;
+      fmt->dump_int("attempts", op->attempts);
+      fmt->dump_stream("snapid") << op->snapid;
+      fmt->dump_stream("snap_context") << op->snapc;
+      fmt->dump_stream("mtime") << op->mtime;
+
+      fmt->open_array_section("osd_ops");
+      for (vector<OSDOp>::const_iterator it = op->ops.begin();
+	   it != op->ops.end();
+	   ++it) {
+	fmt->dump_stream("osd_op") << *it;
+      }
+      fmt->close_section(); // osd_ops array
 
-    fmt->open_array_section("osd_ops");
-    for (vector<OSDOp>::const_iterator it = op->ops.begin();
-	 it != op->ops.end();
-	 ++it) {
-      fmt->dump_stream("osd_op") << *it;
+      fmt->close_section(); // op object
     }
-    fmt->close_section(); // osd_ops array
-
-    fmt->close_section(); // op object
   }
 }
 
@@ -4936,7 +4988,7 @@ Objecter::OSDSession::~OSDSession()
 {
   // Caller is responsible for re-assigning or
   // destroying any ops that were assigned to us
-  assert(ops.empty());
+  assert(ops_empty());
   assert(linger_ops.empty());
   assert(command_ops.empty());
 }
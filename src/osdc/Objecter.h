@@ -35,6 +35,7 @@
 #include "common/ceph_timer.h"
 #include "common/Finisher.h"
 #include "common/shunique_lock.h"
+#include "common/sharded_shared_mutex.h"
 #include "common/zipkin_trace.h"
 
 #include "messages/MOSDOp.h"
@@ -1221,11 +1222,22 @@ private:
   version_t last_seen_osdmap_version;
   version_t last_seen_pgmap_version;
 
-  mutable boost::shared_mutex rwlock;
+  // Guards the map, the session table and everything else not under a
+  // session lock.  Op submission and replies only read it, so readers
+  // are spread over per-thread shards; map updates take them all.
+  mutable ceph::sharded_shared_mutex rwlock;
   using lock_guard = std::unique_lock<decltype(rwlock)>;
   using unique_lock = std::unique_lock<decltype(rwlock)>;
   using shared_lock = boost::shared_lock<decltype(rwlock)>;
   using shunique_lock = ceph::shunique_lock<decltype(rwlock)>;
+
+  // Copy of osdmap for with_osdmap(), republished once handle_osd_map()
+  // has moved to a new epoch.  Readers wait only for the pointer swap,
+  // not for the request rescan and resends done under rwlock.
+  mutable ceph::sharded_shared_mutex published_lock;
+  std::unique_ptr<const OSDMap> published_osdmap;
+  void _publish_osdmap();
+
   ceph::timer<ceph::mono_clock> timer;
 
   PerfCounters *logger;
@@ -1803,14 +1815,42 @@ public:
   };
 
   struct OSDSession : public RefCountedObject {
-    boost::shared_mutex lock;
+    // fewer shards than rwlock: there is one of these per osd
+    ceph::basic_sharded_shared_mutex<4> lock;
     using lock_guard = std::lock_guard<decltype(lock)>;
     using unique_lock = std::unique_lock<decltype(lock)>;
     using shared_lock = boost::shared_lock<decltype(lock)>;
     using shunique_lock = ceph::shunique_lock<decltype(lock)>;
 
-    // pending ops
-    map<ceph_tid_t,Op*> ops;
+    // pending ops, sharded by tid so that submits and replies only
+    // hold lock shared.  Holding lock unique covers every shard;
+    // holding it shared, only a shard whose own lock is held too.
+    // padded, not aligned, for the same reason as the lock shards
+    struct op_shard_t {
+      mutable std::mutex lock;
+      map<ceph_tid_t,Op*> ops;
+      char pad[64];
+    };
+    using unique_op_lock = std::unique_lock<std::mutex>;
+    static constexpr unsigned num_op_shards = 8;
+    op_shard_t op_shards[num_op_shards];
+
+    op_shard_t& op_shard(ceph_tid_t tid) {
+      return op_shards[tid % num_op_shards];
+    }
+    Op *get_op(ceph_tid_t tid) {
+      auto& ops = op_shard(tid).ops;
+      auto p = ops.find(tid);
+      return p == ops.end() ? nullptr : p->second;
+    }
+    bool ops_empty() const {
+      for (auto& shard : op_shards) {
+	if (!shard.ops.empty())
+	  return false;
+      }
+      return true;
+    }
+
     map<uint64_t, LingerOp*> linger_ops;
     map<ceph_tid_t,CommandOp*> command_ops;
 
@@ -1933,7 +1973,7 @@ public:
   }
 
 private:
-  void _check_op_pool_dne(Op *op, unique_lock *sl);
+  void _check_op_pool_dne(Op *op, OSDSession::unique_lock *sl);
   void _send_op_map_check(Op *op);
   void _op_cancel_map_check(Op *op);
   void _check_linger_pool_dne(LingerOp *op, bool *need_unregister);
@@ -2012,7 +2052,9 @@ private:
     op_throttle_ops(cct, "objecter_ops", cct->_conf->objecter_inflight_ops),
     epoch_barrier(0),
     retry_writes_after_first_reply(cct->_conf->objecter_retry_writes_after_first_reply)
-  { }
+  {
+    published_osdmap.reset(new OSDMap);
+  }
   ~Objecter() override;
 
   void init();
@@ -2030,12 +2072,16 @@ private:
   //
   // Do not call into something that will try to lock the OSDMap from
   // here or you will have great woe and misery.
+  //
+  // The callback sees the last published epoch; it may trail osdmap
+  // while handle_osd_map() is still working through a new one.
 
   template<typename Callback, typename...Args>
   auto with_osdmap(Callback&& cb, Args&&... args) const ->
-    decltype(cb(*osdmap, std::forward<Args>(args)...)) {
-    shared_lock l(rwlock);
-    return std::forward<Callback>(cb)(*osdmap, std::forward<Args>(args)...);
+    decltype(cb(*published_osdmap, std::forward<Args>(args)...)) {
+    boost::shared_lock<decltype(published_lock)> l(published_lock);
+    return std::forward<Callback>(cb)(*published_osdmap,
+				      std::forward<Args>(args)...);
   }
 
 
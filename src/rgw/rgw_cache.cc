@@ -5,89 +5,132 @@
 
 #include <errno.h>
 
+#include "common/perf_counters.h"
+#include "include/stringify.h"
+
 #define dout_subsys ceph_subsys_rgw
 
 using namespace std;
 
-int ObjectCache::get(string& name, ObjectCacheInfo& info, uint32_t mask, rgw_cache_entry_info *cache_info)
+ObjectCache::ShardLocker::ShardLocker(Shard& shard, bool write)
+  : shard(shard)
 {
-  RWLock::RLocker l(lock);
+  if (write ? shard.lock.try_get_write() : shard.lock.try_get_read()) {
+    return;
+  }
 
-  if (!enabled) {
+  utime_t start = ceph_clock_now();
+  if (write) {
+    shard.lock.get_write();
+  } else {
+    shard.lock.get_read();
+  }
+  shard.logger->tinc(l_rgw_cache_shard_lock_wait, ceph_clock_now() - start);
+}
+
+ObjectCache::~ObjectCache()
+{
+  for (auto& shard : shards) {
+    cct->get_perfcounters_collection()->remove(shard->logger);
+    delete shard->logger;
+    shard->clock.clear();
+  }
+}
+
+void ObjectCache::set_ctx(CephContext *_cct)
+{
+  cct = _cct;
+  assert(shards.empty());
+
+  unsigned num_shards = std::max<int64_t>(1, cct->_conf->rgw_cache_shards);
+  shard_lru_size = std::max<size_t>(1, cct->_conf->rgw_cache_lru_size / num_shards);
+  for (unsigned i = 0; i < num_shards; ++i) {
+    Shard *shard = new Shard;
+    PerfCountersBuilder plb(cct, "rgw_cache_shard_" + stringify(i),
+                            l_rgw_cache_shard_first, l_rgw_cache_shard_last);
+    plb.add_u64_counter(l_rgw_cache_shard_hit, "hit", "Cache hits");
+    plb.add_u64_counter(l_rgw_cache_shard_miss, "miss", "Cache misses");
+    plb.add_u64_counter(l_rgw_cache_shard_evict, "evict", "Entries evicted");
+    plb.add_u64(l_rgw_cache_shard_entries, "entries", "Entries cached");
+    plb.add_time_avg(l_rgw_cache_shard_lock_wait, "lock_wait",
+                     "Time spent waiting for the shard lock");
+    shard->logger = plb.create_perf_counters();
+    cct->get_perfcounters_collection()->add(shard->logger);
+    shards.emplace_back(shard);
+  }
+}
+
+int ObjectCache::get(string& name, ObjectCacheInfo& info, uint32_t mask, rgw_cache_entry_info *cache_info)
+{
+  if (!enabled || shards.empty()) {
     return -ENOENT;
   }
 
-  map<string, ObjectCacheEntry>::iterator iter = cache_map.find(name);
-  if (iter == cache_map.end()) {
+  Shard& shard = *shards[shard_of(name)];
+  ShardLocker l(shard, false);
+
+  auto iter = shard.cache_map.find(name);
+  if (iter == shard.cache_map.end()) {
     ldout(cct, 10) << "cache get: name=" << name << " : miss" << dendl;
     if(perfcounter) perfcounter->inc(l_rgw_cache_miss);
+    shard.logger->inc(l_rgw_cache_shard_miss);
     return -ENOENT;
   }
 
   ObjectCacheEntry *entry = &iter->second;
-
-  if (lru_counter - entry->lru_promotion_ts > lru_window) {
-    ldout(cct, 20) << "cache get: touching lru, lru_counter=" << lru_counter
-                   << " promotion_ts=" << entry->lru_promotion_ts << dendl;
-    lock.unlock();
-    lock.get_write(); /* promote lock to writer */
-
-    /* need to redo this because entry might have dropped off the cache */
-    iter = cache_map.find(name);
-    if (iter == cache_map.end()) {
-      ldout(cct, 10) << "lost race! cache get: name=" << name << " : miss" << dendl;
-      if(perfcounter) perfcounter->inc(l_rgw_cache_miss);
-      return -ENOENT;
-    }
-
-    entry = &iter->second;
-    /* check again, we might have lost a race here */
-    if (lru_counter - entry->lru_promotion_ts > lru_window) {
-      touch_lru(name, *entry, iter->second.lru_iter);
-    }
-  }
-
-  ObjectCacheInfo& src = iter->second.info;
+  ObjectCacheInfo& src = entry->info;
   if ((src.flags & mask) != mask) {
     ldout(cct, 10) << "cache get: name=" << name << " : type miss (requested=0x"
                    << std::hex << mask << ", cached=0x" << src.flags
                    << std::dec << ")" << dendl;
     if(perfcounter) perfcounter->inc(l_rgw_cache_miss);
+    shard.logger->inc(l_rgw_cache_shard_miss);
     return -ENOENT;
   }
   ldout(cct, 10) << "cache get: name=" << name << " : hit (requested=0x"
                  << std::hex << mask << ", cached=0x" << src.flags
                  << std::dec << ")" << dendl;
 
+  /* avoid dirtying the cache line when the bit is already set */
+  if (!entry->referenced.load(std::memory_order_relaxed)) {
+    entry->referenced.store(true, std::memory_order_relaxed);
+  }
+
   info = src;
   if (cache_info) {
     cache_info->cache_locator = name;
     cache_info->gen = entry->gen;
   }
   if(perfcounter) perfcounter->inc(l_rgw_cache_hit);
+  shard.logger->inc(l_rgw_cache_shard_hit);
 
   return 0;
 }
 
 bool ObjectCache::chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_entries, RGWChainedCache::Entry *chained_entry)
 {
-  RWLock::WLocker l(lock);
-
-  if (!enabled) {
+  if (!enabled || shards.empty()) {
     return false;
   }
 
-  list<rgw_cache_entry_info *>::iterator citer;
+  /* lock every shard involved, in order */
+  set<unsigned> shard_ids;
+  for (auto cache_info : cache_info_entries) {
+    shard_ids.insert(shard_of(cache_info->cache_locator));
+  }
+  deque<ShardLocker> lockers;
+  for (auto id : shard_ids) {
+    lockers.emplace_back(*shards[id], true);
+  }
 
   list<ObjectCacheEntry *> cache_entry_list;
 
   /* first verify that all entries are still valid */
-  for (citer = cache_info_entries.begin(); citer != cache_info_entries.end(); ++citer) {
-    rgw_cache_entry_info *cache_info = *citer;
-
+  for (auto cache_info : cache_info_entries) {
     ldout(cct, 10) << "chain_cache_entry: cache_locator=" << cache_info->cache_locator << dendl;
-    map<string, ObjectCacheEntry>::iterator iter = cache_map.find(cache_info->cache_locator);
-    if (iter == cache_map.end()) {
+    Shard& shard = *shards[shard_of(cache_info->cache_locator)];
+    auto iter = shard.cache_map.find(cache_info->cache_locator);
+    if (iter == shard.cache_map.end()) {
       ldout(cct, 20) << "chain_cache_entry: couldn't find cache locator" << dendl;
       return false;
     }
@@ -105,11 +148,7 @@ bool ObjectCache::chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_ent
 
   chained_entry->cache->chain_cb(chained_entry->key, chained_entry->data);
 
-  list<ObjectCacheEntry *>::iterator liter;
-
-  for (liter = cache_entry_list.begin(); liter != cache_entry_list.end(); ++liter) {
-    ObjectCacheEntry *entry = *liter;
-
+  for (auto entry : cache_entry_list) {
     entry->chained_entries.push_back(make_pair(chained_entry->cache, chained_entry->key));
   }
 
@@ -118,35 +157,47 @@ bool ObjectCache::chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_ent
 
 void ObjectCache::put(string& name, ObjectCacheInfo& info, rgw_cache_entry_info *cache_info)
 {
-  RWLock::WLocker l(lock);
-
-  if (!enabled) {
+  if (!enabled || shards.empty()) {
     return;
   }
 
+  chained_list_t invalidated;
+  {
+    Shard& shard = *shards[shard_of(name)];
+    ShardLocker l(shard, true);
+    do_put(shard, name, info, cache_info, &invalidated);
+  }
+  invalidate_chained(invalidated);
+}
+
+void ObjectCache::do_put(Shard& shard, string& name, ObjectCacheInfo& info,
+                         rgw_cache_entry_info *cache_info,
+                         chained_list_t *invalidated)
+{
   ldout(cct, 10) << "cache put: name=" << name << " info.flags=0x"
                  << std::hex << info.flags << std::dec << dendl;
-  map<string, ObjectCacheEntry>::iterator iter = cache_map.find(name);
-  if (iter == cache_map.end()) {
-    ObjectCacheEntry entry;
-    entry.lru_iter = lru.end();
-    cache_map.insert(pair<string, ObjectCacheEntry>(name, entry));
-    iter = cache_map.find(name);
+  auto iter = shard.cache_map.find(name);
+  if (iter == shard.cache_map.end()) {
+    iter = shard.cache_map.emplace(std::piecewise_construct,
+                                   std::forward_as_tuple(name),
+                                   std::forward_as_tuple()).first;
+    ObjectCacheEntry& entry = iter->second;
+    entry.name = &iter->first;
+
+    /* new entries go right behind the hand, i.e. last in the sweep */
+    shard.clock.insert(shard.hand, entry);
+    ldout(cct, 10) << "adding " << name << " to cache LRU" << dendl;
+    evict(shard, entry, invalidated);
+    shard.logger->set(l_rgw_cache_shard_entries, shard.cache_map.size());
+  } else {
+    iter->second.referenced.store(true, std::memory_order_relaxed);
   }
   ObjectCacheEntry& entry = iter->second;
   ObjectCacheInfo& target = entry.info;
 
-  for (list<pair<RGWChainedCache *, string> >::iterator iiter = entry.chained_entries.begin();
-       iiter != entry.chained_entries.end(); ++iiter) {
-    RGWChainedCache *chained_cache = iiter->first;
-    chained_cache->invalidate(iiter->second);
-  }
-
-  entry.chained_entries.clear();
+  invalidated->splice(invalidated->end(), entry.chained_entries);
   entry.gen++;
 
-  touch_lru(name, entry, entry.lru_iter);
-
   target.status = info.status;
 
   if (info.status < 0) {
@@ -195,79 +246,69 @@ void ObjectCache::put(string& name, ObjectCacheInfo& info, rgw_cache_entry_info
 
 void ObjectCache::remove(string& name)
 {
-  RWLock::WLocker l(lock);
-
-  if (!enabled) {
+  if (!enabled || shards.empty()) {
     return;
   }
 
-  map<string, ObjectCacheEntry>::iterator iter = cache_map.find(name);
-  if (iter == cache_map.end())
-    return;
-
-  ldout(cct, 10) << "removing " << name << " from cache" << dendl;
-  ObjectCacheEntry& entry = iter->second;
-
-  for (list<pair<RGWChainedCache *, string> >::iterator iiter = entry.chained_entries.begin();
-       iiter != entry.chained_entries.end(); ++iiter) {
-    RGWChainedCache *chained_cache = iiter->first;
-    chained_cache->invalidate(iiter->second);
+  chained_list_t invalidated;
+  {
+    Shard& shard = *shards[shard_of(name)];
+    ShardLocker l(shard, true);
+
+    auto iter = shard.cache_map.find(name);
+    if (iter == shard.cache_map.end())
+      return;
+
+    ldout(cct, 10) << "removing " << name << " from cache" << dendl;
+    ObjectCacheEntry& entry = iter->second;
+    invalidated.swap(entry.chained_entries);
+    unlink(shard, entry);
+    shard.cache_map.erase(iter);
+    shard.logger->set(l_rgw_cache_shard_entries, shard.cache_map.size());
   }
+  invalidate_chained(invalidated);
+}
 
-  remove_lru(name, iter->second.lru_iter);
-  cache_map.erase(iter);
+void ObjectCache::unlink(Shard& shard, ObjectCacheEntry& entry)
+{
+  auto iter = shard.clock.iterator_to(entry);
+  if (iter == shard.hand) {
+    shard.hand = shard.clock.erase(iter);
+  } else {
+    shard.clock.erase(iter);
+  }
 }
 
-void ObjectCache::touch_lru(string& name, ObjectCacheEntry& entry, std::list<string>::iterator& lru_iter)
+void ObjectCache::evict(Shard& shard, ObjectCacheEntry& keep, chained_list_t *invalidated)
 {
-  while (lru_size > (size_t)cct->_conf->rgw_cache_lru_size) {
-    list<string>::iterator iter = lru.begin();
-    if ((*iter).compare(name) == 0) {
-      /*
-       * if the entry we're touching happens to be at the lru end, don't remove it,
-       * lru shrinking can wait for next time
-       */
-      break;
+  while (shard.cache_map.size() > shard_lru_size) {
+    if (shard.hand == shard.clock.end()) {
+      shard.hand = shard.clock.begin();
+    }
+    ObjectCacheEntry& entry = *shard.hand;
+    if (&entry == &keep ||
+        entry.referenced.exchange(false, std::memory_order_relaxed)) {
+      ++shard.hand;
+      continue;
     }
-    map<string, ObjectCacheEntry>::iterator map_iter = cache_map.find(*iter);
-    ldout(cct, 10) << "removing entry: name=" << *iter << " from cache LRU" << dendl;
-    if (map_iter != cache_map.end())
-      cache_map.erase(map_iter);
-    lru.pop_front();
-    lru_size--;
-  }
 
-  if (lru_iter == lru.end()) {
-    lru.push_back(name);
-    lru_size++;
-    lru_iter--;
-    ldout(cct, 10) << "adding " << name << " to cache LRU end" << dendl;
-  } else {
-    ldout(cct, 10) << "moving " << name << " to cache LRU end" << dendl;
-    lru.erase(lru_iter);
-    lru.push_back(name);
-    lru_iter = lru.end();
-    --lru_iter;
+    ldout(cct, 10) << "removing entry: name=" << *entry.name << " from cache LRU" << dendl;
+    invalidated->splice(invalidated->end(), entry.chained_entries);
+    shard.hand = shard.clock.erase(shard.hand);
+    shard.cache_map.erase(shard.cache_map.find(*entry.name));
+    shard.logger->inc(l_rgw_cache_shard_evict);
   }
-
-  lru_counter++;
-  entry.lru_promotion_ts = lru_counter;
 }
 
-void ObjectCache::remove_lru(string& name, std::list<string>::iterator& lru_iter)
+void ObjectCache::invalidate_chained(chained_list_t& invalidated)
 {
-  if (lru_iter == lru.end())
-    return;
-
-  lru.erase(lru_iter);
-  lru_size--;
-  lru_iter = lru.end();
+  for (auto& i : invalidated) {
+    i.first->invalidate(i.second);
+  }
 }
 
 void ObjectCache::set_enabled(bool status)
 {
-  RWLock::WLocker l(lock);
-
   enabled = status;
 
   if (!enabled) {
@@ -277,27 +318,26 @@ void ObjectCache::set_enabled(bool status)
 
 void ObjectCache::invalidate_all()
 {
-  RWLock::WLocker l(lock);
-
   do_invalidate_all();
 }
 
 void ObjectCache::do_invalidate_all()
 {
-  cache_map.clear();
-  lru.clear();
-
-  lru_size = 0;
-  lru_counter = 0;
-  lru_window = 0;
+  for (auto& shard : shards) {
+    ShardLocker l(*shard, true);
+    shard->clock.clear();
+    shard->hand = shard->clock.end();
+    shard->cache_map.clear();
+    shard->logger->set(l_rgw_cache_shard_entries, 0);
+  }
 
+  RWLock::RLocker l(chained_lock);
   for (list<RGWChainedCache *>::iterator iter = chained_cache.begin(); iter != chained_cache.end(); ++iter) {
     (*iter)->invalidate_all();
   }
 }
 
 void ObjectCache::chain_cache(RGWChainedCache *cache) {
-  RWLock::WLocker l(lock);
+  RWLock::WLocker l(chained_lock);
   chained_cache.push_back(cache);
 }
-
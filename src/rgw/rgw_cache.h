@@ -5,8 +5,13 @@
 #define CEPH_RGWCACHE_H
 
 #include "rgw_rados.h"
+#include <atomic>
 #include <string>
 #include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <boost/intrusive/list.hpp>
 #include "include/types.h"
 #include "include/utime.h"
 #include "include/assert.h"
@@ -126,40 +131,95 @@ WRITE_CLASS_ENCODER(RGWCacheNotifyInfo)
 
 struct ObjectCacheEntry {
   ObjectCacheInfo info;
-  std::list<string>::iterator lru_iter;
-  uint64_t lru_promotion_ts;
+  const string *name;                          ///< key in the shard map
+  boost::intrusive::list_member_hook<> clock_item;
+  std::atomic<bool> referenced;                ///< CLOCK reference bit
   uint64_t gen;
   std::list<pair<RGWChainedCache *, string> > chained_entries;
 
-  ObjectCacheEntry() : lru_promotion_ts(0), gen(0) {}
+  ObjectCacheEntry() : name(NULL), referenced(false), gen(0) {}
 };
 
+enum {
+  l_rgw_cache_shard_first = 15500,
+  l_rgw_cache_shard_hit,
+  l_rgw_cache_shard_miss,
+  l_rgw_cache_shard_evict,
+  l_rgw_cache_shard_entries,
+  l_rgw_cache_shard_lock_wait,
+  l_rgw_cache_shard_last,
+};
+
+/**
+ * Cache of system objects (bucket and user metadata, zone config, ...)
+ *
+ * Entries are spread over rgw_cache_shards shards by name hash.  Each
+ * shard has its own lock, hash map and CLOCK ring.  A lookup takes its
+ * shard lock shared and only sets the entry's reference bit, so
+ * lookups never serialize behind each other.  An insert that takes the
+ * shard over its share of rgw_cache_lru_size sweeps the ring from the
+ * hand.  Referenced entries get a second chance; the first entry found
+ * without its bit set is evicted.
+ *
+ * Chained caches are invalidated after the shard lock is dropped.
+ */
 class ObjectCache {
-  std::map<string, ObjectCacheEntry> cache_map;
-  std::list<string> lru;
-  unsigned long lru_size;
-  unsigned long lru_counter;
-  unsigned long lru_window;
-  RWLock lock;
+  typedef boost::intrusive::list<
+    ObjectCacheEntry,
+    boost::intrusive::member_hook<
+      ObjectCacheEntry,
+      boost::intrusive::list_member_hook<>,
+      &ObjectCacheEntry::clock_item> > clock_list_t;
+  typedef std::list<pair<RGWChainedCache *, string> > chained_list_t;
+
+  struct Shard {
+    RWLock lock;
+    std::unordered_map<string, ObjectCacheEntry> cache_map;
+    clock_list_t clock;
+    clock_list_t::iterator hand;
+    PerfCounters *logger;
+
+    Shard() : lock("ObjectCache::Shard::lock", false), hand(clock.end()),
+	      logger(NULL) {}
+  };
+
+  /// shard lock that accounts for the time spent waiting for it
+  class ShardLocker {
+    Shard& shard;
+  public:
+    ShardLocker(Shard& shard, bool write);
+    ~ShardLocker() {
+      shard.lock.unlock();
+    }
+  };
+
+  std::vector<std::unique_ptr<Shard> > shards;
+  size_t shard_lru_size;
   CephContext *cct;
 
+  RWLock chained_lock;
   list<RGWChainedCache *> chained_cache;
 
-  bool enabled;
+  std::atomic<bool> enabled;
 
-  void touch_lru(string& name, ObjectCacheEntry& entry, std::list<string>::iterator& lru_iter);
-  void remove_lru(string& name, std::list<string>::iterator& lru_iter);
+  unsigned shard_of(const string& name) const {
+    return std::hash<string>()(name) % shards.size();
+  }
+  void do_put(Shard& shard, string& name, ObjectCacheInfo& info,
+	      rgw_cache_entry_info *cache_info, chained_list_t *invalidated);
+  void unlink(Shard& shard, ObjectCacheEntry& entry);
+  void evict(Shard& shard, ObjectCacheEntry& keep, chained_list_t *invalidated);
+  void invalidate_chained(chained_list_t& invalidated);
 
   void do_invalidate_all();
 public:
-  ObjectCache() : lru_size(0), lru_counter(0), lru_window(0), lock("ObjectCache"), cct(NULL), enabled(false) { }
+  ObjectCache() : shard_lru_size(0), cct(NULL),
+		  chained_lock("ObjectCache::chained_lock"), enabled(false) { }
+  ~ObjectCache();
   int get(std::string& name, ObjectCacheInfo& bl, uint32_t mask, rgw_cache_entry_info *cache_info);
   void put(std::string& name, ObjectCacheInfo& bl, rgw_cache_entry_info *cache_info);
   void remove(std::string& name);
-  void set_ctx(CephContext *_cct) {
-    cct = _cct;
-    lru_window = cct->_conf->rgw_cache_lru_size / 2;
-  }
+  void set_ctx(CephContext *_cct);
   bool chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_entries, RGWChainedCache::Entry *chained_entry);
 
   void set_enabled(bool status);
@@ -1136,6 +1136,44 @@ TEST(BufferListIterator, iterator_crc32c) {
   ASSERT_EQ(0u, it.get_remaining());
 }
 
+TEST(BufferListIterator, iterator_crc32c_blocks) {
+  // segments that end mid-block, on a block boundary, and hold many blocks
+  bufferlist bl;
+  unsigned seg_lens[] = { 10, 22, 64, 3, 37, 32 * 40, 24 };
+  for (unsigned len : seg_lens) {
+    bufferptr bp(len);
+    for (unsigned i = 0; i < len; ++i)
+      bp.c_str()[i] = rand();
+    bl.append(bp);
+  }
+  unsigned length = bl.length();
+  ASSERT_EQ(0u, length % 32);
+
+  for (unsigned block : { 1u, 4u, 32u }) {
+    unsigned n = length / block;
+    std::vector<uint32_t> crcs(n);
+    bufferlist::iterator it = bl.begin();
+    it.crc32c_blocks(block, n, 1234, &crcs[0]);
+    ASSERT_EQ(0u, it.get_remaining());
+    bufferlist::iterator p = bl.begin();
+    for (unsigned i = 0; i < n; ++i) {
+      ASSERT_EQ(p.crc32c(block, 1234), crcs[i]) << "block " << block
+						<< " i " << i;
+    }
+  }
+
+  // blocks past the end match what crc32c() gives there
+  uint32_t crcs[3];
+  bufferlist::iterator it = bl.begin();
+  it.advance(length - 20);
+  it.crc32c_blocks(16, 3, 0, crcs);
+  bufferlist::iterator p = bl.begin();
+  p.advance(length - 20);
+  ASSERT_EQ(p.crc32c(16, 0), crcs[0]);
+  ASSERT_EQ(p.crc32c(16, 0), crcs[1]);
+  ASSERT_EQ(0u, crcs[2]);
+}
+
 TEST(BufferListIterator, seek) {
   bufferlist bl;
   bl.append("ABC", 3);
@@ -1462,6 +1500,62 @@ TEST(BufferList, BenchAlloc) {
   bench_bufferlist_alloc(4, 100000, 16);
 }
 
+void bench_bufferlist_segments(int per, int num)
+{
+  bufferptr bp(buffer::create(64));
+  bp.zero();
+
+  utime_t start = ceph_clock_now();
+  for (int i=0; i<num; ++i) {
+    bufferlist bl;
+    for (int j=0; j<per; ++j)
+      bl.push_back(bp);
+  }
+  utime_t end = ceph_clock_now();
+  cout << num << " build of " << per << " segments"
+       << " in " << (end - start) << std::endl;
+
+  bufferlist src;
+  for (int j=0; j<per; ++j)
+    src.push_back(bp);
+  start = ceph_clock_now();
+  for (int i=0; i<num; ++i) {
+    bufferlist bl(src);
+    bufferlist moved(std::move(bl));
+  }
+  end = ceph_clock_now();
+  cout << num << " copy+move of " << per << " segments"
+       << " in " << (end - start) << std::endl;
+
+  start = ceph_clock_now();
+  unsigned len = 0;
+  for (int i=0; i<num; ++i) {
+    for (auto& p : src.buffers())
+      len += p.length();
+  }
+  end = ceph_clock_now();
+  ASSERT_EQ((unsigned)(num * per * 64), len);
+  cout << num << " walk of " << per << " segments"
+       << " in " << (end - start) << std::endl;
+
+  start = ceph_clock_now();
+  for (int i=0; i<num; ++i) {
+    bufferlist a(src), b(src);
+    a.claim_append(b);
+  }
+  end = ceph_clock_now();
+  cout << num << " claim_append of " << per << "+" << per << " segments"
+       << " in " << (end - start) << std::endl;
+}
+
+TEST(BufferList, BenchSegments) {
+  bench_bufferlist_segments(1, 1000000);
+  bench_bufferlist_segments(2, 1000000);
+  bench_bufferlist_segments(4, 1000000);
+  bench_bufferlist_segments(8, 1000000);
+  bench_bufferlist_segments(32, 100000);
+}
+
 TEST(BufferList, operator_equal) {
   //
   // list& operator= (const list& other)
@@ -1500,6 +1594,55 @@ TEST(BufferList, buffers) {
   ASSERT_EQ((unsigned)1, bl.get_num_buffers());
 }
 
+TEST(BufferList, buffers_spill) {
+  // grow past the inline segments, then copy, move and shrink
+  const unsigned n = bufferlist::buffers_t::INLINE_SEGMENTS * 3;
+  std::string expected;
+  bufferlist bl;
+  for (unsigned i = 0; i < n; ++i) {
+    bufferptr bp(1);
+    bp[0] = 'A' + i;
+    bl.push_back(bp);
+    expected += 'A' + i;
+  }
+  ASSERT_EQ(n, bl.get_num_buffers());
+  EXPECT_EQ(expected, bl.to_str());
+
+  bufferlist copy(bl);
+  EXPECT_EQ(n, copy.get_num_buffers());
+  EXPECT_EQ(expected, copy.to_str());
+  bufferlist moved(std::move(copy));
+  EXPECT_EQ(0u, copy.get_num_buffers());
+  EXPECT_EQ(expected, moved.to_str());
+
+  bufferptr front(1);
+  front[0] = '0';
+  moved.push_front(front);
+  EXPECT_EQ("0" + expected, moved.to_str());
+
+  bufferlist claimed;
+  moved.splice(1, n - 2, &claimed);
+  EXPECT_EQ(expected.substr(0, n - 2), claimed.to_str());
+  EXPECT_EQ("0" + expected.substr(n - 2), moved.to_str());
+
+  // an iterator stays valid across appends
+  bufferlist small;
+  small.append('x');
+  bufferlist::iterator p = small.begin();
+  p.advance(1);
+  for (unsigned i = 0; i < n; ++i)
+    small.append(bl.buffers().front());
+  char c;
+  p.copy(1, &c);
+  EXPECT_EQ('A', c);
+
+  bl.swap(small);
+  EXPECT_EQ(expected, small.to_str());
+  small.claim_append(bl);
+  EXPECT_EQ(2 * n + 1, small.get_num_buffers());
+  EXPECT_EQ(0u, bl.get_num_buffers());
+}
+
 TEST(BufferList, to_str) {
   {
     bufferlist bl;
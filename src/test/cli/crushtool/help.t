@@ -91,6 +91,8 @@
         [--simulate]       simulate placements using a random
                            number generator in place of the CRUSH
                            algorithm
+        [--bench-batch]    time batched CRUSH mapping against one
+                           mapping per input
      --show-utilization    show OSD usage
      --show-utilization-all
                            include zero weight items
@@ -359,3 +359,69 @@ TEST(Crc32c, zeros_performance) {
 
 }
 
+
+TEST(Crc32c, Multi) {
+  const unsigned max_n = 9;
+  const unsigned max_len = 4096 + 7;
+  std::vector<unsigned char> buf(max_n * (max_len + 1));
+  for (size_t i = 0; i < buf.size(); i++)
+    buf[i] = rand();
+
+  unsigned lengths[] = { 0, 1, 7, 8, 9, 15, 16, 17, 63, 64, 512, 4096, 4096 + 7 };
+  for (unsigned length : lengths) {
+    for (unsigned n = 0; n <= max_n; n++) {
+      // odd strides leave most of the buffers misaligned
+      unsigned char const *data[max_n];
+      uint32_t crcs[max_n];
+      for (unsigned i = 0; i < n; i++) {
+	data[i] = &buf[i * (length + 1)];
+	crcs[i] = i * 1234567;
+      }
+      ceph_crc32c_multi(crcs, data, length, n);
+      for (unsigned i = 0; i < n; i++) {
+	ASSERT_EQ(ceph_crc32c_sctp(i * 1234567, data[i], length), crcs[i])
+	  << "length " << length << " n " << n << " i " << i;
+      }
+    }
+  }
+}
+
+TEST(Crc32c, multi_performance) {
+  const unsigned n = 16;
+  const size_t total = 256 * 1024 * 1024;
+  unsigned block_sizes[] = { 64, 512, 4096, 65536 };
+  std::vector<unsigned char> buf(n * 65536);
+  for (size_t i = 0; i < buf.size(); i++)
+    buf[i] = i & 0xff;
+
+  for (unsigned bs : block_sizes) {
+    unsigned char const *data[n];
+    for (unsigned i = 0; i < n; i++)
+      data[i] = &buf[i * bs];
+    size_t iter = total / (n * bs);
+    uint32_t serial[n], multi[n];
+
+    utime_t start = ceph_clock_now();
+    for (size_t j = 0; j < iter; j++) {
+      for (unsigned i = 0; i < n; i++)
+	serial[i] = ceph_crc32c(j, data[i], bs);
+    }
+    utime_t end = ceph_clock_now();
+    float serial_rate = (float)total / (float)(1024*1024) / (float)(end - start);
+
+    start = ceph_clock_now();
+    for (size_t j = 0; j < iter; j++) {
+      for (unsigned i = 0; i < n; i++)
+	multi[i] = j;
+      ceph_crc32c_multi(multi, data, bs, n);
+    }
+    end = ceph_clock_now();
+    float multi_rate = (float)total / (float)(1024*1024) / (float)(end - start);
+
+    std::cout << n << " x " << bs << " byte blocks: ceph_crc32c = "
+	      << serial_rate << " MB/sec, ceph_crc32c_multi = " << multi_rate
+	      << " MB/sec (" << multi_rate / serial_rate << "x)" << std::endl;
+    for (unsigned i = 0; i < n; i++)
+      ASSERT_EQ(serial[i], multi[i]);
+  }
+}
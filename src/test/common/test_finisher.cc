@@ -0,0 +1,180 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "common/Finisher.h"
+#include "global/global_context.h"
+#include "include/coredumpctl.h"
+
+#include "gtest/gtest.h"
+
+struct C_Record : public Context {
+  std::vector<std::pair<int,int> > *done;
+  int id;
+  C_Record(std::vector<std::pair<int,int> > *done, int id)
+    : done(done), id(id) {}
+  void finish(int r) override {
+    done->push_back(std::make_pair(id, r));
+  }
+};
+
+TEST(Finisher, Order)
+{
+  Finisher finisher(g_ceph_context, "test", "fn_test");
+  finisher.start();
+
+  std::vector<std::pair<int,int> > done;
+  finisher.queue(new C_Record(&done, 0));
+  finisher.queue(new C_Record(&done, 1), -EIO);
+  vector<Context*> ls;
+  ls.push_back(new C_Record(&done, 2));
+  ls.push_back(new C_Record(&done, 3));
+  finisher.queue(ls);
+  ASSERT_TRUE(ls.empty());
+  list<Context*> ls2;
+  ls2.push_back(new C_Record(&done, 4));
+  finisher.queue(ls2);
+  finisher.queue(new C_Record(&done, 5), 1);
+
+  finisher.wait_for_empty();
+  finisher.stop();
+
+  ASSERT_EQ(6u, done.size());
+  for (int i = 0; i < 6; i++) {
+    ASSERT_EQ(i, done[i].first);
+  }
+  ASSERT_EQ(0, done[0].second);
+  ASSERT_EQ(-EIO, done[1].second);
+  ASSERT_EQ(0, done[3].second);
+  ASSERT_EQ(1, done[5].second);
+}
+
+TEST(Finisher, QueueTwice)
+{
+  // not started, so the context stays queued; as the oldest one it has
+  // no successor yet
+  Finisher finisher(g_ceph_context, "test", "fn_test");
+  std::vector<std::pair<int,int> > done;
+  C_Record *c = new C_Record(&done, 0);
+  PrCtl unset_dumpable;
+  EXPECT_DEATH({
+      finisher.queue(c);
+      finisher.queue(c);
+    }, ".*");
+  delete c;
+}
+
+struct C_Count : public Context {
+  std::atomic<int> *count;
+  explicit C_Count(std::atomic<int> *count) : count(count) {}
+  void finish(int r) override {
+    ++(*count);
+  }
+};
+
+TEST(Finisher, Producers)
+{
+  const int producers = 4;
+  const int per_producer = 20000;
+  Finisher finisher(g_ceph_context);
+  finisher.start();
+
+  // producers race with the finisher going to sleep; nothing may be lost
+  std::atomic<int> count{0};
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&finisher, &count] {
+      for (int i = 0; i < per_producer; i++) {
+	finisher.queue(new C_Count(&count));
+	if (i % 1000 == 0)
+	  std::this_thread::yield();
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  finisher.wait_for_empty();
+  ASSERT_EQ(producers * per_producer, count.load());
+
+  // and it still wakes up once idle
+  finisher.queue(new C_Count(&count));
+  finisher.wait_for_empty();
+  ASSERT_EQ(producers * per_producer + 1, count.load());
+  finisher.stop();
+}
+
+/// Reused rather than deleted, so the benchmark only pays for queueing.
+struct C_Reused : public Context {
+  std::atomic<int> *count;
+  explicit C_Reused(std::atomic<int> *count) : count(count) {}
+  void finish(int r) override {
+    ++(*count);
+  }
+  void complete(int r) override {
+    finish(r);
+  }
+};
+
+TEST(Finisher, Bench)
+{
+  const int producers = 4;
+  const int per_producer = 250000;
+  const int batch = 16;
+  std::atomic<int> count{0};
+  std::vector<std::vector<std::unique_ptr<C_Reused> > > contexts(producers);
+  for (auto& v : contexts) {
+    for (int i = 0; i < per_producer; i++)
+      v.emplace_back(new C_Reused(&count));
+  }
+
+  for (int b : {1, batch}) {
+    Finisher finisher(g_ceph_context);
+    finisher.start();
+    count = 0;
+
+    utime_t start = ceph_clock_now();
+    std::vector<std::thread> threads;
+    for (auto& v : contexts) {
+      threads.emplace_back([&finisher, &v, b] {
+	vector<Context*> ls;
+	for (auto& c : v) {
+	  if (b == 1) {
+	    finisher.queue(c.get());
+	    continue;
+	  }
+	  ls.push_back(c.get());
+	  if ((int)ls.size() == b)
+	    finisher.queue(ls);
+	}
+	finisher.queue(ls);
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    finisher.wait_for_empty();
+    utime_t elapsed = ceph_clock_now() - start;
+    finisher.stop();
+
+    ASSERT_EQ(producers * per_producer, count.load());
+    std::cout << producers << " producers, batches of " << b << ": "
+	      << (elapsed.to_nsec() / count.load()) << " ns/context, "
+	      << (uint64_t)(count.load() / (double)elapsed) << " contexts/s"
+	      << std::endl;
+  }
+}
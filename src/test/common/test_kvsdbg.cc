@@ -0,0 +1,111 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "gtest/gtest.h"
+#include "include/types.h"
+#include "include/msgr.h"
+#include "common/ceph_context.h"
+#include "common/config.h"
+#include "common/Formatter.h"
+#include "common/kvsdbg.h"
+
+#include <sstream>
+#include <thread>
+
+static size_t count_events(KvsTrace &t, uint64_t max_events = 0)
+{
+  JSONFormatter f;
+  t.dump(&f, max_events);
+  std::stringstream ss;
+  f.flush(ss);
+  std::string s = ss.str();
+  size_t n = 0;
+  for (size_t pos = s.find("\"stamp_ns\""); pos != std::string::npos;
+       pos = s.find("\"stamp_ns\"", pos + 1))
+    n++;
+  return n;
+}
+
+TEST(KvsTraceRing, wrap)
+{
+  KvsTraceRing r(0, 10);
+  ASSERT_EQ(16u, r.events.size());
+  for (uint64_t i = 0; i < 40; i++)
+    r.add(KVS_EV_MSG, i, "x", i, 0);
+  std::vector<kvs_trace_event_t> out;
+  r.snapshot(out);
+  ASSERT_EQ(16u, out.size());
+  for (uint64_t i = 0; i < 16; i++) {
+    ASSERT_EQ(24 + i, out[i].id);
+    if (i) {
+      ASSERT_LE(out[i - 1].stamp, out[i].stamp);
+    }
+  }
+}
+
+TEST(KvsTrace, enable_dump_reset)
+{
+  CephContext *cct = (new CephContext(CEPH_ENTITY_TYPE_CLIENT))->get();
+  KvsTrace &t = cct->kvsdbg;
+
+  KVS_TRACE(cct, KVS_EV_TXC_STATE, 1, "prepare", 0, 0);
+  ASSERT_EQ(0u, count_events(t));
+
+  cct->_conf->set_val("kvsdbg_trace", "true");
+  cct->_conf->apply_changes(nullptr);
+  ASSERT_TRUE(t.enabled());
+
+  KVS_TRACE(cct, KVS_EV_TXC_STATE, 1, "prepare", 0, 0);
+  {
+    KVS_FTRACE_SCOPE(cct);
+  }
+  std::thread th([cct]() {
+    for (int i = 0; i < 10; i++)
+      KVS_TRACE(cct, KVS_EV_TXC_AIO_DONE, i, nullptr, 0, 0);
+  });
+  th.join();
+  ASSERT_EQ(13u, count_events(t));
+  ASSERT_EQ(5u, count_events(t, 5));
+
+  t.reset();
+  ASSERT_EQ(0u, count_events(t));
+  KVS_TRACE(cct, KVS_EV_TXC_STATE, 1, "done", 0, 0);
+  ASSERT_EQ(1u, count_events(t));
+
+  cct->put();
+}
+
+TEST(KvsTrace, thread_exit)
+{
+  CephContext *cct = (new CephContext(CEPH_ENTITY_TYPE_CLIENT))->get();
+  KvsTrace &t = cct->kvsdbg;
+  t.set_enabled(true);
+
+  KVS_TRACE(cct, KVS_EV_MSG, 0, "main", 0, 0);
+  ASSERT_EQ(1u, t.num_rings());
+
+  // an exited thread's ring is kept for dumps and handed to the next thread
+  for (int i = 0; i < 20; i++) {
+    std::thread th([cct]() {
+      KVS_TRACE(cct, KVS_EV_MSG, 0, "worker", 0, 0);
+    });
+    th.join();
+  }
+  ASSERT_EQ(2u, t.num_rings());
+  ASSERT_EQ(2u, count_events(t));
+
+  // concurrent threads retire more rings than are kept
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < KvsTrace::MAX_RETIRED_RINGS * 2; i++) {
+    threads.emplace_back([cct]() {
+      KVS_TRACE(cct, KVS_EV_MSG, 0, "worker", 0, 0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    });
+  }
+  for (auto &th : threads)
+    th.join();
+  ASSERT_EQ(1u + KvsTrace::MAX_RETIRED_RINGS, t.num_rings());
+  ASSERT_EQ(1u + KvsTrace::MAX_RETIRED_RINGS, count_events(t));
+
+  cct->put();
+}
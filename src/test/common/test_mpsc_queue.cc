@@ -0,0 +1,76 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <thread>
+#include <vector>
+
+#include "common/mpsc_queue.h"
+
+#include "gtest/gtest.h"
+
+struct node {
+  int producer;
+  int seq;
+  node *next = nullptr;
+  node(int p, int s) : producer(p), seq(s) {}
+};
+
+TEST(MPSCQueue, Order)
+{
+  ceph::mpsc_queue<node> q;
+  ASSERT_TRUE(q.empty());
+  ASSERT_EQ(nullptr, q.pop_all());
+  node a(0, 0), b(0, 1), c(0, 2);
+  ASSERT_TRUE(q.push(&a));
+  ASSERT_FALSE(q.push(&b));
+  ASSERT_FALSE(q.push(&c));
+  ASSERT_FALSE(q.empty());
+  node *n = q.pop_all();
+  ASSERT_EQ(&a, n);
+  ASSERT_EQ(&b, n->next);
+  ASSERT_EQ(&c, n->next->next);
+  ASSERT_EQ(nullptr, n->next->next->next);
+  ASSERT_TRUE(q.empty());
+  ASSERT_TRUE(q.push(&a));
+}
+
+TEST(MPSCQueue, Producers)
+{
+  const int producers = 4;
+  const int per_producer = 100000;
+  ceph::mpsc_queue<node> q;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&q, p] {
+      for (int i = 0; i < per_producer; i++)
+        q.push(new node(p, i));
+    });
+  }
+
+  // each producer's nodes come out in the order it pushed them
+  std::vector<int> next(producers, 0);
+  int got = 0;
+  while (got < producers * per_producer) {
+    node *n = q.pop_all();
+    while (n) {
+      node *following = n->next;
+      ASSERT_EQ(next[n->producer], n->seq);
+      next[n->producer]++;
+      got++;
+      delete n;
+      n = following;
+    }
+  }
+  for (auto &t : threads)
+    t.join();
+  ASSERT_TRUE(q.empty());
+}
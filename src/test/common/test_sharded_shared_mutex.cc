@@ -0,0 +1,90 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/thread/shared_mutex.hpp>
+
+#include "common/sharded_shared_mutex.h"
+
+#include "gtest/gtest.h"
+
+using ceph::sharded_shared_mutex;
+
+TEST(ShardedSharedMutex, Exclusive)
+{
+  sharded_shared_mutex m;
+  m.lock();
+  // neither kind of lock can be had from any thread
+  for (int i = 0; i < sharded_shared_mutex::num_shards * 2; ++i) {
+    ASSERT_FALSE(std::async(std::launch::async, [&m] {
+	  if (m.try_lock_shared()) {
+	    m.unlock_shared();
+	    return true;
+	  }
+	  return false;
+	}).get());
+  }
+  ASSERT_FALSE(std::async(std::launch::async, [&m] {
+	return m.try_lock();
+      }).get());
+  m.unlock();
+  ASSERT_TRUE(m.try_lock());
+  m.unlock();
+}
+
+TEST(ShardedSharedMutex, Shared)
+{
+  sharded_shared_mutex m;
+  boost::shared_lock<sharded_shared_mutex> l(m);
+  // other readers get in, a writer does not
+  ASSERT_TRUE(std::async(std::launch::async, [&m] {
+	if (m.try_lock_shared()) {
+	  m.unlock_shared();
+	  return true;
+	}
+	return false;
+      }).get());
+  ASSERT_FALSE(std::async(std::launch::async, [&m] {
+	return m.try_lock();
+      }).get());
+  l.unlock();
+  ASSERT_TRUE(m.try_lock());
+  m.unlock();
+}
+
+TEST(ShardedSharedMutex, Counter)
+{
+  sharded_shared_mutex m;
+  uint64_t counter = 0;
+  const int threads = 8;
+  const int loops = 10000;
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&] {
+	for (int i = 0; i < loops; ++i) {
+	  {
+	    std::unique_lock<sharded_shared_mutex> wl(m);
+	    ++counter;
+	  }
+	  boost::shared_lock<sharded_shared_mutex> rl(m);
+	  ASSERT_GT(counter, 0u);
+	}
+      });
+  }
+  for (auto& t : workers)
+    t.join();
+  ASSERT_EQ((uint64_t)threads * loops, counter);
+}
@@ -637,3 +637,57 @@ TEST(CRUSH, straw2_reweight) {
     cout << "     vs " << estddev << std::endl;
   }
 }
+
+TEST(CRUSH, straw2_batch) {
+  // the batched mapper swaps the straw2 division for a reciprocal
+  // multiply; it must give exactly what the per-input mapper gives.
+  std::unique_ptr<CrushWrapper> c(new CrushWrapper);
+  c->set_type_name(2, "root");
+  c->set_type_name(1, "host");
+  c->set_type_name(0, "osd");
+
+  const int num_host = 10, num_osd = 12;
+  int hosts[num_host], host_weights[num_host];
+  int osd = 0;
+  for (int h = 0; h < num_host; ++h) {
+    int items[num_osd], weights[num_osd];
+    for (int o = 0; o < num_osd; ++o, ++osd) {
+      items[o] = osd;
+      weights[o] = (o == 3) ? 0 : 1 + rand() % 0x100000;
+    }
+    crush_bucket *b = crush_make_bucket(c->get_crush_map(),
+					CRUSH_BUCKET_STRAW2,
+					CRUSH_HASH_RJENKINS1,
+					1, num_osd, items, weights);
+    ASSERT_EQ(0, crush_add_bucket(c->get_crush_map(), 0, b, &hosts[h]));
+    c->set_item_name(hosts[h], string("host-") + stringify(h));
+    host_weights[h] = b->weight;
+  }
+  c->set_max_devices(osd);
+  int root;
+  crush_bucket *b = crush_make_bucket(c->get_crush_map(),
+				      CRUSH_BUCKET_STRAW2, CRUSH_HASH_RJENKINS1,
+				      2, num_host, hosts, host_weights);
+  ASSERT_EQ(0, crush_add_bucket(c->get_crush_map(), 0, b, &root));
+  c->set_item_name(root, "default");
+  int rule = c->add_simple_rule("rule", "default", "host", "",
+				"firstn", pg_pool_t::TYPE_REPLICATED);
+  ASSERT_EQ(0, rule);
+  c->finalize();
+
+  vector<unsigned> reweight(osd, 0x10000);
+  reweight[5] = 0x8000;
+  reweight[17] = 0;
+
+  vector<int> xs;
+  for (int x = 0; x < 100000; ++x)
+    xs.push_back(x);
+  vector<int> out, out_len;
+  ASSERT_EQ(0, c->do_rule_batch(rule, xs, 3, reweight, 0, &out, &out_len));
+  for (unsigned i = 0; i < xs.size(); ++i) {
+    vector<int> expected;
+    c->do_rule(rule, xs[i], expected, 3, reweight, 0);
+    ASSERT_EQ(expected,
+	      vector<int>(out.begin() + i * 3, out.begin() + i * 3 + out_len[i]));
+  }
+}
@@ -137,6 +137,9 @@ TYPE(bluestore_deferred_transaction_t)
 
 #include "os/kvsstore/kvsstore_types.h"
 TYPE(kvsstore_onode_t)
+TYPE(kvsstore_pglog_meta_t)
+TYPE(kvsstore_pool_stat_t)
+TYPE(kvsstore_statfs_t)
 
 #include "common/hobject.h"
 TYPE(hobject_t)
@@ -129,6 +129,80 @@ TYPED_TEST(ErasureCodeTest, encode_decode)
   }
 }
 
+TYPED_TEST(ErasureCodeTest, encode_decode_stripes)
+{
+  TypeParam jerasure;
+  ErasureCodeProfile profile;
+  profile["k"] = "2";
+  profile["m"] = "2";
+  profile["packetsize"] = "8";
+  jerasure.init(profile, &cerr);
+
+  const unsigned stripe_width = 4096;
+  const unsigned stripes = 3;
+  unsigned chunk_size = jerasure.get_chunk_size(stripe_width);
+  ASSERT_EQ(stripe_width, 2 * chunk_size);
+  bufferptr in_ptr(buffer::create_page_aligned(stripe_width * stripes));
+  for (unsigned i = 0; i < in_ptr.length(); i++)
+    in_ptr.c_str()[i] = 'A' + i % 61;
+  bufferlist in;
+  in.push_back(in_ptr);
+  set<int> want_to_encode = { 0, 1, 2, 3 };
+
+  // one stripe at a time, appended chunk by chunk
+  map<int, bufferlist> expected;
+  for (unsigned i = 0; i < stripes; i++) {
+    bufferlist stripe;
+    stripe.substr_of(in, i * stripe_width, stripe_width);
+    map<int, bufferlist> encoded;
+    EXPECT_EQ(0, jerasure.encode(want_to_encode, stripe, &encoded));
+    for (auto &j : encoded)
+      expected[j.first].claim_append(j.second);
+  }
+
+  // all the stripes with a single call
+  map<int, bufferlist> encoded;
+  for (unsigned i = 0; i < stripes; i++) {
+    for (unsigned j = 0; j < 2; j++) {
+      bufferlist chunk;
+      chunk.substr_of(in, i * stripe_width + j * chunk_size, chunk_size);
+      encoded[j].claim_append(chunk);
+    }
+  }
+  EXPECT_EQ(0, jerasure.encode_stripes(want_to_encode, chunk_size, &encoded));
+  EXPECT_EQ(4u, encoded.size());
+  for (auto &j : expected)
+    EXPECT_TRUE(j.second.contents_equal(encoded[j.first]));
+
+  // the lengths must be whole stripes
+  {
+    map<int, bufferlist> partial;
+    partial[0].substr_of(in, 0, chunk_size + 1);
+    partial[1].substr_of(in, 0, chunk_size + 1);
+    EXPECT_EQ(-EINVAL,
+	      jerasure.encode_stripes(want_to_encode, chunk_size, &partial));
+  }
+
+  // two chunks are missing
+  {
+    map<int, bufferlist> degraded = encoded;
+    degraded.erase(0);
+    degraded.erase(1);
+    map<int, bufferlist> decoded;
+    EXPECT_EQ(0, jerasure.decode_stripes(set<int>{ 0, 1 }, chunk_size,
+					 degraded, &decoded));
+    bufferlist data;
+    for (unsigned i = 0; i < stripes; i++) {
+      for (unsigned j = 0; j < 2; j++) {
+	bufferlist chunk;
+	chunk.substr_of(decoded[j], i * chunk_size, chunk_size);
+	data.claim_append(chunk);
+      }
+    }
+    EXPECT_TRUE(data.contents_equal(in));
+  }
+}
+
 TYPED_TEST(ErasureCodeTest, minimum_to_decode)
 {
   TypeParam jerasure;
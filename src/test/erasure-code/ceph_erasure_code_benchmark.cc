@@ -61,6 +61,11 @@ int ErasureCodeBench::setup(int argc, char** argv) {
      " the first chunk, then the second etc.)")
     ("parameter,P", po::value<vector<string> >(),
      "add a parameter to the erasure code profile")
+    ("stripe-width,S", po::value<int>()->default_value(0),
+     "if not zero, split the buffer into stripes of this size and code "
+     "them one after the other")
+    ("batch,b", "with --stripe-width, code all the stripes with a single "
+     "encode_stripes/decode_stripes call")
     ;
 
   po::variables_map vm;
@@ -132,6 +137,14 @@ int ErasureCodeBench::setup(int argc, char** argv) {
     return -EINVAL;
   } 
 
+  stripe_width = vm["stripe-width"].as<int>();
+  batch = vm.count("batch") > 0;
+  if (stripe_width < 0 || (stripe_width > 0 && in_size % stripe_width)) {
+    cout << "size " << in_size << " is not a multiple of the stripe width "
+	 << stripe_width << endl;
+    return -EINVAL;
+  }
+
   verbose = vm.count("verbose") > 0 ? true : false;
 
   return 0;
@@ -179,7 +192,7 @@ int ErasureCodeBench::encode()
   utime_t begin_time = ceph_clock_now();
   for (int i = 0; i < max_iterations; i++) {
     map<int,bufferlist> encoded;
-    code = erasure_code->encode(want_to_encode, in, &encoded);
+    code = encode_buffer(erasure_code, want_to_encode, in, &encoded);
     if (code)
       return code;
   }
@@ -188,6 +201,80 @@ int ErasureCodeBench::encode()
   return 0;
 }
 
+/*
+ * With --stripe-width the chunks hold the chunk of every stripe back
+ * to back, as encode_stripes lays them out, however they were coded.
+ */
+int ErasureCodeBench::encode_buffer(ErasureCodeInterfaceRef erasure_code,
+				    const set<int> &want_to_encode,
+				    const bufferlist &in,
+				    map<int,bufferlist> *encoded)
+{
+  if (stripe_width == 0)
+    return erasure_code->encode(want_to_encode, in, encoded);
+
+  unsigned chunk_size = erasure_code->get_chunk_size(stripe_width);
+  if (chunk_size * k != (unsigned)stripe_width) {
+    cerr << "stripe width " << stripe_width << " is not "
+	 << k << " chunks of " << chunk_size << " bytes" << endl;
+    return -EINVAL;
+  }
+  const vector<int> &chunk_mapping = erasure_code->get_chunk_mapping();
+  if (batch) {
+    for (unsigned off = 0; off < in.length(); off += stripe_width) {
+      for (int j = 0; j < k; j++) {
+	int chunk = chunk_mapping.size() > (unsigned)j ? chunk_mapping[j] : j;
+	bufferlist bl;
+	bl.substr_of(in, off + j * chunk_size, chunk_size);
+	(*encoded)[chunk].claim_append(bl);
+      }
+    }
+    return erasure_code->encode_stripes(want_to_encode, chunk_size, encoded);
+  }
+  for (unsigned off = 0; off < in.length(); off += stripe_width) {
+    bufferlist stripe;
+    stripe.substr_of(in, off, stripe_width);
+    map<int,bufferlist> out;
+    int code = erasure_code->encode(want_to_encode, stripe, &out);
+    if (code)
+      return code;
+    for (map<int,bufferlist>::iterator i = out.begin(); i != out.end(); ++i)
+      (*encoded)[i->first].claim_append(i->second);
+  }
+  return 0;
+}
+
+int ErasureCodeBench::decode_buffer(ErasureCodeInterfaceRef erasure_code,
+				    const set<int> &want_to_read,
+				    const map<int,bufferlist> &chunks,
+				    map<int,bufferlist> *decoded)
+{
+  if (stripe_width == 0)
+    return erasure_code->decode(want_to_read, chunks, decoded);
+
+  unsigned chunk_size = erasure_code->get_chunk_size(stripe_width);
+  if (batch)
+    return erasure_code->decode_stripes(want_to_read, chunk_size,
+					chunks, decoded);
+  unsigned length = chunks.begin()->second.length();
+  for (unsigned off = 0; off < length; off += chunk_size) {
+    map<int,bufferlist> stripe;
+    for (map<int,bufferlist>::const_iterator i = chunks.begin();
+	 i != chunks.end();
+	 ++i)
+      stripe[i->first].substr_of(i->second, off, chunk_size);
+    map<int,bufferlist> out;
+    int code = erasure_code->decode(want_to_read, stripe, &out);
+    if (code)
+      return code;
+    for (set<int>::const_iterator i = want_to_read.begin();
+	 i != want_to_read.end();
+	 ++i)
+      (*decoded)[*i].claim_append(out[*i]);
+  }
+  return 0;
+}
+
 static void display_chunks(const map<int,bufferlist> &chunks,
 			   unsigned int chunk_count) {
   cout << "chunks ";
@@ -219,7 +306,7 @@ int ErasureCodeBench::decode_erasures(const map<int,bufferlist> &all_chunks,
 	want_to_read.insert(chunk);
 
     map<int,bufferlist> decoded;
-    code = erasure_code->decode(want_to_read, chunks, &decoded);
+    code = decode_buffer(erasure_code, want_to_read, chunks, &decoded);
     if (code)
       return code;
     for (set<int>::iterator chunk = want_to_read.begin();
@@ -281,7 +368,7 @@ int ErasureCodeBench::decode()
   }
 
   map<int,bufferlist> encoded;
-  code = erasure_code->encode(want_to_encode, in, &encoded);
+  code = encode_buffer(erasure_code, want_to_encode, in, &encoded);
   if (code)
     return code;
 
@@ -303,7 +390,7 @@ int ErasureCodeBench::decode()
 	return code;
     } else if (erased.size() > 0) {
       map<int,bufferlist> decoded;
-      code = erasure_code->decode(want_to_read, encoded, &decoded);
+      code = decode_buffer(erasure_code, want_to_read, encoded, &decoded);
       if (code)
 	return code;
     } else {
@@ -316,7 +403,7 @@ int ErasureCodeBench::decode()
 	chunks.erase(erasure);
       }
       map<int,bufferlist> decoded;
-      code = erasure_code->decode(want_to_read, chunks, &decoded);
+      code = decode_buffer(erasure_code, want_to_read, chunks, &decoded);
       if (code)
 	return code;
     }
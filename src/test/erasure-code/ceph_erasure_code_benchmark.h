@@ -34,6 +34,8 @@ class ErasureCodeBench {
   bool exhaustive_erasures;
   vector<int> erased;
   string workload;
+  int stripe_width;
+  bool batch;
 
   ErasureCodeProfile profile;
 
@@ -47,6 +49,14 @@ public:
 		      unsigned i,
 		      unsigned want_erasures,
 		      ErasureCodeInterfaceRef erasure_code);
+  int encode_buffer(ErasureCodeInterfaceRef erasure_code,
+		    const set<int> &want_to_encode,
+		    const bufferlist &in,
+		    map<int,bufferlist> *encoded);
+  int decode_buffer(ErasureCodeInterfaceRef erasure_code,
+		    const set<int> &want_to_read,
+		    const map<int,bufferlist> &chunks,
+		    map<int,bufferlist> *decoded);
   int decode();
   int encode();
 };
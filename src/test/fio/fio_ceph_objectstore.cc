@@ -8,10 +8,13 @@
  *
  */
 
+#include <atomic>
 #include <memory>
 #include <system_error>
 #include <vector>
 
+#include <sys/resource.h>
+
 #include "os/ObjectStore.h"
 #include "global/global_init.h"
 #include "common/errno.h"
@@ -33,6 +36,13 @@ namespace {
 struct Options {
   thread_data* td;
   char* conf;
+  unsigned osd_txn;
+  unsigned oi_attr_len;
+  unsigned pglog_omap_len;
+  unsigned pglog_max_entries;
+  unsigned pglog_trim_batch;
+  unsigned pginfo_omap_len;
+  unsigned pginfo_full_pct;
 };
 
 template <class Func> // void Func(fio_option&)
@@ -54,9 +64,75 @@ static std::vector<fio_option> ceph_options{
     o.help   = "Path to a ceph configuration file";
     o.off1   = offsetof(Options, conf);
   }),
+  make_option([] (fio_option& o) {
+    o.name   = "osd_txn";
+    o.lname  = "OSD-shaped transactions";
+    o.type   = FIO_OPT_BOOL;
+    o.help   = "Add the object info, pg log and pg info updates an OSD issues with each write";
+    o.off1   = offsetof(Options, osd_txn);
+    o.def    = "0";
+  }),
+  make_option([] (fio_option& o) {
+    o.name   = "oi_attr_len";
+    o.lname  = "object info attr length";
+    o.type   = FIO_OPT_INT;
+    o.help   = "Length of the '_' attribute set on each written object (0 to skip)";
+    o.off1   = offsetof(Options, oi_attr_len);
+    o.def    = "256";
+  }),
+  make_option([] (fio_option& o) {
+    o.name   = "pglog_omap_len";
+    o.lname  = "pg log entry length";
+    o.type   = FIO_OPT_INT;
+    o.help   = "Length of the pg log entry added to the pgmeta omap per write (0 to skip)";
+    o.off1   = offsetof(Options, pglog_omap_len);
+    o.def    = "180";
+  }),
+  make_option([] (fio_option& o) {
+    o.name   = "pglog_max_entries";
+    o.lname  = "pg log length";
+    o.type   = FIO_OPT_INT;
+    o.help   = "Number of pg log entries kept per collection before trimming";
+    o.off1   = offsetof(Options, pglog_max_entries);
+    o.def    = "3000";
+  }),
+  make_option([] (fio_option& o) {
+    o.name   = "pglog_trim_batch";
+    o.lname  = "pg log trim batch";
+    o.type   = FIO_OPT_INT;
+    o.help   = "Number of pg log entries removed by a single trim";
+    o.off1   = offsetof(Options, pglog_trim_batch);
+    o.def    = "100";
+  }),
+  make_option([] (fio_option& o) {
+    o.name   = "pginfo_omap_len";
+    o.lname  = "pg info length";
+    o.type   = FIO_OPT_INT;
+    o.help   = "Length of the _info/_fastinfo pgmeta omap value written per write (0 to skip)";
+    o.off1   = offsetof(Options, pginfo_omap_len);
+    o.def    = "186";
+  }),
+  make_option([] (fio_option& o) {
+    o.name   = "pginfo_full_pct";
+    o.lname  = "full pg info ratio";
+    o.type   = FIO_OPT_INT;
+    o.help   = "Percentage of writes that rewrite _info instead of _fastinfo";
+    o.off1   = offsetof(Options, pginfo_full_pct);
+    o.def    = "10";
+    o.maxval = 100;
+  }),
   {} // fio expects a 'null'-terminated list
 };
 
+enum {
+  l_fio_os_first = 951000,
+  l_fio_os_write_lat,
+  l_fio_os_osd_write_lat,
+  l_fio_os_pglog_trim_lat,
+  l_fio_os_read_lat,
+  l_fio_os_last,
+};
+
 
 /// global engine state shared between all jobs within the process. this
 /// includes g_ceph_context and the ObjectStore instance
@@ -64,6 +140,11 @@ struct Engine {
   /// the initial g_ceph_context reference to be dropped on destruction
   boost::intrusive_ptr<CephContext> cct;
   std::unique_ptr<ObjectStore> os;
+  /// per-op-type latencies, dumped with the other perf counters
+  PerfCounters* logger = nullptr;
+  /// ios issued since mount, and the process cpu time used by then
+  std::atomic<uint64_t> num_ios = {0};
+  double mount_cpu = 0;
 
   std::mutex lock;
   int ref_count;
@@ -71,6 +152,14 @@ struct Engine {
   Engine(const thread_data* td);
   ~Engine();
 
+  /// user plus system cpu seconds used by this process so far
+  static double process_cpu() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+      (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+  }
+
   static Engine* get_instance(thread_data* td) {
     // note: creates an Engine with the options associated with the first job
     static Engine engine(td);
@@ -90,6 +179,12 @@ struct Engine {
       cct->get_perfcounters_collection()->dump_formatted(f, false);
       ostr << "FIO plugin ";
       f->flush(ostr);
+      const uint64_t ios = num_ios.load();
+      if (ios) {
+        const double cpu = process_cpu() - mount_cpu;
+        ostr << "FIO cpu " << cpu << "s (usr+sys) over " << ios << " ios, "
+             << cpu * 1000000 / ios << "us per io ";
+      }
       if (g_conf->rocksdb_perf) {
         os->get_db_statistics(f);
         ostr << "FIO get_db_statistics ";
@@ -123,6 +218,19 @@ Engine::Engine(const thread_data* td) : ref_count(0)
 			 CODE_ENVIRONMENT_UTILITY, 0);
   common_init_finish(g_ceph_context);
 
+  PerfCountersBuilder b(g_ceph_context, "fio_ceph_objectstore",
+                        l_fio_os_first, l_fio_os_last);
+  b.add_time_avg(l_fio_os_write_lat, "write_lat",
+                 "Average latency of a data write transaction");
+  b.add_time_avg(l_fio_os_osd_write_lat, "osd_write_lat",
+                 "Average latency of a data write with OSD metadata");
+  b.add_time_avg(l_fio_os_pglog_trim_lat, "pglog_trim_lat",
+                 "Average latency of an OSD write that also trims the pg log");
+  b.add_time_avg(l_fio_os_read_lat, "read_lat",
+                 "Average latency of a read");
+  logger = b.create_perf_counters();
+  g_ceph_context->get_perfcounters_collection()->add(logger);
+
   // create the ObjectStore
   os.reset(ObjectStore::create(g_ceph_context,
                                g_conf->osd_objectstore,
@@ -147,24 +255,33 @@ Engine::Engine(const thread_data* td) : ref_count(0)
   r = os->mount();
   if (r < 0)
     throw std::system_error(-r, std::system_category(), "mount failed");
+  mount_cpu = process_cpu();
 }
 
 Engine::~Engine()
 {
   assert(!ref_count);
+  if (logger) {
+    cct->get_perfcounters_collection()->remove(logger);
+    delete logger;
+  }
 }
 
 
 struct Collection {
   spg_t pg;
   coll_t cid;
+  ghobject_t pgmeta_oid; //< holds the pg log and pg info in osd_txn mode
   ObjectStore::Sequencer sequencer;
+  uint64_t pglog_head = 0; //< next pg log version to write
+  uint64_t pglog_tail = 0; //< oldest pg log version not yet trimmed
 
   // use big pool ids to avoid clashing with existing collections
   static constexpr int64_t MIN_POOL_ID = 0x0000ffffffffffff;
 
   Collection(const spg_t& pg)
-    : pg(pg), cid(pg), sequencer(stringify(pg)) {
+    : pg(pg), cid(pg), pgmeta_oid(pg.make_pgmeta_oid()),
+      sequencer(stringify(pg)) {
     sequencer.shard_hint = pg;
   }
 };
@@ -185,17 +302,31 @@ struct Job {
   std::vector<Object> objects; //< associate an object with each fio_file
   std::vector<io_u*> events; //< completions for fio_ceph_os_event()
   const bool unlink; //< unlink objects on destruction
+  const Options* options;
+  bufferlist oi_attr; //< stands in for the object_info_t attr
+  bufferlist pglog_entry; //< stands in for an encoded pg_log_entry_t
+  bufferlist pginfo; //< stands in for an encoded pg_info_t
 
   Job(Engine* engine, const thread_data* td);
   ~Job();
+
+  /// adds what an OSD writes alongside the data. returns true if the pg log
+  /// was trimmed as well
+  bool add_osd_metadata(ObjectStore::Transaction& t, Object& object);
 };
 
 Job::Job(Engine* engine, const thread_data* td)
   : engine(engine),
     events(td->o.iodepth),
-    unlink(td->o.unlink)
+    unlink(td->o.unlink),
+    options(static_cast<const Options*>(td->eo))
 {
   engine->ref();
+  if (options->osd_txn) {
+    oi_attr.append_zero(options->oi_attr_len);
+    pglog_entry.append_zero(options->pglog_omap_len);
+    pginfo.append_zero(options->pginfo_omap_len);
+  }
   // use the fio thread_number for our unique pool id
   const uint64_t pool = Collection::MIN_POOL_ID + td->thread_number;
 
@@ -217,6 +348,8 @@ Job::Job(Engine* engine, const thread_data* td)
     auto& cid = collections.back().cid;
     if (!engine->os->collection_exists(cid))
       t.create_collection(cid, split_bits);
+    if (options->osd_txn)
+      t.touch(cid, collections.back().pgmeta_oid);
   }
 
   const uint64_t file_size = td->o.size / max(1u, td->o.nr_files);
@@ -256,6 +389,8 @@ Job::~Job()
     }
     // remove our collections
     for (auto& coll : collections) {
+      if (options->osd_txn)
+        t.remove(coll.cid, coll.pgmeta_oid);
       t.remove_collection(coll.cid);
     }
     ObjectStore::Sequencer sequencer("job cleanup");
@@ -267,6 +402,43 @@ Job::~Job()
 }
 
 
+bool Job::add_osd_metadata(ObjectStore::Transaction& t, Object& object)
+{
+  auto& coll = object.coll;
+  bool trimmed = false;
+
+  if (options->oi_attr_len) {
+    t.setattr(coll.cid, object.oid, "_", oi_attr);
+  }
+
+  map<string, bufferlist> keys;
+  if (options->pglog_omap_len) {
+    keys[eversion_t(1, ++coll.pglog_head).get_key_name()] = pglog_entry;
+  }
+  if (options->pginfo_omap_len) {
+    // the OSD rewrites the full _info only when more than the stats changed
+    if (coll.pglog_head % 100 < options->pginfo_full_pct)
+      keys["_info"] = pginfo;
+    else
+      keys["_fastinfo"] = pginfo;
+  }
+  if (!keys.empty()) {
+    t.omap_setkeys(coll.cid, coll.pgmeta_oid, keys);
+  }
+
+  if (options->pglog_omap_len &&
+      coll.pglog_head - coll.pglog_tail > options->pglog_max_entries) {
+    set<string> trim;
+    for (unsigned i = 0; i < max(1u, options->pglog_trim_batch); i++) {
+      trim.insert(eversion_t(1, ++coll.pglog_tail).get_key_name());
+    }
+    t.omap_rmkeys(coll.cid, coll.pgmeta_oid, trim);
+    trimmed = true;
+  }
+  return trimmed;
+}
+
+
 int fio_ceph_os_setup(thread_data* td)
 {
   // if there are multiple jobs, they must run in the same process against a
@@ -332,9 +504,14 @@ int fio_ceph_os_getevents(thread_data* td, unsigned int min,
 /// completion context for ObjectStore::queue_transaction()
 class UnitComplete : public Context {
   io_u* u;
+  PerfCounters* logger;
+  int idx; //< latency counter for this op type
+  utime_t start;
  public:
-  UnitComplete(io_u* u) : u(u) {}
+  UnitComplete(io_u* u, PerfCounters* logger, int idx)
+    : u(u), logger(logger), idx(idx), start(ceph_clock_now()) {}
   void finish(int r) {
+    logger->tinc(idx, ceph_clock_now() - start);
     // mark the pointer to indicate completion for fio_ceph_os_getevents()
     u->engine_data = reinterpret_cast<void*>(1ull);
   }
@@ -348,6 +525,7 @@ int fio_ceph_os_queue(thread_data* td, io_u* u)
   auto& object = job->objects[u->file->engine_pos];
   auto& coll = object.coll;
   auto& os = job->engine->os;
+  ++job->engine->num_ios;
 
   if (u->ddir == DDIR_WRITE) {
     // provide a hint if we're likely to read this data back
@@ -360,17 +538,25 @@ int fio_ceph_os_queue(thread_data* td, io_u* u)
     // enqueue a write transaction on the collection's sequencer
     ObjectStore::Transaction t;
     t.write(coll.cid, object.oid, u->offset, u->xfer_buflen, bl, flags);
+
+    int idx = l_fio_os_write_lat;
+    if (job->options->osd_txn) {
+      idx = job->add_osd_metadata(t, object) ?
+        l_fio_os_pglog_trim_lat : l_fio_os_osd_write_lat;
+    }
     os->queue_transaction(&coll.sequencer,
                           std::move(t),
                           nullptr,
-                          new UnitComplete(u));
+                          new UnitComplete(u, job->engine->logger, idx));
     return FIO_Q_QUEUED;
   }
 
   if (u->ddir == DDIR_READ) {
     // ObjectStore reads are synchronous, so make the call and return COMPLETED
     bufferlist bl;
+    const utime_t start = ceph_clock_now();
     int r = os->read(coll.cid, object.oid, u->offset, u->xfer_buflen, bl);
+    job->engine->logger->tinc(l_fio_os_read_lat, ceph_clock_now() - start);
     if (r < 0) {
       u->error = r;
       td_verror(td, u->error, "xfer");
@@ -0,0 +1,421 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "test/librbd/test_mock_fixture.h"
+#include "test/librbd/test_support.h"
+#include "test/librbd/mock/MockImageCtx.h"
+#include "cls/rbd/cls_rbd_client.h"
+#include "common/safe_io.h"
+#include "include/stringify.h"
+#include "librbd/cache/FileImageCache.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace librbd {
+namespace {
+
+struct MockTestImageCtx : public MockImageCtx {
+  MockTestImageCtx(ImageCtx &image_ctx) : MockImageCtx(image_ctx) {
+  }
+};
+
+/// the image behind the cache: extents written back land in a buffer
+struct MockImageWriteback {
+  static MockImageWriteback *s_instance;
+
+  int r = 0;
+  std::string data;
+  uint64_t write_count = 0;
+
+  MockImageWriteback() {
+    assert(s_instance == nullptr);
+    s_instance = this;
+  }
+  ~MockImageWriteback() {
+    s_instance = nullptr;
+  }
+
+  void write(uint64_t off, const char *buf, uint64_t len) {
+    if (data.size() < off + len) {
+      data.resize(off + len, '\0');
+    }
+    data.replace(off, len, buf, len);
+  }
+
+  std::string read(uint64_t off, uint64_t len) const {
+    std::string s(len, '\0');
+    if (off < data.size()) {
+      data.copy(&s[0], std::min<uint64_t>(len, data.size() - off), off);
+    }
+    return s;
+  }
+};
+
+MockImageWriteback *MockImageWriteback::s_instance = nullptr;
+
+} // anonymous namespace
+
+namespace cache {
+
+template <>
+struct ImageWriteback<librbd::MockTestImageCtx> {
+  typedef std::vector<std::pair<uint64_t,uint64_t> > Extents;
+
+  librbd::MockTestImageCtx &image_ctx;
+
+  ImageWriteback(librbd::MockTestImageCtx &image_ctx) : image_ctx(image_ctx) {
+  }
+
+  void complete(Context *on_finish, int r) {
+    image_ctx.image_ctx->op_work_queue->queue(on_finish, r);
+  }
+
+  void aio_read(Extents &&image_extents, ceph::bufferlist *bl,
+                int fadvise_flags, Context *on_finish) {
+    auto writeback = MockImageWriteback::s_instance;
+    for (auto &extent : image_extents) {
+      bl->append(writeback->read(extent.first, extent.second));
+    }
+    complete(on_finish, 0);
+  }
+
+  void aio_write(Extents &&image_extents, ceph::bufferlist&& bl,
+                 int fadvise_flags, Context *on_finish) {
+    auto writeback = MockImageWriteback::s_instance;
+    if (writeback->r < 0) {
+      complete(on_finish, writeback->r);
+      return;
+    }
+    uint64_t bl_off = 0;
+    for (auto &extent : image_extents) {
+      bufferlist sub;
+      sub.substr_of(bl, bl_off, extent.second);
+      writeback->write(extent.first, sub.c_str(), extent.second);
+      bl_off += extent.second;
+      ++writeback->write_count;
+    }
+    complete(on_finish, 0);
+  }
+
+  void aio_discard(uint64_t offset, uint64_t length,
+                   bool skip_partial_discard, Context *on_finish) {
+    auto writeback = MockImageWriteback::s_instance;
+    if (writeback->r < 0) {
+      complete(on_finish, writeback->r);
+      return;
+    }
+    std::string zeros(length, '\0');
+    writeback->write(offset, zeros.c_str(), length);
+    complete(on_finish, 0);
+  }
+
+  void aio_flush(Context *on_finish) {
+    complete(on_finish, 0);
+  }
+
+  void aio_writesame(uint64_t offset, uint64_t length,
+                     ceph::bufferlist&& bl,
+                     int fadvise_flags, Context *on_finish) {
+    complete(on_finish, -EOPNOTSUPP);
+  }
+
+  void aio_compare_and_write(Extents &&image_extents,
+                             ceph::bufferlist&& cmp_bl,
+                             ceph::bufferlist&& bl,
+                             uint64_t *mismatch_offset,
+                             int fadvise_flags, Context *on_finish) {
+    complete(on_finish, -EOPNOTSUPP);
+  }
+};
+
+} // namespace cache
+} // namespace librbd
+
+// template definitions
+#include "librbd/cache/FileImageCache.cc"
+
+namespace librbd {
+namespace cache {
+
+using ::testing::_;
+using ::testing::Return;
+
+class TestMockCacheFileImageCache : public TestMockFixture {
+public:
+  typedef FileImageCache<librbd::MockTestImageCtx> MockFileImageCache;
+
+  static const uint64_t BLOCK = 4096;
+
+  std::string m_cache_dir;
+
+  void SetUp() override {
+    TestMockFixture::SetUp();
+
+    char dir[] = "/tmp/rbd_pcache.XXXXXX";
+    ASSERT_TRUE(::mkdtemp(dir) != nullptr);
+    m_cache_dir = dir;
+  }
+
+  void TearDown() override {
+    DIR *dir = ::opendir(m_cache_dir.c_str());
+    if (dir != nullptr) {
+      struct dirent *de;
+      while ((de = ::readdir(dir)) != nullptr) {
+        if (de->d_name[0] != '.') {
+          ::unlink((m_cache_dir + "/" + de->d_name).c_str());
+        }
+      }
+      ::closedir(dir);
+    }
+    ::rmdir(m_cache_dir.c_str());
+
+    TestMockFixture::TearDown();
+  }
+
+  void init_image_ctx(MockTestImageCtx &mock_image_ctx) {
+    // a small log, so a few writes wrap it
+    mock_image_ctx.persistent_cache_path = m_cache_dir;
+    mock_image_ctx.persistent_cache_size = 64 << 10;
+    mock_image_ctx.persistent_cache_destage_max_bytes = 16 << 10;
+
+    expect_op_work_queue(mock_image_ctx);
+    EXPECT_CALL(mock_image_ctx, get_stripe_period())
+      .WillRepeatedly(Return(mock_image_ctx.image_ctx->get_object_size()));
+  }
+
+  std::string get_log_path(MockTestImageCtx &mock_image_ctx) {
+    return m_cache_dir + "/rbd-pcache." +
+           stringify(mock_image_ctx.md_ctx.get_id()) + "." +
+           mock_image_ctx.id;
+  }
+
+  int init(MockFileImageCache &cache) {
+    C_SaferCond ctx;
+    cache.init(&ctx);
+    return ctx.wait();
+  }
+
+  int shut_down(MockFileImageCache &cache) {
+    C_SaferCond ctx;
+    cache.shut_down(&ctx);
+    return ctx.wait();
+  }
+
+  int write(MockFileImageCache &cache, uint64_t off, char c) {
+    bufferlist bl;
+    bl.append(std::string(BLOCK, c));
+    C_SaferCond ctx;
+    cache.aio_write({{off, BLOCK}}, std::move(bl), 0, &ctx);
+    return ctx.wait();
+  }
+
+  int read(MockFileImageCache &cache, uint64_t off, std::string *s) {
+    bufferlist bl;
+    C_SaferCond ctx;
+    cache.aio_read({{off, BLOCK}}, &bl, 0, &ctx);
+    int r = ctx.wait();
+    if (r == 0) {
+      *s = bl.to_str();
+    }
+    return r;
+  }
+
+  int get_owner(librbd::ImageCtx *ictx, std::string *owner) {
+    return cls_client::metadata_get(&ictx->md_ctx, ictx->header_oid,
+                                    OWNER_KEY, owner);
+  }
+
+  /// leave the writes in the log, as a crash would
+  void write_and_crash(MockTestImageCtx &mock_image_ctx,
+                       MockImageWriteback &writeback,
+                       const std::vector<std::pair<uint64_t, char> > &writes) {
+    writeback.r = -EIO;
+    MockFileImageCache cache(mock_image_ctx);
+    ASSERT_EQ(0, init(cache));
+    for (auto &w : writes) {
+      ASSERT_EQ(0, write(cache, w.first, w.second));
+    }
+    ASSERT_EQ(-EIO, shut_down(cache));
+    writeback.r = 0;
+  }
+};
+
+TEST_F(TestMockCacheFileImageCache, Replay) {
+  librbd::ImageCtx *ictx;
+  ASSERT_EQ(0, open_image(m_image_name, &ictx));
+
+  MockTestImageCtx mock_image_ctx(*ictx);
+  init_image_ctx(mock_image_ctx);
+  MockImageWriteback writeback;
+
+  write_and_crash(mock_image_ctx, writeback,
+                  {{0, 'a'}, {2 * BLOCK, 'b'}, {0, 'c'}});
+  ASSERT_EQ(0U, writeback.write_count);
+
+  std::string owner;
+  ASSERT_EQ(0, get_owner(ictx, &owner));
+
+  MockFileImageCache cache(mock_image_ctx);
+  ASSERT_EQ(0, init(cache));
+  ASSERT_EQ(std::string(BLOCK, 'c'), writeback.read(0, BLOCK));
+  ASSERT_EQ(std::string(BLOCK, '\0'), writeback.read(BLOCK, BLOCK));
+  ASSERT_EQ(std::string(BLOCK, 'b'), writeback.read(2 * BLOCK, BLOCK));
+  ASSERT_EQ(0, shut_down(cache));
+
+  ASSERT_EQ(-ENOENT, get_owner(ictx, &owner));
+}
+
+TEST_F(TestMockCacheFileImageCache, TornEntry) {
+  librbd::ImageCtx *ictx;
+  ASSERT_EQ(0, open_image(m_image_name, &ictx));
+
+  MockTestImageCtx mock_image_ctx(*ictx);
+  init_image_ctx(mock_image_ctx);
+  MockImageWriteback writeback;
+
+  write_and_crash(mock_image_ctx, writeback,
+                  {{0, 'a'}, {BLOCK, 'b'}, {2 * BLOCK, 'c'}, {3 * BLOCK, 'd'}});
+
+  // tear the payload of the third entry: it and everything after it
+  // were never acknowledged
+  int fd = ::open(get_log_path(mock_image_ctx).c_str(), O_RDWR);
+  ASSERT_LE(0, fd);
+  uint64_t entry_off = SUPER_SIZE +
+                       2 * P2ROUNDUP(HEADER_SIZE + BLOCK, ENTRY_ALIGN);
+  ASSERT_EQ(0, safe_pwrite(fd, "x", 1, entry_off + HEADER_SIZE + 100));
+  ::close(fd);
+
+  MockFileImageCache cache(mock_image_ctx);
+  ASSERT_EQ(0, init(cache));
+  ASSERT_EQ(std::string(BLOCK, 'a'), writeback.read(0, BLOCK));
+  ASSERT_EQ(std::string(BLOCK, 'b'), writeback.read(BLOCK, BLOCK));
+  ASSERT_EQ(std::string(BLOCK, '\0'), writeback.read(2 * BLOCK, BLOCK));
+  ASSERT_EQ(std::string(BLOCK, '\0'), writeback.read(3 * BLOCK, BLOCK));
+
+  // the torn tail is overwritten by new entries
+  ASSERT_EQ(0, write(cache, 2 * BLOCK, 'e'));
+  ASSERT_EQ(0, shut_down(cache));
+  ASSERT_EQ(std::string(BLOCK, 'e'), writeback.read(2 * BLOCK, BLOCK));
+}
+
+TEST_F(TestMockCacheFileImageCache, LogWrap) {
+  librbd::ImageCtx *ictx;
+  ASSERT_EQ(0, open_image(m_image_name, &ictx));
+
+  MockTestImageCtx mock_image_ctx(*ictx);
+  init_image_ctx(mock_image_ctx);
+  MockImageWriteback writeback;
+
+  // a 64K log holds 13 entries: 20 writes wrap it and block on space
+  {
+    MockFileImageCache cache(mock_image_ctx);
+    ASSERT_EQ(0, init(cache));
+    for (uint64_t i = 0; i < 20; ++i) {
+      ASSERT_EQ(0, write(cache, i * BLOCK, 'a' + i));
+    }
+
+    std::string s;
+    ASSERT_EQ(0, read(cache, 19 * BLOCK, &s));
+    ASSERT_EQ(std::string(BLOCK, 'a' + 19), s);
+
+    C_SaferCond flush_ctx;
+    cache.flush(&flush_ctx);
+    ASSERT_EQ(0, flush_ctx.wait());
+
+    // leave some behind, past the wrap
+    writeback.r = -EIO;
+    for (uint64_t i = 0; i < 5; ++i) {
+      ASSERT_EQ(0, write(cache, i * BLOCK, 'A' + i));
+    }
+    ASSERT_EQ(0, read(cache, 4 * BLOCK, &s));
+    ASSERT_EQ(std::string(BLOCK, 'A' + 4), s);
+    ASSERT_EQ(-EIO, shut_down(cache));
+    writeback.r = 0;
+  }
+
+  MockFileImageCache cache(mock_image_ctx);
+  ASSERT_EQ(0, init(cache));
+  for (uint64_t i = 0; i < 20; ++i) {
+    char c = i < 5 ? 'A' + i : 'a' + i;
+    ASSERT_EQ(std::string(BLOCK, c), writeback.read(i * BLOCK, BLOCK));
+  }
+  ASSERT_EQ(0, shut_down(cache));
+}
+
+TEST_F(TestMockCacheFileImageCache, StaleLogDiscarded) {
+  librbd::ImageCtx *ictx;
+  ASSERT_EQ(0, open_image(m_image_name, &ictx));
+
+  MockTestImageCtx mock_image_ctx(*ictx);
+  init_image_ctx(mock_image_ctx);
+  MockImageWriteback writeback;
+
+  write_and_crash(mock_image_ctx, writeback, {{0, 'a'}});
+
+  // resized elsewhere since
+  mock_image_ctx.size += BLOCK;
+
+  MockFileImageCache cache(mock_image_ctx);
+  ASSERT_EQ(0, init(cache));
+  ASSERT_EQ(0U, writeback.write_count);
+  ASSERT_EQ(std::string(BLOCK, '\0'), writeback.read(0, BLOCK));
+  ASSERT_EQ(0, shut_down(cache));
+}
+
+TEST_F(TestMockCacheFileImageCache, ForeignOwner) {
+  librbd::ImageCtx *ictx;
+  ASSERT_EQ(0, open_image(m_image_name, &ictx));
+
+  MockTestImageCtx mock_image_ctx(*ictx);
+  init_image_ctx(mock_image_ctx);
+  MockImageWriteback writeback;
+
+  write_and_crash(mock_image_ctx, writeback, {{0, 'a'}});
+
+  // another host took over and has dirty data of its own
+  std::map<std::string, bufferlist> data;
+  data[OWNER_KEY].append("otherhost:1");
+  ASSERT_EQ(0, cls_client::metadata_set(&ictx->md_ctx, ictx->header_oid,
+                                        data));
+
+  {
+    MockFileImageCache cache(mock_image_ctx);
+    ASSERT_EQ(-EBUSY, init(cache));
+  }
+
+  // once its data is gone, the image can be cached here again, but
+  // not with the old log
+  ASSERT_EQ(0, cls_client::metadata_remove(&ictx->md_ctx, ictx->header_oid,
+                                           OWNER_KEY));
+  MockFileImageCache cache(mock_image_ctx);
+  ASSERT_EQ(0, init(cache));
+  ASSERT_EQ(0U, writeback.write_count);
+  ASSERT_EQ(0, shut_down(cache));
+}
+
+TEST_F(TestMockCacheFileImageCache, ForeignOwnerDiscarded) {
+  librbd::ImageCtx *ictx;
+  ASSERT_EQ(0, open_image(m_image_name, &ictx));
+
+  MockTestImageCtx mock_image_ctx(*ictx);
+  init_image_ctx(mock_image_ctx);
+  mock_image_ctx.persistent_cache_discard_dirty = true;
+  MockImageWriteback writeback;
+
+  std::map<std::string, bufferlist> data;
+  data[OWNER_KEY].append("otherhost:1");
+  ASSERT_EQ(0, cls_client::metadata_set(&ictx->md_ctx, ictx->header_oid,
+                                        data));
+
+  // the image is taken over, so the other host discards its log
+  MockFileImageCache cache(mock_image_ctx);
+  ASSERT_EQ(0, init(cache));
+  std::string owner;
+  ASSERT_EQ(0, get_owner(ictx, &owner));
+  ASSERT_NE("otherhost:1", owner);
+  ASSERT_EQ(0, shut_down(cache));
+}
+
+} // namespace cache
+} // namespace librbd
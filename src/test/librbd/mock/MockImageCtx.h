@@ -89,6 +89,11 @@ struct MockImageCtx {
       image_watcher(NULL), object_map(NULL),
       exclusive_lock(NULL), journal(NULL),
       trace_endpoint(image_ctx.trace_endpoint),
+      persistent_cache_path(image_ctx.persistent_cache_path),
+      persistent_cache_size(image_ctx.persistent_cache_size),
+      persistent_cache_destage_max_bytes(
+          image_ctx.persistent_cache_destage_max_bytes),
+      persistent_cache_discard_dirty(image_ctx.persistent_cache_discard_dirty),
       concurrent_management_ops(image_ctx.concurrent_management_ops),
       blacklist_on_break_lock(image_ctx.blacklist_on_break_lock),
       blacklist_expire_seconds(image_ctx.blacklist_expire_seconds),
@@ -288,6 +293,10 @@ struct MockImageCtx {
 
   ZTracer::Endpoint trace_endpoint;
 
+  std::string persistent_cache_path;
+  uint64_t persistent_cache_size;
+  uint64_t persistent_cache_destage_max_bytes;
+  bool persistent_cache_discard_dirty;
   int concurrent_management_ops;
   bool blacklist_on_break_lock;
   uint32_t blacklist_expire_seconds;
@@ -1,6 +1,7 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 // vim: ts=8 sw=2 smarttab
 
+#include "cls/rbd/cls_rbd_client.h"
 #include "cls/rbd/cls_rbd_types.h"
 #include "test/librbd/test_fixture.h"
 #include "test/librbd/test_support.h"
@@ -141,6 +142,38 @@ TEST_F(TestInternal, OpenByID) {
    close_image(ictx);
 }
 
+TEST_F(TestInternal, OpenWithPersistentCacheOwner) {
+  REQUIRE_FORMAT_V2();
+
+  librbd::ImageCtx *ictx;
+  ASSERT_EQ(0, open_image(m_image_name, &ictx));
+  std::string header_oid = ictx->header_oid;
+  close_image(ictx);
+
+  // another client crashed with writes in its persistent cache
+  std::map<std::string, bufferlist> data;
+  data[librbd::ImageCtx::PERSISTENT_CACHE_OWNER_KEY].append("otherhost:1");
+  ASSERT_EQ(0, librbd::cls_client::metadata_set(&m_ioctx, header_oid, data));
+
+  ictx = new librbd::ImageCtx(m_image_name, "", nullptr, m_ioctx, false);
+  ASSERT_EQ(-EBUSY, ictx->state->open(false));
+
+  ictx = new librbd::ImageCtx(m_image_name, "", nullptr, m_ioctx, true);
+  ASSERT_EQ(0, ictx->state->open(false));
+  ASSERT_EQ(0, ictx->state->close());
+
+  data.clear();
+  data[librbd::ImageCtx::METADATA_CONF_PREFIX +
+       "rbd_persistent_cache_discard_dirty"].append("true");
+  ASSERT_EQ(0, librbd::cls_client::metadata_set(&m_ioctx, header_oid, data));
+  ASSERT_EQ(0, open_image(m_image_name, &ictx));
+
+  std::string owner;
+  ASSERT_EQ(-ENOENT, librbd::cls_client::metadata_get(
+    &m_ioctx, header_oid, librbd::ImageCtx::PERSISTENT_CACHE_OWNER_KEY,
+    &owner));
+}
+
 TEST_F(TestInternal, IsExclusiveLockOwner) {
   REQUIRE_FEATURE(RBD_FEATURE_EXCLUSIVE_LOCK);
 
@@ -4,7 +4,9 @@
  * In memory space allocator test cases.
  * Author: Ramesh Chander, Ramesh.Chander@sandisk.com
  */
+#include <chrono>
 #include <iostream>
+#include <random>
 #include <boost/scoped_ptr.hpp>
 #include <gtest/gtest.h>
 
@@ -13,8 +15,10 @@
 #include "common/errno.h"
 #include "include/stringify.h"
 #include "include/Context.h"
+#include "include/scope_guard.h"
 #include "os/bluestore/Allocator.h"
 #include "os/bluestore/BitAllocator.h"
+#include "os/bluestore/AvlAllocator.h"
 
 
 #if GTEST_HAS_PARAM_TEST
@@ -218,7 +222,7 @@ TEST_P(AllocTest, test_alloc_big)
 
 TEST_P(AllocTest, test_alloc_hint_bmap)
 {
-  if (GetParam() == std::string("stupid")) {
+  if (GetParam() != std::string("bitmap")) {
     return;
   }
   int64_t blocks = BitMapArea::get_level_factor(g_ceph_context, 2) * 4;
@@ -290,11 +294,163 @@ TEST_P(AllocTest, test_alloc_non_aligned_len)
   EXPECT_EQ(want_size, alloc->allocate(want_size, alloc_unit, 0, &extents));
 }
 
+TEST_P(AllocTest, test_alloc_fragmentation)
+{
+  int64_t block_size = 4096;
+  int64_t blocks = 16384;
+  init_alloc(blocks * block_size, block_size);
+  alloc->init_add_free(0, blocks * block_size);
+
+  // take every block, one at a time
+  vector<AllocExtent> allocated;
+  for (int64_t i = 0; i < blocks; ++i) {
+    ASSERT_EQ(0, alloc->reserve(block_size));
+    AllocExtentVector extents;
+    ASSERT_EQ(block_size, alloc->allocate(block_size, block_size, 0,
+					  &extents));
+    ASSERT_EQ(1u, extents.size());
+    allocated.push_back(extents[0]);
+  }
+  EXPECT_EQ(0u, alloc->get_free());
+
+  // give back every other block: half free, but nothing contiguous
+  std::sort(allocated.begin(), allocated.end(),
+	    [](const AllocExtent& a, const AllocExtent& b) {
+	      return a.offset < b.offset;
+	    });
+  for (size_t i = 0; i < allocated.size(); i += 2) {
+    alloc->release(allocated[i].offset, allocated[i].length);
+  }
+  EXPECT_EQ((uint64_t)blocks / 2 * block_size, alloc->get_free());
+  {
+    ASSERT_EQ(0, alloc->reserve(2 * block_size));
+    AllocExtentVector extents;
+    EXPECT_EQ(-ENOSPC, alloc->allocate(2 * block_size, 2 * block_size, 0,
+				       &extents));
+    alloc->unreserve(2 * block_size);
+  }
+
+  // give back the rest: free space is whole again
+  for (size_t i = 1; i < allocated.size(); i += 2) {
+    alloc->release(allocated[i].offset, allocated[i].length);
+  }
+  EXPECT_EQ((uint64_t)blocks * block_size, alloc->get_free());
+  {
+    ASSERT_EQ(0, alloc->reserve(blocks * block_size));
+    AllocExtentVector extents;
+    EXPECT_EQ(blocks * block_size,
+	      alloc->allocate(blocks * block_size, block_size, 0, &extents));
+    if (GetParam() == std::string("avl")) {
+      // releases merged with their neighbours
+      EXPECT_EQ(1u, extents.size());
+    }
+  }
+}
+
+// ages a 1 GB device; run with --gtest_also_run_disabled_tests
+TEST_P(AllocTest, DISABLED_test_alloc_bench_fragmented)
+{
+  int64_t block_size = 4096;
+  int64_t blocks = 262144;  // 1 GB
+  int64_t capacity = blocks * block_size;
+  init_alloc(capacity, block_size);
+  alloc->init_add_free(0, capacity);
+
+  std::mt19937_64 rng(1234);
+  std::uniform_int_distribution<int64_t> len_dist(1, 64);
+  std::vector<AllocExtent> live;
+  int64_t used = 0;
+
+  auto alloc_one = [&](int64_t len) -> bool {
+    if (alloc->reserve(len) < 0)
+      return false;
+    AllocExtentVector extents;
+    int64_t got = alloc->allocate(len, block_size, 0, &extents);
+    if (got < 0) {
+      alloc->unreserve(len);
+      return false;
+    }
+    if (got < len)
+      alloc->unreserve(len - got);
+    for (auto& e : extents)
+      live.push_back(e);
+    used += got;
+    return true;
+  };
+
+  // age the allocator: fill to 90% with mixed sizes, then churn
+  while (used < capacity * 9 / 10) {
+    ASSERT_TRUE(alloc_one(len_dist(rng) * block_size));
+  }
+  const int ops = 20000;
+  std::chrono::nanoseconds alloc_time(0);
+  std::chrono::nanoseconds max_alloc_time(0);
+  for (int i = 0; i < ops; ++i) {
+    std::uniform_int_distribution<size_t> pick(0, live.size() - 1);
+    size_t victim = pick(rng);
+    alloc->release(live[victim].offset, live[victim].length);
+    used -= live[victim].length;
+    live[victim] = live.back();
+    live.pop_back();
+
+    auto start = std::chrono::steady_clock::now();
+    alloc_one(len_dist(rng) * block_size);
+    auto lat = std::chrono::steady_clock::now() - start;
+    alloc_time += lat;
+    max_alloc_time = std::max(max_alloc_time,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(lat));
+  }
+  EXPECT_EQ((uint64_t)(capacity - used), alloc->get_free());
+  std::cout << GetParam() << ": " << live.size() << " live extents, "
+	    << ops << " allocations, avg "
+	    << alloc_time.count() / ops << " ns, max "
+	    << max_alloc_time.count() << " ns" << std::endl;
+}
+
+TEST_P(AllocTest, test_alloc_avl_spillover)
+{
+  if (GetParam() != std::string("avl")) {
+    return;
+  }
+  int64_t block_size = 4096;
+  int64_t blocks = 16384;
+  const uint64_t mem_cap = g_conf->bluestore_avl_alloc_mem_cap;
+  auto restore_mem_cap = make_scope_guard([&] {
+    g_conf->set_val("bluestore_avl_alloc_mem_cap", stringify(mem_cap));
+  });
+  g_conf->set_val("bluestore_avl_alloc_mem_cap",
+		  stringify(sizeof(range_seg_t) * 16));
+  init_alloc(blocks * block_size, block_size);
+
+  // 64 isolated free blocks; only 16 fit in the trees
+  for (int64_t i = 0; i < 64; ++i) {
+    alloc->init_add_free(i * 2 * block_size, block_size);
+  }
+  EXPECT_EQ(64u * block_size, alloc->get_free());
+
+  // the shortest (and, among those, lowest) extents went to the bitmap
+  alloc->init_rm_free(0, block_size);
+  alloc->init_rm_free(126 * block_size, block_size);
+  EXPECT_EQ(62u * block_size, alloc->get_free());
+
+  ASSERT_EQ(0, alloc->reserve(62 * block_size));
+  AllocExtentVector extents;
+  EXPECT_EQ(62 * block_size,
+	    alloc->allocate(62 * block_size, block_size, 0, &extents));
+  EXPECT_EQ(62u, extents.size());
+  EXPECT_EQ(0u, alloc->get_free());
+
+  for (auto& e : extents) {
+    alloc->release(e.offset, e.length);
+  }
+  EXPECT_EQ(62u * block_size, alloc->get_free());
+}
+
 
 INSTANTIATE_TEST_CASE_P(
   Allocator,
   AllocTest,
-  ::testing::Values("stupid", "bitmap"));
+  ::testing::Values("stupid", "bitmap", "avl"));
 
 #else
 
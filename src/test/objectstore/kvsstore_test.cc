@@ -551,6 +551,383 @@ TEST_P(KvsStoreTest, OmapSimple) {
     }
 }
 
+TEST_P(KvsStoreTest, OmapClearReaperTest) {
+    ObjectStore::Sequencer osr("test");
+    int r;
+    coll_t cid(spg_t(pg_t(0, 2), shard_id_t::NO_SHARD));
+    ghobject_t hoid(hobject_t(sobject_t("omap_reap_obj", CEPH_NOSNAP),
+                              "", 1, 2, ""));
+    map<string,bufferlist> km;
+    for (int i = 0; i < 200; ++i) {
+        km[stringify(i)].append("value");
+    }
+    bufferlist header;
+    header.append("header");
+    {
+        ObjectStore::Transaction t;
+        t.create_collection(cid, 0);
+        t.touch(cid, hoid);
+        t.omap_setkeys(cid, hoid, km);
+        t.omap_setheader(cid, hoid, header);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+    // clear and repopulate in the same transaction: old keys must not show up
+    map<string,bufferlist> km2;
+    km2["new"].append("new value");
+    {
+        ObjectStore::Transaction t;
+        t.omap_clear(cid, hoid);
+        t.omap_setkeys(cid, hoid, km2);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+    {
+        bufferlist h;
+        map<string,bufferlist> out;
+        store->omap_get(cid, hoid, &h, &out);
+        ASSERT_EQ(0u, h.length());
+        ASSERT_EQ(km2.size(), out.size());
+        ASSERT_TRUE(bl_eq(km2["new"], out["new"]));
+    }
+    // pending reaper records survive a remount
+    r = store->umount();
+    ASSERT_EQ(0, r);
+    r = store->mount();
+    ASSERT_EQ(0, r);
+    {
+        bufferlist h;
+        map<string,bufferlist> out;
+        store->omap_get(cid, hoid, &h, &out);
+        ASSERT_EQ(km2.size(), out.size());
+    }
+    {
+        ObjectStore::Transaction t;
+        t.remove(cid, hoid);
+        t.remove_collection(cid);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+    // wait for the reaper to drain
+    for (int i = 0; i < 100; ++i) {
+        const PerfCounters *logger = store->get_perf_counters();
+        if (const_cast<PerfCounters*>(logger)->get(l_kvsstore_reaper_pending) == 0)
+            break;
+        usleep(100 * 1000);
+    }
+    ASSERT_EQ(0u, const_cast<PerfCounters*>(store->get_perf_counters())->get(l_kvsstore_reaper_pending));
+}
+
+TEST_P(KvsStoreTest, OmapOverwriteCoalesceTest) {
+    ObjectStore::Sequencer osr("test");
+    int r;
+    coll_t cid;
+    ghobject_t hoid(hobject_t(sobject_t("omap_hot_obj", CEPH_NOSNAP)));
+    {
+        ObjectStore::Transaction t;
+        t.create_collection(cid, 0);
+        t.touch(cid, hoid);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+    PerfCounters *logger = const_cast<PerfCounters*>(store->get_perf_counters());
+    const uint64_t coalesced = logger->get(l_kvsstore_wbuf_coalesced);
+
+    // rewrite the same small keys, as the OSD does with _info and _fastinfo
+    for (int i = 0; i < 50; ++i) {
+        map<string,bufferlist> km;
+        km["_info"].append(stringify(i));
+        km["_fastinfo"].append(stringify(i * 2));
+        bufferlist header;
+        header.append(stringify(i * 3));
+        ObjectStore::Transaction t;
+        t.omap_setkeys(cid, hoid, km);
+        t.omap_setheader(cid, hoid, header);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+    if (g_conf->kvsstore_write_buffer_max_bytes)
+        ASSERT_LT(coalesced, logger->get(l_kvsstore_wbuf_coalesced));
+
+    // a delete of a buffered key must win
+    {
+        set<string> keys;
+        keys.insert("_fastinfo");
+        ObjectStore::Transaction t;
+        t.omap_rmkeys(cid, hoid, keys);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+        bufferlist h;
+        map<string,bufferlist> out;
+        store->omap_get(cid, hoid, &h, &out);
+        ASSERT_EQ(stringify(49 * 3), h.to_str());
+        ASSERT_EQ(1u, out.size());
+        ASSERT_EQ(stringify(49), out["_info"].to_str());
+
+        ObjectMap::ObjectMapIterator iter = store->get_omap_iterator(cid, hoid);
+        iter->seek_to_first();
+        ASSERT_TRUE(iter->valid());
+        ASSERT_EQ("_info", iter->key());
+        ASSERT_EQ(stringify(49), iter->value().to_str());
+        iter->next();
+        ASSERT_FALSE(iter->valid());
+
+        // buffered updates are written back on umount
+        r = store->umount();
+        ASSERT_EQ(0, r);
+        r = store->mount();
+        ASSERT_EQ(0, r);
+    }
+    {
+        ObjectStore::Transaction t;
+        t.remove(cid, hoid);
+        t.remove_collection(cid);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+}
+
+TEST_P(KvsStoreTest, StatfsTest) {
+    ObjectStore::Sequencer osr("test");
+    int r;
+    coll_t cid(spg_t(pg_t(0, 7), shard_id_t::NO_SHARD));
+    ghobject_t a(hobject_t(sobject_t("Object a", CEPH_NOSNAP), "", 1, 7, ""));
+    ghobject_t b(hobject_t(sobject_t("Object b", CEPH_NOSNAP), "", 2, 7, ""));
+    store_statfs_t base;
+    r = store->statfs(&base);
+    ASSERT_EQ(0, r);
+    ASSERT_LT(0u, base.total);
+    {
+        ObjectStore::Transaction t;
+        t.create_collection(cid, 0);
+        bufferlist bl;
+        bl.append(string(4096, 'a'));
+        t.write(cid, a, 0, bl.length(), bl);
+        bufferlist small;
+        small.append(string(1000, 'b'));
+        t.write(cid, b, 0, small.length(), small);
+        map<string,bufferlist> km;
+        km["key"].append("0123456789");
+        t.omap_setkeys(cid, b, km);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+        store_statfs_t st;
+        r = store->statfs(&st);
+        ASSERT_EQ(0, r);
+        ASSERT_EQ(base.stored + 4096 + 1000 + 3 + 10, st.stored);
+
+        // the counters are written with the superblock
+        r = store->umount();
+        ASSERT_EQ(0, r);
+        r = store->mount();
+        ASSERT_EQ(0, r);
+    }
+    {
+        // after the remount the old values are not known, so overwrites
+        // are charged as new keys until the omap has been recounted
+        const double interval = g_ceph_context->_conf->kvsstore_statfs_refresh_interval;
+        g_ceph_context->_conf->set_val("kvsstore_statfs_refresh_interval", "0.1");
+        PerfCounters *logger = const_cast<PerfCounters*>(store->get_perf_counters());
+        const uint64_t recounts = logger->get(l_kvsstore_omap_recounts);
+
+        ObjectStore::Transaction t;
+        map<string,bufferlist> km;
+        km["key"].append("0123");
+        t.omap_setkeys(cid, b, km);
+        km.clear();
+        km["key2"].append("xy");
+        t.omap_setkeys(cid, b, km);
+        km["key2"].append("z");
+        t.omap_setkeys(cid, b, km);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+        store_statfs_t st;
+        store->statfs(&st);
+        ASSERT_LE(base.stored + 4096 + 1000 + 3 + 4 + 4 + 3, st.stored);
+        ASSERT_LT(0u, logger->get(l_kvsstore_omap_estimates));
+
+        for (int i = 0; i < 100; ++i) {
+            if (logger->get(l_kvsstore_omap_recounts) > recounts)
+                break;
+            usleep(100 * 1000);
+        }
+        g_ceph_context->_conf->set_val("kvsstore_statfs_refresh_interval", stringify(interval).c_str());
+        ASSERT_LT(recounts, logger->get(l_kvsstore_omap_recounts));
+
+        // the next change settles the charge against the count
+        ObjectStore::Transaction t2;
+        set<string> keys;
+        keys.insert("key");
+        t2.omap_rmkeys(cid, b, keys);
+        r = apply_transaction(store, &osr, std::move(t2));
+        ASSERT_EQ(r, 0);
+        store->statfs(&st);
+        ASSERT_EQ(base.stored + 4096 + 1000 + 4 + 3, st.stored);
+    }
+    {
+        ObjectStore::Transaction t;
+        t.truncate(cid, a, 100);
+        t.omap_clear(cid, b);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+        store_statfs_t st;
+        store->statfs(&st);
+        ASSERT_EQ(base.stored + 100 + 1000, st.stored);
+    }
+    {
+        ObjectStore::Transaction t;
+        t.remove(cid, a);
+        t.remove(cid, b);
+        t.remove_collection(cid);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+        store_statfs_t st;
+        store->statfs(&st);
+        ASSERT_EQ(base.stored, st.stored);
+    }
+}
+
+TEST_P(KvsStoreTest, PGLogSegmentTest) {
+    ObjectStore::Sequencer osr("test");
+    int r;
+    spg_t pgid(pg_t(0, 3), shard_id_t::NO_SHARD);
+    coll_t cid(pgid);
+    ghobject_t pgmeta_oid(pgid.make_pgmeta_oid());
+    {
+        ObjectStore::Transaction t;
+        t.create_collection(cid, 0);
+        t.touch(cid, pgmeta_oid);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+    PerfCounters *logger = const_cast<PerfCounters*>(store->get_perf_counters());
+    const uint64_t seg_writes = logger->get(l_kvsstore_pglog_seg_writes);
+    const uint64_t meta_writes = logger->get(l_kvsstore_pglog_meta_writes);
+    const uint64_t delta_writes = logger->get(l_kvsstore_pglog_delta_writes);
+
+    // append log and dup entries the way PGLog does, trimming the tail
+    const unsigned entries = 300, keep = 100;
+    for (unsigned v = 1; v <= entries; ++v) {
+        map<string,bufferlist> km;
+        km[eversion_t(1, v).get_key_name()].append(stringify(v));
+        pg_log_dup_t dup;
+        dup.version = eversion_t(1, v);
+        km[dup.get_key_name()].append(stringify(v));
+        km["_info"].append(stringify(v));
+        ObjectStore::Transaction t;
+        if (v > keep) {
+            set<string> trimmed;
+            trimmed.insert(eversion_t(1, v - keep).get_key_name());
+            t.omap_rmkeys(cid, pgmeta_oid, trimmed);
+        }
+        t.omap_setkeys(cid, pgmeta_oid, km);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+    if (g_conf->kvsstore_pglog_segment_entries) {
+        ASSERT_LT(seg_writes, logger->get(l_kvsstore_pglog_seg_writes));
+        // appends go to delta records, the heads are rewritten now and then
+        ASSERT_LT(delta_writes + entries / 2, logger->get(l_kvsstore_pglog_delta_writes));
+        ASSERT_GT(seg_writes + entries / 2, logger->get(l_kvsstore_pglog_seg_writes));
+    }
+    // the trim point moves with the head segment, not the meta key
+    if (g_conf->kvsstore_pglog_segment_entries >= 8) {
+        ASSERT_GT(meta_writes + entries / 4, logger->get(l_kvsstore_pglog_meta_writes));
+    }
+
+    for (int pass = 0; pass < 2; ++pass) {
+        map<string,bufferlist> out;
+        bufferlist h;
+        r = store->omap_get(cid, pgmeta_oid, &h, &out);
+        ASSERT_EQ(0, r);
+        // keep log entries, all dups and _info
+        ASSERT_EQ(keep + entries + 1, out.size());
+        ASSERT_EQ(0u, out.count(eversion_t(1, entries - keep).get_key_name()));
+        ASSERT_EQ(stringify(entries - keep + 1),
+                  out[eversion_t(1, entries - keep + 1).get_key_name()].to_str());
+
+        // the iterator returns the entries in key order
+        ObjectMap::ObjectMapIterator it = store->get_omap_iterator(cid, pgmeta_oid);
+        unsigned n = 0;
+        string last;
+        for (it->seek_to_first(); it->valid(); it->next()) {
+            ASSERT_LT(last, it->key());
+            ASSERT_EQ(out[it->key()].to_str(), it->value().to_str());
+            last = it->key();
+            ++n;
+        }
+        ASSERT_EQ(out.size(), n);
+
+        set<string> keys, found;
+        keys.insert(eversion_t(1, 1).get_key_name());
+        keys.insert(eversion_t(1, entries).get_key_name());
+        r = store->omap_check_keys(cid, pgmeta_oid, keys, &found);
+        ASSERT_EQ(0, r);
+        ASSERT_EQ(1u, found.size());
+        ASSERT_EQ(1u, found.count(eversion_t(1, entries).get_key_name()));
+
+        r = store->umount();
+        ASSERT_EQ(0, r);
+        r = store->mount();
+        ASSERT_EQ(0, r);
+    }
+
+    // rewinding the head and clearing a whole kind
+    {
+        // the heads were loaded at mount
+        const uint64_t seg_reads = logger->get(l_kvsstore_pglog_seg_reads);
+        ObjectStore::Transaction t;
+        pg_log_dup_t min, max;
+        max.version = eversion_t::max();
+        t.omap_rmkeyrange(cid, pgmeta_oid, eversion_t(1, entries - 9).get_key_name(),
+                          eversion_t::max().get_key_name());
+        t.omap_rmkeyrange(cid, pgmeta_oid, min.get_key_name(), max.get_key_name());
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+        if (g_conf->kvsstore_pglog_segment_entries >= 16) {
+            ASSERT_EQ(seg_reads, logger->get(l_kvsstore_pglog_seg_reads));
+        }
+
+        set<string> keys;
+        r = store->omap_get_keys(cid, pgmeta_oid, &keys);
+        ASSERT_EQ(0, r);
+        ASSERT_EQ(keep - 10 + 1, keys.size());
+        ASSERT_EQ(1u, keys.count(eversion_t(1, entries - 10).get_key_name()));
+        ASSERT_EQ(0u, keys.count(eversion_t(1, entries - 9).get_key_name()));
+    }
+    {
+        // a range in the middle of the log only reads the segments it overlaps
+        const uint64_t seg_reads = logger->get(l_kvsstore_pglog_seg_reads);
+        ObjectStore::Transaction t;
+        t.omap_rmkeyrange(cid, pgmeta_oid, eversion_t(1, entries - 59).get_key_name(),
+                          eversion_t(1, entries - 49).get_key_name());
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+        if (g_conf->kvsstore_pglog_segment_entries >= 16) {
+            ASSERT_GE(seg_reads + 2, logger->get(l_kvsstore_pglog_seg_reads));
+        }
+
+        set<string> keys;
+        r = store->omap_get_keys(cid, pgmeta_oid, &keys);
+        ASSERT_EQ(0, r);
+        ASSERT_EQ(keep - 20 + 1, keys.size());
+        ASSERT_EQ(1u, keys.count(eversion_t(1, entries - 60).get_key_name()));
+        ASSERT_EQ(0u, keys.count(eversion_t(1, entries - 59).get_key_name()));
+        ASSERT_EQ(1u, keys.count(eversion_t(1, entries - 49).get_key_name()));
+    }
+    {
+        ObjectStore::Transaction t;
+        t.remove(cid, pgmeta_oid);
+        t.remove_collection(cid);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+}
+
 TEST_P(KvsStoreTest, OMapTest) {
     ObjectStore::Sequencer osr("test");
     coll_t cid;
@@ -1929,6 +2306,77 @@ TEST_P(KvsStoreTest, SimpleAttrTest) {
     }
 }
 
+TEST_P(KvsStoreTest, AttrUpdateRemountTest) {
+    ObjectStore::Sequencer osr("test");
+    int r;
+    coll_t cid;
+    ghobject_t hoid(hobject_t(sobject_t("attr update object", CEPH_NOSNAP)));
+    bufferlist oi, ss, extra, oi2, added;
+    oi.append("object info");
+    ss.append("snapset");
+    extra.append("extra");
+    oi2.append("object info v2");
+    added.append("added");
+    {
+        ObjectStore::Transaction t;
+        t.create_collection(cid, 0);
+        t.touch(cid, hoid);
+        t.setattr(cid, hoid, "_", oi);
+        t.setattr(cid, hoid, "snapset", ss);
+        t.setattr(cid, hoid, "extra", extra);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+    r = store->umount();
+    ASSERT_EQ(0, r);
+    r = store->mount();
+    ASSERT_EQ(0, r);
+    // modify an onode that was loaded from the device
+    {
+        ObjectStore::Transaction t;
+        t.setattr(cid, hoid, "_", oi2);
+        t.rmattr(cid, hoid, "extra");
+        t.setattr(cid, hoid, "added", added);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+        map<string, bufferptr> aset;
+        r = store->getattrs(cid, hoid, aset);
+        ASSERT_EQ(0, r);
+        ASSERT_EQ(3u, aset.size());
+        ASSERT_EQ(oi2.to_str(), string(aset["_"].c_str(), aset["_"].length()));
+        ASSERT_EQ(ss.to_str(), string(aset["snapset"].c_str(), aset["snapset"].length()));
+        ASSERT_EQ(added.to_str(), string(aset["added"].c_str(), aset["added"].length()));
+
+        bufferptr bp;
+        r = store->getattr(cid, hoid, "extra", bp);
+        ASSERT_EQ(-ENODATA, r);
+
+        r = store->umount();
+        ASSERT_EQ(0, r);
+        r = store->mount();
+        ASSERT_EQ(0, r);
+    }
+    {
+        ObjectStore::Transaction t;
+        t.rmattrs(cid, hoid);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+        map<string, bufferptr> aset;
+        r = store->getattrs(cid, hoid, aset);
+        ASSERT_EQ(0, r);
+        ASSERT_TRUE(aset.empty());
+    }
+    {
+        ObjectStore::Transaction t;
+        t.remove(cid, hoid);
+        t.remove_collection(cid);
+        r = apply_transaction(store, &osr, std::move(t));
+        ASSERT_EQ(r, 0);
+    }
+}
+
 TEST_P(KvsStoreTest, SimpleListTest) {
     ObjectStore::Sequencer osr("test");
     int r;
@@ -446,6 +446,123 @@ TEST_F(OSDMapTest, PrimaryAffinity) {
   }
 }
 
+TEST_F(OSDMapTest, IncrementalMapping) {
+  set_up_map();
+  mapping.update(osdmap);
+
+  // apply inc, update the mapping incrementally, and verify it against a
+  // mapping built from scratch
+  auto apply_and_verify = [&](OSDMap::Incremental& inc) {
+    ASSERT_EQ(0, osdmap.apply_incremental(inc));
+    mapping.update(osdmap, inc);
+    OSDMapMapping full;
+    full.update(osdmap);
+    ASSERT_TRUE(mapping.same_as(full));
+  };
+  auto get_up = [&](pg_t pgid) {
+    vector<int> up;
+    int up_primary;
+    osdmap.pg_to_up_acting_osds(pgid, &up, &up_primary, nullptr, nullptr);
+    return up;
+  };
+
+  {
+    // nothing that affects placement
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_up_thru[0] = osdmap.get_epoch();
+    apply_and_verify(inc);
+  }
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_state[1] = CEPH_OSD_UP;
+    apply_and_verify(inc);
+  }
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_weight[2] = CEPH_OSD_IN / 2;
+    apply_and_verify(inc);
+  }
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_primary_affinity[3] = 0;
+    apply_and_verify(inc);
+  }
+  pg_t pga(0, my_rep_pool), pgb(1, my_rep_pool), pgc(2, my_ec_pool);
+  int upmap_target;
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    vector<int> up = get_up(pga);
+    std::reverse(up.begin(), up.end());
+    inc.new_pg_temp[pga] = mempool::osdmap::vector<int>(up.begin(), up.end());
+    inc.new_primary_temp[pgb] = get_up(pgb).back();
+    apply_and_verify(inc);
+  }
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    vector<int> up = get_up(pgc);
+    set<int> spare = {0, 1, 2, 3, 4, 5};
+    for (auto osd : up)
+      spare.erase(osd);
+    ASSERT_FALSE(spare.empty());
+    upmap_target = *spare.begin();
+    inc.new_pg_upmap_items[pgc].push_back(make_pair(up[0], upmap_target));
+    apply_and_verify(inc);
+  }
+  {
+    // an osd named only by an override
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_weight[upmap_target] = CEPH_OSD_OUT;
+    apply_and_verify(inc);
+  }
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.old_pg_upmap_items.insert(pgc);
+    inc.new_pg_temp[pga].clear();
+    apply_and_verify(inc);
+  }
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    entity_addr_t sample_addr;
+    inc.new_up_client[1] = sample_addr;
+    inc.new_weight[2] = CEPH_OSD_IN;
+    apply_and_verify(inc);
+  }
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    CrushWrapper crush;
+    bufferlist bl;
+    osdmap.crush->encode(bl, CEPH_FEATURES_SUPPORTED_DEFAULT);
+    bufferlist::iterator p = bl.begin();
+    crush.decode(p);
+    crush.adjust_item_weightf(g_ceph_context, 4, 0.25);
+    crush.encode(inc.crush, CEPH_FEATURES_SUPPORTED_DEFAULT);
+    apply_and_verify(inc);
+  }
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    pg_pool_t *p = inc.get_new_pool(my_rep_pool,
+				    osdmap.get_pg_pool(my_rep_pool));
+    p->set_pgp_num(32);
+    apply_and_verify(inc);
+  }
+  {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    pg_pool_t *p = inc.get_new_pool(my_ec_pool,
+				    osdmap.get_pg_pool(my_ec_pool));
+    p->set_pg_num(128);
+    apply_and_verify(inc);
+  }
+  {
+    // not the next epoch for this mapping: falls back to a full update
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.new_state[0] = CEPH_OSD_UP;
+    ASSERT_EQ(0, osdmap.apply_incremental(inc));
+    OSDMap::Incremental inc2(osdmap.get_epoch() + 1);
+    inc2.new_weight[5] = CEPH_OSD_IN / 4;
+    apply_and_verify(inc2);
+  }
+}
+
 TEST_F(OSDMapTest, parse_osd_id_list) {
   set_up_map();
   set<int> out;
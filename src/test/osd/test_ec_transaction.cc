@@ -15,6 +15,7 @@
 #include <gtest/gtest.h>
 #include "osd/PGTransaction.h"
 #include "osd/ECTransaction.h"
+#include "erasure-code/ErasureCode.h"
 
 #include "test/unit.cc"
 
@@ -122,3 +123,233 @@ TEST(ectransaction, many_writes)
   ASSERT_EQ(0u, plan.to_read.size());
   ASSERT_EQ(1u, plan.will_write.size());
 }
+
+TEST(ectransaction, parity_delta)
+{
+  hobject_t h;
+  ECUtil::stripe_info_t sinfo(4, 16384);  // 4+2, 4096 byte chunks
+  vector<int> chunk_mapping;
+  auto plan_for = [&](uint64_t off, uint64_t len, bool readable) {
+    PGTransactionUPtr t(new PGTransaction);
+    bufferlist a;
+    a.append_zero(len);
+    t->write(h, off, a.length(), a, 0);
+    ECUtil::HashInfoRef ref(new ECUtil::HashInfo(6));
+    ref->set_total_chunk_size_clear_hash(
+      sinfo.aligned_logical_offset_to_chunk_offset(65536));
+    ref->set_projected_total_logical_size(sinfo, 65536);
+    auto plan = ECTransaction::get_write_plan(
+      sinfo,
+      std::move(t),
+      [&](const hobject_t &i) {
+	return ref;
+      },
+      &dpp);
+    ECTransaction::plan_parity_delta(
+      sinfo,
+      chunk_mapping,
+      2,
+      plan,
+      [&](const hobject_t &i, const set<int> &shards) {
+	return readable;
+      },
+      &dpp);
+    generic_derr << "to_read " << plan.to_read << dendl;
+    generic_derr << "will_write " << plan.will_write << dendl;
+    generic_derr << "delta_read " << plan.delta_read << dendl;
+    return plan;
+  };
+
+  // a small write inside one chunk reads that chunk and the parity
+  {
+    auto plan = plan_for(16384 + 4096 + 100, 512, true);
+    ASSERT_EQ(0u, plan.to_read.size());
+    ASSERT_EQ(1u, plan.delta_read.size());
+    ASSERT_EQ(16384u, plan.delta_read[h].range_start());
+    ASSERT_EQ(16384, plan.delta_read[h].size());
+    ASSERT_EQ((set<int>{1, 4, 5}), plan.delta_shards[h]);
+    ASSERT_EQ(plan.delta_read[h], plan.will_write[h]);
+    ASSERT_TRUE(plan.invalidates_cache);
+    ASSERT_EQ(16384u, plan.delta_rmw_bytes);
+  }
+
+  // touching every chunk of the stripe reads less by rmw
+  {
+    auto plan = plan_for(100, 16000, true);
+    ASSERT_EQ(1u, plan.to_read.size());
+    ASSERT_EQ(0u, plan.delta_read.size());
+  }
+
+  // unreadable shards keep the rmw path
+  {
+    auto plan = plan_for(100, 512, false);
+    ASSERT_EQ(1u, plan.to_read.size());
+    ASSERT_EQ(0u, plan.delta_read.size());
+  }
+}
+
+/* k data chunks, parity 0 is their xor and parity 1 the xor of data
+ * chunk i times 2^i in GF(2^8): linear like the real plugins, and with
+ * parities that differ in which data bytes they mix. */
+class ErasureCodeLinear : public ceph::ErasureCode {
+  unsigned k;
+public:
+  explicit ErasureCodeLinear(unsigned _k) : k(_k) {}
+
+  unsigned int get_chunk_count() const override { return k + 2; }
+  unsigned int get_data_chunk_count() const override { return k; }
+  unsigned int get_chunk_size(unsigned int object_size) const override {
+    return object_size / k;
+  }
+
+  static unsigned char mul2(unsigned char b) {
+    return (b << 1) ^ (b & 0x80 ? 0x1d : 0);
+  }
+
+  int encode_chunks(const set<int> &want_to_encode,
+		    map<int, bufferlist> *encoded) override {
+    const unsigned len = (*encoded)[0].length();
+    char *p0 = (*encoded)[k].c_str();
+    char *p1 = (*encoded)[k + 1].c_str();
+    memset(p0, 0, len);
+    memset(p1, 0, len);
+    for (unsigned i = 0; i < k; ++i) {
+      const char *d = (*encoded)[i].c_str();
+      for (unsigned j = 0; j < len; ++j) {
+	unsigned char m = d[j];
+	for (unsigned n = 0; n < i; ++n)
+	  m = mul2(m);
+	p0[j] ^= d[j];
+	p1[j] ^= m;
+      }
+    }
+    return 0;
+  }
+
+protected:
+  bool chunks_span_stripes() const override { return true; }
+};
+
+TEST(ectransaction, parity_delta_matches_encode)
+{
+  hobject_t h;
+  pg_t pgid;
+  const unsigned k = 8;
+  const uint64_t chunk_size = 4096;
+  const uint64_t object_size = 4 * k * chunk_size;   // 4 stripes
+  ECUtil::stripe_info_t sinfo(k, k * chunk_size);
+  ErasureCodeInterfaceRef ecimpl(new ErasureCodeLinear(k));
+  set<int> all;
+  for (unsigned i = 0; i < k + 2; ++i)
+    all.insert(i);
+
+  bufferlist logical;
+  {
+    bufferptr p(object_size);
+    for (uint64_t i = 0; i < object_size; ++i)
+      p[i] = rand();
+    logical.append(p);
+  }
+  map<int, bufferlist> shards;
+  ASSERT_EQ(0, ECUtil::encode(sinfo, ecimpl, logical, all, &shards));
+
+  auto overwrite = [&](uint64_t off, uint64_t len) {
+    bufferlist bl;
+    bufferptr p(len);
+    for (uint64_t i = 0; i < len; ++i)
+      p[i] = rand();
+    bl.append(p);
+
+    PGTransactionUPtr t(new PGTransaction);
+    t->write(h, off, len, bl, 0);
+    ECUtil::HashInfoRef ref(new ECUtil::HashInfo(k + 2));
+    ref->set_total_chunk_size_clear_hash(
+      sinfo.aligned_logical_offset_to_chunk_offset(object_size));
+    ref->set_projected_total_logical_size(sinfo, object_size);
+    auto plan = ECTransaction::get_write_plan(
+      sinfo,
+      std::move(t),
+      [&](const hobject_t &i) {
+	return ref;
+      },
+      &dpp);
+    ECTransaction::plan_parity_delta(
+      sinfo,
+      ecimpl->get_chunk_mapping(),
+      2,
+      plan,
+      [&](const hobject_t &i, const set<int> &want) {
+	return true;
+      },
+      &dpp);
+    ASSERT_EQ(1u, plan.delta_read.size());
+    const extent_set &stripes = plan.delta_read[h];
+    const set<int> &want = plan.delta_shards[h];
+
+    // what the delta reads would return
+    map<int, extent_map> old;
+    for (auto shard: want) {
+      for (auto extent = stripes.begin(); extent != stripes.end(); ++extent) {
+	uint64_t coff = sinfo.aligned_logical_offset_to_chunk_offset(
+	  extent.get_start());
+	uint64_t clen = sinfo.aligned_logical_offset_to_chunk_offset(
+	  extent.get_len());
+	bufferlist chunk;
+	chunk.substr_of(shards[shard], coff, clen);
+	old[shard].insert(coff, clen, chunk);
+      }
+    }
+
+    map<shard_id_t, ObjectStore::Transaction> transactions;
+    for (auto shard: all)
+      transactions[shard_id_t(shard)];
+    ECTransaction::delta_and_write(
+      pgid, h, sinfo, ecimpl, want, stripes,
+      plan.t->op_map[h], old, &transactions, &dpp);
+
+    // apply the shard writes
+    for (auto &&st: transactions) {
+      bufferlist &shard = shards[st.first];
+      shard.rebuild();
+      auto i = st.second.begin();
+      while (i.have_op()) {
+	auto op = i.decode_op();
+	ASSERT_EQ(ObjectStore::Transaction::OP_WRITE, op->op);
+	ASSERT_TRUE(want.count(st.first));
+	bufferlist data;
+	i.decode_bl(data);
+	ASSERT_EQ(op->len, data.length());
+	ASSERT_LE(op->off + op->len, shard.length());
+	data.copy(0, data.length(), shard.c_str() + op->off);
+      }
+    }
+
+    bufferlist updated;
+    updated.substr_of(logical, 0, off);
+    updated.append(bl);
+    bufferlist tail;
+    tail.substr_of(logical, off + len, object_size - off - len);
+    updated.append(tail);
+    logical.swap(updated);
+  };
+
+  auto check = [&]() {
+    map<int, bufferlist> expected;
+    ASSERT_EQ(0, ECUtil::encode(sinfo, ecimpl, logical, all, &expected));
+    for (auto shard: all) {
+      ASSERT_TRUE(expected[shard].contents_equal(shards[shard]))
+	<< "shard " << shard;
+    }
+  };
+
+  // inside one chunk
+  overwrite(sinfo.get_stripe_width() + chunk_size + 100, 512);
+  check();
+  // across a chunk boundary, then again on the same stripe
+  overwrite(sinfo.get_stripe_width() + 2 * chunk_size - 64, 128);
+  overwrite(sinfo.get_stripe_width() + chunk_size + 300, 50);
+  check();
+  // across a stripe boundary
+  overwrite(3 * sinfo.get_stripe_width() - 200, 400);
+  check();
+}
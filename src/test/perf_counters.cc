@@ -17,6 +17,7 @@
 
 
 #include "common/perf_counters.h"
+#include "common/Clock.h"
 #include "common/admin_socket_client.h"
 #include "common/ceph_context.h"
 #include "common/config.h"
@@ -40,6 +41,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <thread>
 #include <time.h>
 #include <unistd.h>
 
@@ -219,3 +221,97 @@ TEST(PerfCounters, ResetPerfCounters) {
   ASSERT_EQ("", client.do_request("{ \"prefix\": \"perf reset\", \"var\": \"test_perfcounter_1\", \"format\": \"json\" }", &msg));
   ASSERT_EQ(sd("{\"error\":\"Not find: test_perfcounter_1\"}"), msg);
 }
+
+enum {
+  TEST_PERFCOUNTERS3_ELEMENT_FIRST = 600,
+  TEST_PERFCOUNTERS3_ELEMENT_PLAIN,
+  TEST_PERFCOUNTERS3_ELEMENT_SHARDED,
+  TEST_PERFCOUNTERS3_ELEMENT_LAT,
+  TEST_PERFCOUNTERS3_ELEMENT_LAST,
+};
+
+static PerfCounters* setup_test_perfcounter3(CephContext *cct)
+{
+  PerfCountersBuilder bld(cct, "test_perfcounter_3",
+	  TEST_PERFCOUNTERS3_ELEMENT_FIRST, TEST_PERFCOUNTERS3_ELEMENT_LAST);
+  bld.add_u64_counter(TEST_PERFCOUNTERS3_ELEMENT_PLAIN, "plain");
+  bld.add_u64_counter(TEST_PERFCOUNTERS3_ELEMENT_SHARDED, "sharded");
+  bld.add_time_avg(TEST_PERFCOUNTERS3_ELEMENT_LAT, "lat");
+  bld.set_sharded(TEST_PERFCOUNTERS3_ELEMENT_SHARDED);
+  bld.set_sharded(TEST_PERFCOUNTERS3_ELEMENT_LAT);
+  return bld.create_perf_counters();
+}
+
+static double hammer(PerfCounters *pf, int idx, int nthreads, int n,
+		     bool sharded)
+{
+  utime_t start = ceph_clock_now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < nthreads; ++t) {
+    threads.emplace_back([=] {
+	for (int i = 0; i < n; ++i) {
+	  if (sharded)
+	    pf->inc_sharded(idx);
+	  else
+	    pf->inc(idx);
+	}
+      });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  return (double)(ceph_clock_now() - start);
+}
+
+TEST(PerfCounters, ShardedPerfCounters) {
+  PerfCountersCollection *coll = g_ceph_context->get_perfcounters_collection();
+  coll->clear();
+  PerfCounters* fake_pf = setup_test_perfcounter3(g_ceph_context);
+  coll->add(fake_pf);
+  AdminSocketClient client(get_rand_socket_path());
+  std::string msg;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([=] {
+	for (int i = 0; i < 1000; ++i) {
+	  fake_pf->inc_sharded(TEST_PERFCOUNTERS3_ELEMENT_SHARDED, 2);
+	  fake_pf->tinc_sharded(TEST_PERFCOUNTERS3_ELEMENT_LAT, utime_t(0, 1000));
+	}
+      });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(16000u, fake_pf->get(TEST_PERFCOUNTERS3_ELEMENT_SHARDED));
+  // plain updates of a sharded counter are added in
+  fake_pf->inc(TEST_PERFCOUNTERS3_ELEMENT_SHARDED, 5);
+  ASSERT_EQ(16005u, fake_pf->get(TEST_PERFCOUNTERS3_ELEMENT_SHARDED));
+  fake_pf->dec(TEST_PERFCOUNTERS3_ELEMENT_SHARDED, 5);
+  ASSERT_EQ("", client.do_request("{ \"prefix\": \"perf dump\", \"format\": \"json\" }", &msg));
+  ASSERT_EQ(sd("{\"test_perfcounter_3\":{\"plain\":0,\"sharded\":16000,\"lat\":"
+	    "{\"avgcount\":8000,\"sum\":0.008000000,\"avgtime\":0.000001000}}}"), msg);
+
+  fake_pf->reset();
+  ASSERT_EQ(0u, fake_pf->get(TEST_PERFCOUNTERS3_ELEMENT_SHARDED));
+  ASSERT_EQ("", client.do_request("{ \"prefix\": \"perf dump\", \"format\": \"json\" }", &msg));
+  ASSERT_EQ(sd("{\"test_perfcounter_3\":{\"plain\":0,\"sharded\":0,\"lat\":"
+	    "{\"avgcount\":0,\"sum\":0.000000000,\"avgtime\":0.000000000}}}"), msg);
+  coll->clear();
+}
+
+TEST(PerfCounters, BenchShardedPerfCounters) {
+  PerfCounters* fake_pf = setup_test_perfcounter3(g_ceph_context);
+  const int n = 1000000;
+  for (int nthreads : { 1, 2, 4, 8 }) {
+    double plain = hammer(fake_pf, TEST_PERFCOUNTERS3_ELEMENT_PLAIN,
+			  nthreads, n, false);
+    double sharded = hammer(fake_pf, TEST_PERFCOUNTERS3_ELEMENT_SHARDED,
+			    nthreads, n, true);
+    std::cout << nthreads << " threads x " << n << " inc: plain "
+	      << plain << "s, sharded " << sharded << "s" << std::endl;
+    ASSERT_EQ(fake_pf->get(TEST_PERFCOUNTERS3_ELEMENT_PLAIN),
+	      fake_pf->get(TEST_PERFCOUNTERS3_ELEMENT_SHARDED));
+  }
+  delete fake_pf;
+}
@@ -0,0 +1,168 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include "gtest/gtest.h"
+
+#include "rgw/rgw_cache.h"
+#include "global/global_context.h"
+#include "include/stringify.h"
+
+class ut_chained_cache : public RGWChainedCache {
+public:
+  std::set<string> chained;
+  std::set<string> invalidated;
+  int invalidated_all = 0;
+
+  void chain_cb(const string& key, void *data) override {
+    chained.insert(key);
+  }
+  void invalidate(const string& key) override {
+    chained.erase(key);
+    invalidated.insert(key);
+  }
+  void invalidate_all() override {
+    chained.clear();
+    ++invalidated_all;
+  }
+};
+
+class TestObjectCache : public ::testing::Test {
+protected:
+  ObjectCache cache;
+
+  void init(int shards, int lru_size) {
+    g_ceph_context->_conf->set_val("rgw_cache_shards", stringify(shards));
+    g_ceph_context->_conf->set_val("rgw_cache_lru_size", stringify(lru_size));
+    g_ceph_context->_conf->apply_changes(NULL);
+    cache.set_ctx(g_ceph_context);
+    cache.set_enabled(true);
+  }
+
+  void put(const string& key, uint32_t flags, rgw_cache_entry_info *ci = NULL) {
+    string name = key;
+    ObjectCacheInfo info;
+    info.flags = flags;
+    info.data.append(key);
+    cache.put(name, info, ci);
+  }
+
+  int get(const string& key, uint32_t mask, ObjectCacheInfo *info = NULL,
+	  rgw_cache_entry_info *ci = NULL) {
+    string name = key;
+    ObjectCacheInfo tmp;
+    return cache.get(name, info ? *info : tmp, mask, ci);
+  }
+};
+
+TEST_F(TestObjectCache, PutGet)
+{
+  init(4, 100);
+
+  put("obj", CACHE_FLAG_DATA);
+  ObjectCacheInfo info;
+  ASSERT_EQ(0, get("obj", CACHE_FLAG_DATA, &info));
+  ASSERT_EQ(string("obj"), info.data.to_str());
+
+  // not everything that was asked for is cached
+  ASSERT_EQ(-ENOENT, get("obj", CACHE_FLAG_DATA | CACHE_FLAG_XATTRS));
+  ASSERT_EQ(-ENOENT, get("other", CACHE_FLAG_DATA));
+
+  string name = "obj";
+  cache.remove(name);
+  ASSERT_EQ(-ENOENT, get("obj", CACHE_FLAG_DATA));
+}
+
+TEST_F(TestObjectCache, Disabled)
+{
+  init(4, 100);
+
+  put("obj", CACHE_FLAG_DATA);
+  cache.set_enabled(false);
+  ASSERT_EQ(-ENOENT, get("obj", CACHE_FLAG_DATA));
+  put("obj", CACHE_FLAG_DATA);
+  cache.set_enabled(true);
+  ASSERT_EQ(-ENOENT, get("obj", CACHE_FLAG_DATA));
+}
+
+TEST_F(TestObjectCache, Eviction)
+{
+  init(1, 8);
+
+  for (int i = 0; i < 64; ++i) {
+    put("obj" + stringify(i), CACHE_FLAG_DATA);
+  }
+  int cached = 0;
+  for (int i = 0; i < 64; ++i) {
+    if (get("obj" + stringify(i), CACHE_FLAG_DATA) == 0) {
+      ++cached;
+    }
+  }
+  ASSERT_EQ(8, cached);
+  // the most recent entry always survives its own insertion
+  ASSERT_EQ(0, get("obj63", CACHE_FLAG_DATA));
+}
+
+TEST_F(TestObjectCache, SecondChance)
+{
+  init(1, 4);
+
+  for (int i = 0; i < 4; ++i) {
+    put("obj" + stringify(i), CACHE_FLAG_DATA);
+  }
+  // keep touching obj0 while the others are pushed out
+  for (int i = 4; i < 16; ++i) {
+    ASSERT_EQ(0, get("obj0", CACHE_FLAG_DATA));
+    put("obj" + stringify(i), CACHE_FLAG_DATA);
+  }
+  ASSERT_EQ(0, get("obj0", CACHE_FLAG_DATA));
+}
+
+TEST_F(TestObjectCache, ChainedInvalidation)
+{
+  init(4, 100);
+
+  ut_chained_cache chained;
+  cache.chain_cache(&chained);
+
+  rgw_cache_entry_info ci1, ci2;
+  put("obj1", CACHE_FLAG_DATA, &ci1);
+  put("obj2", CACHE_FLAG_DATA, &ci2);
+
+  string key = "chained";
+  RGWChainedCache::Entry entry(&chained, key, NULL);
+  list<rgw_cache_entry_info *> entries = { &ci1, &ci2 };
+  ASSERT_TRUE(cache.chain_cache_entry(entries, &entry));
+  ASSERT_EQ(1u, chained.chained.count("chained"));
+
+  // updating either object drops what was built from it
+  put("obj2", CACHE_FLAG_DATA);
+  ASSERT_EQ(0u, chained.chained.count("chained"));
+  ASSERT_EQ(1u, chained.invalidated.count("chained"));
+
+  // a stale generation cannot be chained
+  ASSERT_FALSE(cache.chain_cache_entry(entries, &entry));
+
+  cache.invalidate_all();
+  ASSERT_EQ(1, chained.invalidated_all);
+}
+
+TEST_F(TestObjectCache, ChainedEviction)
+{
+  init(1, 2);
+
+  ut_chained_cache chained;
+  cache.chain_cache(&chained);
+
+  rgw_cache_entry_info ci;
+  put("obj0", CACHE_FLAG_DATA, &ci);
+
+  string key = "chained";
+  RGWChainedCache::Entry entry(&chained, key, NULL);
+  list<rgw_cache_entry_info *> entries = { &ci };
+  ASSERT_TRUE(cache.chain_cache_entry(entries, &entry));
+
+  for (int i = 1; i < 8; ++i) {
+    put("obj" + stringify(i), CACHE_FLAG_DATA);
+  }
+  ASSERT_EQ(-ENOENT, get("obj0", CACHE_FLAG_DATA));
+  ASSERT_EQ(1u, chained.invalidated.count("chained"));
+}
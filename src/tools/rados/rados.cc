@@ -43,6 +43,7 @@ using namespace libradosstriper;
 #include <climits>
 #include <locale>
 #include <memory>
+#include <thread>
 
 #include "cls/lock/cls_lock_client.h"
 #include "include/compat.h"
@@ -102,6 +103,9 @@ void usage(ostream& out)
 "                                    default is 16 concurrent IOs and 4 MB ops\n"
 "                                    default is to clean up after write benchmark\n"
 "                                    run-name is an integer [0..15], uniquely identifying a client\n"
+"   bench <seconds> stat [-t concurrent_operations] [--threads N] [--no-cleanup]\n"
+"                                    stat small objects from N submitting threads,\n"
+"                                    -t per thread; measures client op rate scaling\n"
 "   cleanup [--run-name run_name] [--prefix prefix]\n"
 "                                    clean up a previous benchmark operation\n"
 "                                    run-name is an integer [0..15], uniquely identifying a client\n"
@@ -198,6 +202,8 @@ void usage(ostream& out)
 "   -t N\n"
 "   --concurrent-ios=N\n"
 "        Set number of concurrent I/O operations\n"
+"   --threads=N\n"
+"        Set number of submitting threads for the stat benchmark\n"
 "   --show-time\n"
 "        prefix output with date/time\n"
 "   --no-verify\n"
@@ -1003,6 +1009,104 @@ public:
   }
 };
 
+/*
+ * Small ops from many submitting threads, to see how far client-side
+ * op submission scales.  Each thread keeps concurrent_ios stats of its
+ * own object in flight.
+ */
+static int stat_bench(IoCtx& io_ctx, int seconds, int threads,
+                      int concurrent_ios, bool cleanup)
+{
+  if (threads <= 0 || concurrent_ios <= 0)
+    return -EINVAL;
+
+  std::vector<string> oids;
+  bufferlist bl;
+  bl.append_zero(4096);
+  for (int i = 0; i < threads; ++i) {
+    string oid = "benchmark_stat_" + stringify(getpid()) + "_" + stringify(i);
+    int r = io_ctx.write_full(oid, bl);
+    if (r < 0) {
+      cerr << "error creating " << oid << ": " << cpp_strerror(r) << std::endl;
+      return r;
+    }
+    oids.push_back(oid);
+  }
+
+  cout << "Maintaining " << concurrent_ios << " concurrent stats from each of "
+       << threads << " threads for up to " << seconds << " seconds" << std::endl;
+
+  std::atomic<uint64_t> total_ops = { 0 };
+  std::atomic<uint64_t> total_lat_ns = { 0 };
+  std::atomic<int> error = { 0 };
+  auto start = ceph::mono_clock::now();
+  auto finish = start + std::chrono::seconds(seconds);
+  auto run = [&](const string& oid) {
+    std::vector<AioCompletion*> c(concurrent_ios, nullptr);
+    std::vector<ceph::mono_time> issued(concurrent_ios);
+    std::vector<uint64_t> size(concurrent_ios);
+    std::vector<time_t> mtime(concurrent_ios);
+    uint64_t ops = 0, lat_ns = 0;
+    for (int j = 0; j < concurrent_ios; ++j) {
+      c[j] = Rados::aio_create_completion();
+      issued[j] = ceph::mono_clock::now();
+      io_ctx.aio_stat(oid, c[j], &size[j], &mtime[j]);
+    }
+    for (int j = 0; ; j = (j + 1) % concurrent_ios) {
+      c[j]->wait_for_complete();
+      int r = c[j]->get_return_value();
+      c[j]->release();
+      c[j] = nullptr;
+      auto now = ceph::mono_clock::now();
+      if (r < 0) {
+        error = r;
+        break;
+      }
+      ++ops;
+      lat_ns += std::chrono::nanoseconds(now - issued[j]).count();
+      if (now >= finish || error)
+        break;
+      c[j] = Rados::aio_create_completion();
+      issued[j] = now;
+      io_ctx.aio_stat(oid, c[j], &size[j], &mtime[j]);
+    }
+    for (auto completion : c) {
+      if (completion) {
+        completion->wait_for_complete();
+        completion->release();
+      }
+    }
+    total_ops += ops;
+    total_lat_ns += lat_ns;
+  };
+
+  std::vector<std::thread> workers;
+  for (auto& oid : oids)
+    workers.emplace_back(run, std::cref(oid));
+  for (auto& t : workers)
+    t.join();
+  double elapsed = std::chrono::duration<double>(
+    ceph::mono_clock::now() - start).count();
+
+  if (cleanup) {
+    for (auto& oid : oids)
+      io_ctx.remove(oid);
+  }
+  if (error) {
+    cerr << "stat failed: " << cpp_strerror(error) << std::endl;
+    return error;
+  }
+
+  uint64_t ops = total_ops;
+  cout << "Total time run:         " << elapsed << std::endl;
+  cout << "Total stats completed:  " << ops << std::endl;
+  cout << "Threads:                " << threads << std::endl;
+  cout << "Average IOPS:           " << (uint64_t)(ops / elapsed) << std::endl;
+  cout << "Average Latency(s):     "
+       << (ops ? total_lat_ns / (double)ops / 1000000000.0 : 0) << std::endl;
+  return 0;
+}
+
 static int do_lock_cmd(std::vector<const char*> &nargs,
                        const std::map < std::string, std::string > &opts,
                        IoCtx *ioctx,
@@ -1616,6 +1720,7 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
   const char *target_pool_name = NULL;
   string oloc, target_oloc, nspace, target_nspace;
   int concurrent_ios = 16;
+  int bench_threads = 1;
   unsigned op_size = default_op_size;
   unsigned object_size = 0;
   unsigned max_objects = 0;
@@ -1695,6 +1800,12 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
       return -EINVAL;
     }
   }
+  i = opts.find("threads");
+  if (i != opts.end()) {
+    if (rados_sistrtoll(i, &bench_threads)) {
+      return -EINVAL;
+    }
+  }
 
   i = opts.find("force-full");
   if (i != opts.end()) {
@@ -2962,6 +3073,12 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
       ret = -EINVAL;
       goto out;
     }
+    if (strcmp(nargs[2], "stat") == 0) {
+      ret = stat_bench(io_ctx, seconds, bench_threads, concurrent_ios, cleanup);
+      if (ret != 0)
+        cerr << "error during benchmark: " << cpp_strerror(ret) << std::endl;
+      goto out;
+    }
     int operation = 0;
     if (strcmp(nargs[2], "write") == 0)
       operation = OP_WRITE;
@@ -3629,6 +3746,8 @@ int main(int argc, const char **argv)
       opts["no-verify"] = "true";
     } else if (ceph_argparse_witharg(args, i, &val, "--run-name", (char*)NULL)) {
       opts["run-name"] = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--threads", (char*)NULL)) {
+      opts["threads"] = val;
     } else if (ceph_argparse_witharg(args, i, &val, "--prefix", (char*)NULL)) {
       opts["prefix"] = val;
     } else if (ceph_argparse_witharg(args, i, &val, "-p", "--pool", (char*)NULL)) {